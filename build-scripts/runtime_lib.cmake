@@ -130,7 +130,9 @@ if (WAMR_BUILD_DEBUG_INTERP EQUAL 1)
     endif ()
 endif ()
 
-set (WAMR_BUILD_MIGRATION 1)
+if (NOT DEFINED WAMR_BUILD_MIGRATION)
+    set (WAMR_BUILD_MIGRATION 1)
+endif ()
 if (WAMR_BUILD_MIGRATION EQUAL 1)
     include (${IWASM_DIR}/migration/migration.cmake)
 endif()
@@ -676,4 +676,9 @@
 #endif
 #endif
 
+/* Checkpoint/restore of the interpreter state, enabled by migration.cmake */
+#ifndef WASM_ENABLE_MIGRATION
+#define WASM_ENABLE_MIGRATION 0
+#endif
+
 #endif /* end of _CONFIG_H_ */
@@ -876,6 +876,142 @@ fail:
 }
 #endif /* end of WASM_ENABLE_STRINGREF != 0 */
 
+#if WASM_ENABLE_MIGRATION != 0
+static void
+destroy_checkpoint_funcs(AOTFuncCheckpointInfo *cp_funcs, uint32 count)
+{
+    uint32 i, j;
+
+    for (i = 0; i < count; i++) {
+        if (cp_funcs[i].local_cells)
+            wasm_runtime_free(cp_funcs[i].local_cells);
+        if (cp_funcs[i].safepoints) {
+            for (j = 0; j < cp_funcs[i].safepoint_count; j++) {
+                /* value_cells share the buffer of blocks */
+                if (cp_funcs[i].safepoints[j].blocks)
+                    wasm_runtime_free(cp_funcs[i].safepoints[j].blocks);
+            }
+            wasm_runtime_free(cp_funcs[i].safepoints);
+        }
+    }
+    wasm_runtime_free(cp_funcs);
+}
+
+static bool
+load_checkpoint_section(const uint8 *buf, const uint8 *buf_end,
+                        AOTModule *module, char *error_buf,
+                        uint32 error_buf_size)
+{
+    const uint8 *p = buf, *p_end = buf_end;
+    AOTFuncCheckpointInfo *cp_func;
+    AOTSafepoint *safepoint;
+    uint32 func_count, value, i, j, k;
+    uint64 size;
+
+    read_uint32(p, p_end, func_count);
+    if (func_count != module->func_count) {
+        set_error_buf(error_buf, error_buf_size,
+                      "invalid function count in checkpoint section");
+        goto fail;
+    }
+    if (func_count == 0)
+        return true;
+
+    size = (uint64)sizeof(AOTFuncCheckpointInfo) * func_count;
+    if (!(module->checkpoint_funcs =
+              loader_malloc(size, error_buf, error_buf_size))) {
+        goto fail;
+    }
+    module->checkpoint_func_count = func_count;
+
+    for (i = 0; i < func_count; i++) {
+        cp_func = module->checkpoint_funcs + i;
+        read_uint32(p, p_end, cp_func->code_size);
+        read_uint32(p, p_end, cp_func->ret_cell_num);
+        read_uint32(p, p_end, cp_func->local_count);
+        if (cp_func->local_count > 0) {
+            if (!(cp_func->local_cells = loader_malloc(
+                      cp_func->local_count, error_buf, error_buf_size))) {
+                goto fail;
+            }
+            for (j = 0; j < cp_func->local_count; j++) {
+                read_uint32(p, p_end, value);
+                cp_func->local_cells[j] = (uint8)value;
+            }
+        }
+
+        read_uint32(p, p_end, cp_func->safepoint_count);
+        if (cp_func->safepoint_count == 0)
+            continue;
+
+        size = (uint64)sizeof(AOTSafepoint) * cp_func->safepoint_count;
+        if (!(cp_func->safepoints =
+                  loader_malloc(size, error_buf, error_buf_size))) {
+            goto fail;
+        }
+
+        for (j = 0; j < cp_func->safepoint_count; j++) {
+            safepoint = cp_func->safepoints + j;
+            read_uint32(p, p_end, safepoint->ip_offset);
+            read_uint32(p, p_end, safepoint->offset);
+            read_uint32(p, p_end, safepoint->kind);
+            read_uint32(p, p_end, safepoint->tbl_idx);
+            read_uint32(p, p_end, safepoint->arg_count);
+            read_uint32(p, p_end, safepoint->value_count);
+            if (safepoint->arg_count > safepoint->value_count
+                || (j > 0
+                    && safepoint->ip_offset
+                           <= cp_func->safepoints[j - 1].ip_offset)) {
+                set_error_buf(error_buf, error_buf_size,
+                              "invalid safepoint in checkpoint section");
+                goto fail;
+            }
+
+            /* Read value cells after the blocks are allocated together */
+            CHECK_BUF(p, p_end, sizeof(uint32) * safepoint->value_count);
+            buf = p;
+            p += sizeof(uint32) * safepoint->value_count;
+            read_uint32(p, p_end, safepoint->block_count);
+
+            size = (uint64)sizeof(uint32) * 4 * safepoint->block_count
+                   + safepoint->value_count;
+            if (size == 0)
+                continue;
+            if (!(safepoint->blocks =
+                      loader_malloc(size, error_buf, error_buf_size))) {
+                goto fail;
+            }
+            safepoint->value_cells =
+                (uint8 *)(safepoint->blocks + 4 * safepoint->block_count);
+
+            for (k = 0; k < safepoint->block_count * 4; k++)
+                read_uint32(p, p_end, safepoint->blocks[k]);
+            for (k = 0; k < safepoint->value_count; k++) {
+                read_uint32(buf, p_end, value);
+                safepoint->value_cells[k] = (uint8)value;
+            }
+        }
+    }
+
+    if (p != p_end) {
+        set_error_buf(error_buf, error_buf_size,
+                      "invalid checkpoint section size");
+        goto fail;
+    }
+
+    LOG_VERBOSE("Load checkpoint section success.");
+    return true;
+fail:
+    if (module->checkpoint_funcs) {
+        destroy_checkpoint_funcs(module->checkpoint_funcs,
+                                 module->checkpoint_func_count);
+        module->checkpoint_funcs = NULL;
+        module->checkpoint_func_count = 0;
+    }
+    return false;
+}
+#endif /* end of WASM_ENABLE_MIGRATION != 0 */
+
 static bool
 load_custom_section(const uint8 *buf, const uint8 *buf_end, AOTModule *module,
                     bool is_load_from_file_buf, char *error_buf,
@@ -909,6 +1045,13 @@ load_custom_section(const uint8 *buf, const uint8 *buf_end, AOTModule *module,
                 goto fail;
             break;
 #endif
+#if WASM_ENABLE_MIGRATION != 0
+        case AOT_CUSTOM_SECTION_CHECKPOINT:
+            if (!load_checkpoint_section(buf, buf_end, module, error_buf,
+                                         error_buf_size))
+                goto fail;
+            break;
+#endif
 #if WASM_ENABLE_LOAD_CUSTOM_SECTION != 0
         case AOT_CUSTOM_SECTION_RAW:
         {
@@ -4230,6 +4373,12 @@ aot_unload(AOTModule *module)
         wasm_runtime_free(module->max_stack_cell_nums);
 #endif
 
+#if WASM_ENABLE_MIGRATION != 0
+    if (module->checkpoint_funcs)
+        destroy_checkpoint_funcs(module->checkpoint_funcs,
+                                 module->checkpoint_func_count);
+#endif
+
 #if WASM_ENABLE_GC != 0
     if (module->func_local_ref_flags) {
         uint32 i;
@@ -181,6 +181,14 @@ typedef struct {
 #define REG_STRINGREF_SYM()
 #endif
 
+#if WASM_ENABLE_MIGRATION != 0
+#define REG_MIGRATION_SYM()                \
+    REG_SYM(aot_checkpoint),               \
+    REG_SYM(aot_restore_frame),
+#else
+#define REG_MIGRATION_SYM()
+#endif
+
 #define REG_COMMON_SYMBOLS                \
     REG_SYM(aot_set_exception_with_id),   \
     REG_SYM(aot_invoke_native),           \
@@ -213,6 +221,7 @@ typedef struct {
     REG_INTRINSIC_SYM()                   \
     REG_LLVM_PGO_SYM()                    \
     REG_GC_SYM()                          \
+    REG_MIGRATION_SYM()                   \
     REG_STRINGREF_SYM()                   \
 
 #define CHECK_RELOC_OFFSET(data_size) do {              \
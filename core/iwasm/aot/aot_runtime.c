@@ -2173,6 +2173,11 @@ aot_call_function(WASMExecEnv *exec_env, AOTFunctionInstance *function,
     /* Set exec env, so it can be later retrieved from instance */
     module_inst->cur_exec_env = exec_env;
 
+#if WASM_ENABLE_MIGRATION != 0
+    if (!aot_checkpoint_prepare_call(exec_env, function))
+        return false;
+#endif
+
     if (ext_ret_count > 0) {
         uint32 cell_num = 0, i;
         uint8 *ext_ret_types = func_type->types + func_type->param_count + 1;
@@ -3530,6 +3535,38 @@ get_func_name_from_index(const AOTModuleInstance *module_inst,
           WASM_ENABLE_PERF_PROFILING != 0 */
 
 #if WASM_ENABLE_GC == 0
+#if WASM_ENABLE_MIGRATION != 0
+/* The module compiled with --enable-checkpoint spills the locals and the
+   operands to the frame, so the frame is allocated from the wasm stack
+   with its cells, the same as the frames allocated in AOT code */
+static AOTFrame *
+alloc_checkpoint_frame(WASMExecEnv *exec_env, AOTModule *module,
+                       uint32 func_index)
+{
+    AOTFrame *frame;
+    uint32 max_local_cell_num, max_stack_cell_num;
+
+    if (func_index >= module->import_func_count) {
+        uint32 aot_func_idx = func_index - module->import_func_count;
+        max_local_cell_num = module->max_local_cell_nums[aot_func_idx];
+        max_stack_cell_num = module->max_stack_cell_nums[aot_func_idx];
+    }
+    else {
+        AOTFuncType *func_type = module->import_funcs[func_index].func_type;
+        max_local_cell_num =
+            func_type->param_cell_num > 2 ? func_type->param_cell_num : 2;
+        max_stack_cell_num = 0;
+    }
+
+    frame = wasm_exec_env_alloc_wasm_frame(
+        exec_env, (uint32)offsetof(AOTFrame, lp)
+                      + (max_local_cell_num + max_stack_cell_num) * 4);
+    if (frame)
+        frame->sp = frame->lp + max_local_cell_num;
+    return frame;
+}
+#endif
+
 bool
 aot_alloc_frame(WASMExecEnv *exec_env, uint32 func_index)
 {
@@ -3542,14 +3579,26 @@ aot_alloc_frame(WASMExecEnv *exec_env, uint32 func_index)
     uint32 size = (uint32)offsetof(AOTFrame, lp);
 
     cur_frame = (AOTFrame *)exec_env->cur_frame;
-    if (!cur_frame)
-        frame = (AOTFrame *)exec_env->wasm_stack.bottom;
+#if WASM_ENABLE_MIGRATION != 0
+    if (((AOTModule *)module_inst->module)->checkpoint_funcs) {
+        if (!(frame = alloc_checkpoint_frame(
+                  exec_env, (AOTModule *)module_inst->module, func_index))) {
+            aot_set_exception(module_inst, "wasm operand stack overflow");
+            return false;
+        }
+    }
     else
-        frame = (AOTFrame *)((uint8 *)cur_frame + size);
+#endif
+    {
+        if (!cur_frame)
+            frame = (AOTFrame *)exec_env->wasm_stack.bottom;
+        else
+            frame = (AOTFrame *)((uint8 *)cur_frame + size);
 
-    if ((uint8 *)frame + size > exec_env->wasm_stack.top_boundary) {
-        aot_set_exception(module_inst, "wasm operand stack overflow");
-        return false;
+        if ((uint8 *)frame + size > exec_env->wasm_stack.top_boundary) {
+            aot_set_exception(module_inst, "wasm operand stack overflow");
+            return false;
+        }
     }
 
     frame->func_index = func_index;
@@ -3594,6 +3643,11 @@ aot_free_frame_internal(WASMExecEnv *exec_env)
         prev_frame->func_perf_prof_info->children_exec_time += time_elapsed;
 #endif
 
+#if WASM_ENABLE_MIGRATION != 0
+    if (((AOTModule *)((AOTModuleInstance *)exec_env->module_inst)->module)
+            ->checkpoint_funcs)
+        wasm_exec_env_free_wasm_frame(exec_env, cur_frame);
+#endif
     exec_env->cur_frame = (struct WASMInterpFrame *)prev_frame;
 }
 
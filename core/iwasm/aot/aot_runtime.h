@@ -53,8 +53,16 @@ typedef enum AOTCustomSectionType {
     AOT_CUSTOM_SECTION_ACCESS_CONTROL = 2,
     AOT_CUSTOM_SECTION_NAME = 3,
     AOT_CUSTOM_SECTION_STRING_LITERAL = 4,
+    AOT_CUSTOM_SECTION_CHECKPOINT = 5,
 } AOTCustomSectionType;
 
+/* Kinds of the safepoints emitted by wamrc --enable-checkpoint */
+typedef enum AOTSafepointKind {
+    AOT_SAFEPOINT_LOOP = 0,
+    AOT_SAFEPOINT_CALL = 1,
+    AOT_SAFEPOINT_CALL_INDIRECT = 2,
+} AOTSafepointKind;
+
 typedef struct AOTObjectDataSection {
     char *name;
     uint8 *data;
@@ -121,6 +129,35 @@ typedef struct GOTItem {
 } GOTItem, *GOTItemList;
 #endif
 
+#if WASM_ENABLE_MIGRATION != 0
+/* Safepoint of the checkpoint section, AOT code spills the locals and the
+   operands to the AOTFrame there */
+typedef struct AOTSafepoint {
+    /* ip committed to AOTFrame at the safepoint, sorted in ascending order */
+    uint32 ip_offset;
+    /* Offset to the function code where the frame resumes in the image */
+    uint32 offset;
+    uint32 kind;
+    uint32 tbl_idx;
+    /* Number of the operands consumed by the call */
+    uint32 arg_count;
+    uint32 value_count;
+    uint8 *value_cells;
+    /* begin, target, frame_sp (in cells), cell_num of each block */
+    uint32 block_count;
+    uint32 *blocks;
+} AOTSafepoint;
+
+typedef struct AOTFuncCheckpointInfo {
+    uint32 code_size;
+    uint32 ret_cell_num;
+    uint32 local_count;
+    uint8 *local_cells;
+    uint32 safepoint_count;
+    AOTSafepoint *safepoints;
+} AOTFuncCheckpointInfo;
+#endif
+
 #if WASM_ENABLE_GC != 0
 typedef struct LocalRefFlag {
     uint32 local_ref_flag_cell_num;
@@ -313,6 +350,13 @@ typedef struct AOTModule {
 
     /* Whether the underlying wasm binary buffer can be freed */
     bool is_binary_freeable;
+
+#if WASM_ENABLE_MIGRATION != 0
+    /* Safepoints of each non-imported function, NULL if the module
+       wasn't compiled with --enable-checkpoint */
+    uint32 checkpoint_func_count;
+    AOTFuncCheckpointInfo *checkpoint_funcs;
+#endif
 } AOTModule;
 
 #define AOTMemoryInstance WASMMemoryInstance
@@ -684,6 +728,38 @@ aot_free_frame(WASMExecEnv *exec_env);
 void
 aot_frame_update_profile_info(WASMExecEnv *exec_env, bool alloc_frame);
 
+#if WASM_ENABLE_MIGRATION != 0
+/* Take a checkpoint when AOT code reaches a loop safepoint with the
+   checkpoint flag set, the values of the frames are already spilled */
+bool
+aot_checkpoint(WASMExecEnv *exec_env);
+
+/* Fill the current frame from the checkpoint image at the entry of an AOT
+   function, return the index of the safepoint to resume or -1 on failure */
+int32
+aot_restore_frame(WASMExecEnv *exec_env);
+
+/* Called before a function is entered from the host, restore the linear
+   memory and the globals and start rebuilding the frames if the image was
+   taken in this function */
+bool
+aot_checkpoint_prepare_call(WASMExecEnv *exec_env,
+                            AOTFunctionInstance *function);
+
+struct WASMImageWriter;
+struct WASMImageReader;
+
+/* Write and read the GLOBAL section of a checkpoint image, the globals are
+   in the same order and size as in the interpreter */
+int
+aot_checkpoint_dump_global(AOTModuleInstance *module_inst,
+                           struct WASMImageWriter *writer);
+
+int
+aot_checkpoint_restore_global(AOTModuleInstance *module_inst,
+                              struct WASMImageReader *image);
+#endif
+
 bool
 aot_create_call_stack(struct WASMExecEnv *exec_env);
 
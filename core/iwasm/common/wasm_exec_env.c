@@ -19,6 +19,10 @@
 #include "aot_runtime.h"
 #endif
 
+#if WASM_ENABLE_MIGRATION != 0
+#include "../migration/wasm_dump.h"
+#endif
+
 #if WASM_ENABLE_THREAD_MGR != 0
 #include "../libraries/thread-mgr/thread_manager.h"
 #if WASM_ENABLE_DEBUG_INTERP != 0
@@ -125,6 +129,9 @@ wasm_exec_env_destroy_internal(WASMExecEnv *exec_env)
 #endif
 #if WASM_ENABLE_AOT != 0
     wasm_runtime_free(exec_env->argv_buf);
+#endif
+#if WASM_ENABLE_MIGRATION != 0
+    wasm_dump_unregister_exec_env(exec_env);
 #endif
     wasm_runtime_free(exec_env);
 }
@@ -38,7 +38,11 @@
 #include "../compilation/aot_llvm.h"
 #endif
 #include "../common/wasm_c_api_internal.h"
+#if WASM_ENABLE_MIGRATION != 0
 #include "../migration/wasm_restore.h"
+#include "../migration/wasm_dump.h"
+#include "../migration/wasm_image_compress.h"
+#endif
 #include "../../version.h"
 
 /**
@@ -176,6 +180,11 @@ static uint32 gc_heap_size_default = GC_HEAP_SIZE_DEFAULT;
 
 static RunningMode runtime_running_mode = Mode_Default;
 
+#if WASM_ENABLE_INTERP != 0
+static uint32 loader_threads_default = 0;
+static bool lazy_translation_default = false;
+#endif
+
 #ifdef OS_ENABLE_HW_BOUND_CHECK
 /* The exec_env of thread local storage, set before calling function
    and used in signal handler, as we cannot get it from the argument
@@ -722,6 +731,20 @@ wasm_runtime_get_gc_heap_size_default(void)
 }
 #endif
 
+#if WASM_ENABLE_INTERP != 0
+uint32
+wasm_runtime_get_loader_threads_default(void)
+{
+    return loader_threads_default;
+}
+
+bool
+wasm_runtime_get_lazy_translation_default(void)
+{
+    return lazy_translation_default;
+}
+#endif
+
 static bool
 wasm_runtime_full_init_internal(RuntimeInitArgs *init_args)
 {
@@ -742,6 +765,11 @@ wasm_runtime_full_init_internal(RuntimeInitArgs *init_args)
     gc_heap_size_default = init_args->gc_heap_size;
 #endif
 
+#if WASM_ENABLE_INTERP != 0
+    loader_threads_default = init_args->loader_threads;
+    lazy_translation_default = init_args->lazy_translation;
+#endif
+
 #if WASM_ENABLE_JIT != 0
     llvm_jit_options.size_level = init_args->llvm_jit_size_level;
     llvm_jit_options.opt_level = init_args->llvm_jit_opt_level;
@@ -778,9 +806,20 @@ wasm_runtime_full_init_internal(RuntimeInitArgs *init_args)
         return false;
     }
 
-    if (init_args->restore_flag) {
+#if WASM_ENABLE_MIGRATION != 0
+    if (init_args->restore_flag || init_args->restore_source) {
         set_restore_flag(true);
+        set_restore_source(init_args->restore_source);
     }
+    set_restore_lazy(init_args->restore_lazy);
+    set_checkpoint_target(init_args->checkpoint_target);
+    set_checkpoint_compress(init_args->checkpoint_compress);
+    set_checkpoint_page_pool(init_args->checkpoint_page_pool);
+    wasm_image_set_worker_count(init_args->checkpoint_threads);
+    set_checkpoint_async(init_args->checkpoint_async);
+    wasm_image_set_direct_io(init_args->checkpoint_direct_io);
+    wasm_image_set_sync(init_args->checkpoint_sync);
+#endif
 
 #if WASM_ENABLE_THREAD_MGR != 0
     wasm_cluster_set_max_thread_num(init_args->max_thread_num);
@@ -526,6 +526,16 @@ uint32
 wasm_runtime_get_gc_heap_size_default(void);
 #endif
 
+#if WASM_ENABLE_INTERP != 0
+/* Internal API */
+uint32
+wasm_runtime_get_loader_threads_default(void);
+
+/* Internal API */
+bool
+wasm_runtime_get_lazy_translation_default(void);
+#endif
+
 /* See wasm_export.h for description */
 WASM_RUNTIME_API_EXTERN bool
 wasm_runtime_full_init(RuntimeInitArgs *init_args);
@@ -256,6 +256,9 @@ wasm_runtime_atomic_wait(WASMModuleInstanceCommon *module, void *address,
 #endif
     uint64 timeout_left, timeout_wait, timeout_1sec;
     bool check_ret, is_timeout, no_wait;
+#if WASM_ENABLE_MIGRATION != 0 && WASM_ENABLE_THREAD_MGR != 0
+    bool can_interrupt, is_interrupted = false;
+#endif
 
     bh_assert(module->module_type == Wasm_Module_Bytecode
               || module->module_type == Wasm_Module_AoT);
@@ -286,6 +289,17 @@ wasm_runtime_atomic_wait(WASMModuleInstanceCommon *module, void *address,
     bh_assert(exec_env);
 #endif
 
+#if WASM_ENABLE_MIGRATION != 0 && WASM_ENABLE_THREAD_MGR != 0
+    /* Only the classic interpreter can execute the wait opcode again */
+    can_interrupt =
+#if WASM_ENABLE_FAST_INTERP == 0
+        module->module_type == Wasm_Module_Bytecode
+        && wasm_runtime_get_running_mode(module) == Mode_Interp;
+#else
+        false;
+#endif
+#endif
+
     lock = shared_memory_get_lock_pointer(module_inst->memories[0]);
 
     /* Lock the shared_mem_lock for the whole atomic wait process,
@@ -337,6 +351,15 @@ wasm_runtime_atomic_wait(WASMModuleInstanceCommon *module, void *address,
                here we keep waiting and checking every second */
             os_cond_reltimedwait(&wait_node->wait_cond, lock,
                                  (uint64)timeout_1sec);
+#if WASM_ENABLE_MIGRATION != 0 && WASM_ENABLE_THREAD_MGR != 0
+            /* give up the wait to stop for a checkpoint */
+            if (can_interrupt && wait_node->status != S_NOTIFIED
+                && (WASM_SUSPEND_FLAGS_GET(exec_env->suspend_flags)
+                    & WASM_SUSPEND_FLAG_CHECKPOINT)) {
+                is_interrupted = true;
+                break;
+            }
+#endif
             if (wait_node->status == S_NOTIFIED /* notified by atomic.notify */
 #if WASM_ENABLE_THREAD_MGR != 0
                 /* terminated by other thread */
@@ -350,6 +373,15 @@ wasm_runtime_atomic_wait(WASMModuleInstanceCommon *module, void *address,
             timeout_wait =
                 timeout_left < timeout_1sec ? timeout_left : timeout_1sec;
             os_cond_reltimedwait(&wait_node->wait_cond, lock, timeout_wait);
+#if WASM_ENABLE_MIGRATION != 0 && WASM_ENABLE_THREAD_MGR != 0
+            /* give up the wait to stop for a checkpoint */
+            if (can_interrupt && wait_node->status != S_NOTIFIED
+                && (WASM_SUSPEND_FLAGS_GET(exec_env->suspend_flags)
+                    & WASM_SUSPEND_FLAG_CHECKPOINT)) {
+                is_interrupted = true;
+                break;
+            }
+#endif
             if (wait_node->status == S_NOTIFIED /* notified by atomic.notify */
                 || timeout_left <= timeout_wait /* time out */
 #if WASM_ENABLE_THREAD_MGR != 0
@@ -379,6 +411,10 @@ wasm_runtime_atomic_wait(WASMModuleInstanceCommon *module, void *address,
 
     os_mutex_unlock(lock);
 
+#if WASM_ENABLE_MIGRATION != 0 && WASM_ENABLE_THREAD_MGR != 0
+    if (is_interrupted)
+        return WASM_ATOMIC_WAIT_INTERRUPTED;
+#endif
     return is_timeout ? 2 : 0;
 }
 
@@ -48,6 +48,12 @@ shared_memory_dec_reference(WASMMemoryInstance *memory);
             os_mutex_unlock(&g_shared_memory_lock); \
     } while (0)
 
+#if WASM_ENABLE_MIGRATION != 0
+/* Returned by wasm_runtime_atomic_wait when the wait is given up for a
+   checkpoint, the interpreter executes the wait opcode again after it */
+#define WASM_ATOMIC_WAIT_INTERRUPTED 3
+#endif
+
 uint32
 wasm_runtime_atomic_wait(WASMModuleInstanceCommon *module, void *address,
                          uint64 expect, int64 timeout, bool wait64);
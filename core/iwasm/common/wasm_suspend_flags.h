@@ -22,6 +22,10 @@ extern "C" {
 #define WASM_SUSPEND_FLAG_EXIT 0x8
 /* The thread might be blocking */
 #define WASM_SUSPEND_FLAG_BLOCKING 0x10
+/* Need to take a checkpoint at the next safepoint */
+#define WASM_SUSPEND_FLAG_CHECKPOINT 0x20
+/* Frames are being rebuilt from a checkpoint image */
+#define WASM_SUSPEND_FLAG_RESTORE 0x40
 
 typedef union WASMSuspendFlags {
     bh_atomic_32_t flags;
@@ -35,7 +39,9 @@ typedef union WASMSuspendFlags {
 #define WASM_SUSPEND_FLAGS_FETCH_AND(s_flags, val) \
     BH_ATOMIC_32_FETCH_AND(s_flags.flags, val)
 
-#define WASM_SUSPEND_FLAG_INHERIT_MASK (~WASM_SUSPEND_FLAG_BLOCKING)
+#define WASM_SUSPEND_FLAG_INHERIT_MASK                           \
+    (~(WASM_SUSPEND_FLAG_BLOCKING | WASM_SUSPEND_FLAG_CHECKPOINT \
+       | WASM_SUSPEND_FLAG_RESTORE))
 
 #if WASM_SUSPEND_FLAGS_IS_ATOMIC != 0
 #define WASM_SUSPEND_FLAGS_LOCK(lock) (void)0
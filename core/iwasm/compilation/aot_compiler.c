@@ -16,6 +16,7 @@
 #include "aot_emit_parametric.h"
 #include "aot_emit_table.h"
 #include "aot_emit_gc.h"
+#include "aot_emit_checkpoint.h"
 #include "simd/simd_access_lanes.h"
 #include "simd/simd_bitmask_extracts.h"
 #include "simd/simd_bit_shifts.h"
@@ -972,6 +973,11 @@ aot_compile_func(AOTCompContext *comp_ctx, uint32 func_index)
     LLVMPositionBuilderAtEnd(
         comp_ctx->builder,
         func_ctx->block_stack.block_list_head->llvm_entry_block);
+
+    if (comp_ctx->enable_checkpoint
+        && !aot_checkpoint_begin_func(comp_ctx, func_ctx, func_index))
+        return false;
+
     while (frame_ip < frame_ip_end) {
         opcode = *frame_ip++;
 
@@ -3857,6 +3863,10 @@ aot_compile_func(AOTCompContext *comp_ctx, uint32 func_index)
         }
     }
 
+    if (comp_ctx->enable_checkpoint
+        && !aot_checkpoint_end_func(comp_ctx, func_ctx))
+        return false;
+
     /* Move func_return block to the bottom */
     if (func_ctx->func_return_block) {
         LLVMBasicBlockRef last_block = LLVMGetLastBasicBlock(func_ctx->func);
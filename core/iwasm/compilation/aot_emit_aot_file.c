@@ -4,6 +4,7 @@
  */
 
 #include "aot_compiler.h"
+#include "aot_emit_checkpoint.h"
 #include "../aot/aot_runtime.h"
 
 #define PUT_U64_TO_ADDR(addr, value)        \
@@ -1189,6 +1190,9 @@ get_string_literal_section_size(AOTCompContext *comp_ctx,
 static uint32
 get_custom_sections_size(AOTCompContext *comp_ctx, AOTCompData *comp_data);
 
+static uint32
+get_checkpoint_section_size(AOTCompContext *comp_ctx, AOTCompData *comp_data);
+
 static uint32
 get_aot_file_size(AOTCompContext *comp_ctx, AOTCompData *comp_data,
                   AOTObjectData *obj_data)
@@ -1252,6 +1256,14 @@ get_aot_file_size(AOTCompContext *comp_ctx, AOTCompData *comp_data,
         size += size_custom_section;
     }
 
+    if (comp_ctx->enable_checkpoint) {
+        /* checkpoint section */
+        size = align_uint(size, 4);
+        /* section id + section size + sub section id */
+        size += (uint32)sizeof(uint32) * 3;
+        size += get_checkpoint_section_size(comp_ctx, comp_data);
+    }
+
 #if WASM_ENABLE_STRINGREF != 0
     /* string literal section */
     size_string_literal_section =
@@ -1639,6 +1651,34 @@ get_string_literal_section_size(AOTCompContext *comp_ctx,
 }
 #endif /* end of WASM_ENABLE_STRINGREF != 0 */
 
+static uint32
+get_checkpoint_section_size(AOTCompContext *comp_ctx, AOTCompData *comp_data)
+{
+    AOTCheckpointFunc *cp_func;
+    AOTCheckpointSafepoint *safepoint;
+    uint32 size, i;
+
+    /* function count */
+    size = (uint32)sizeof(uint32);
+
+    for (i = 0; i < comp_data->func_count; i++) {
+        cp_func = comp_ctx->checkpoint_funcs + i;
+        /* code size, ret cell num, local count, local cells, safepoint count */
+        size += (uint32)sizeof(uint32) * (4 + cp_func->local_count);
+
+        for (safepoint = cp_func->safepoints; safepoint;
+             safepoint = safepoint->next) {
+            /* ip offset, offset, kind, table index, argument count,
+               value count, value cells, block count, blocks */
+            size += (uint32)sizeof(uint32)
+                    * (7 + safepoint->value_count
+                       + 4 * safepoint->block_count);
+        }
+    }
+
+    return size;
+}
+
 static uint32
 get_custom_sections_size(AOTCompContext *comp_ctx, AOTCompData *comp_data)
 {
@@ -2844,6 +2884,57 @@ aot_emit_name_section(uint8 *buf, uint8 *buf_end, uint32 *p_offset,
 }
 #endif
 
+static bool
+aot_emit_checkpoint_section(uint8 *buf, uint8 *buf_end, uint32 *p_offset,
+                            AOTCompData *comp_data, AOTCompContext *comp_ctx)
+{
+    AOTCheckpointFunc *cp_func;
+    AOTCheckpointSafepoint *safepoint;
+    uint32 offset, i, j;
+
+    if (!comp_ctx->enable_checkpoint)
+        return true;
+
+    *p_offset = offset = align_uint(*p_offset, 4);
+
+    EMIT_U32(AOT_SECTION_TYPE_CUSTOM);
+    /* sub section id + checkpoint section size */
+    EMIT_U32(sizeof(uint32) * 1
+             + get_checkpoint_section_size(comp_ctx, comp_data));
+    EMIT_U32(AOT_CUSTOM_SECTION_CHECKPOINT);
+
+    EMIT_U32(comp_data->func_count);
+    for (i = 0; i < comp_data->func_count; i++) {
+        cp_func = comp_ctx->checkpoint_funcs + i;
+        EMIT_U32(cp_func->code_size);
+        EMIT_U32(cp_func->ret_cell_num);
+        EMIT_U32(cp_func->local_count);
+        for (j = 0; j < cp_func->local_count; j++)
+            EMIT_U32(cp_func->local_cells[j]);
+
+        EMIT_U32(cp_func->safepoint_count);
+        for (safepoint = cp_func->safepoints; safepoint;
+             safepoint = safepoint->next) {
+            EMIT_U32(safepoint->ip_offset);
+            EMIT_U32(safepoint->offset);
+            EMIT_U32(safepoint->kind);
+            EMIT_U32(safepoint->tbl_idx);
+            EMIT_U32(safepoint->arg_count);
+            EMIT_U32(safepoint->value_count);
+            for (j = 0; j < safepoint->value_count; j++)
+                EMIT_U32(safepoint->value_cells[j]);
+            EMIT_U32(safepoint->block_count);
+            for (j = 0; j < safepoint->block_count * 4; j++)
+                EMIT_U32(safepoint->blocks[j]);
+        }
+    }
+
+    *p_offset = offset;
+
+    LOG_DEBUG("emit checkpoint section");
+    return true;
+}
+
 #if WASM_ENABLE_STRINGREF != 0
 static bool
 aot_emit_string_literal_section(uint8 *buf, uint8 *buf_end, uint32 *p_offset,
@@ -4477,6 +4568,8 @@ aot_emit_aot_file_buf(AOTCompContext *comp_ctx, AOTCompData *comp_data,
                                         comp_data, obj_data)
         || !aot_emit_native_symbol(buf, buf_end, &offset, comp_ctx)
         || !aot_emit_custom_sections(buf, buf_end, &offset, comp_data, comp_ctx)
+        || !aot_emit_checkpoint_section(buf, buf_end, &offset, comp_data,
+                                        comp_ctx)
 #if WASM_ENABLE_STRINGREF != 0
         || !aot_emit_string_literal_section(buf, buf_end, &offset, comp_data,
                                             comp_ctx)
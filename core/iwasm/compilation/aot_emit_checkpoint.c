@@ -0,0 +1,601 @@
+#include "aot_emit_checkpoint.h"
+#include "aot_emit_exception.h"
+#include "../aot/aot_runtime.h"
+#include "../interpreter/wasm_opcode.h"
+
+#define ADD_BASIC_BLOCK(block, name)                                          \
+    do {                                                                      \
+        if (!(block = LLVMAppendBasicBlockInContext(comp_ctx->context,        \
+                                                    func_ctx->func, name))) { \
+            aot_set_last_error("llvm add basic block failed.");               \
+            goto fail;                                                        \
+        }                                                                     \
+    } while (0)
+
+#define CURR_BLOCK() LLVMGetInsertBlock(comp_ctx->builder)
+
+#define MOVE_BLOCK_AFTER(llvm_block, llvm_block_after) \
+    LLVMMoveBasicBlockAfter(llvm_block, llvm_block_after)
+
+#define MOVE_BLOCK_AFTER_CURR(llvm_block) \
+    LLVMMoveBasicBlockAfter(llvm_block, CURR_BLOCK())
+
+#define BUILD_COND_BR(value_if, block_then, block_else)               \
+    do {                                                              \
+        if (!LLVMBuildCondBr(comp_ctx->builder, value_if, block_then, \
+                             block_else)) {                           \
+            aot_set_last_error("llvm build cond br failed.");         \
+            goto fail;                                                \
+        }                                                             \
+    } while (0)
+
+#define SET_BUILDER_POS(llvm_block) \
+    LLVMPositionBuilderAtEnd(comp_ctx->builder, llvm_block)
+
+#define BUILD_BR(llvm_block)                               \
+    do {                                                   \
+        if (!LLVMBuildBr(comp_ctx->builder, llvm_block)) { \
+            aot_set_last_error("llvm build br failed.");   \
+            goto fail;                                     \
+        }                                                  \
+    } while (0)
+
+#define BUILD_ICMP(op, left, right, res, name)                                \
+    do {                                                                      \
+        if (!(res =                                                           \
+                  LLVMBuildICmp(comp_ctx->builder, op, left, right, name))) { \
+            aot_set_last_error("llvm build icmp failed.");                    \
+            goto fail;                                                        \
+        }                                                                     \
+    } while (0)
+
+bool
+aot_checkpoint_init(AOTCompContext *comp_ctx)
+{
+    uint64 size =
+        sizeof(AOTCheckpointFunc) * (uint64)comp_ctx->comp_data->func_count;
+
+    if (size == 0)
+        return true;
+
+    if (size >= UINT32_MAX
+        || !(comp_ctx->checkpoint_funcs = wasm_runtime_malloc((uint32)size))) {
+        aot_set_last_error("allocate memory failed.");
+        return false;
+    }
+    memset(comp_ctx->checkpoint_funcs, 0, (uint32)size);
+    return true;
+}
+
+void
+aot_checkpoint_destroy(AOTCompContext *comp_ctx)
+{
+    AOTCheckpointFunc *cp_func;
+    AOTCheckpointSafepoint *safepoint, *next;
+    uint32 i;
+
+    if (!comp_ctx->checkpoint_funcs)
+        return;
+
+    for (i = 0; i < comp_ctx->comp_data->func_count; i++) {
+        cp_func = comp_ctx->checkpoint_funcs + i;
+        if (cp_func->local_cells)
+            wasm_runtime_free(cp_func->local_cells);
+        for (safepoint = cp_func->safepoints; safepoint; safepoint = next) {
+            next = safepoint->next;
+            wasm_runtime_free(safepoint);
+        }
+    }
+    wasm_runtime_free(comp_ctx->checkpoint_funcs);
+    comp_ctx->checkpoint_funcs = NULL;
+}
+
+static uint32
+get_value_cell_num(uint8 type)
+{
+    switch (type) {
+        case VALUE_TYPE_I64:
+        case VALUE_TYPE_F64:
+            return 2;
+        case VALUE_TYPE_V128:
+            return 4;
+        default:
+            return 1;
+    }
+}
+
+static LLVMValueRef
+get_frame_cell_ptr(AOTCompContext *comp_ctx, AOTFuncContext *func_ctx,
+                   uint32 cell, LLVMTypeRef type)
+{
+    LLVMValueRef offset, addr;
+
+    if (!(offset = I32_CONST(offset_of_local(comp_ctx, cell)))) {
+        aot_set_last_error("llvm build const failed");
+        return NULL;
+    }
+    if (!(addr = LLVMBuildInBoundsGEP2(comp_ctx->builder, INT8_TYPE,
+                                       func_ctx->cur_frame, &offset, 1,
+                                       "cell_addr"))
+        || !(addr = LLVMBuildBitCast(comp_ctx->builder, addr,
+                                     LLVMPointerType(type, 0), "cell_ptr"))) {
+        aot_set_last_error("llvm build cell address failed");
+        return NULL;
+    }
+    return addr;
+}
+
+static bool
+store_cell(AOTCompContext *comp_ctx, AOTFuncContext *func_ctx,
+           LLVMValueRef value, uint32 cell)
+{
+    LLVMValueRef ptr, res;
+
+    if (LLVMTypeOf(value) == INT1_TYPE
+        && !(value = LLVMBuildZExt(comp_ctx->builder, value, I32_TYPE,
+                                   "i32_val"))) {
+        aot_set_last_error("llvm build zext failed");
+        return false;
+    }
+    if (!(ptr = get_frame_cell_ptr(comp_ctx, func_ctx, cell,
+                                   LLVMTypeOf(value))))
+        return false;
+    if (!(res = LLVMBuildStore(comp_ctx->builder, value, ptr))) {
+        aot_set_last_error("llvm build store failed");
+        return false;
+    }
+    LLVMSetAlignment(res, 4);
+    return true;
+}
+
+static LLVMValueRef
+load_cell(AOTCompContext *comp_ctx, AOTFuncContext *func_ctx, LLVMTypeRef type,
+          uint32 cell)
+{
+    LLVMTypeRef load_type = type == INT1_TYPE ? I32_TYPE : type;
+    LLVMValueRef ptr, value;
+
+    if (!(ptr = get_frame_cell_ptr(comp_ctx, func_ctx, cell, load_type)))
+        return NULL;
+    if (!(value = LLVMBuildLoad2(comp_ctx->builder, load_type, ptr,
+                                 "restored"))) {
+        aot_set_last_error("llvm build load failed");
+        return NULL;
+    }
+    LLVMSetAlignment(value, 4);
+
+    if (type == INT1_TYPE
+        && !(value = LLVMBuildICmp(comp_ctx->builder, LLVMIntNE, value,
+                                   I32_ZERO, "restored_i1"))) {
+        aot_set_last_error("llvm build icmp failed");
+        return NULL;
+    }
+    return value;
+}
+
+static LLVMValueRef
+load_suspend_flags(AOTCompContext *comp_ctx, AOTFuncContext *func_ctx,
+                   uint32 flag)
+{
+    LLVMValueRef offset = I32_FIVE, addr, flags;
+
+    /* Offset of suspend_flags, see check_suspend_flags */
+    if (!(addr = LLVMBuildInBoundsGEP2(comp_ctx->builder, OPQ_PTR_TYPE,
+                                       func_ctx->exec_env, &offset, 1,
+                                       "suspend_flags_addr"))
+        || !(addr = LLVMBuildBitCast(comp_ctx->builder, addr, INT32_PTR_TYPE,
+                                     "suspend_flags_ptr"))) {
+        aot_set_last_error("llvm build suspend flags address failed");
+        return NULL;
+    }
+    if (!(flags = LLVMBuildLoad2(comp_ctx->builder, I32_TYPE, addr,
+                                 "suspend_flags"))) {
+        aot_set_last_error("llvm build load failed");
+        return NULL;
+    }
+    /* The flag is set by another thread or a signal handler */
+    LLVMSetVolatile(flags, true);
+
+    if (!(flags = LLVMBuildAnd(comp_ctx->builder, flags, I32_CONST(flag),
+                               "flag"))
+        || !(flags = LLVMBuildICmp(comp_ctx->builder, LLVMIntNE, flags,
+                                   I32_ZERO, "flag_set"))) {
+        aot_set_last_error("llvm build suspend flags check failed");
+        return NULL;
+    }
+    return flags;
+}
+
+bool
+aot_checkpoint_begin_func(AOTCompContext *comp_ctx, AOTFuncContext *func_ctx,
+                          uint32 func_index)
+{
+    AOTCheckpointFunc *cp_func = comp_ctx->checkpoint_funcs + func_index;
+    AOTFunc *aot_func = func_ctx->aot_func;
+    AOTFuncType *aot_func_type = aot_func->func_type;
+    LLVMTypeRef param_types[1], ret_type, func_type, func_ptr_type;
+    LLVMValueRef param_values[1], value, func, res, cmp;
+    LLVMBasicBlockRef entry_block, restore_block, restore_fail, body_block;
+    uint32 i;
+
+    cp_func->code_size = aot_func->code_size;
+    cp_func->ret_cell_num = aot_func_type->ret_cell_num;
+    cp_func->local_count = aot_func_type->param_count + aot_func->local_count;
+    if (cp_func->local_count > 0) {
+        if (!(cp_func->local_cells =
+                  wasm_runtime_malloc(cp_func->local_count))) {
+            aot_set_last_error("allocate memory failed.");
+            return false;
+        }
+        for (i = 0; i < aot_func_type->param_count; i++)
+            cp_func->local_cells[i] =
+                (uint8)wasm_value_type_cell_num(aot_func_type->types[i]);
+        for (i = 0; i < aot_func->local_count; i++)
+            cp_func->local_cells[aot_func_type->param_count + i] =
+                (uint8)wasm_value_type_cell_num(aot_func->local_types_wp[i]);
+    }
+    func_ctx->checkpoint_func = cp_func;
+
+    /* Frames of this function and its callers are being rebuilt if the
+       restore flag is set, jump to where the frame was saved */
+    entry_block = CURR_BLOCK();
+    ADD_BASIC_BLOCK(restore_block, "restore_frame");
+    ADD_BASIC_BLOCK(restore_fail, "restore_frame_fail");
+    ADD_BASIC_BLOCK(body_block, "func_body");
+    MOVE_BLOCK_AFTER(body_block, entry_block);
+
+    if (!(cmp = load_suspend_flags(comp_ctx, func_ctx,
+                                   WASM_SUSPEND_FLAG_RESTORE)))
+        return false;
+    BUILD_COND_BR(cmp, restore_block, body_block);
+
+    /* The callee returns the index of the safepoint to resume from */
+    SET_BUILDER_POS(restore_block);
+    param_types[0] = comp_ctx->exec_env_type;
+    ret_type = I32_TYPE;
+    GET_AOT_FUNCTION(aot_restore_frame, 1);
+    param_values[0] = func_ctx->exec_env;
+    if (!(res = LLVMBuildCall2(comp_ctx->builder, func_type, func,
+                               param_values, 1, "safepoint_idx"))) {
+        aot_set_last_error("llvm build call failed.");
+        return false;
+    }
+    if (!(cp_func->restore_switch =
+              LLVMBuildSwitch(comp_ctx->builder, res, restore_fail, 8))) {
+        aot_set_last_error("llvm build switch failed.");
+        return false;
+    }
+
+    /* The exception has been set in aot_restore_frame */
+    SET_BUILDER_POS(restore_fail);
+    if (!aot_build_zero_function_ret(comp_ctx, func_ctx, aot_func_type))
+        return false;
+
+    SET_BUILDER_POS(body_block);
+    return true;
+fail:
+    return false;
+}
+
+static AOTCheckpointSafepoint *
+create_safepoint(AOTCompContext *comp_ctx, AOTFuncContext *func_ctx,
+                 uint32 kind, uint32 tbl_idx, uint32 arg_count,
+                 const uint8 *resume_ip)
+{
+    AOTCompFrame *aot_frame = comp_ctx->aot_frame;
+    AOTCheckpointFunc *cp_func = func_ctx->checkpoint_func;
+    AOTFunc *aot_func = func_ctx->aot_func;
+    WASMModule *wasm_module = comp_ctx->comp_data->wasm_module;
+    AOTValueSlot *bottom = aot_frame->lp + aot_frame->max_local_cell_num, *p;
+    AOTBlock *func_block = func_ctx->block_stack.block_list_head, *block;
+    AOTCheckpointSafepoint *safepoint;
+    uint32 value_count = 0, block_count = 0, i, *b;
+    uint64 size;
+
+    for (p = bottom; p < aot_frame->sp; p += get_value_cell_num(p->type))
+        value_count++;
+    bh_assert(p == aot_frame->sp);
+    for (block = func_block->next; block; block = block->next)
+        block_count++;
+
+    size = sizeof(AOTCheckpointSafepoint)
+           + (sizeof(LLVMValueRef) * 2 + sizeof(uint8)) * (uint64)value_count
+           + sizeof(uint32) * 4 * (uint64)block_count;
+    if (size >= UINT32_MAX || !(safepoint = wasm_runtime_malloc((uint32)size))) {
+        aot_set_last_error("allocate memory failed.");
+        return NULL;
+    }
+    memset(safepoint, 0, (uint32)size);
+
+    safepoint->ip_offset = (uint32)(aot_frame->frame_ip - wasm_module->load_addr);
+    safepoint->offset = (uint32)(resume_ip - aot_func->code);
+    safepoint->kind = kind;
+    safepoint->tbl_idx = tbl_idx;
+    safepoint->arg_count = arg_count;
+    safepoint->value_count = value_count;
+    safepoint->block_count = block_count;
+    safepoint->values = (LLVMValueRef *)(safepoint + 1);
+    safepoint->restored = safepoint->values + value_count;
+    safepoint->blocks = (uint32 *)(safepoint->restored + value_count);
+    safepoint->value_cells = (uint8 *)(safepoint->blocks + 4 * block_count);
+
+    for (p = bottom, i = 0; p < aot_frame->sp;
+         p += safepoint->value_cells[i++]) {
+        safepoint->values[i] = p->value;
+        safepoint->value_cells[i] = (uint8)get_value_cell_num(p->type);
+    }
+
+    /* Same layout as the label stack of the classic interpreter */
+    for (block = func_block->next, b = safepoint->blocks; block;
+         block = block->next, b += 4) {
+        b[0] = (uint32)(block->wasm_code_begin - aot_func->code);
+        if (block->label_type == LABEL_TYPE_LOOP) {
+            b[1] = b[0];
+            b[3] = wasm_get_cell_num(block->param_types, block->param_count);
+        }
+        else {
+            b[1] = (uint32)(block->wasm_code_end - aot_func->code);
+            b[3] = wasm_get_cell_num(block->result_types, block->result_count);
+        }
+        b[2] = (uint32)(block->frame_sp_begin - bottom);
+    }
+
+    if (cp_func->last_safepoint)
+        cp_func->last_safepoint->next = safepoint;
+    else
+        cp_func->safepoints = safepoint;
+    cp_func->last_safepoint = safepoint;
+    cp_func->safepoint_count++;
+    return safepoint;
+}
+
+/* Store the locals and the first value_count operands to AOTFrame */
+static bool
+spill_frame(AOTCompContext *comp_ctx, AOTFuncContext *func_ctx,
+            AOTCheckpointSafepoint *safepoint, uint32 value_count)
+{
+    AOTCheckpointFunc *cp_func = func_ctx->checkpoint_func;
+    LLVMValueRef local;
+    uint32 cell = 0, i;
+
+    for (i = 0; i < cp_func->local_count; i++) {
+        if (!(local = LLVMBuildLoad2(
+                  comp_ctx->builder,
+                  LLVMGetAllocatedType(func_ctx->locals[i]),
+                  func_ctx->locals[i], "local"))) {
+            aot_set_last_error("llvm build load failed");
+            return false;
+        }
+        if (!store_cell(comp_ctx, func_ctx, local, cell))
+            return false;
+        cell += cp_func->local_cells[i];
+    }
+
+    cell = comp_ctx->aot_frame->max_local_cell_num;
+    for (i = 0; i < value_count; i++) {
+        if (!store_cell(comp_ctx, func_ctx, safepoint->values[i], cell))
+            return false;
+        cell += safepoint->value_cells[i];
+    }
+    return true;
+}
+
+/* Reload the locals and all the operands from AOTFrame, then continue at
+   resume_block */
+static bool
+build_restore_block(AOTCompContext *comp_ctx, AOTFuncContext *func_ctx,
+                    AOTCheckpointSafepoint *safepoint,
+                    LLVMBasicBlockRef resume_block)
+{
+    AOTCheckpointFunc *cp_func = func_ctx->checkpoint_func;
+    LLVMBasicBlockRef restore_block;
+    LLVMValueRef value, restored;
+    uint32 cell = 0, i, j;
+
+    ADD_BASIC_BLOCK(restore_block, "restore_safepoint");
+    LLVMAddCase(cp_func->restore_switch,
+                I32_CONST(cp_func->safepoint_count - 1), restore_block);
+    SET_BUILDER_POS(restore_block);
+
+    for (i = 0; i < cp_func->local_count; i++) {
+        if (!(value = load_cell(comp_ctx, func_ctx,
+                                LLVMGetAllocatedType(func_ctx->locals[i]),
+                                cell)))
+            return false;
+        if (!LLVMBuildStore(comp_ctx->builder, value, func_ctx->locals[i])) {
+            aot_set_last_error("llvm build store failed");
+            return false;
+        }
+        cell += cp_func->local_cells[i];
+    }
+
+    cell = comp_ctx->aot_frame->max_local_cell_num;
+    for (i = 0; i < safepoint->value_count; i++) {
+        value = safepoint->values[i];
+        restored = NULL;
+        if (LLVMIsConstant(value))
+            restored = value;
+        for (j = 0; j < i && !restored; j++) {
+            if (safepoint->values[j] == value)
+                restored = safepoint->restored[j];
+        }
+        if (!restored
+            && !(restored = load_cell(comp_ctx, func_ctx, LLVMTypeOf(value),
+                                      cell)))
+            return false;
+        safepoint->restored[i] = restored;
+        cell += safepoint->value_cells[i];
+    }
+
+    BUILD_BR(resume_block);
+    return true;
+fail:
+    return false;
+}
+
+bool
+aot_checkpoint_emit_loop_safepoint(AOTCompContext *comp_ctx,
+                                   AOTFuncContext *func_ctx, AOTBlock *block)
+{
+    AOTCheckpointSafepoint *safepoint;
+    LLVMTypeRef param_types[1], ret_type, func_type, func_ptr_type;
+    LLVMValueRef param_values[1], value, func, res, cmp;
+    LLVMBasicBlockRef checkpoint_block, checkpoint_fail, resume_block;
+
+    if (!(safepoint =
+              create_safepoint(comp_ctx, func_ctx, AOT_SAFEPOINT_LOOP, 0, 0,
+                               block->wasm_code_begin)))
+        return false;
+
+    ADD_BASIC_BLOCK(checkpoint_block, "checkpoint");
+    ADD_BASIC_BLOCK(checkpoint_fail, "checkpoint_fail");
+    ADD_BASIC_BLOCK(resume_block, "loop_body");
+    MOVE_BLOCK_AFTER_CURR(resume_block);
+
+    if (!(cmp = load_suspend_flags(comp_ctx, func_ctx,
+                                   WASM_SUSPEND_FLAG_CHECKPOINT)))
+        return false;
+    BUILD_COND_BR(cmp, checkpoint_block, resume_block);
+
+    /* Save the whole frame, commit the ip so that the runtime can find
+       this safepoint, and take the checkpoint */
+    SET_BUILDER_POS(checkpoint_block);
+    if (!spill_frame(comp_ctx, func_ctx, safepoint, safepoint->value_count)
+        || !aot_gen_commit_sp_ip(comp_ctx->aot_frame, false, true))
+        return false;
+
+    param_types[0] = comp_ctx->exec_env_type;
+    ret_type = INT8_TYPE;
+    GET_AOT_FUNCTION(aot_checkpoint, 1);
+    param_values[0] = func_ctx->exec_env;
+    if (!(res = LLVMBuildCall2(comp_ctx->builder, func_type, func,
+                               param_values, 1, "checkpoint_ret"))) {
+        aot_set_last_error("llvm build call failed.");
+        return false;
+    }
+    BUILD_ICMP(LLVMIntNE, res, I8_ZERO, cmp, "checkpoint_succ");
+    BUILD_COND_BR(cmp, resume_block, checkpoint_fail);
+
+    SET_BUILDER_POS(checkpoint_fail);
+    if (!aot_build_zero_function_ret(comp_ctx, func_ctx,
+                                     func_ctx->aot_func->func_type))
+        return false;
+
+    if (!build_restore_block(comp_ctx, func_ctx, safepoint, resume_block))
+        return false;
+
+    SET_BUILDER_POS(resume_block);
+    aot_checked_addr_list_destroy(func_ctx);
+    return true;
+fail:
+    return false;
+}
+
+static const uint8 *
+skip_leb(const uint8 *p)
+{
+    while (*p++ & 0x80)
+        ;
+    return p;
+}
+
+bool
+aot_checkpoint_emit_call_safepoint(AOTCompContext *comp_ctx,
+                                   AOTFuncContext *func_ctx, uint32 tbl_idx,
+                                   uint32 arg_count)
+{
+    AOTCheckpointSafepoint *safepoint;
+    LLVMBasicBlockRef resume_block;
+    const uint8 *ip = comp_ctx->aot_frame->frame_ip;
+    uint32 kind;
+
+    /* Only the calls that return to this frame, the table index of
+       call_indirect has been validated by the loader */
+    switch (*ip++) {
+        case WASM_OP_CALL:
+            kind = AOT_SAFEPOINT_CALL;
+            ip = skip_leb(ip);
+            break;
+        case WASM_OP_CALL_INDIRECT:
+            kind = AOT_SAFEPOINT_CALL_INDIRECT;
+            ip = skip_leb(skip_leb(ip));
+            break;
+        default:
+            return true;
+    }
+
+    if (!(safepoint = create_safepoint(comp_ctx, func_ctx, kind, tbl_idx,
+                                       arg_count, ip)))
+        return false;
+    bh_assert(safepoint->value_count >= arg_count);
+
+    /* The arguments are saved in the frame of the callee */
+    if (!spill_frame(comp_ctx, func_ctx, safepoint,
+                     safepoint->value_count - arg_count))
+        return false;
+
+    ADD_BASIC_BLOCK(resume_block, "call_safepoint");
+    MOVE_BLOCK_AFTER_CURR(resume_block);
+    BUILD_BR(resume_block);
+
+    if (!build_restore_block(comp_ctx, func_ctx, safepoint, resume_block))
+        return false;
+
+    SET_BUILDER_POS(resume_block);
+    aot_checked_addr_list_destroy(func_ctx);
+    return true;
+fail:
+    return false;
+}
+
+bool
+aot_checkpoint_end_func(AOTCompContext *comp_ctx, AOTFuncContext *func_ctx)
+{
+    AOTCheckpointFunc *cp_func = func_ctx->checkpoint_func;
+    AOTCheckpointSafepoint *safepoint;
+    LLVMValueRef *values = NULL, *restored = NULL;
+    uint64 size = 0;
+    uint32 count = 0, i, j;
+
+    for (safepoint = cp_func->safepoints; safepoint;
+         safepoint = safepoint->next)
+        size += safepoint->value_count;
+
+    if (size > 0) {
+        size *= sizeof(LLVMValueRef) * 2;
+        if (size >= UINT32_MAX
+            || !(values = wasm_runtime_malloc((uint32)size))) {
+            aot_set_last_error("allocate memory failed.");
+            return false;
+        }
+        restored = values + size / sizeof(LLVMValueRef) / 2;
+
+        /* Constants and duplicated operands were not reloaded */
+        for (safepoint = cp_func->safepoints; safepoint;
+             safepoint = safepoint->next) {
+            for (i = 0; i < safepoint->value_count; i++) {
+                if (safepoint->restored[i] == safepoint->values[i])
+                    continue;
+                for (j = 0; j < i; j++) {
+                    if (safepoint->restored[j] == safepoint->restored[i])
+                        break;
+                }
+                if (j < i)
+                    continue;
+                values[count] = safepoint->values[i];
+                restored[count] = safepoint->restored[i];
+                count++;
+            }
+        }
+
+        aot_checkpoint_repair_ssa(func_ctx->func, values, restored, count);
+        wasm_runtime_free(values);
+    }
+
+    for (safepoint = cp_func->safepoints; safepoint;
+         safepoint = safepoint->next)
+        safepoint->values = safepoint->restored = NULL;
+    cp_func->last_safepoint = NULL;
+    cp_func->restore_switch = NULL;
+    return true;
+}
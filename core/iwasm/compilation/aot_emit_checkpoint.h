@@ -0,0 +1,84 @@
+#ifndef _AOT_EMIT_CHECKPOINT_H_
+#define _AOT_EMIT_CHECKPOINT_H_
+
+#include "aot_compiler.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* A point where the frame state of a function can be saved to and rebuilt
+   from its AOTFrame, emitted at loop headers and before calls */
+typedef struct AOTCheckpointSafepoint {
+    struct AOTCheckpointSafepoint *next;
+    /* Offset of the loop/call opcode to the wasm binary, it is the ip
+       committed to AOTFrame and the key to find the safepoint at runtime */
+    uint32 ip_offset;
+    /* Offset to the function code where the frame resumes in the image:
+       the loop body for a loop, the next opcode for a call */
+    uint32 offset;
+    /* AOT_SAFEPOINT_LOOP/CALL/CALL_INDIRECT */
+    uint32 kind;
+    uint32 tbl_idx;
+    /* Number of the operands consumed by the call */
+    uint32 arg_count;
+    /* Cell num of each operand from the stack bottom */
+    uint32 value_count;
+    uint8 *value_cells;
+    /* begin, target, frame_sp (in cells) and cell_num of each block except
+       the function block, from the outermost one */
+    uint32 block_count;
+    uint32 *blocks;
+    /* Operands and their copies reloaded in the restore block, only valid
+       while the function is being compiled */
+    LLVMValueRef *values;
+    LLVMValueRef *restored;
+} AOTCheckpointSafepoint;
+
+typedef struct AOTCheckpointFunc {
+    uint32 code_size;
+    uint32 ret_cell_num;
+    /* Cell num of each param and local */
+    uint32 local_count;
+    uint8 *local_cells;
+    uint32 safepoint_count;
+    AOTCheckpointSafepoint *safepoints;
+    AOTCheckpointSafepoint *last_safepoint;
+    /* Switch on the safepoint index returned by aot_restore_frame */
+    LLVMValueRef restore_switch;
+} AOTCheckpointFunc;
+
+bool
+aot_checkpoint_init(AOTCompContext *comp_ctx);
+
+void
+aot_checkpoint_destroy(AOTCompContext *comp_ctx);
+
+/* Emit the dispatch to the restore blocks at the function entry, the
+   builder is left at the block where the function body starts */
+bool
+aot_checkpoint_begin_func(AOTCompContext *comp_ctx, AOTFuncContext *func_ctx,
+                          uint32 func_index);
+
+/* Merge the reloaded operands into the SSA values they replace */
+bool
+aot_checkpoint_end_func(AOTCompContext *comp_ctx, AOTFuncContext *func_ctx);
+
+/* Poll the checkpoint flag at the header of the loop being translated */
+bool
+aot_checkpoint_emit_loop_safepoint(AOTCompContext *comp_ctx,
+                                   AOTFuncContext *func_ctx, AOTBlock *block);
+
+/* Spill the locals and the operands below the arguments before the call
+   being translated, arg_count includes the element index of call_indirect.
+   Tail calls have no caller frame to resume and get no safepoint. */
+bool
+aot_checkpoint_emit_call_safepoint(AOTCompContext *comp_ctx,
+                                   AOTFuncContext *func_ctx, uint32 tbl_idx,
+                                   uint32 arg_count);
+
+#ifdef __cplusplus
+} /* end of extern "C" */
+#endif
+
+#endif /* end of _AOT_EMIT_CHECKPOINT_H_ */
@@ -8,6 +8,7 @@
 #include "aot_emit_exception.h"
 #if WASM_ENABLE_GC != 0
 #include "aot_emit_gc.h"
+#include "aot_emit_checkpoint.h"
 #endif
 #include "../aot/aot_runtime.h"
 #include "../interpreter/wasm_loader.h"
@@ -578,6 +579,7 @@ aot_compile_op_block(AOTCompContext *comp_ctx, AOTFuncContext *func_ctx,
         bh_memcpy_s(block->result_types, result_count, result_types,
                     result_count);
     }
+    block->wasm_code_begin = *p_frame_ip;
     block->wasm_code_else = else_addr;
     block->wasm_code_end = end_addr;
     block->block_index = func_ctx->block_stack.block_index[label_type];
@@ -602,8 +604,13 @@ aot_compile_op_block(AOTCompContext *comp_ctx, AOTFuncContext *func_ctx,
             goto fail;
         /* Start to translate the block */
         SET_BUILDER_POS(block->llvm_entry_block);
-        if (label_type == LABEL_TYPE_LOOP)
+        if (label_type == LABEL_TYPE_LOOP) {
             aot_checked_addr_list_destroy(func_ctx);
+            if (comp_ctx->enable_checkpoint
+                && !aot_checkpoint_emit_loop_safepoint(comp_ctx, func_ctx,
+                                                       block))
+                return false;
+        }
     }
     else if (label_type == LABEL_TYPE_IF) {
         POP_COND(value);
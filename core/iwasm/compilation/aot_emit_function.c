@@ -7,6 +7,7 @@
 #include "aot_emit_exception.h"
 #include "aot_emit_control.h"
 #include "aot_emit_table.h"
+#include "aot_emit_checkpoint.h"
 #include "../aot/aot_runtime.h"
 #if WASM_ENABLE_GC != 0
 #include "aot_emit_gc.h"
@@ -612,7 +613,15 @@ alloc_frame_for_aot_func(AOTCompContext *comp_ctx, AOTFuncContext *func_ctx,
        check whether wasm operand stack is overflow */
     if (!comp_ctx->is_jit_mode) {
         /* Refer to aot_alloc_frame */
-        if (!comp_ctx->enable_gc) {
+        if (comp_ctx->enable_checkpoint) {
+            /* Locals and operands are saved to the frame at safepoints */
+            frame_size = comp_ctx->pointer_size * aot_frame_ptr_num
+                         + all_cell_num * 4;
+            frame_size_with_outs_area =
+                frame_size + comp_ctx->pointer_size * aot_frame_ptr_num
+                + max_stack_cell_num * 4;
+        }
+        else if (!comp_ctx->enable_gc) {
             frame_size = frame_size_with_outs_area =
                 comp_ctx->pointer_size * aot_frame_ptr_num;
         }
@@ -641,7 +650,7 @@ alloc_frame_for_aot_func(AOTCompContext *comp_ctx, AOTFuncContext *func_ctx,
 
     cur_frame = func_ctx->cur_frame;
 
-    if (!comp_ctx->enable_gc) {
+    if (!comp_ctx->enable_gc && !comp_ctx->enable_checkpoint) {
         offset = I32_CONST(frame_size);
         CHECK_LLVM_CONST(offset);
         if (!(wasm_stack_top =
@@ -702,6 +711,25 @@ alloc_frame_for_aot_func(AOTCompContext *comp_ctx, AOTFuncContext *func_ctx,
         return false;
     }
 
+    if (comp_ctx->enable_checkpoint) {
+        LLVMValueRef wasm_stack_top_new;
+
+        /* exec_env->wasm_stack.top += frame_size */
+        offset = I32_CONST(frame_size);
+        CHECK_LLVM_CONST(offset);
+        if (!(wasm_stack_top_new = LLVMBuildInBoundsGEP2(
+                  comp_ctx->builder, INT8_TYPE, wasm_stack_top, &offset, 1,
+                  "wasm_stack_top_new"))) {
+            aot_set_last_error("llvm build in bounds gep failed");
+            return false;
+        }
+        if (!LLVMBuildStore(comp_ctx->builder, wasm_stack_top_new,
+                            wasm_stack_top_ptr)) {
+            aot_set_last_error("llvm build store failed");
+            return false;
+        }
+    }
+
 #if WASM_ENABLE_GC != 0
     if (comp_ctx->enable_gc) {
         LLVMValueRef wasm_stack_top_new, frame_ref, frame_ref_ptr;
@@ -1120,7 +1148,7 @@ free_frame_for_aot_func(AOTCompContext *comp_ctx, AOTFuncContext *func_ctx)
         }
     }
 
-    if (comp_ctx->enable_gc) {
+    if (comp_ctx->enable_gc || comp_ctx->enable_checkpoint) {
         /* cur_frame = exec_env->cur_frame */
         if (!(cur_frame = LLVMBuildLoad2(comp_ctx->builder, INT8_PTR_TYPE,
                                          cur_frame_ptr, "cur_frame"))) {
@@ -1432,6 +1460,13 @@ aot_compile_op_call(AOTCompContext *comp_ctx, AOTFuncContext *func_ctx,
             return false;
     }
 
+    /* Calls to import functions can't be on the stack of a checkpoint */
+    if (comp_ctx->enable_checkpoint && func_idx >= import_func_count
+        && !tail_call
+        && !aot_checkpoint_emit_call_safepoint(comp_ctx, func_ctx, 0,
+                                               func_type->param_count))
+        return false;
+
     /* Insert suspend check point */
     if (comp_ctx->enable_thread_mgr) {
         if (!check_suspend_flags(comp_ctx, func_ctx, true))
@@ -2098,6 +2133,12 @@ aot_compile_op_call_indirect(AOTCompContext *comp_ctx, AOTFuncContext *func_ctx,
             return false;
     }
 
+    /* The element index is passed to the callee as well */
+    if (comp_ctx->enable_checkpoint
+        && !aot_checkpoint_emit_call_safepoint(comp_ctx, func_ctx, tbl_idx,
+                                               func_type->param_count + 1))
+        return false;
+
     /* Insert suspend check point */
     if (comp_ctx->enable_thread_mgr) {
         if (!check_suspend_flags(comp_ctx, func_ctx, true))
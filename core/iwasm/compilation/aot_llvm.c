@@ -8,6 +8,7 @@
 #include "aot_compiler.h"
 #include "aot_emit_exception.h"
 #include "aot_emit_table.h"
+#include "aot_emit_checkpoint.h"
 #include "../aot/aot_runtime.h"
 #include "../aot/aot_intrinsic.h"
 #include "../interpreter/wasm_runtime.h"
@@ -2610,6 +2611,10 @@ aot_create_comp_context(const AOTCompData *comp_data, aot_comp_option_t option)
     if (option->enable_gc)
         comp_ctx->enable_gc = true;
 
+    /* Checkpoint relies on the AOTFrame layout, which isn't used in JIT */
+    if (option->enable_checkpoint && !option->is_jit_mode)
+        comp_ctx->enable_checkpoint = true;
+
     comp_ctx->opt_level = option->opt_level;
     comp_ctx->size_level = option->size_level;
 
@@ -3205,6 +3210,9 @@ aot_create_comp_context(const AOTCompData *comp_data, aot_comp_option_t option)
     if (comp_ctx->disable_llvm_intrinsics)
         aot_intrinsic_fill_capability_flags(comp_ctx);
 
+    if (comp_ctx->enable_checkpoint && !aot_checkpoint_init(comp_ctx))
+        goto fail;
+
     ret = comp_ctx;
 
 fail:
@@ -3269,6 +3277,8 @@ aot_destroy_comp_context(AOTCompContext *comp_ctx)
         wasm_runtime_free(comp_ctx->aot_frame);
     }
 
+    aot_checkpoint_destroy(comp_ctx);
+
     wasm_runtime_free(comp_ctx);
 }
 
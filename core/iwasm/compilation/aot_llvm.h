@@ -149,6 +149,8 @@ typedef struct AOTBlock {
     /* Whether skip translation of wasm else branch */
     bool skip_wasm_code_else;
 
+    /* code after the block type of this block */
+    uint8 *wasm_code_begin;
     /* code of else opcode of this block, if it is a IF block  */
     uint8 *wasm_code_else;
     /* code end of this block */
@@ -252,6 +254,9 @@ typedef struct AOTFuncContext {
 
     unsigned int stack_consumption_for_func_call;
 
+    /* Safepoints of the function when checkpoint is enabled */
+    struct AOTCheckpointFunc *checkpoint_func;
+
     LLVMValueRef locals[1];
 } AOTFuncContext;
 
@@ -410,6 +415,9 @@ typedef struct AOTCompContext {
     /* Generate auxiliary stack frame */
     bool enable_aux_stack_frame;
 
+    /* Generate checkpoint/restore safepoints */
+    bool enable_checkpoint;
+
     /* Function performance profiling */
     bool enable_perf_profiling;
 
@@ -511,6 +519,9 @@ typedef struct AOTCompContext {
 
     /* Current frame information for translation */
     AOTCompFrame *aot_frame;
+
+    /* Safepoints of each function, emitted to the checkpoint section */
+    struct AOTCheckpointFunc *checkpoint_funcs;
 } AOTCompContext;
 
 enum {
@@ -617,6 +628,10 @@ aot_apply_llvm_new_pass_manager(AOTCompContext *comp_ctx, LLVMModuleRef module);
 void
 aot_handle_llvm_errmsg(const char *string, LLVMErrorRef err);
 
+void
+aot_checkpoint_repair_ssa(LLVMValueRef func, LLVMValueRef *values,
+                          LLVMValueRef *restored, uint32 count);
+
 char *
 aot_compress_aot_func_names(AOTCompContext *comp_ctx, uint32 *p_size);
 
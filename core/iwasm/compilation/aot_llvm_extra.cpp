@@ -42,6 +42,8 @@
 #include <llvm/Target/TargetMachine.h>
 #include <llvm/Target/TargetOptions.h>
 #include <llvm/Transforms/Utils/LowerMemIntrinsics.h>
+#include <llvm/Transforms/Utils/SSAUpdater.h>
+#include <llvm/ADT/MapVector.h>
 #include <llvm/Transforms/Vectorize/LoopVectorize.h>
 #include <llvm/Transforms/Vectorize/LoadStoreVectorizer.h>
 #include <llvm/Transforms/Vectorize/SLPVectorizer.h>
@@ -79,6 +81,10 @@ aot_check_simd_compatibility(const char *arch_c_str, const char *cpu_c_str);
 void
 aot_apply_llvm_new_pass_manager(AOTCompContext *comp_ctx, LLVMModuleRef module);
 
+void
+aot_checkpoint_repair_ssa(LLVMValueRef func, LLVMValueRef *values,
+                          LLVMValueRef *restored, uint32 count);
+
 LLVM_C_EXTERN_C_END
 
 ExitOnError ExitOnErr;
@@ -422,3 +428,43 @@ aot_compress_aot_func_names(AOTCompContext *comp_ctx, uint32 *p_size)
     *p_size = compressed_str_len;
     return compressed_str;
 }
+
+void
+aot_checkpoint_repair_ssa(LLVMValueRef func, LLVMValueRef *values,
+                          LLVMValueRef *restored, uint32 count)
+{
+    Function *F = unwrap<Function>(func);
+    MapVector<Value *, SmallVector<Instruction *, 4>> Restored;
+    uint32 i;
+
+    for (i = 0; i < count; i++)
+        Restored[unwrap(values[i])].push_back(unwrap<Instruction>(restored[i]));
+
+    /* An operand reloaded at a restore block no longer dominates the code
+       after the safepoint, rewrite its uses to the values merged from the
+       definition and all of the restore blocks */
+    for (auto &Entry : Restored) {
+        Value *V = Entry.first;
+        BasicBlock *DefBB = isa<Instruction>(V)
+                                ? cast<Instruction>(V)->getParent()
+                                : &F->getEntryBlock();
+        SmallVector<Use *, 16> Uses;
+        SSAUpdater Updater;
+
+        Updater.Initialize(V->getType(), V->getName());
+        Updater.AddAvailableValue(DefBB, V);
+        for (Instruction *R : Entry.second)
+            Updater.AddAvailableValue(R->getParent(), R);
+
+        for (Use &U : V->uses()) {
+            Instruction *User = cast<Instruction>(U.getUser());
+            /* Uses following the definition in the same block can't be
+               reached from a safepoint */
+            if (User->getParent() == DefBB && !isa<PHINode>(User))
+                continue;
+            Uses.push_back(&U);
+        }
+        for (Use *U : Uses)
+            Updater.RewriteUse(*U);
+    }
+}
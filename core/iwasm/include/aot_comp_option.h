@@ -22,6 +22,7 @@ typedef struct AOTCompOption {
     bool enable_gc;
     bool enable_aux_stack_check;
     bool enable_aux_stack_frame;
+    bool enable_checkpoint;
     bool enable_perf_profiling;
     bool enable_memory_profiling;
     bool disable_llvm_intrinsics;
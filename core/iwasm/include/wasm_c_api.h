@@ -534,6 +534,9 @@ typedef struct LoadArgs {
     bool clone_wasm_binary;
     /* This option is only used by the AOT/wasm loader (see wasm_export.h) */
     bool wasm_binary_freeable;
+    /* This option is only used by the wasm loader (see wasm_export.h) */
+    uint32_t loader_threads;
+    bool lazy_translation;
     /* TODO: more fields? */
 } LoadArgs;
 #endif /* LOAD_ARGS_OPTION_DEFINED */
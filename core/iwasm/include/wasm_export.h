@@ -127,6 +127,10 @@ typedef struct wasm_section_t {
 struct WASMExecEnv;
 typedef struct WASMExecEnv *wasm_exec_env_t;
 
+/* Snapshot image of an initialized module instance */
+struct WASMSnapshot;
+typedef struct WASMSnapshot *wasm_snapshot_t;
+
 /* Package Type */
 typedef enum {
     Wasm_Module_Bytecode = 0,
@@ -218,8 +222,41 @@ typedef struct RuntimeInitArgs {
     uint32_t llvm_jit_size_level;
     /* Segue optimization flags for LLVM JIT */
     uint32_t segue_flags;
-    /* Restore from interp.img and frame.img */
+    /* Restore from checkpoint.img */
     bool restore_flag;
+    /* Map the saved linear memory copy-on-write instead of copying it,
+       for restore_flag and wasm_runtime_restore_instance */
+    bool restore_lazy;
+    /* Where the final checkpoint image is written and where it is
+       restored from: "fd:N", "unix:/path" or a file path, NULL for
+       checkpoint.img. A restore_source also sets restore_flag. */
+    const char *checkpoint_target;
+    const char *restore_source;
+    /* Compress the linear memory of checkpoint images */
+    bool checkpoint_compress;
+    /* Number of the threads that dump and restore linear memory,
+       0 uses the number of online CPUs */
+    uint32_t checkpoint_threads;
+    /* Store the linear memory pages of checkpoint images once in this
+       shared page pool, the images refer to the pages in it and restore
+       maps them copy-on-write. NULL writes the pages to each image. */
+    const char *checkpoint_page_pool;
+    /* Write the images of pre-copy rounds and of instance checkpoints on a
+       background thread, see wasm_runtime_set_checkpoint_callback() */
+    bool checkpoint_async;
+    /* Open the image files with O_DIRECT and fdatasync them before they
+       are renamed into place */
+    bool checkpoint_direct_io;
+    bool checkpoint_sync;
+    /* Number of the threads that validate and translate the function
+       bodies of a wasm module for the fast interpreter, 0 or 1 does it on
+       the loading thread. LoadArgs.loader_threads overrides it. */
+    uint32_t loader_threads;
+    /* Translate each function body for the fast interpreter on its first
+       call instead of at load time, which only checks the structure of the
+       code section. A function that fails to translate traps when called.
+       Not applied when the wasm binary buffer is freeable. */
+    bool lazy_translation;
     /**
      * If enabled
      * - llvm-jit will output a jitdump file for `perf inject`
@@ -242,6 +279,13 @@ typedef struct LoadArgs {
     const strings), making it possible to free the wasm binary buffer after
     loading. */
     bool wasm_binary_freeable;
+    /* Number of the threads that validate and translate the function
+    bodies, used by the wasm loader of the fast interpreter only. 0 uses
+    RuntimeInitArgs.loader_threads. */
+    uint32_t loader_threads;
+    /* Translate the function bodies on their first call, either this or
+    RuntimeInitArgs.lazy_translation enables it. */
+    bool lazy_translation;
     /* TODO: more fields? */
 } LoadArgs;
 #endif /* LOAD_ARGS_OPTION_DEFINED */
@@ -537,6 +581,226 @@ wasm_runtime_get_module_hash(wasm_module_t module);
 WASM_RUNTIME_API_EXTERN void
 wasm_runtime_checkpoint();
 
+/**
+ * Request a pre-copy round: the linear memory pages dirtied since the
+ * previous round are written to checkpoint.img.<round> and execution
+ * continues. A later wasm_runtime_checkpoint() then only has to write the
+ * pages dirtied since the last round.
+ */
+WASM_RUNTIME_API_EXTERN void
+wasm_runtime_checkpoint_precopy();
+
+/**
+ * Request a snapshot: a child process is forked at the next safepoint and
+ * writes checkpoint.img from its copy-on-write view of the instance while
+ * the guest keeps running. The guest only pauses for the fork.
+ */
+WASM_RUNTIME_API_EXTERN void
+wasm_runtime_checkpoint_snapshot();
+
+/**
+ * Request a checkpoint of one module instance. At its next safepoint the
+ * instance writes its image to sink and stops: the wasm call running in it
+ * returns false with the "checkpointed" exception, and the other instances
+ * of the process keep running. Unlike wasm_runtime_checkpoint(), the process
+ * doesn't exit. With checkpoint_async of RuntimeInitArgs the image may still
+ * be written when the call returns, see wasm_runtime_set_checkpoint_callback().
+ *
+ * @param module_inst the main instance to checkpoint
+ * @param sink where the image is written: "fd:N", "unix:/path" or a file
+ *        path, NULL for checkpoint.img. It must stay valid until the
+ *        checkpoint is taken.
+ *
+ * @return true if the request is raised, false otherwise, e.g. if the
+ *         instance runs in Fast JIT or LLVM JIT mode, which don't support
+ *         checkpoints
+ */
+WASM_RUNTIME_API_EXTERN bool
+wasm_runtime_request_checkpoint(wasm_module_inst_t module_inst,
+                                const char *sink);
+
+/**
+ * Restore a module instance from a checkpoint image. The next wasm call
+ * into the instance resumes the execution recorded in the image instead of
+ * running the called function, the instance must be instantiated from the
+ * same module. Other instances are not affected.
+ *
+ * @param module_inst the instance to restore
+ * @param source where the image is read: "fd:N", "unix:/path" or a file
+ *        path, NULL for checkpoint.img. It must stay valid until the call.
+ *
+ * @return true if the restore is armed, false otherwise, e.g. if the
+ *         instance runs in Fast JIT or LLVM JIT mode
+ */
+WASM_RUNTIME_API_EXTERN bool
+wasm_runtime_restore_instance(wasm_module_inst_t module_inst,
+                              const char *source);
+
+/* Kinds of the operations recorded by the migration statistics */
+typedef enum {
+    WASM_MIGRATION_CHECKPOINT = 0,
+    WASM_MIGRATION_PRECOPY,
+    WASM_MIGRATION_SNAPSHOT,
+    WASM_MIGRATION_RESTORE,
+    WASM_MIGRATION_KIND_COUNT
+} wasm_migration_kind_t;
+
+typedef enum {
+    WASM_MIGRATION_PHASE_STOP_THREADS = 0,
+    WASM_MIGRATION_PHASE_FORK,
+    WASM_MIGRATION_PHASE_MEMORY,
+    WASM_MIGRATION_PHASE_GLOBAL,
+    WASM_MIGRATION_PHASE_PROGRAM_COUNTER,
+    WASM_MIGRATION_PHASE_STACK,
+    WASM_MIGRATION_PHASE_THREADS,
+    WASM_MIGRATION_PHASE_WRITE,
+    WASM_MIGRATION_PHASE_COUNT
+} wasm_migration_phase_t;
+
+/* Statistics of one checkpoint, pre-copy round, snapshot or restore */
+typedef struct wasm_migration_stats_t {
+    wasm_migration_kind_t kind;
+    bool success;
+    /* CLOCK_MONOTONIC time when the operation finished */
+    uint64_t timestamp_ns;
+    uint64_t total_ns;
+    /* Time of each phase, 0 for the phases that didn't run */
+    uint64_t phase_ns[WASM_MIGRATION_PHASE_COUNT];
+    /* Size of the images written and read */
+    uint64_t bytes_written;
+    uint64_t bytes_read;
+    /* 4KB pages of the linear memory, the pages recorded in the image,
+       which are the dirty pages of a pre-copy delta or all of them, and
+       the zero pages among them */
+    uint64_t memory_pages;
+    uint64_t dirty_pages;
+    uint64_t zero_pages;
+    /* Bytes of the non-zero recorded pages and their stored size */
+    uint64_t raw_page_bytes;
+    uint64_t stored_page_bytes;
+    /* stored_page_bytes / raw_page_bytes, 1 if nothing was compressed */
+    double compression_ratio;
+    /* Frames of all the threads and the threads, the main one included */
+    uint32_t frame_count;
+    uint32_t thread_count;
+    /* The pre-copy round of a WASM_MIGRATION_PRECOPY */
+    uint32_t precopy_round;
+} wasm_migration_stats_t;
+
+/**
+ * Callback of wasm_runtime_set_checkpoint_callback().
+ *
+ * @param kind WASM_MIGRATION_CHECKPOINT or WASM_MIGRATION_PRECOPY
+ * @param target the file or the stream the image was written to
+ * @param success whether the image was written, and synced when
+ *        checkpoint_sync of RuntimeInitArgs is set
+ * @param user_data the user data given to the setter
+ */
+typedef void (*wasm_checkpoint_callback_t)(wasm_migration_kind_t kind,
+                                           const char *target, bool success,
+                                           void *user_data);
+
+/**
+ * Set the callback called when the image of a checkpoint or a pre-copy
+ * round is written. With checkpoint_async of RuntimeInitArgs the guest
+ * resumes, or the checkpointed call returns, as soon as its state is
+ * copied, and the callback runs later on the background writer thread.
+ * The write phase of the statistics then only covers the copy.
+ *
+ * @param callback the callback, NULL to remove it
+ * @param user_data passed to the callback
+ */
+WASM_RUNTIME_API_EXTERN void
+wasm_runtime_set_checkpoint_callback(wasm_checkpoint_callback_t callback,
+                                     void *user_data);
+
+/**
+ * Get the statistics of the last operation of a kind in this process. A
+ * final checkpoint requested for the whole process exits it and a snapshot
+ * is written by a forked child, only the JSON lines report them.
+ *
+ * @param kind the kind of the operation
+ * @param stats the statistics are copied to it
+ *
+ * @return true if an operation of the kind has finished, false otherwise
+ */
+WASM_RUNTIME_API_EXTERN bool
+wasm_runtime_get_migration_stats(wasm_migration_kind_t kind,
+                                 wasm_migration_stats_t *stats);
+
+/**
+ * Write the statistics of every operation to fd as one JSON object per
+ * line, with the same fields as wasm_migration_stats_t.
+ *
+ * @param fd the file descriptor, -1 to stop writing
+ */
+WASM_RUNTIME_API_EXTERN void
+wasm_runtime_set_migration_stats_fd(int fd);
+
+/**
+ * Initialize a module instance and write its snapshot image: the exported
+ * function init_func is called and the resulting linear memory and globals
+ * are written to path. Instances created from the snapshot start from this
+ * state without running the start function or the initializer again.
+ *
+ * @param module_inst the instance to initialize, it must not be running
+ * @param init_func the exported function to call, it takes no parameters,
+ *        NULL to write the instance as it is
+ * @param path the file the snapshot is written to, NULL for checkpoint.img
+ *
+ * @return true if success, false otherwise
+ */
+WASM_RUNTIME_API_EXTERN bool
+wasm_runtime_create_snapshot(wasm_module_inst_t module_inst,
+                             const char *init_func, const char *path);
+
+/**
+ * Load a snapshot image written by wasm_runtime_create_snapshot(). The
+ * image is mapped read-only once and shared by all the instances created
+ * from it.
+ *
+ * @param path the snapshot file, NULL for checkpoint.img
+ * @param error_buf buffer to output the error info if failed
+ * @param error_buf_size the size of the error buffer
+ *
+ * @return the snapshot if success, NULL otherwise
+ */
+WASM_RUNTIME_API_EXTERN wasm_snapshot_t
+wasm_runtime_load_snapshot(const char *path, char *error_buf,
+                           uint32_t error_buf_size);
+
+/**
+ * Unload a snapshot, the instances created from it stay valid.
+ *
+ * @param snapshot the snapshot to unload
+ */
+WASM_RUNTIME_API_EXTERN void
+wasm_runtime_unload_snapshot(wasm_snapshot_t snapshot);
+
+/**
+ * Instantiate a module from a snapshot. The linear memory is mapped
+ * copy-on-write from the snapshot file when the platform reserves linear
+ * memory with mmap, so that the pages are shared until an instance writes
+ * them, and copied otherwise.
+ *
+ * @param module the module the snapshot was created from
+ * @param snapshot the snapshot loaded by wasm_runtime_load_snapshot()
+ * @param default_stack_size the default stack size of the instance
+ * @param host_managed_heap_size the heap size, it must be the one the
+ *        snapshot was created with
+ * @param error_buf buffer to output the error info if failed
+ * @param error_buf_size the size of the error buffer
+ *
+ * @return the instantiated module instance, NULL if failed
+ */
+WASM_RUNTIME_API_EXTERN wasm_module_inst_t
+wasm_runtime_instantiate_from_snapshot(const wasm_module_t module,
+                                       wasm_snapshot_t snapshot,
+                                       uint32_t default_stack_size,
+                                       uint32_t host_managed_heap_size,
+                                       char *error_buf,
+                                       uint32_t error_buf_size);
+
 /**
  * Set WASI parameters.
  *
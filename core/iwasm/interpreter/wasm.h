@@ -9,6 +9,7 @@
 #include "bh_platform.h"
 #include "bh_hashmap.h"
 #include "bh_assert.h"
+#include "bh_atomic.h"
 #if WASM_ENABLE_GC != 0
 #include "gc_export.h"
 #endif
@@ -628,6 +629,68 @@ typedef struct WASMImport {
     } u;
 } WASMImport;
 
+#if WASM_ENABLE_MIGRATION != 0
+typedef struct WASMTypeStackEntry {
+    /* bytecode offset from WASMFunction.code */
+    uint32 offset;
+    /* offset of the stack in WASMTypeStackTable.stacks */
+    uint32 stack;
+#if WASM_ENABLE_FAST_INTERP != 0
+    /* offset of the same point in WASMFunction.code_compiled */
+    uint32 compiled_offset;
+    /* offset of the enclosing blocks in WASMTypeStackTable.blocks */
+    uint32 blocks;
+#endif
+} WASMTypeStackEntry;
+
+#if WASM_ENABLE_FAST_INTERP != 0
+/* A block in the layout of the classic interpreter's label stack, so that
+   the fast interpreter can write checkpoints compatible with it */
+typedef struct WASMTypeStackBlock {
+    /* bytecode offsets from WASMFunction.code */
+    uint32 begin_offset;
+    uint32 target_offset;
+    /* operand stack cells below the block params */
+    uint32 frame_sp;
+    /* cells copied when branching to the block */
+    uint32 cell_num;
+} WASMTypeStackBlock;
+#endif
+
+/* Operand type stacks of a function, generated by the loader and used to
+   convert the frames into the unified checkpoint format. Each stack in
+   `stacks` is a uint32 value count followed by the cell num of each value
+   from the bottom to the top, and for the fast interpreter, the int16 slot
+   offset of each value from the frame lp. Equal stacks are stored once.
+   Only the safepoints where the interpreters can take a checkpoint have
+   an entry. */
+typedef struct WASMTypeStackTable {
+    /* the stack before each safepoint, i.e. the function entry, the first
+       instruction of each loop body, the instruction following each call
+       and, for the classic interpreter, atomic.wait, sorted by offset */
+    WASMTypeStackEntry *entries;
+    uint32 entry_count;
+    /* the stack at the return address of each call instruction, i.e. the
+       params of the callee are popped and the results are not pushed yet,
+       sorted by offset */
+    WASMTypeStackEntry *return_entries;
+    uint32 return_entry_count;
+    uint8 *stacks;
+    uint32 stacks_size;
+    /* bit i is set if an instruction of the original bytecode starts at
+       offset i, used by the debug helpers */
+    uint8 *instr_starts;
+#if WASM_ENABLE_FAST_INTERP != 0
+    /* each list is a uint32 count followed by the indexes of block_infos
+       from the outermost block, the function block itself is not listed */
+    uint32 *blocks;
+    uint32 blocks_size;
+    WASMTypeStackBlock *block_infos;
+    uint32 block_info_count;
+#endif
+} WASMTypeStackTable;
+#endif
+
 struct WASMFunction {
 #if WASM_ENABLE_CUSTOM_NAME_SECTION != 0
     char *field_name;
@@ -660,6 +723,12 @@ struct WASMFunction {
     uint8 *code_compiled;
     uint8 *consts;
     uint32 const_cell_num;
+    /* Whether the function is translated, set after the fields above, so
+       that a module loaded with lazy translation can translate it on its
+       first call while other threads call it */
+    bh_atomic_32_t is_translated;
+    /* The error of a failed lazy translation, reported by each call */
+    char *translate_error;
 #endif
 
 #if WASM_ENABLE_GC != 0
@@ -698,6 +767,10 @@ struct WASMFunction {
     void *call_to_fast_jit_from_llvm_jit;
 #endif
 #endif
+
+#if WASM_ENABLE_MIGRATION != 0
+    WASMTypeStackTable type_stack_table;
+#endif
 };
 
 #if WASM_ENABLE_TAGS != 0
@@ -1078,6 +1151,13 @@ struct WASMModule {
 
     /* Whether the underlying wasm binary buffer can be freed */
     bool is_binary_freeable;
+
+#if WASM_ENABLE_FAST_INTERP != 0
+    /* Whether the function bodies are translated on their first call
+       rather than at load time, and the lock of translating them */
+    bool is_lazy_translation;
+    korp_mutex translate_lock;
+#endif
 };
 
 typedef struct BlockType {
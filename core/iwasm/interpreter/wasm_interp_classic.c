@@ -12,9 +12,11 @@
 #include "wasm_loader.h"
 #include "wasm_memory.h"
 #include "../common/wasm_exec_env.h"
+#if WASM_ENABLE_MIGRATION != 0
 #include "../migration/wasm_migration.h"
 #include "../migration/wasm_dump.h"
 #include "../migration/wasm_restore.h"
+#endif
 #if WASM_ENABLE_GC != 0
 #include "../common/gc/gc_object.h"
 #include "mem_alloc.h"
@@ -1398,10 +1400,7 @@ wasm_interp_call_func_import(WASMModuleInstance *module_inst,
 #endif /* WASM_ENABLE_DEBUG_INTERP */
 #endif /* WASM_ENABLE_THREAD_MGR */
 
-#if WASM_ENABLE_LABELS_AS_VALUES != 0
-
-#define HANDLE_OP(opcode) HANDLE_##opcode:
-
+#if WASM_ENABLE_MIGRATION != 0
 #define DO_CHECKPOINT()                                                     \
     do {                                                                    \
         SYNC_ALL_TO_FRAME();                                                \
@@ -1409,29 +1408,90 @@ wasm_interp_call_func_import(WASMModuleInstance *module_inst,
         uint32 *dummy_sp;                                                   \
         dummy_ip = frame_ip;                                                \
         dummy_sp = frame_sp;                                                \
-        int rc = wasm_dump(exec_env, module, memory,                        \
-            globals, global_data, global_addr, cur_func,                    \
-            frame, dummy_ip, dummy_sp, frame_csp,                           \
-            frame_ip_end, else_addr, end_addr, maddr, done_flag);           \
-        if (rc < 0) {                                                       \
-            perror("failed to dump\n");                                     \
-            exit(1);                                                        \
+        wasm_migration_stats_begin(WASM_MIGRATION_CHECKPOINT);              \
+        int rc = wasm_dump_stop_threads(exec_env);                          \
+        if (rc == 0)                                                        \
+            rc = wasm_dump(exec_env, module, memory,                        \
+                globals, global_data, global_addr, cur_func,                \
+                frame, dummy_ip, dummy_sp, frame_csp,                       \
+                frame_ip_end, else_addr, end_addr, maddr, done_flag);       \
+        /* process全体へのrequestなら、失敗しない限りここで終了する */      \
+        if (wasm_dump_end_checkpoint(exec_env, rc))                         \
+            goto got_exception;                                             \
+    } while(0)
+
+// forkした子がimageを書き、親はそのまま実行を続ける
+#define DO_SNAPSHOT()                                                       \
+    do {                                                                    \
+        SYNC_ALL_TO_FRAME();                                                \
+        wasm_migration_stats_begin(WASM_MIGRATION_SNAPSHOT);                \
+        if (wasm_dump_stop_threads(exec_env) < 0) {                         \
+            wasm_clear_checkpoint_request(exec_env,                         \
+                                          WASM_CHECKPOINT_REQUEST_SNAPSHOT);\
+            LOG_WARNING("failed to stop threads for snapshot\n");          \
+        }                                                                   \
+        else if (wasm_dump_fork_snapshot(exec_env) == 0) {                  \
+            int rc = wasm_dump(exec_env, module, memory,                    \
+                globals, global_data, global_addr, cur_func,                \
+                frame, frame_ip, frame_sp, frame_csp,                       \
+                frame_ip_end, else_addr, end_addr, maddr, done_flag);       \
+            wasm_migration_stats_end(rc == 0);                              \
+            _exit(rc < 0 ? 1 : 0);                                          \
+        }                                                                   \
+        wasm_dump_resume_threads(exec_env);                                 \
+    } while (0)
+
+#if WASM_ENABLE_THREAD_MGR != 0
+// mainのthreadのcheckpointのために止まる
+#define DO_PARK()                                                           \
+    do {                                                                    \
+        SYNC_ALL_TO_FRAME();                                                \
+        wasm_dump_park_thread(exec_env, module, globals, global_data,       \
+                              cur_func, frame, frame_ip);                   \
+    } while (0)
+#else
+#define DO_PARK() (void)0
+#endif
+
+#define DO_PRECOPY()                                                        \
+    do {                                                                    \
+        wasm_clear_checkpoint_request(exec_env,                             \
+                                      WASM_CHECKPOINT_REQUEST_PRECOPY);     \
+        if (memory && wasm_dump_precopy(memory) < 0) {                      \
+            LOG_WARNING("failed to dump pre-copy image\n");                 \
         }                                                                   \
-        LOG_DEBUG("dispatch_count: %d\n", dispatch_count);                  \
-        exit(0);                                                            \
-    } while(0)                                                              
+    } while (0)
 
+// checkpointのrequestはexec_envのsuspend_flagsで届く
+// loopの先頭, call, returnでだけ確認し、それ以外の命令のdispatchには何も足さない
 #define CHECK_DUMP()                                                        \
-    if (wasm_get_checkpoint()) {                                            \
-        DO_CHECKPOINT();                                                    \
-    }
+    do {                                                                    \
+        if (WASM_SUSPEND_FLAGS_GET(exec_env->suspend_flags)                 \
+            & WASM_SUSPEND_FLAG_CHECKPOINT) {                               \
+            WASM_SUSPEND_FLAGS_FETCH_AND(exec_env->suspend_flags,           \
+                                         ~WASM_SUSPEND_FLAG_CHECKPOINT);    \
+            if (!wasm_dump_is_primary(exec_env))                            \
+                DO_PARK();                                                  \
+            else if (wasm_get_checkpoint_request(exec_env)                  \
+                     & WASM_CHECKPOINT_REQUEST_FINAL)                       \
+                DO_CHECKPOINT();                                            \
+            else if (wasm_get_checkpoint_request(exec_env)                  \
+                     & WASM_CHECKPOINT_REQUEST_SNAPSHOT)                    \
+                DO_SNAPSHOT();                                              \
+            else if (wasm_get_checkpoint_request(exec_env)                  \
+                     & WASM_CHECKPOINT_REQUEST_PRECOPY)                     \
+                DO_PRECOPY();                                               \
+        }                                                                   \
+    } while (0)
+#else
+#define CHECK_DUMP() (void)0
+#endif
+
+#if WASM_ENABLE_LABELS_AS_VALUES != 0
+
+#define HANDLE_OP(opcode) HANDLE_##opcode:
 
-// #define FETCH_OPCODE_AND_DISPATCH() goto *handle_table[*frame_ip++]
-#define FETCH_OPCODE_AND_DISPATCH()                                     \
-do {                                                                    \
-    CHECK_DUMP()                                                        \
-    goto *handle_table[*frame_ip++];                                    \
-} while(0);
+#define FETCH_OPCODE_AND_DISPATCH() goto *handle_table[*frame_ip++]
 
 #if WASM_ENABLE_THREAD_MGR != 0 && WASM_ENABLE_DEBUG_INTERP != 0
 #define HANDLE_OP_END()                                                   \
@@ -1447,7 +1507,6 @@ do {                                                                    \
             wasm_cluster_thread_waiting_run(exec_env);                    \
         }                                                                 \
         os_mutex_unlock(&exec_env->wait_lock);                            \
-        CHECK_DUMP();                                                     \
         goto *handle_table[*frame_ip++];                                  \
     } while (0)
 #else
@@ -1486,18 +1545,9 @@ get_global_addr(uint8 *global_data, WASMGlobalInstance *global)
 #endif
 }
 
-static void clear_refs() {
-    int fd;
-    char *v = "4";
-
-    fd = open("/proc/self/clear_refs", O_WRONLY);
-    if (write(fd, v, 3) < 3) {
-        perror("Can't clear soft-dirty bit");
-    }
-    close(fd);
-}
-
+#if WASM_ENABLE_MIGRATION != 0
 bool done_flag = false;
+#endif
 
 static void
 wasm_interp_call_func_bytecode(WASMModuleInstance *module,
@@ -1596,26 +1646,27 @@ wasm_interp_call_func_bytecode(WASMModuleInstance *module,
 #undef HANDLE_OPCODE
 #endif
 
-#if BH_PLATFORM_LINUX == 1
-    // Clear soft-dirty bit
-    clear_refs();
-#endif
+#if WASM_ENABLE_MIGRATION != 0
+    // SIGINTなどのcheckpointのrequestをこのexec_envのsuspend_flagsで受け取る
+    wasm_dump_register_exec_env(exec_env);
 
-    // リストアの初期化時間の計測(終了)
-    struct timespec ts1;
-    clock_gettime(CLOCK_MONOTONIC, &ts1);
-    fprintf(stderr, "boot_end, %lu\n", (uint64_t)(ts1.tv_sec*1e9) + ts1.tv_nsec);
-
-    if (get_restore_flag()) {
+    // restoreを指定されたinstance, mainのthread, またはimageからrespawnされたthreadのframeを戻す
+    if (wasm_restore_begin_instance(exec_env) || get_restore_flag()
+        || wasm_restore_begin_thread(exec_env)) {
         // bool done_flag;
         int rc;
-        struct timespec ts2;
+        struct timespec ts1, ts2;
+
+        set_restore_flag(false);
 
+        wasm_migration_stats_begin(WASM_MIGRATION_RESTORE);
         clock_gettime(CLOCK_MONOTONIC, &ts1);
         frame = wasm_restore_stack(&exec_env);
         clock_gettime(CLOCK_MONOTONIC, &ts2);
-        fprintf(stderr, "stack, %lu\n", get_time(ts1, ts2));
+        wasm_migration_stats_phase(WASM_MIGRATION_PHASE_STACK,
+                                   get_time(ts1, ts2));
         if (frame == NULL) {
+            wasm_migration_stats_end(false);
             perror("Error:wasm_interp_func_bytecode:frame is NULL\n");
             return;
         }
@@ -1653,6 +1704,7 @@ wasm_interp_call_func_bytecode(WASMModuleInstance *module,
         UPDATE_ALL_FROM_FRAME();
         FETCH_OPCODE_AND_DISPATCH();
     }
+#endif
 
 #if WASM_ENABLE_LABELS_AS_VALUES == 0
     while (frame_ip < frame_ip_end) {
@@ -2111,6 +2163,7 @@ wasm_interp_call_func_bytecode(WASMModuleInstance *module,
                 cell_num = 0;
             handle_op_loop:
                 PUSH_CSP(LABEL_TYPE_LOOP, param_cell_num, cell_num, frame_ip);
+                CHECK_DUMP();
                 HANDLE_OP_END();
             }
 
@@ -2217,6 +2270,10 @@ wasm_interp_call_func_bytecode(WASMModuleInstance *module,
                     }
                     frame_ip = end_addr;
                 }
+                /* a branch to a loop lands on the start of its body, the
+                   other targets are not safepoints */
+                if (frame_ip == (frame_csp - 1)->begin_addr)
+                    CHECK_DUMP();
                 HANDLE_OP_END();
             }
 
@@ -5990,6 +6047,11 @@ wasm_interp_call_func_bytecode(WASMModuleInstance *module,
                 mem_offset_t offset = 0, addr;
                 uint32 align = 0;
                 uint32 opcode1;
+#if WASM_ENABLE_MIGRATION != 0
+                /* the wait opcodes are executed again after a checkpoint */
+                uint8 *opcode_ip = frame_ip - 1;
+                uint32 *opcode_sp = frame_sp;
+#endif
 
                 read_leb_uint32(frame_ip, frame_ip_end, opcode1);
                 /* opcode1 was checked in loader and is no larger than
@@ -6036,6 +6098,14 @@ wasm_interp_call_func_bytecode(WASMModuleInstance *module,
                             (uint64)expect, timeout, false);
                         if (ret == (uint32)-1)
                             goto got_exception;
+#if WASM_ENABLE_MIGRATION != 0
+                        if (ret == WASM_ATOMIC_WAIT_INTERRUPTED) {
+                            frame_ip = opcode_ip;
+                            frame_sp = opcode_sp;
+                            CHECK_DUMP();
+                            HANDLE_OP_END();
+                        }
+#endif
 
 #if WASM_ENABLE_THREAD_MGR != 0
                         CHECK_SUSPEND_FLAGS();
@@ -6060,6 +6130,14 @@ wasm_interp_call_func_bytecode(WASMModuleInstance *module,
                             timeout, true);
                         if (ret == (uint32)-1)
                             goto got_exception;
+#if WASM_ENABLE_MIGRATION != 0
+                        if (ret == WASM_ATOMIC_WAIT_INTERRUPTED) {
+                            frame_ip = opcode_ip;
+                            frame_sp = opcode_sp;
+                            CHECK_DUMP();
+                            HANDLE_OP_END();
+                        }
+#endif
 
 #if WASM_ENABLE_THREAD_MGR != 0
                         CHECK_SUSPEND_FLAGS();
@@ -6424,6 +6502,19 @@ wasm_interp_call_func_bytecode(WASMModuleInstance *module,
         HANDLE_OP(EXT_OP_COPY_STACK_TOP)
         HANDLE_OP(EXT_OP_COPY_STACK_TOP_I64)
         HANDLE_OP(EXT_OP_COPY_STACK_VALUES)
+        HANDLE_OP(EXT_OP_I32_EQZ_BR_IF)
+        HANDLE_OP(EXT_OP_I32_EQ_BR_IF)
+        HANDLE_OP(EXT_OP_I32_NE_BR_IF)
+        HANDLE_OP(EXT_OP_I32_LT_S_BR_IF)
+        HANDLE_OP(EXT_OP_I32_LT_U_BR_IF)
+        HANDLE_OP(EXT_OP_I32_GT_S_BR_IF)
+        HANDLE_OP(EXT_OP_I32_GT_U_BR_IF)
+        HANDLE_OP(EXT_OP_I32_LE_S_BR_IF)
+        HANDLE_OP(EXT_OP_I32_LE_U_BR_IF)
+        HANDLE_OP(EXT_OP_I32_GE_S_BR_IF)
+        HANDLE_OP(EXT_OP_I32_GE_U_BR_IF)
+        HANDLE_OP(EXT_OP_I32_ADD_TEE_LOCAL_FAST)
+        HANDLE_OP(EXT_OP_I32_SUB_TEE_LOCAL_FAST)
         {
             wasm_set_exception(module, "unsupported opcode");
             goto got_exception;
@@ -6678,6 +6769,7 @@ wasm_interp_call_func_bytecode(WASMModuleInstance *module,
 #if WASM_ENABLE_THREAD_MGR != 0
         CHECK_SUSPEND_FLAGS();
 #endif
+        CHECK_DUMP();
         HANDLE_OP_END();
     }
 
@@ -6699,6 +6791,7 @@ wasm_interp_call_func_bytecode(WASMModuleInstance *module,
             goto find_a_catch_handler;
         }
 #endif
+        CHECK_DUMP();
         HANDLE_OP_END();
     }
 
@@ -7329,6 +7422,14 @@ wasm_interp_call_wasm(WASMModuleInstance *module_inst, WASMExecEnv *exec_env,
         }
     }
     else {
+#if WASM_ENABLE_MIGRATION != 0
+        // jitted codeはframeを戻せないので、--restoreで最初からやり直さない
+        if (running_mode != Mode_Interp && get_restore_flag()) {
+            wasm_set_exception(module_inst,
+                               "restore is not supported in JIT mode");
+        }
+        else
+#endif
         if (running_mode == Mode_Interp) {
             wasm_interp_call_func_bytecode(module_inst, exec_env, function,
                                            frame);
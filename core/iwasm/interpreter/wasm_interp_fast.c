@@ -20,6 +20,11 @@
 #if WASM_ENABLE_SHARED_MEMORY != 0
 #include "../common/wasm_shared_memory.h"
 #endif
+#if WASM_ENABLE_MIGRATION != 0
+#include "../migration/wasm_migration.h"
+#include "../migration/wasm_dump.h"
+#include "../migration/wasm_restore.h"
+#endif
 
 typedef int32 CellType_I32;
 typedef int64 CellType_I64;
@@ -554,6 +559,17 @@ wasm_interp_get_frame_ref(WASMInterpFrame *frame)
         frame_ip += 6;                                               \
     } while (0)
 
+/* Compare and br_if fused by the loader. The label and the condition of
+   br_if are skipped, the result of the compare is only read by br_if so it
+   is not stored */
+#define DEF_OP_CMP_BR_IF(src_type, src_op_type, cond_op)           \
+    do {                                                           \
+        cond = GET_OPERAND(src_type, src_op_type, 2)               \
+            cond_op GET_OPERAND(src_type, src_op_type, 0);         \
+        frame_ip += 6 + LABEL_SIZE + 2;                            \
+        goto br_if_cond;                                           \
+    } while (0)
+
 #define DEF_OP_BIT_COUNT(src_type, src_op_type, operation)               \
     do {                                                                 \
         SET_OPERAND(                                                     \
@@ -1257,6 +1273,39 @@ wasm_interp_call_func_native(WASMModuleInstance *module_inst,
     wasm_exec_env_set_cur_frame(exec_env, prev_frame);
 }
 
+/* The consts of a function are put before its locals in its frame, so the
+   caller needs the count to pass the arguments. It is known only after the
+   function is translated. */
+static inline uint32
+get_const_cell_num(const WASMFunctionInstance *func)
+{
+    return func->is_import_func ? 0 : func->u.func->const_cell_num;
+}
+
+/* Translate the function on its first call if func_module_inst was loaded
+   with lazy translation, and throw the error of translation to module_inst
+   if it fails */
+static inline bool
+translate_function(WASMModuleInstance *module_inst,
+                   WASMModuleInstance *func_module_inst,
+                   WASMFunctionInstance *func)
+{
+    char error_buf[128];
+
+    if (func->is_import_func || BH_ATOMIC_32_LOAD(func->u.func->is_translated))
+        return true;
+
+    if (!wasm_loader_translate_function(
+            func_module_inst->module,
+            (uint32)(func - func_module_inst->e->functions)
+                - func_module_inst->module->import_function_count,
+            error_buf, sizeof(error_buf))) {
+        wasm_set_exception(module_inst, error_buf);
+        return false;
+    }
+    return true;
+}
+
 #if WASM_ENABLE_MULTI_MODULE != 0
 static void
 wasm_interp_call_func_bytecode(WASMModuleInstance *module,
@@ -1295,6 +1344,9 @@ wasm_interp_call_func_import(WASMModuleInstance *module_inst,
         return;
     }
 
+    if (!translate_function(module_inst, sub_module_inst, sub_func_inst))
+        return;
+
     /* Switch exec_env but keep using the same one by replacing necessary
      * variables */
     sub_module_exec_env = wasm_runtime_get_exec_env_singleton(
@@ -1361,20 +1413,56 @@ DEFINE_GOTO_TABLE(OpcodeInfo, opcode_table);
 #undef HANDLE_OPCODE
 /* clang-format on */
 
+/* Count of each pair of handlers executed one after the other, the hot
+   pairs are the candidates of the superinstructions, see
+   wasm_loader_fuse_label */
+#define OPCODE_PAIR_DUMP_NUM 32
+static uint64 opcode_pair_count[WASM_INSTRUCTION_NUM][WASM_INSTRUCTION_NUM];
+static uint8 last_opcode = WASM_OP_NOP;
+
+static void
+wasm_interp_dump_op_pair_count(uint64 total_count)
+{
+    uint32 i, j, n, max_i, max_j;
+    uint64 max;
+
+    os_printf("hot opcode pairs:\n");
+    for (n = 0; n < OPCODE_PAIR_DUMP_NUM; n++) {
+        max = 0;
+        max_i = max_j = 0;
+        for (i = 0; i < WASM_INSTRUCTION_NUM; i++)
+            for (j = 0; j < WASM_INSTRUCTION_NUM; j++)
+                if (opcode_pair_count[i][j] > max) {
+                    max = opcode_pair_count[i][j];
+                    max_i = i;
+                    max_j = j;
+                }
+        if (max == 0)
+            break;
+        os_printf("\t\t%s -> %s count:\t\t%ld,\t\t%.2f%%\n",
+                  opcode_table[max_i].name, opcode_table[max_j].name, max,
+                  max * 100.0f / total_count);
+        /* clear it so that the next one is found, the dump is the last
+           use of the counts */
+        opcode_pair_count[max_i][max_j] = 0;
+    }
+}
+
 static void
 wasm_interp_dump_op_count()
 {
     uint32 i;
     uint64 total_count = 0;
-    for (i = 0; i < WASM_OP_IMPDEP; i++)
+    for (i = 0; i < WASM_INSTRUCTION_NUM; i++)
         total_count += opcode_table[i].count;
 
     os_printf("total opcode count: %ld\n", total_count);
-    for (i = 0; i < WASM_OP_IMPDEP; i++)
+    for (i = 0; i < WASM_INSTRUCTION_NUM; i++)
         if (opcode_table[i].count > 0)
             os_printf("\t\t%s count:\t\t%ld,\t\t%.2f%%\n", opcode_table[i].name,
                       opcode_table[i].count,
                       opcode_table[i].count * 100.0f / total_count);
+    wasm_interp_dump_op_pair_count(total_count);
 }
 #endif
 
@@ -1382,10 +1470,14 @@ wasm_interp_dump_op_count()
 
 /* #define HANDLE_OP(opcode) HANDLE_##opcode:printf(#opcode"\n"); */
 #if WASM_ENABLE_OPCODE_COUNTER != 0
-#define HANDLE_OP(opcode) HANDLE_##opcode : opcode_table[opcode].count++;
+#define HANDLE_OP(opcode)                         \
+    HANDLE_##opcode : opcode_table[opcode].count++; \
+    opcode_pair_count[last_opcode][opcode]++;       \
+    last_opcode = opcode;
 #else
 #define HANDLE_OP(opcode) HANDLE_##opcode:
 #endif
+
 #if WASM_CPU_SUPPORTS_UNALIGNED_ADDR_ACCESS != 0
 #define FETCH_OPCODE_AND_DISPATCH()                    \
     do {                                               \
@@ -1418,6 +1510,14 @@ wasm_interp_dump_op_count()
 #endif /* end of WASM_CPU_SUPPORTS_UNALIGNED_ADDR_ACCESS */
 #define HANDLE_OP_END() FETCH_OPCODE_AND_DISPATCH()
 
+/* Size of the label of a compiled instruction, a superinstruction skips
+   the label of its second instruction and runs the body of it directly */
+#if WASM_CPU_SUPPORTS_UNALIGNED_ADDR_ACCESS != 0
+#define LABEL_SIZE sizeof(void *)
+#else
+#define LABEL_SIZE sizeof(int32)
+#endif
+
 #else /* else of WASM_ENABLE_LABELS_AS_VALUES */
 
 #define HANDLE_OP(opcode) case opcode:
@@ -1425,6 +1525,98 @@ wasm_interp_dump_op_count()
 
 #endif /* end of WASM_ENABLE_LABELS_AS_VALUES */
 
+#if WASM_ENABLE_MIGRATION != 0
+#define DO_CHECKPOINT()                                                     \
+    do {                                                                    \
+        SYNC_ALL_TO_FRAME();                                                \
+        wasm_migration_stats_begin(WASM_MIGRATION_CHECKPOINT);              \
+        int rc = wasm_dump_stop_threads(exec_env);                          \
+        if (rc == 0)                                                        \
+            rc = wasm_dump(exec_env, module, memory, globals, global_data,  \
+                           global_addr, cur_func, frame, frame_ip, NULL,    \
+                           NULL, frame_ip_end, NULL, NULL, maddr, false);   \
+        if (wasm_dump_end_checkpoint(exec_env, rc))                         \
+            goto got_exception;                                             \
+    } while (0)
+
+#define DO_SNAPSHOT()                                                       \
+    do {                                                                    \
+        SYNC_ALL_TO_FRAME();                                                \
+        wasm_migration_stats_begin(WASM_MIGRATION_SNAPSHOT);                \
+        if (wasm_dump_stop_threads(exec_env) < 0) {                         \
+            wasm_clear_checkpoint_request(exec_env,                         \
+                                          WASM_CHECKPOINT_REQUEST_SNAPSHOT);\
+            LOG_WARNING("failed to stop threads for snapshot\n");          \
+        }                                                                   \
+        else if (wasm_dump_fork_snapshot(exec_env) == 0) {                  \
+            int rc = wasm_dump(exec_env, module, memory, globals,           \
+                               global_data, global_addr, cur_func, frame,   \
+                               frame_ip, NULL, NULL, frame_ip_end, NULL,    \
+                               NULL, maddr, false);                         \
+            wasm_migration_stats_end(rc == 0);                              \
+            _exit(rc < 0 ? 1 : 0);                                          \
+        }                                                                   \
+        wasm_dump_resume_threads(exec_env);                                 \
+    } while (0)
+
+#if WASM_ENABLE_THREAD_MGR != 0
+// mainのthreadのcheckpointのために止まる
+#define DO_PARK()                                                           \
+    do {                                                                    \
+        SYNC_ALL_TO_FRAME();                                                \
+        wasm_dump_park_thread(exec_env, module, globals, global_data,       \
+                              cur_func, frame, frame_ip);                   \
+    } while (0)
+#else
+#define DO_PARK() (void)0
+#endif
+
+#define DO_PRECOPY()                                                        \
+    do {                                                                    \
+        wasm_clear_checkpoint_request(exec_env,                             \
+                                      WASM_CHECKPOINT_REQUEST_PRECOPY);     \
+        if (memory && wasm_dump_precopy(memory) < 0) {                      \
+            LOG_WARNING("failed to dump pre-copy image\n");                 \
+        }                                                                   \
+    } while (0)
+
+/* Like the classic interpreter, checkpoint requests are only polled at
+   the taken branches, calls and returns, the dispatch of the other opcodes
+   stays untouched. The final checkpoint, the snapshot and the parking of
+   the other threads of the cluster wait until the frame is at a safepoint
+   recorded by the loader, e.g. a branch to a loop rather than to the end
+   of a block, and raise the flag again until then. */
+#define CHECK_DUMP()                                                        \
+    do {                                                                    \
+        if (WASM_SUSPEND_FLAGS_GET(exec_env->suspend_flags)                 \
+            & WASM_SUSPEND_FLAG_CHECKPOINT) {                               \
+            bool primary = wasm_dump_is_primary(exec_env);                  \
+            uint32 request;                                                 \
+            WASM_SUSPEND_FLAGS_FETCH_AND(exec_env->suspend_flags,           \
+                                         ~WASM_SUSPEND_FLAG_CHECKPOINT);    \
+            request = primary ? wasm_get_checkpoint_request(exec_env) : 0;  \
+            if (primary                                                     \
+                && !(request                                                \
+                     & (WASM_CHECKPOINT_REQUEST_FINAL                       \
+                        | WASM_CHECKPOINT_REQUEST_SNAPSHOT))) {             \
+                if (request & WASM_CHECKPOINT_REQUEST_PRECOPY)              \
+                    DO_PRECOPY();                                           \
+            }                                                               \
+            else if (!wasm_dump_is_safepoint(cur_func, frame_ip))           \
+                WASM_SUSPEND_FLAGS_FETCH_OR(exec_env->suspend_flags,        \
+                                            WASM_SUSPEND_FLAG_CHECKPOINT);  \
+            else if (!primary)                                              \
+                DO_PARK();                                                  \
+            else if (request & WASM_CHECKPOINT_REQUEST_FINAL)               \
+                DO_CHECKPOINT();                                            \
+            else                                                            \
+                DO_SNAPSHOT();                                              \
+        }                                                                   \
+    } while (0)
+#else
+#define CHECK_DUMP() (void)0
+#endif
+
 #if WASM_ENABLE_LABELS_AS_VALUES != 0
 static void **global_handle_table;
 #endif
@@ -1527,6 +1719,57 @@ wasm_interp_call_func_bytecode(WASMModuleInstance *module,
     }
 #endif
 
+#if WASM_ENABLE_MIGRATION != 0
+    // checkpointを取るのはmainのthreadだけ
+    wasm_dump_register_exec_env(exec_env);
+
+    if (wasm_restore_begin_instance(exec_env) || get_restore_flag()
+        || wasm_restore_begin_thread(exec_env)) {
+        int ret;
+        struct timespec ts1, ts2;
+
+        // 入れ子の呼び出しで再びrestoreしないように
+        set_restore_flag(false);
+
+        wasm_migration_stats_begin(WASM_MIGRATION_RESTORE);
+        clock_gettime(CLOCK_MONOTONIC, &ts1);
+        frame = wasm_restore_stack(&exec_env);
+        clock_gettime(CLOCK_MONOTONIC, &ts2);
+        wasm_migration_stats_phase(WASM_MIGRATION_PHASE_STACK,
+                                   get_time(ts1, ts2));
+        if (frame == NULL) {
+            wasm_migration_stats_end(false);
+            perror("Error:wasm_interp_func_bytecode:frame is NULL\n");
+            return;
+        }
+
+        cur_func = frame->function;
+        prev_frame = frame->prev_frame;
+
+        uint8 *dummy_ip;
+        ret = wasm_restore(&module, &exec_env, &cur_func, &prev_frame, &memory,
+                           &globals, &global_data, &global_addr, &frame,
+                           &dummy_ip, NULL, NULL, NULL, &frame_ip_end, NULL,
+                           NULL, &maddr, NULL);
+        if (ret < 0) {
+            perror("failed to restore\n");
+            return;
+        }
+        frame->ip = dummy_ip;
+#if !defined(OS_ENABLE_HW_BOUND_CHECK)              \
+    || WASM_CPU_SUPPORTS_UNALIGNED_ADDR_ACCESS == 0 \
+    || WASM_ENABLE_BULK_MEMORY != 0
+        if (memory)
+            linear_mem_size = get_linear_mem_size();
+#endif
+
+        RECOVER_CONTEXT(frame);
+#if WASM_ENABLE_LABELS_AS_VALUES != 0
+        HANDLE_OP_END();
+#endif
+    }
+#endif
+
 #if WASM_ENABLE_LABELS_AS_VALUES == 0
     while (frame_ip < frame_ip_end) {
         opcode = *frame_ip++;
@@ -1577,15 +1820,19 @@ wasm_interp_call_func_bytecode(WASMModuleInstance *module,
 #endif
             recover_br_info:
                 RECOVER_BR_INFO();
+                CHECK_DUMP();
                 HANDLE_OP_END();
             }
 
             HANDLE_OP(WASM_OP_BR_IF)
             {
+                cond = frame_lp[GET_OFFSET()];
+#if WASM_ENABLE_LABELS_AS_VALUES != 0
+            br_if_cond:
+#endif
 #if WASM_ENABLE_THREAD_MGR != 0
                 CHECK_SUSPEND_FLAGS();
 #endif
-                cond = frame_lp[GET_OFFSET()];
 
                 if (cond)
                     goto recover_br_info;
@@ -3444,6 +3691,9 @@ wasm_interp_call_func_bytecode(WASMModuleInstance *module,
             HANDLE_OP(EXT_OP_SET_LOCAL_FAST)
             HANDLE_OP(EXT_OP_TEE_LOCAL_FAST)
             {
+#if WASM_ENABLE_LABELS_AS_VALUES != 0
+            tee_local_fast:
+#endif
                 /* clang-format off */
 #if WASM_CPU_SUPPORTS_UNALIGNED_ADDR_ACCESS != 0
                 local_offset = *frame_ip++;
@@ -3951,6 +4201,80 @@ wasm_interp_call_func_bytecode(WASMModuleInstance *module,
                 HANDLE_OP_END();
             }
 
+#if WASM_ENABLE_LABELS_AS_VALUES != 0
+            /* superinstructions, see wasm_loader_fuse_label */
+            HANDLE_OP(EXT_OP_I32_EQZ_BR_IF)
+            {
+                cond = GET_OPERAND(int32, I32, 0) == 0;
+                frame_ip += 4 + LABEL_SIZE + 2;
+                goto br_if_cond;
+            }
+
+            HANDLE_OP(EXT_OP_I32_EQ_BR_IF)
+            {
+                DEF_OP_CMP_BR_IF(uint32, I32, ==);
+            }
+
+            HANDLE_OP(EXT_OP_I32_NE_BR_IF)
+            {
+                DEF_OP_CMP_BR_IF(uint32, I32, !=);
+            }
+
+            HANDLE_OP(EXT_OP_I32_LT_S_BR_IF)
+            {
+                DEF_OP_CMP_BR_IF(int32, I32, <);
+            }
+
+            HANDLE_OP(EXT_OP_I32_LT_U_BR_IF)
+            {
+                DEF_OP_CMP_BR_IF(uint32, I32, <);
+            }
+
+            HANDLE_OP(EXT_OP_I32_GT_S_BR_IF)
+            {
+                DEF_OP_CMP_BR_IF(int32, I32, >);
+            }
+
+            HANDLE_OP(EXT_OP_I32_GT_U_BR_IF)
+            {
+                DEF_OP_CMP_BR_IF(uint32, I32, >);
+            }
+
+            HANDLE_OP(EXT_OP_I32_LE_S_BR_IF)
+            {
+                DEF_OP_CMP_BR_IF(int32, I32, <=);
+            }
+
+            HANDLE_OP(EXT_OP_I32_LE_U_BR_IF)
+            {
+                DEF_OP_CMP_BR_IF(uint32, I32, <=);
+            }
+
+            HANDLE_OP(EXT_OP_I32_GE_S_BR_IF)
+            {
+                DEF_OP_CMP_BR_IF(int32, I32, >=);
+            }
+
+            HANDLE_OP(EXT_OP_I32_GE_U_BR_IF)
+            {
+                DEF_OP_CMP_BR_IF(uint32, I32, >=);
+            }
+
+            HANDLE_OP(EXT_OP_I32_ADD_TEE_LOCAL_FAST)
+            {
+                DEF_OP_NUMERIC(uint32, uint32, I32, +);
+                frame_ip += LABEL_SIZE;
+                goto tee_local_fast;
+            }
+
+            HANDLE_OP(EXT_OP_I32_SUB_TEE_LOCAL_FAST)
+            {
+                DEF_OP_NUMERIC(uint32, uint32, I32, -);
+                frame_ip += LABEL_SIZE;
+                goto tee_local_fast;
+            }
+#endif /* end of WASM_ENABLE_LABELS_AS_VALUES != 0 */
+
             /* comparison instructions of i64 */
             HANDLE_OP(WASM_OP_I64_EQZ)
             {
@@ -5758,6 +6082,9 @@ wasm_interp_call_func_bytecode(WASMModuleInstance *module,
         uint32 *lp_base = NULL, *lp = NULL;
         int i;
 
+        if (!translate_function(module, module, cur_func))
+            goto got_exception;
+
         if (cur_func->param_cell_num > 0
             && !(lp_base = lp = wasm_runtime_malloc(cur_func->param_cell_num
                                                     * sizeof(uint32)))) {
@@ -5778,7 +6105,7 @@ wasm_interp_call_func_bytecode(WASMModuleInstance *module,
                 lp++;
             }
         }
-        frame->lp = frame->operand + cur_func->const_cell_num;
+        frame->lp = frame->operand + get_const_cell_num(cur_func);
         if (lp - lp_base > 0) {
             word_copy(frame->lp, lp_base, lp - lp_base);
         }
@@ -5800,15 +6127,22 @@ wasm_interp_call_func_bytecode(WASMModuleInstance *module,
 
 #if WASM_ENABLE_MULTI_MODULE != 0
         if (cur_func->is_import_func) {
+            if (cur_func->import_func_inst
+                && !translate_function(module, cur_func->import_module_inst,
+                                       cur_func->import_func_inst))
+                goto got_exception;
             outs_area->lp = outs_area->operand
                             + (cur_func->import_func_inst
-                                   ? cur_func->import_func_inst->const_cell_num
+                                   ? get_const_cell_num(
+                                       cur_func->import_func_inst)
                                    : 0);
         }
         else
 #endif
         {
-            outs_area->lp = outs_area->operand + cur_func->const_cell_num;
+            if (!translate_function(module, module, cur_func))
+                goto got_exception;
+            outs_area->lp = outs_area->operand + get_const_cell_num(cur_func);
         }
 
         if ((uint8 *)(outs_area->lp + cur_func->param_cell_num)
@@ -5916,7 +6250,8 @@ wasm_interp_call_func_bytecode(WASMModuleInstance *module,
             cell_num_of_local_stack = cur_func->param_cell_num
                                       + cur_func->local_cell_num
                                       + cur_wasm_func->max_stack_cell_num;
-            all_cell_num = cur_func->const_cell_num + cell_num_of_local_stack;
+            all_cell_num =
+                cur_wasm_func->const_cell_num + cell_num_of_local_stack;
 #if WASM_ENABLE_GC != 0
             /* area of frame_ref */
             all_cell_num += (cell_num_of_local_stack + 3) / 4;
@@ -5982,6 +6317,7 @@ wasm_interp_call_func_bytecode(WASMModuleInstance *module,
 #if WASM_ENABLE_THREAD_MGR != 0
         CHECK_SUSPEND_FLAGS();
 #endif
+        CHECK_DUMP();
         HANDLE_OP_END();
     }
 
@@ -5998,6 +6334,7 @@ wasm_interp_call_func_bytecode(WASMModuleInstance *module,
 #if WASM_ENABLE_GC != 0
         local_cell_num = cur_func->param_cell_num + cur_func->local_cell_num;
 #endif
+        CHECK_DUMP();
         HANDLE_OP_END();
     }
 
@@ -6113,6 +6450,9 @@ wasm_interp_call_wasm(WASMModuleInstance *module_inst, WASMExecEnv *exec_env,
     }
     argc = function->param_cell_num;
 
+    if (!translate_function(module_inst, module_inst, function))
+        return;
+
 #if defined(OS_ENABLE_HW_BOUND_CHECK) && WASM_DISABLE_STACK_HW_BOUND_CHECK == 0
     /*
      * wasm_runtime_detect_native_stack_overflow is done by
@@ -6140,7 +6480,7 @@ wasm_interp_call_wasm(WASMModuleInstance *module_inst, WASMExecEnv *exec_env,
 #endif
     frame->ret_offset = 0;
 
-    if ((uint8 *)(outs_area->operand + function->const_cell_num + argc)
+    if ((uint8 *)(outs_area->operand + get_const_cell_num(function) + argc)
         > exec_env->wasm_stack.top_boundary) {
         wasm_set_exception((WASMModuleInstance *)exec_env->module_inst,
                            "wasm operand stack overflow");
@@ -6148,7 +6488,8 @@ wasm_interp_call_wasm(WASMModuleInstance *module_inst, WASMExecEnv *exec_env,
     }
 
     if (argc > 0)
-        word_copy(outs_area->operand + function->const_cell_num, argv, argc);
+        word_copy(outs_area->operand + get_const_cell_num(function), argv,
+                  argc);
 
     wasm_exec_env_set_cur_frame(exec_env, frame);
 
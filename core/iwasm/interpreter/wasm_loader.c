@@ -5762,9 +5762,37 @@ compile_jit_functions(WASMModule *module, char *error_buf,
 }
 #endif /* end of WASM_ENABLE_FAST_JIT != 0 || WASM_ENABLE_JIT != 0 */
 
+/* The flags of the module that wasm_loader_prepare_bytecode sets, they are
+   collected by the caller and ORed into the module with merge_module_flags,
+   so that the functions can be prepared by several threads */
+typedef struct WASMModuleFlags {
+    bool possible_memory_grow;
+#if WASM_ENABLE_WAMR_COMPILER != 0
+    bool is_simd_used;
+    bool is_ref_types_used;
+    bool is_bulk_memory_used;
+#endif
+} WASMModuleFlags;
+
+static void
+merge_module_flags(WASMModule *module, const WASMModuleFlags *flags)
+{
+    if (flags->possible_memory_grow)
+        module->possible_memory_grow = true;
+#if WASM_ENABLE_WAMR_COMPILER != 0
+    if (flags->is_simd_used)
+        module->is_simd_used = true;
+    if (flags->is_ref_types_used)
+        module->is_ref_types_used = true;
+    if (flags->is_bulk_memory_used)
+        module->is_bulk_memory_used = true;
+#endif
+}
+
 static bool
 wasm_loader_prepare_bytecode(WASMModule *module, WASMFunction *func,
-                             uint32 cur_func_idx, char *error_buf,
+                             uint32 cur_func_idx,
+                             WASMModuleFlags *module_flags, char *error_buf,
                              uint32 error_buf_size);
 
 #if WASM_ENABLE_FAST_INTERP != 0 && WASM_ENABLE_LABELS_AS_VALUES != 0
@@ -5774,9 +5802,198 @@ wasm_interp_get_handle_table();
 static void **handle_table;
 #endif
 
+#if WASM_ENABLE_FAST_INTERP != 0 && WASM_ENABLE_GC == 0
+/* Validate and translate the function bodies on a pool of threads. Each
+   function gets its own loader context, and each worker collects the module
+   flags set by wasm_loader_prepare_bytecode in its own WASMModuleFlags, so
+   the module isn't written until the workers are joined. The reftype set
+   of GC is shared by the functions, so GC modules are prepared serially. */
+typedef struct PrepareBytecodeContext {
+    WASMModule *module;
+    korp_mutex lock;
+    uint32 next_func;
+    /* The flags of all the workers, ORed in when each of them finishes */
+    WASMModuleFlags flags;
+    /* The failed function with the smallest index and its error, which is
+       the error that the serial loop reports */
+    uint32 failed_func;
+    char error_buf[128];
+} PrepareBytecodeContext;
+
+static void
+or_module_flags(WASMModuleFlags *dst, const WASMModuleFlags *src)
+{
+    dst->possible_memory_grow |= src->possible_memory_grow;
+#if WASM_ENABLE_WAMR_COMPILER != 0
+    dst->is_simd_used |= src->is_simd_used;
+    dst->is_ref_types_used |= src->is_ref_types_used;
+    dst->is_bulk_memory_used |= src->is_bulk_memory_used;
+#endif
+}
+
+static void *
+prepare_bytecode_thread(void *arg)
+{
+    PrepareBytecodeContext *ctx = (PrepareBytecodeContext *)arg;
+    WASMModuleFlags flags = { 0 };
+    char error_buf[128];
+    uint32 i;
+
+    for (;;) {
+        os_mutex_lock(&ctx->lock);
+        /* The functions after the failed one needn't be prepared, but the
+           ones before it may still fail with an earlier error */
+        i = ctx->next_func < ctx->failed_func ? ctx->next_func++ : (uint32)-1;
+        os_mutex_unlock(&ctx->lock);
+        if (i == (uint32)-1)
+            break;
+
+        if (!wasm_loader_prepare_bytecode(ctx->module, ctx->module->functions[i],
+                                          i, &flags, error_buf,
+                                          sizeof(error_buf))) {
+            os_mutex_lock(&ctx->lock);
+            if (i < ctx->failed_func) {
+                ctx->failed_func = i;
+                bh_memcpy_s(ctx->error_buf, sizeof(ctx->error_buf), error_buf,
+                            sizeof(error_buf));
+            }
+            os_mutex_unlock(&ctx->lock);
+        }
+    }
+
+    os_mutex_lock(&ctx->lock);
+    or_module_flags(&ctx->flags, &flags);
+    os_mutex_unlock(&ctx->lock);
+    return NULL;
+}
+
+static bool
+prepare_bytecode_parallel(WASMModule *module, uint32 thread_num,
+                          char *error_buf, uint32 error_buf_size)
+{
+    PrepareBytecodeContext ctx = { 0 };
+    korp_tid *tids;
+    uint32 i, created = 0;
+
+    if (thread_num > module->function_count)
+        thread_num = module->function_count;
+    if (!(tids = loader_malloc(sizeof(korp_tid) * thread_num, error_buf,
+                               error_buf_size)))
+        return false;
+    if (os_mutex_init(&ctx.lock) != 0) {
+        set_error_buf(error_buf, error_buf_size, "init mutex failed");
+        wasm_runtime_free(tids);
+        return false;
+    }
+    ctx.module = module;
+    ctx.failed_func = module->function_count;
+
+    /* The calling thread is one of the workers, and if a thread can't be
+       created the others take over its functions */
+    for (i = 0; i < thread_num - 1; i++) {
+        if (os_thread_create(&tids[created], prepare_bytecode_thread, &ctx,
+                             APP_THREAD_STACK_SIZE_DEFAULT)
+            != 0) {
+            LOG_WARNING("failed to create loader thread, use %u threads",
+                        created + 1);
+            break;
+        }
+        created++;
+    }
+    prepare_bytecode_thread(&ctx);
+    for (i = 0; i < created; i++)
+        os_thread_join(tids[i], NULL);
+    merge_module_flags(module, &ctx.flags);
+
+    os_mutex_destroy(&ctx.lock);
+    wasm_runtime_free(tids);
+    if (ctx.failed_func < module->function_count) {
+        if (error_buf)
+            snprintf(error_buf, error_buf_size, "%s", ctx.error_buf);
+        return false;
+    }
+    return true;
+}
+#endif /* end of WASM_ENABLE_FAST_INTERP != 0 && WASM_ENABLE_GC == 0 */
+
+#if WASM_ENABLE_FAST_INTERP != 0
+/* The check of the function bodies done at load time with lazy translation,
+   the rest of the validation is done when a function is first called */
+static bool
+check_function_ends(WASMModule *module, char *error_buf,
+                    uint32 error_buf_size)
+{
+    WASMFunction *func;
+    uint32 i;
+
+    for (i = 0; i < module->function_count; i++) {
+        func = module->functions[i];
+        if (func->code_size == 0
+            || func->code[func->code_size - 1] != WASM_OP_END) {
+            /* The same errors as wasm_loader_prepare_bytecode reports */
+            if (i < module->function_count - 1)
+                set_error_buf(error_buf, error_buf_size,
+                              "END opcode expected");
+            else
+                set_error_buf(error_buf, error_buf_size,
+                              "unexpected end of section or function, "
+                              "or section size mismatch");
+            return false;
+        }
+    }
+    return true;
+}
+
+bool
+wasm_loader_translate_function(WASMModule *module, uint32 func_idx,
+                               char *error_buf, uint32 error_buf_size)
+{
+    WASMFunction *func = module->functions[func_idx];
+    WASMModuleFlags flags = { 0 };
+    uint32 size;
+    bool ret = true;
+
+    if (BH_ATOMIC_32_LOAD(func->is_translated))
+        return true;
+
+    /* Only the functions of a lazily translated module can be left */
+    bh_assert(module->is_lazy_translation);
+    os_mutex_lock(&module->translate_lock);
+    if (BH_ATOMIC_32_LOAD(func->is_translated)) {
+        /* Translated by another thread */
+    }
+    else if (func->translate_error) {
+        if (error_buf)
+            snprintf(error_buf, error_buf_size, "%s", func->translate_error);
+        ret = false;
+    }
+    else if (!wasm_loader_prepare_bytecode(module, func, func_idx, &flags,
+                                           error_buf, error_buf_size)) {
+        /* Drop the partly translated code, and keep the error to report it
+           again on the next calls. If it can't be kept, the function is
+           translated again by the next call. */
+        if (func->code_compiled) {
+            wasm_runtime_free(func->code_compiled);
+            func->code_compiled = NULL;
+            func->code_compiled_size = 0;
+        }
+        if (error_buf) {
+            size = (uint32)strlen(error_buf) + 1;
+            if ((func->translate_error = wasm_runtime_malloc(size)))
+                bh_memcpy_s(func->translate_error, size, error_buf, size);
+        }
+        ret = false;
+    }
+    merge_module_flags(module, &flags);
+    os_mutex_unlock(&module->translate_lock);
+    return ret;
+}
+#endif /* end of WASM_ENABLE_FAST_INTERP != 0 */
+
 static bool
 load_from_sections(WASMModule *module, WASMSection *sections,
                    bool is_load_from_file_buf, bool wasm_binary_freeable,
+                   uint32 loader_threads, bool lazy_translation,
                    char *error_buf, uint32 error_buf_size)
 {
     WASMExport *export;
@@ -6125,15 +6342,58 @@ load_from_sections(WASMModule *module, WASMSection *sections,
     handle_table = wasm_interp_get_handle_table();
 #endif
 
-    for (i = 0; i < module->function_count; i++) {
-        WASMFunction *func = module->functions[i];
-        if (!wasm_loader_prepare_bytecode(module, func, i, error_buf,
-                                          error_buf_size)) {
+#if WASM_ENABLE_FAST_INTERP != 0 && WASM_ENABLE_GC == 0 \
+    && WASM_ENABLE_JIT == 0
+    /* The functions are translated from the wasm binary when called, so it
+       must outlive the module. GC modules share their reftype set with the
+       running instances, and LLVM JIT compiles the functions at load time
+       with the flags found by the translation, so both translate eagerly. */
+    if (lazy_translation && is_load_from_file_buf && !wasm_binary_freeable) {
+        if (os_mutex_init(&module->translate_lock) != 0) {
+            set_error_buf(error_buf, error_buf_size,
+                          "init translate lock failed");
+            return false;
+        }
+        module->is_lazy_translation = true;
+    }
+#endif
+    (void)lazy_translation;
+
+#if WASM_ENABLE_FAST_INTERP != 0
+    if (module->is_lazy_translation) {
+        if (!check_function_ends(module, error_buf, error_buf_size))
+            return false;
+        /* Whether memory.grow is used isn't known until the functions are
+           translated, so the memory isn't shrunk */
+        module->possible_memory_grow = true;
+    }
+    else
+#endif
+#if WASM_ENABLE_FAST_INTERP != 0 && WASM_ENABLE_GC == 0
+    if (loader_threads > 1 && module->function_count > 1) {
+        if (!prepare_bytecode_parallel(module, loader_threads, error_buf,
+                                       error_buf_size))
             return false;
+    }
+    else
+#endif
+    {
+        WASMModuleFlags flags = { 0 };
+
+        for (i = 0; i < module->function_count; i++) {
+            if (!wasm_loader_prepare_bytecode(module, module->functions[i], i,
+                                              &flags, error_buf,
+                                              error_buf_size)) {
+                return false;
+            }
         }
+        merge_module_flags(module, &flags);
+    }
+    (void)loader_threads;
 
-        if (i == module->function_count - 1
-            && func->code + func->code_size != buf_code_end) {
+    if (module->function_count > 0) {
+        WASMFunction *func = module->functions[module->function_count - 1];
+        if (func->code + func->code_size != buf_code_end) {
             set_error_buf(error_buf, error_buf_size,
                           "code section size mismatch");
             return false;
@@ -6360,8 +6620,9 @@ wasm_loader_load_from_sections(WASMSection *section_list, char *error_buf,
     if (!module)
         return NULL;
 
-    if (!load_from_sections(module, section_list, false, true, error_buf,
-                            error_buf_size)) {
+    if (!load_from_sections(module, section_list, false, true,
+                            wasm_runtime_get_loader_threads_default(), false,
+                            error_buf, error_buf_size)) {
         wasm_loader_unload(module);
         return NULL;
     }
@@ -6505,7 +6766,8 @@ static union {
 
 static bool
 load(const uint8 *buf, uint32 size, WASMModule *module,
-     bool wasm_binary_freeable, char *error_buf, uint32 error_buf_size)
+     bool wasm_binary_freeable, uint32 loader_threads, bool lazy_translation,
+     char *error_buf, uint32 error_buf_size)
 {
     const uint8 *buf_end = buf + size;
     const uint8 *p = buf, *p_end = buf_end;
@@ -6534,7 +6796,8 @@ load(const uint8 *buf, uint32 size, WASMModule *module,
 
     if (!create_sections(buf, size, &section_list, error_buf, error_buf_size)
         || !load_from_sections(module, section_list, true, wasm_binary_freeable,
-                               error_buf, error_buf_size)) {
+                               loader_threads, lazy_translation, error_buf,
+                               error_buf_size)) {
         destroy_sections(section_list);
         return false;
     }
@@ -6710,8 +6973,12 @@ wasm_loader_load(uint8 *buf, uint32 size,
     module->load_size = size;
 #endif
 
-    if (!load(buf, size, module, args->wasm_binary_freeable, error_buf,
-              error_buf_size)) {
+    if (!load(buf, size, module, args->wasm_binary_freeable,
+              args->loader_threads ? args->loader_threads
+                                   : wasm_runtime_get_loader_threads_default(),
+              args->lazy_translation
+                  || wasm_runtime_get_lazy_translation_default(),
+              error_buf, error_buf_size)) {
         goto fail;
     }
 
@@ -6734,6 +7001,28 @@ fail:
     return NULL;
 }
 
+#if WASM_ENABLE_MIGRATION != 0
+static void
+wasm_type_stack_table_destroy(WASMTypeStackTable *table)
+{
+    if (table->entries)
+        wasm_runtime_free(table->entries);
+    if (table->return_entries)
+        wasm_runtime_free(table->return_entries);
+    if (table->stacks)
+        wasm_runtime_free(table->stacks);
+    if (table->instr_starts)
+        wasm_runtime_free(table->instr_starts);
+#if WASM_ENABLE_FAST_INTERP != 0
+    if (table->blocks)
+        wasm_runtime_free(table->blocks);
+    if (table->block_infos)
+        wasm_runtime_free(table->block_infos);
+#endif
+    memset(table, 0, sizeof(WASMTypeStackTable));
+}
+#endif
+
 void
 wasm_loader_unload(WASMModule *module)
 {
@@ -6780,11 +7069,17 @@ wasm_loader_unload(WASMModule *module)
             if (module->functions[i]) {
                 if (module->functions[i]->local_offsets)
                     wasm_runtime_free(module->functions[i]->local_offsets);
+#if WASM_ENABLE_MIGRATION != 0
+                wasm_type_stack_table_destroy(
+                    &module->functions[i]->type_stack_table);
+#endif
 #if WASM_ENABLE_FAST_INTERP != 0
                 if (module->functions[i]->code_compiled)
                     wasm_runtime_free(module->functions[i]->code_compiled);
                 if (module->functions[i]->consts)
                     wasm_runtime_free(module->functions[i]->consts);
+                if (module->functions[i]->translate_error)
+                    wasm_runtime_free(module->functions[i]->translate_error);
 #endif
 #if WASM_ENABLE_FAST_JIT != 0
                 if (module->functions[i]->fast_jit_jitted_code) {
@@ -6810,6 +7105,11 @@ wasm_loader_unload(WASMModule *module)
         wasm_runtime_free(module->functions);
     }
 
+#if WASM_ENABLE_FAST_INTERP != 0
+    if (module->is_lazy_translation)
+        os_mutex_destroy(&module->translate_lock);
+#endif
+
     if (module->tables) {
 #if WASM_ENABLE_GC != 0
         for (i = 0; i < module->table_count; i++) {
@@ -7870,6 +8170,10 @@ typedef struct BranchBlock {
      * to copy the stack operands to the loop block's arguments in
      * wasm_loader_emit_br_info for opcode br. */
     uint16 start_dynamic_offset;
+#if WASM_ENABLE_MIGRATION != 0
+    /* index of the block in WASMTypeStackTable.block_infos */
+    uint32 type_stack_block;
+#endif
 #endif
 
     /* Indicate the operand stack is in polymorphic state.
@@ -7943,6 +8247,29 @@ typedef struct WASMLoaderContext {
      * there will not be invalid memory access during second traverse */
     uint32 code_compiled_peak_size;
 #endif
+
+#if WASM_ENABLE_MIGRATION != 0
+    /* type stack table of the function, moved to WASMFunction on success */
+    WASMTypeStackTable type_stack_table;
+    uint32 type_stack_entry_capacity;
+    uint32 type_stack_return_entry_capacity;
+    uint32 type_stacks_capacity;
+    /* open addressing table of (hash, offset + 1) of the stacks, so that
+       equal stacks are stored once */
+    uint32 *type_stack_hash;
+    uint32 type_stack_hash_size;
+    uint32 type_stack_count;
+    /* callee type of the preceding call opcode, its return address is the
+       offset of the next opcode */
+    WASMFuncType *type_stack_call_type;
+#if WASM_ENABLE_FAST_INTERP != 0
+    const uint8 *type_stack_code;
+    uint32 type_stack_blocks_capacity;
+    uint32 type_stack_block_info_capacity;
+    /* offset of the last list appended to type_stack_table.blocks */
+    uint32 last_type_stack_blocks;
+#endif
+#endif
 } WASMLoaderContext;
 
 typedef struct Const {
@@ -8170,6 +8497,11 @@ wasm_loader_ctx_destroy(WASMLoaderContext *ctx)
             wasm_runtime_free(ctx->frame_offset_bottom);
         if (ctx->const_buf)
             wasm_runtime_free(ctx->const_buf);
+#endif
+#if WASM_ENABLE_MIGRATION != 0
+        wasm_type_stack_table_destroy(&ctx->type_stack_table);
+        if (ctx->type_stack_hash)
+            wasm_runtime_free(ctx->type_stack_hash);
 #endif
         wasm_runtime_free(ctx);
     }
@@ -8232,6 +8564,37 @@ wasm_loader_ctx_init(WASMFunction *func, char *error_buf, uint32 error_buf_size)
     loader_ctx->start_dynamic_offset = loader_ctx->dynamic_offset =
         loader_ctx->max_dynamic_offset =
             func->param_cell_num + func->local_cell_num;
+#endif
+
+#if WASM_ENABLE_MIGRATION != 0
+    loader_ctx->type_stack_entry_capacity = 8;
+    if (!(loader_ctx->type_stack_table.entries = loader_malloc(
+              sizeof(WASMTypeStackEntry) * 8, error_buf, error_buf_size)))
+        goto fail;
+    loader_ctx->type_stack_return_entry_capacity = 8;
+    if (!(loader_ctx->type_stack_table.return_entries = loader_malloc(
+              sizeof(WASMTypeStackEntry) * 8, error_buf, error_buf_size)))
+        goto fail;
+    loader_ctx->type_stacks_capacity = 64;
+    if (!(loader_ctx->type_stack_table.stacks =
+              loader_malloc(64, error_buf, error_buf_size)))
+        goto fail;
+    if (!(loader_ctx->type_stack_table.instr_starts = loader_malloc(
+              (uint64)func->code_size / 8 + 1, error_buf,
+              error_buf_size)))
+        goto fail;
+#if WASM_ENABLE_FAST_INTERP != 0
+    loader_ctx->type_stack_code = func->code;
+    loader_ctx->type_stack_blocks_capacity = 16;
+    if (!(loader_ctx->type_stack_table.blocks = loader_malloc(
+              sizeof(uint32) * 16, error_buf, error_buf_size)))
+        goto fail;
+    loader_ctx->type_stack_block_info_capacity = 8;
+    if (!(loader_ctx->type_stack_table.block_infos = loader_malloc(
+              sizeof(WASMTypeStackBlock) * 8, error_buf, error_buf_size)))
+        goto fail;
+    loader_ctx->last_type_stack_blocks = (uint32)-1;
+#endif
 #endif
     return loader_ctx;
 
@@ -8240,6 +8603,414 @@ fail:
     return NULL;
 }
 
+#if WASM_ENABLE_MIGRATION != 0
+/* Store the stack of size bytes just written after the stacks, unless an
+   equal one is already stored, and return its offset */
+static bool
+wasm_loader_intern_type_stack(WASMLoaderContext *ctx, uint32 size,
+                              uint32 *p_stack, char *error_buf,
+                              uint32 error_buf_size)
+{
+    WASMTypeStackTable *table = &ctx->type_stack_table;
+    const uint8 *stack = table->stacks + table->stacks_size;
+    uint32 hash = 2166136261u, mask, n, i, j, *buckets;
+
+    for (i = 0; i < size; i++)
+        hash = (hash ^ stack[i]) * 16777619u;
+
+    if ((ctx->type_stack_count + 1) * 2 > ctx->type_stack_hash_size) {
+        n = ctx->type_stack_hash_size ? ctx->type_stack_hash_size * 2 : 16;
+        if (!(buckets = loader_malloc(sizeof(uint32) * 2 * (uint64)n,
+                                      error_buf, error_buf_size)))
+            return false;
+        for (i = 0; i < ctx->type_stack_hash_size; i++) {
+            if (ctx->type_stack_hash[i * 2 + 1] == 0)
+                continue;
+            for (j = ctx->type_stack_hash[i * 2] & (n - 1);
+                 buckets[j * 2 + 1] != 0; j = (j + 1) & (n - 1))
+                ;
+            buckets[j * 2] = ctx->type_stack_hash[i * 2];
+            buckets[j * 2 + 1] = ctx->type_stack_hash[i * 2 + 1];
+        }
+        if (ctx->type_stack_hash)
+            wasm_runtime_free(ctx->type_stack_hash);
+        ctx->type_stack_hash = buckets;
+        ctx->type_stack_hash_size = n;
+    }
+
+    mask = ctx->type_stack_hash_size - 1;
+    buckets = ctx->type_stack_hash;
+    for (i = hash & mask; buckets[i * 2 + 1] != 0; i = (i + 1) & mask) {
+        /* the value count leads the stack, so equal bytes mean equal size */
+        if (buckets[i * 2] == hash
+            && !memcmp(table->stacks + buckets[i * 2 + 1] - 1, stack,
+                       size)) {
+            *p_stack = buckets[i * 2 + 1] - 1;
+            return true;
+        }
+    }
+    buckets[i * 2] = hash;
+    buckets[i * 2 + 1] = table->stacks_size + 1;
+    ctx->type_stack_count++;
+    *p_stack = table->stacks_size;
+    table->stacks_size += size;
+    return true;
+}
+
+/* Shrink an array of the table to the used size, it is kept by the
+   function until the module is unloaded */
+static bool
+wasm_loader_shrink_type_stack_array(void **p_mem, uint32 size,
+                                    char *error_buf, uint32 error_buf_size)
+{
+    void *mem = NULL;
+
+    if (size > 0) {
+        if (!(mem = loader_malloc(size, error_buf, error_buf_size)))
+            return false;
+        bh_memcpy_s(mem, size, *p_mem, size);
+    }
+    wasm_runtime_free(*p_mem);
+    *p_mem = mem;
+    return true;
+}
+
+/* Move the table to the function */
+static bool
+wasm_loader_finish_type_stacks(WASMLoaderContext *ctx, WASMFunction *func,
+                               char *error_buf, uint32 error_buf_size)
+{
+    WASMTypeStackTable *table = &ctx->type_stack_table;
+
+    if (!wasm_loader_shrink_type_stack_array(
+            (void **)&table->entries,
+            (uint32)sizeof(WASMTypeStackEntry) * table->entry_count,
+            error_buf, error_buf_size)
+        || !wasm_loader_shrink_type_stack_array(
+            (void **)&table->return_entries,
+            (uint32)sizeof(WASMTypeStackEntry) * table->return_entry_count,
+            error_buf, error_buf_size)
+        || !wasm_loader_shrink_type_stack_array((void **)&table->stacks,
+                                                table->stacks_size, error_buf,
+                                                error_buf_size)
+#if WASM_ENABLE_FAST_INTERP != 0
+        || !wasm_loader_shrink_type_stack_array(
+            (void **)&table->blocks,
+            (uint32)sizeof(uint32) * table->blocks_size, error_buf,
+            error_buf_size)
+        || !wasm_loader_shrink_type_stack_array(
+            (void **)&table->block_infos,
+            (uint32)sizeof(WASMTypeStackBlock) * table->block_info_count,
+            error_buf, error_buf_size)
+#endif
+    )
+        return false;
+
+    func->type_stack_table = *table;
+    memset(table, 0, sizeof(WASMTypeStackTable));
+    return true;
+}
+
+#if WASM_ENABLE_FAST_INTERP != 0
+static void
+wasm_loader_reset_type_stacks(WASMLoaderContext *ctx)
+{
+    ctx->type_stack_table.entry_count = 0;
+    ctx->type_stack_table.return_entry_count = 0;
+    ctx->type_stack_table.stacks_size = 0;
+    ctx->type_stack_table.blocks_size = 0;
+    ctx->type_stack_table.block_info_count = 0;
+    if (ctx->type_stack_hash)
+        memset(ctx->type_stack_hash, 0,
+               sizeof(uint32) * 2 * ctx->type_stack_hash_size);
+    ctx->type_stack_count = 0;
+    ctx->last_type_stack_blocks = (uint32)-1;
+    ctx->type_stack_call_type = NULL;
+}
+
+/* Register the block just pushed to frame_csp, the target of blocks other
+   than loop is set when their end opcode is reached */
+static bool
+wasm_loader_push_type_stack_block(WASMLoaderContext *ctx, char *error_buf,
+                                  uint32 error_buf_size)
+{
+    WASMTypeStackTable *table = &ctx->type_stack_table;
+    BranchBlock *block = ctx->frame_csp - 1;
+    WASMTypeStackBlock *info;
+    uint32 n;
+
+    /* the function block is generated when dumping */
+    if (block->label_type == LABEL_TYPE_FUNCTION)
+        return true;
+
+    if (table->block_info_count >= ctx->type_stack_block_info_capacity) {
+        n = ctx->type_stack_block_info_capacity * 2;
+        MEM_REALLOC(table->block_infos,
+                    sizeof(WASMTypeStackBlock)
+                        * ctx->type_stack_block_info_capacity,
+                    sizeof(WASMTypeStackBlock) * n);
+        ctx->type_stack_block_info_capacity = n;
+    }
+
+    block->type_stack_block = table->block_info_count;
+    info = &table->block_infos[table->block_info_count++];
+    info->begin_offset = (uint32)(block->start_addr - ctx->type_stack_code);
+    info->target_offset = (uint32)-1;
+    info->frame_sp = block->stack_cell_num;
+    if (block->label_type == LABEL_TYPE_LOOP) {
+        info->target_offset = info->begin_offset;
+        info->cell_num = block->block_type.is_value_type
+                             ? 0
+                             : block->block_type.u.type->param_cell_num;
+    }
+    else {
+        info->cell_num = block->block_type.is_value_type
+                             ? wasm_value_type_cell_num(
+                                 block->block_type.u.value_type.type)
+                             : block->block_type.u.type->ret_cell_num;
+    }
+    return true;
+fail:
+    return false;
+}
+
+/* Append the list of blocks enclosing the current instruction */
+static bool
+wasm_loader_append_type_stack_blocks(WASMLoaderContext *ctx, uint32 *p_blocks,
+                                     char *error_buf, uint32 error_buf_size)
+{
+    WASMTypeStackTable *table = &ctx->type_stack_table;
+    uint32 count = ctx->csp_num > 0 ? ctx->csp_num - 1 : 0;
+    uint32 size = table->blocks_size + 1 + count, n, i;
+    uint32 *blocks;
+
+    if (size > ctx->type_stack_blocks_capacity) {
+        n = ctx->type_stack_blocks_capacity * 2;
+        if (n < size)
+            n = size;
+        MEM_REALLOC(table->blocks,
+                    sizeof(uint32) * ctx->type_stack_blocks_capacity,
+                    sizeof(uint32) * n);
+        ctx->type_stack_blocks_capacity = n;
+    }
+
+    blocks = table->blocks + table->blocks_size;
+    blocks[0] = count;
+    for (i = 0; i < count; i++)
+        blocks[i + 1] = ctx->frame_csp_bottom[i + 1].type_stack_block;
+
+    if (ctx->last_type_stack_blocks != (uint32)-1
+        && table->blocks[ctx->last_type_stack_blocks] == count
+        && !memcmp(table->blocks + ctx->last_type_stack_blocks + 1, blocks + 1,
+                   sizeof(uint32) * count)) {
+        *p_blocks = ctx->last_type_stack_blocks;
+    }
+    else {
+        *p_blocks = ctx->last_type_stack_blocks = table->blocks_size;
+        table->blocks_size += 1 + count;
+    }
+    return true;
+fail:
+    return false;
+}
+
+/* local.set at offset merged into the previous opcode by writing its
+   result to the local directly: the value on the top of the stack before
+   local.set is in the local slot */
+static bool
+wasm_loader_set_type_stack_top_slot(WASMLoaderContext *ctx, uint32 offset,
+                                    int16 slot, char *error_buf,
+                                    uint32 error_buf_size)
+{
+    WASMTypeStackTable *table = &ctx->type_stack_table;
+    WASMTypeStackEntry *entry;
+    uint32 value_count, size, n;
+    uint8 *stack;
+
+    if (!ctx->p_code_compiled || table->entry_count == 0)
+        return true;
+
+    /* nothing to do if the local.set is not a safepoint */
+    entry = &table->entries[table->entry_count - 1];
+    if (entry->offset != offset)
+        return true;
+    bh_memcpy_s(&value_count, sizeof(uint32), table->stacks + entry->stack,
+                sizeof(uint32));
+    if (value_count == 0)
+        return true;
+
+    /* the stack may be shared with other entries, change a copy of it */
+    size = (uint32)sizeof(uint32) + value_count * 3;
+    if (table->stacks_size + size > ctx->type_stacks_capacity) {
+        n = ctx->type_stacks_capacity * 2;
+        if (n < table->stacks_size + size)
+            n = table->stacks_size + size;
+        MEM_REALLOC(table->stacks, ctx->type_stacks_capacity, n);
+        ctx->type_stacks_capacity = n;
+    }
+    stack = table->stacks + table->stacks_size;
+    bh_memcpy_s(stack, size, table->stacks + entry->stack, size);
+    bh_memcpy_s(stack + sizeof(uint32) + value_count
+                    + sizeof(int16) * (value_count - 1),
+                sizeof(int16), &slot, sizeof(int16));
+    return wasm_loader_intern_type_stack(ctx, size, &entry->stack, error_buf,
+                                         error_buf_size);
+fail:
+    return false;
+}
+#endif /* end of WASM_ENABLE_FAST_INTERP != 0 */
+
+/* Append the current operand stack without its top drop_cell_num cells */
+static bool
+wasm_loader_append_type_stack(WASMLoaderContext *ctx, WASMFunction *func,
+                              uint32 offset, bool is_return,
+                              uint32 drop_cell_num, char *error_buf,
+                              uint32 error_buf_size)
+{
+    WASMTypeStackTable *table = &ctx->type_stack_table;
+    WASMTypeStackEntry *entry;
+    uint32 cell_num, value_count = 0, stack, size, i, n;
+    uint8 *values;
+#if WASM_ENABLE_FAST_INTERP != 0
+    uint32 blocks;
+    int16 *slots;
+#endif
+
+    bh_assert(ctx->stack_cell_num >= drop_cell_num);
+    cell_num = ctx->stack_cell_num - drop_cell_num;
+
+    /* at most one value per cell */
+#if WASM_ENABLE_FAST_INTERP != 0
+    size = table->stacks_size + (uint32)sizeof(uint32) + cell_num * 3;
+#else
+    size = table->stacks_size + (uint32)sizeof(uint32) + cell_num;
+#endif
+    if (size > ctx->type_stacks_capacity) {
+        n = ctx->type_stacks_capacity * 2;
+        if (n < size)
+            n = size;
+        MEM_REALLOC(table->stacks, ctx->type_stacks_capacity, n);
+        ctx->type_stacks_capacity = n;
+    }
+
+    values = table->stacks + table->stacks_size + sizeof(uint32);
+    for (i = 0; i < cell_num; i += n) {
+        n = wasm_value_type_cell_num(ctx->frame_ref_bottom[i]);
+        if (n == 0)
+            n = 1;
+        values[value_count++] = (uint8)n;
+    }
+#if WASM_ENABLE_FAST_INTERP != 0
+    /* the slots follow the cell nums, unaligned */
+    slots = (int16 *)(values + value_count);
+    for (i = 0, n = 0; i < value_count; n += values[i], i++)
+        bh_memcpy_s(slots + i, sizeof(int16), ctx->frame_offset_bottom + n,
+                    sizeof(int16));
+    size = (uint32)sizeof(uint32) + value_count * 3;
+#else
+    size = (uint32)sizeof(uint32) + value_count;
+#endif
+    bh_memcpy_s(table->stacks + table->stacks_size, sizeof(uint32),
+                &value_count, sizeof(uint32));
+    if (!wasm_loader_intern_type_stack(ctx, size, &stack, error_buf,
+                                       error_buf_size))
+        goto fail;
+
+#if WASM_ENABLE_FAST_INTERP != 0
+    if (!wasm_loader_append_type_stack_blocks(ctx, &blocks, error_buf,
+                                              error_buf_size))
+        goto fail;
+#endif
+
+    if (!is_return) {
+        if (table->entry_count >= ctx->type_stack_entry_capacity) {
+            n = ctx->type_stack_entry_capacity * 2;
+            MEM_REALLOC(table->entries,
+                        sizeof(WASMTypeStackEntry)
+                            * ctx->type_stack_entry_capacity,
+                        sizeof(WASMTypeStackEntry) * n);
+            ctx->type_stack_entry_capacity = n;
+        }
+        entry = &table->entries[table->entry_count++];
+    }
+    else {
+        if (table->return_entry_count
+            >= ctx->type_stack_return_entry_capacity) {
+            n = ctx->type_stack_return_entry_capacity * 2;
+            MEM_REALLOC(table->return_entries,
+                        sizeof(WASMTypeStackEntry)
+                            * ctx->type_stack_return_entry_capacity,
+                        sizeof(WASMTypeStackEntry) * n);
+            ctx->type_stack_return_entry_capacity = n;
+        }
+        entry = &table->return_entries[table->return_entry_count++];
+    }
+    entry->offset = offset;
+    entry->stack = stack;
+#if WASM_ENABLE_FAST_INTERP != 0
+    entry->compiled_offset =
+        (uint32)(ctx->p_code_compiled - func->code_compiled);
+    entry->blocks = blocks;
+#endif
+    (void)func;
+    return true;
+fail:
+    return false;
+}
+
+/* Record the type stack before the opcode at p if it is a safepoint, and
+   the one of the return address if the previous opcode is a call */
+static bool
+wasm_loader_record_type_stack(WASMLoaderContext *ctx, WASMFunction *func,
+                              const uint8 *p, char *error_buf,
+                              uint32 error_buf_size)
+{
+    WASMTypeStackTable *table = &ctx->type_stack_table;
+    uint32 offset = (uint32)(p - func->code);
+    bool is_safepoint;
+
+#if WASM_ENABLE_FAST_INTERP != 0
+    /* only the second traverse emits code */
+    if (!ctx->p_code_compiled)
+        return true;
+#endif
+
+    table->instr_starts[offset / 8] |= (uint8)(1 << (offset % 8));
+
+    /* the function entry, the return from a call and the first
+       instruction of a loop body, where a branch to the loop lands */
+    is_safepoint = offset == 0 || ctx->type_stack_call_type
+                   || ((ctx->frame_csp - 1)->label_type == LABEL_TYPE_LOOP
+                       && (ctx->frame_csp - 1)->start_addr == p);
+#if WASM_ENABLE_SHARED_MEMORY != 0 && WASM_ENABLE_FAST_INTERP == 0
+    /* the classic interpreter also stops at an interrupted atomic.wait */
+    if (p[0] == WASM_OP_ATOMIC_PREFIX
+        && (p[1] == WASM_OP_ATOMIC_WAIT32 || p[1] == WASM_OP_ATOMIC_WAIT64))
+        is_safepoint = true;
+#endif
+    if (!is_safepoint)
+        return true;
+
+    if (ctx->type_stack_call_type) {
+        if (!wasm_loader_append_type_stack(
+                ctx, func, offset, true,
+                ctx->type_stack_call_type->ret_cell_num, error_buf,
+                error_buf_size))
+            return false;
+        ctx->type_stack_call_type = NULL;
+    }
+
+    /* the end opcode of an if block without else is traversed twice, as
+       a virtual else and then as end, keep the state before the first */
+    if (table->entry_count > 0
+        && table->entries[table->entry_count - 1].offset == offset)
+        return true;
+
+    return wasm_loader_append_type_stack(ctx, func, offset, false, 0,
+                                         error_buf, error_buf_size);
+}
+#endif
+
 static bool
 check_stack_push(WASMLoaderContext *ctx, uint8 type, char *error_buf,
                  uint32 error_buf_size)
@@ -8730,6 +9501,11 @@ wasm_loader_push_frame_csp(WASMLoaderContext *ctx, uint8 label_type,
             return false;
         }
     }
+#if WASM_ENABLE_MIGRATION != 0 && WASM_ENABLE_FAST_INTERP != 0
+    if (ctx->p_code_compiled
+        && !wasm_loader_push_type_stack_block(ctx, error_buf, error_buf_size))
+        return false;
+#endif
     return true;
 fail:
     return false;
@@ -8804,6 +9580,44 @@ fail:
     } while (0)
 #endif /* end of WASM_ENABLE_LABELS_AS_VALUES */
 
+#if WASM_ENABLE_LABELS_AS_VALUES != 0
+/* Superinstructions: a hot pair of instructions found by the opcode pair
+   profile of WASM_ENABLE_OPCODE_COUNTER is fused by replacing the label of
+   the first instruction with the label of a handler running both of them.
+   The compiled code keeps its layout, the handler skips the label of the
+   second instruction, so that the second instruction still starts at its
+   own compiled offset and the code needn't be sized again. */
+#if WASM_CPU_SUPPORTS_UNALIGNED_ADDR_ACCESS != 0
+#define LABEL_SIZE sizeof(void *)
+#else
+#define LABEL_SIZE sizeof(int32)
+#endif
+
+static void
+wasm_loader_fuse_label(uint8 *p_label, uint8 opcode)
+{
+#if WASM_CPU_SUPPORTS_UNALIGNED_ADDR_ACCESS != 0
+    *(void **)p_label = handle_table[opcode];
+#else
+#if UINTPTR_MAX == UINT64_MAX
+    /* emit int32 relative offset in 64-bit target */
+    *(int32 *)p_label =
+        (int32)((uint8 *)handle_table[opcode] - (uint8 *)handle_table[0]);
+#else
+    /* emit uint32 label address in 32-bit target */
+    *(uint32 *)p_label = (uint32)(uintptr_t)handle_table[opcode];
+#endif
+#endif /* end of WASM_CPU_SUPPORTS_UNALIGNED_ADDR_ACCESS */
+    LOG_OP("\nfuse op [%02x]\n", opcode);
+}
+
+/* Whether the previous instruction was emitted with size bytes of operands
+   right before the current one, p_last_label is NULL in the first
+   traversal and nothing is fused there */
+#define LAST_OP_FUSABLE(size) \
+    (p_last_label && p_last_label + LABEL_SIZE + (size) == p_cur_label)
+#endif /* end of WASM_ENABLE_LABELS_AS_VALUES */
+
 #define emit_empty_label_addr_and_frame_ip(type)                             \
     do {                                                                     \
         if (!add_label_patch_to_list(loader_ctx->frame_csp - 1, type,        \
@@ -10890,7 +11704,8 @@ wasm_loader_get_custom_section(WASMModule *module, const char *name,
 
 static bool
 wasm_loader_prepare_bytecode(WASMModule *module, WASMFunction *func,
-                             uint32 cur_func_idx, char *error_buf,
+                             uint32 cur_func_idx,
+                             WASMModuleFlags *module_flags, char *error_buf,
                              uint32 error_buf_size)
 {
     uint8 *p = func->code, *p_end = func->code + func->code_size, *p_org;
@@ -10918,6 +11733,10 @@ wasm_loader_prepare_bytecode(WASMModule *module, WASMFunction *func,
     uint8 *func_const_end, *func_const = NULL;
     int16 operand_offset = 0;
     uint8 last_op = 0;
+#if WASM_ENABLE_LABELS_AS_VALUES != 0
+    /* compiled labels of the previous and the current instruction */
+    uint8 *p_last_label = NULL, *p_cur_label = NULL;
+#endif
     bool disable_emit, preserve_local = false, if_condition_available = true;
     float32 f32_const;
     float64 f64_const;
@@ -10980,16 +11799,28 @@ re_scan:
         p = func->code;
         func->code_compiled = loader_ctx->p_code_compiled;
         func->code_compiled_size = loader_ctx->code_compiled_size;
+#if WASM_ENABLE_MIGRATION != 0
+        wasm_loader_reset_type_stacks(loader_ctx);
+#endif
     }
 #endif
 
     PUSH_CSP(LABEL_TYPE_FUNCTION, func_block_type, p);
 
     while (p < p_end) {
+#if WASM_ENABLE_MIGRATION != 0
+        if (!wasm_loader_record_type_stack(loader_ctx, func, p, error_buf,
+                                           error_buf_size))
+            goto fail;
+#endif
         opcode = *p++;
 #if WASM_ENABLE_FAST_INTERP != 0
         p_org = p;
         disable_emit = false;
+#if WASM_ENABLE_LABELS_AS_VALUES != 0
+        p_last_label = p_cur_label;
+        p_cur_label = loader_ctx->p_code_compiled;
+#endif
         emit_label(opcode);
 #endif
         switch (opcode) {
@@ -11066,10 +11897,10 @@ re_scan:
                     block_type.u.value_type.type = value_type;
 #if WASM_ENABLE_WAMR_COMPILER != 0
                     if (value_type == VALUE_TYPE_V128)
-                        module->is_simd_used = true;
+                        module_flags->is_simd_used = true;
                     else if (value_type == VALUE_TYPE_FUNCREF
                              || value_type == VALUE_TYPE_EXTERNREF)
-                        module->is_ref_types_used = true;
+                        module_flags->is_ref_types_used = true;
 #endif
 #if WASM_ENABLE_GC != 0
                     if (value_type != VALUE_TYPE_VOID) {
@@ -11617,6 +12448,14 @@ re_scan:
                 POP_CSP();
 
 #if WASM_ENABLE_FAST_INTERP != 0
+#if WASM_ENABLE_MIGRATION != 0
+                if (loader_ctx->p_code_compiled
+                    && loader_ctx->frame_csp->label_type != LABEL_TYPE_FUNCTION
+                    && loader_ctx->frame_csp->label_type != LABEL_TYPE_LOOP)
+                    loader_ctx->type_stack_table
+                        .block_infos[loader_ctx->frame_csp->type_stack_block]
+                        .target_offset = (uint32)(p - 1 - func->code);
+#endif
                 skip_label();
                 /* copy the result to the block return address */
                 RESERVE_BLOCK_RET();
@@ -11672,6 +12511,15 @@ re_scan:
                                              error_buf, error_buf_size)))
                     goto fail;
 
+#if WASM_ENABLE_FAST_INTERP != 0 && WASM_ENABLE_LABELS_AS_VALUES != 0
+                /* the condition is the result of the i32 compare right
+                   before, eqz has one operand and the others have two */
+                if (last_op >= WASM_OP_I32_EQZ && last_op <= WASM_OP_I32_GE_U
+                    && LAST_OP_FUSABLE(last_op == WASM_OP_I32_EQZ ? 4 : 6))
+                    wasm_loader_fuse_label(p_last_label,
+                                           EXT_OP_I32_EQZ_BR_IF
+                                               + (last_op - WASM_OP_I32_EQZ));
+#endif
                 break;
             }
 
@@ -12005,6 +12853,14 @@ re_scan:
 #if WASM_ENABLE_FAST_JIT != 0 || WASM_ENABLE_JIT != 0 \
     || WASM_ENABLE_WAMR_COMPILER != 0
                 func->has_op_func_call = true;
+#endif
+#if WASM_ENABLE_MIGRATION != 0
+                if (opcode == WASM_OP_CALL
+#if WASM_ENABLE_GC != 0
+                    || opcode == WASM_OP_CALL_REF
+#endif
+                )
+                    loader_ctx->type_stack_call_type = func_type;
 #endif
                 (void)type;
                 break;
@@ -12106,6 +12962,10 @@ re_scan:
 #endif
 #if WASM_ENABLE_JIT != 0 || WASM_ENABLE_WAMR_COMPILER != 0
                 func->has_op_call_indirect = true;
+#endif
+#if WASM_ENABLE_MIGRATION != 0
+                if (opcode == WASM_OP_CALL_INDIRECT)
+                    loader_ctx->type_stack_call_type = func_type;
 #endif
                 break;
             }
@@ -12415,7 +13275,7 @@ re_scan:
                 PUSH_REF(type);
 
 #if WASM_ENABLE_WAMR_COMPILER != 0
-                module->is_ref_types_used = true;
+                module_flags->is_ref_types_used = true;
 #endif
                 (void)vec_len;
                 break;
@@ -12469,7 +13329,7 @@ re_scan:
                 }
 
 #if WASM_ENABLE_WAMR_COMPILER != 0
-                module->is_ref_types_used = true;
+                module_flags->is_ref_types_used = true;
 #endif
                 break;
             }
@@ -12513,7 +13373,7 @@ re_scan:
                 PUSH_TYPE(ref_type);
 
 #if WASM_ENABLE_WAMR_COMPILER != 0
-                module->is_ref_types_used = true;
+                module_flags->is_ref_types_used = true;
 #endif
                 break;
             }
@@ -12568,7 +13428,7 @@ re_scan:
                 PUSH_I32();
 
 #if WASM_ENABLE_WAMR_COMPILER != 0
-                module->is_ref_types_used = true;
+                module_flags->is_ref_types_used = true;
 #endif
                 break;
             }
@@ -12672,7 +13532,7 @@ re_scan:
 #endif
 
 #if WASM_ENABLE_WAMR_COMPILER != 0
-                module->is_ref_types_used = true;
+                module_flags->is_ref_types_used = true;
 #endif
                 break;
             }
@@ -12833,6 +13693,13 @@ re_scan:
                                       local_offset);
                         loader_ctx->frame_offset--;
                         loader_ctx->dynamic_offset--;
+#if WASM_ENABLE_MIGRATION != 0
+                        if (!wasm_loader_set_type_stack_top_slot(
+                                loader_ctx, (uint32)(p_org - func->code),
+                                (int16)local_offset, error_buf,
+                                error_buf_size))
+                            goto fail;
+#endif
                     }
                     else if ((!preserve_local) && (LAST_OP_OUTPUT_I64())) {
                         if (loader_ctx->p_code_compiled)
@@ -12840,6 +13707,13 @@ re_scan:
                                       local_offset);
                         loader_ctx->frame_offset -= 2;
                         loader_ctx->dynamic_offset -= 2;
+#if WASM_ENABLE_MIGRATION != 0
+                        if (!wasm_loader_set_type_stack_top_slot(
+                                loader_ctx, (uint32)(p_org - func->code),
+                                (int16)local_offset, error_buf,
+                                error_buf_size))
+                            goto fail;
+#endif
                     }
                     else {
                         if (is_32bit_type(local_type)) {
@@ -12919,6 +13793,17 @@ re_scan:
                 ) {
                     skip_label();
                     if (is_32bit_type(local_type)) {
+#if WASM_ENABLE_LABELS_AS_VALUES != 0
+                        /* no local was preserved in between */
+                        if ((last_op == WASM_OP_I32_ADD
+                             || last_op == WASM_OP_I32_SUB)
+                            && !preserve_local && LAST_OP_FUSABLE(6))
+                            wasm_loader_fuse_label(
+                                p_last_label,
+                                last_op == WASM_OP_I32_ADD
+                                    ? EXT_OP_I32_ADD_TEE_LOCAL_FAST
+                                    : EXT_OP_I32_SUB_TEE_LOCAL_FAST);
+#endif
                         emit_label(EXT_OP_TEE_LOCAL_FAST);
                         emit_byte(loader_ctx, (uint8)local_offset);
                     }
@@ -13239,7 +14124,7 @@ re_scan:
                 }
                 PUSH_PAGE_COUNT();
 
-                module->possible_memory_grow = true;
+                module_flags->possible_memory_grow = true;
 #if WASM_ENABLE_JIT != 0 || WASM_ENABLE_WAMR_COMPILER != 0
                 func->has_memory_operations = true;
 #endif
@@ -13255,7 +14140,7 @@ re_scan:
                 }
                 POP_AND_PUSH(mem_offset_type, mem_offset_type);
 
-                module->possible_memory_grow = true;
+                module_flags->possible_memory_grow = true;
 #if WASM_ENABLE_FAST_JIT != 0 || WASM_ENABLE_JIT != 0 \
     || WASM_ENABLE_WAMR_COMPILER != 0
                 func->has_op_memory_grow = true;
@@ -14624,7 +15509,7 @@ re_scan:
                         func->has_memory_operations = true;
 #endif
 #if WASM_ENABLE_WAMR_COMPILER != 0
-                        module->is_bulk_memory_used = true;
+                        module_flags->is_bulk_memory_used = true;
 #endif
                         break;
                     }
@@ -14647,7 +15532,7 @@ re_scan:
                         func->has_memory_operations = true;
 #endif
 #if WASM_ENABLE_WAMR_COMPILER != 0
-                        module->is_bulk_memory_used = true;
+                        module_flags->is_bulk_memory_used = true;
 #endif
                         break;
                     }
@@ -14670,7 +15555,7 @@ re_scan:
                         func->has_memory_operations = true;
 #endif
 #if WASM_ENABLE_WAMR_COMPILER != 0
-                        module->is_bulk_memory_used = true;
+                        module_flags->is_bulk_memory_used = true;
 #endif
                         break;
                     }
@@ -14690,7 +15575,7 @@ re_scan:
                         func->has_memory_operations = true;
 #endif
 #if WASM_ENABLE_WAMR_COMPILER != 0
-                        module->is_bulk_memory_used = true;
+                        module_flags->is_bulk_memory_used = true;
 #endif
                         break;
                     }
@@ -14763,7 +15648,7 @@ re_scan:
                         POP_I32();
 
 #if WASM_ENABLE_WAMR_COMPILER != 0
-                        module->is_ref_types_used = true;
+                        module_flags->is_ref_types_used = true;
 #endif
                         break;
                     }
@@ -14779,7 +15664,7 @@ re_scan:
 #endif
 
 #if WASM_ENABLE_WAMR_COMPILER != 0
-                        module->is_ref_types_used = true;
+                        module_flags->is_ref_types_used = true;
 #endif
                         break;
                     }
@@ -14836,7 +15721,7 @@ re_scan:
                         POP_I32();
 
 #if WASM_ENABLE_WAMR_COMPILER != 0
-                        module->is_ref_types_used = true;
+                        module_flags->is_ref_types_used = true;
 #endif
                         break;
                     }
@@ -14856,7 +15741,7 @@ re_scan:
                         PUSH_I32();
 
 #if WASM_ENABLE_WAMR_COMPILER != 0
-                        module->is_ref_types_used = true;
+                        module_flags->is_ref_types_used = true;
 #endif
                         break;
                     }
@@ -14913,7 +15798,7 @@ re_scan:
                             POP_I32();
 
 #if WASM_ENABLE_WAMR_COMPILER != 0
-                        module->is_ref_types_used = true;
+                        module_flags->is_ref_types_used = true;
 #endif
                         break;
                     }
@@ -14936,7 +15821,7 @@ re_scan:
 
 #if WASM_ENABLE_WAMR_COMPILER != 0
                 /* Mark the SIMD instruction is used in this module */
-                module->is_simd_used = true;
+                module_flags->is_simd_used = true;
 #endif
 
                 read_leb_uint32(p, p_end, opcode1);
@@ -15798,6 +16683,15 @@ re_scan:
     func->max_stack_cell_num = loader_ctx->max_stack_cell_num;
 #endif
     func->max_block_num = loader_ctx->max_csp_num;
+#if WASM_ENABLE_MIGRATION != 0
+    if (!wasm_loader_finish_type_stacks(loader_ctx, func, error_buf,
+                                        error_buf_size))
+        goto fail;
+#endif
+#if WASM_ENABLE_FAST_INTERP != 0
+    /* Publish the translated code after all the fields above are set */
+    BH_ATOMIC_32_STORE(func->is_translated, 1);
+#endif
     return_value = true;
 
 fail:
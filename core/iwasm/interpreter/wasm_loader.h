@@ -73,6 +73,25 @@ wasm_loader_find_block_addr(WASMExecEnv *exec_env, BlockAddr *block_addr_cache,
                             uint8 block_type, uint8 **p_else_addr,
                             uint8 **p_end_addr);
 
+#if WASM_ENABLE_FAST_INTERP != 0
+/**
+ * Translate a function of a module loaded with lazy translation, called
+ * before the function is called for the first time. It returns at once if
+ * the function is translated already.
+ *
+ * @param module the module of the function
+ * @param func_idx the index of the function, not counting the imports
+ * @param error_buf returns the error of the translation
+ * @param error_buf_size the size of the error string
+ *
+ * @return true if success, false if the function fails to translate, which
+ *         fails with the same error each time it is called
+ */
+bool
+wasm_loader_translate_function(WASMModule *module, uint32 func_idx,
+                               char *error_buf, uint32 error_buf_size);
+#endif
+
 #ifdef __cplusplus
 }
 #endif
@@ -3419,6 +3419,20 @@ wasm_loader_unload(WASMModule *module)
     wasm_runtime_free(module);
 }
 
+#if WASM_ENABLE_FAST_INTERP != 0
+bool
+wasm_loader_translate_function(WASMModule *module, uint32 func_idx,
+                               char *error_buf, uint32 error_buf_size)
+{
+    /* The mini loader translates all the functions at load time */
+    (void)module;
+    (void)func_idx;
+    (void)error_buf;
+    (void)error_buf_size;
+    return true;
+}
+#endif
+
 bool
 wasm_loader_find_block_addr(WASMExecEnv *exec_env, BlockAddr *block_addr_cache,
                             const uint8 *start_addr, const uint8 *code_end_addr,
@@ -8156,6 +8170,9 @@ re_scan:
     func->max_stack_cell_num = loader_ctx->max_stack_cell_num;
 #endif
     func->max_block_num = loader_ctx->max_csp_num;
+#if WASM_ENABLE_FAST_INTERP != 0
+    BH_ATOMIC_32_STORE(func->is_translated, 1);
+#endif
     return_value = true;
 
 fail:
@@ -278,6 +278,23 @@ typedef enum WASMOpcode {
     DEBUG_OP_BREAK = 0xdc, /* debug break point */
 #endif
 
+    /* superinstructions of fast interpreter, i32 compare + br_if, in the
+       order of WASM_OP_I32_EQZ ~ WASM_OP_I32_GE_U */
+    EXT_OP_I32_EQZ_BR_IF = 0xdd,
+    EXT_OP_I32_EQ_BR_IF = 0xde,
+    EXT_OP_I32_NE_BR_IF = 0xdf,
+    EXT_OP_I32_LT_S_BR_IF = 0xe0,
+    EXT_OP_I32_LT_U_BR_IF = 0xe1,
+    EXT_OP_I32_GT_S_BR_IF = 0xe2,
+    EXT_OP_I32_GT_U_BR_IF = 0xe3,
+    EXT_OP_I32_LE_S_BR_IF = 0xe4,
+    EXT_OP_I32_LE_U_BR_IF = 0xe5,
+    EXT_OP_I32_GE_S_BR_IF = 0xe6,
+    EXT_OP_I32_GE_U_BR_IF = 0xe7,
+    /* i32.add/i32.sub + local.tee */
+    EXT_OP_I32_ADD_TEE_LOCAL_FAST = 0xe8,
+    EXT_OP_I32_SUB_TEE_LOCAL_FAST = 0xe9,
+
     /* Post-MVP extend op prefix */
     WASM_OP_GC_PREFIX = 0xfb,
     WASM_OP_MISC_PREFIX = 0xfc,
@@ -1016,6 +1033,19 @@ typedef enum WASMAtomicEXTOpcode {
         HANDLE_OPCODE(EXT_OP_IF),                    /* 0xd9 */ \
         HANDLE_OPCODE(EXT_OP_BR_TABLE_CACHE),        /* 0xda */ \
         HANDLE_OPCODE(EXT_OP_TRY),                   /* 0xdb */ \
+        SET_GOTO_TABLE_ELEM(EXT_OP_I32_EQZ_BR_IF),   /* 0xdd */ \
+        SET_GOTO_TABLE_ELEM(EXT_OP_I32_EQ_BR_IF),    /* 0xde */ \
+        SET_GOTO_TABLE_ELEM(EXT_OP_I32_NE_BR_IF),    /* 0xdf */ \
+        SET_GOTO_TABLE_ELEM(EXT_OP_I32_LT_S_BR_IF),  /* 0xe0 */ \
+        SET_GOTO_TABLE_ELEM(EXT_OP_I32_LT_U_BR_IF),  /* 0xe1 */ \
+        SET_GOTO_TABLE_ELEM(EXT_OP_I32_GT_S_BR_IF),  /* 0xe2 */ \
+        SET_GOTO_TABLE_ELEM(EXT_OP_I32_GT_U_BR_IF),  /* 0xe3 */ \
+        SET_GOTO_TABLE_ELEM(EXT_OP_I32_LE_S_BR_IF),  /* 0xe4 */ \
+        SET_GOTO_TABLE_ELEM(EXT_OP_I32_LE_U_BR_IF),  /* 0xe5 */ \
+        SET_GOTO_TABLE_ELEM(EXT_OP_I32_GE_S_BR_IF),  /* 0xe6 */ \
+        SET_GOTO_TABLE_ELEM(EXT_OP_I32_GE_U_BR_IF),  /* 0xe7 */ \
+        SET_GOTO_TABLE_ELEM(EXT_OP_I32_ADD_TEE_LOCAL_FAST), /* 0xe8 */ \
+        SET_GOTO_TABLE_ELEM(EXT_OP_I32_SUB_TEE_LOCAL_FAST), /* 0xe9 */ \
         SET_GOTO_TABLE_ELEM(WASM_OP_GC_PREFIX),      /* 0xfb */ \
         SET_GOTO_TABLE_ELEM(WASM_OP_MISC_PREFIX),    /* 0xfc */ \
         SET_GOTO_TABLE_SIMD_PREFIX_ELEM()            /* 0xfd */ \
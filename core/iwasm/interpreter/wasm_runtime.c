@@ -30,6 +30,9 @@
 #if WASM_ENABLE_JIT != 0
 #include "../aot/aot_runtime.h"
 #endif
+#if WASM_ENABLE_MIGRATION != 0
+#include "../migration/wasm_restore.h"
+#endif
 
 static void
 set_error_buf(char *error_buf, uint32 error_buf_size, const char *string)
@@ -154,6 +157,36 @@ memories_deinstantiate(WASMModuleInstance *module_inst,
     (void)module_inst;
 }
 
+#if WASM_ENABLE_MIGRATION != 0
+/**
+ * Whether the main instance is instantiated to restore a checkpoint image
+ * or a snapshot. Its linear memory and globals are overwritten by the image
+ * and its start function has run before the image was taken, so they are
+ * not initialized.
+ */
+static bool
+is_restore_instance(bool is_sub_inst)
+{
+    return !is_sub_inst && wasm_restore_skips_init();
+}
+
+/* Size of the globals overwritten by wasm_restore_global, 0 for others */
+static uint32
+restored_global_size(uint8 type)
+{
+    switch (type) {
+        case VALUE_TYPE_I32:
+        case VALUE_TYPE_F32:
+            return sizeof(int32);
+        case VALUE_TYPE_I64:
+        case VALUE_TYPE_F64:
+            return sizeof(int64);
+        default:
+            return 0;
+    }
+}
+#endif
+
 static WASMMemoryInstance *
 memory_instantiate(WASMModuleInstance *module_inst, WASMModuleInstance *parent,
                    WASMMemoryInstance *memory, uint32 memory_idx,
@@ -168,6 +201,9 @@ memory_instantiate(WASMModuleInstance *module_inst, WASMModuleInstance *parent,
         heap_offset = (uint64)num_bytes_per_page * init_page_count;
     uint64 memory_data_size, max_memory_data_size;
     uint8 *global_addr;
+#if WASM_ENABLE_MIGRATION != 0
+    uint32 image_page_count;
+#endif
 
     bool is_shared_memory = false;
 #if WASM_ENABLE_SHARED_MEMORY != 0
@@ -297,6 +333,16 @@ memory_instantiate(WASMModuleInstance *module_inst, WASMModuleInstance *parent,
             max_page_count = default_max_page;
     }
 
+#if WASM_ENABLE_MIGRATION != 0
+    /* Commit the pages recorded in the checkpoint image at once, so that
+       wasm_restore_memory doesn't enlarge the memory again */
+    if (memory_idx == 0 && is_restore_instance(parent != NULL)
+        && (image_page_count = wasm_restore_get_page_count()) > init_page_count
+        && image_page_count <= max_page_count) {
+        init_page_count = image_page_count;
+    }
+#endif
+
     LOG_VERBOSE("Memory instantiate:");
     LOG_VERBOSE("  page bytes: %u, init pages: %u, max pages: %u",
                 num_bytes_per_page, init_page_count, max_page_count);
@@ -718,10 +764,6 @@ functions_instantiate(const WASMModule *module, WASMModuleInstance *module_inst,
 
         function->local_offsets = function->u.func->local_offsets;
 
-#if WASM_ENABLE_FAST_INTERP != 0
-        function->const_cell_num = function->u.func->const_cell_num;
-#endif
-
         function++;
     }
     bh_assert((uint32)(function - functions) == function_count);
@@ -1388,6 +1430,13 @@ execute_post_instantiate_functions(WASMModuleInstance *module_inst,
     WASMExecEnv *exec_env = NULL, *exec_env_created = NULL;
     bool ret = false;
 
+#if WASM_ENABLE_MIGRATION != 0
+    if (is_restore_instance(is_sub_inst)) {
+        /* The effects of these functions are in the checkpoint image */
+        return true;
+    }
+#endif
+
 #if WASM_ENABLE_LIBC_WASI != 0
     /*
      * WASI reactor instances may assume that _initialize will be called by
@@ -2135,6 +2184,10 @@ wasm_instantiate(WASMModule *module, WASMModuleInstance *parent,
     bool ret = false;
 #endif
     const bool is_sub_inst = parent != NULL;
+#if WASM_ENABLE_MIGRATION != 0
+    const bool is_restore_inst = is_restore_instance(is_sub_inst);
+    uint32 global_size;
+#endif
 
     if (!module)
         return NULL;
@@ -2362,6 +2415,13 @@ wasm_instantiate(WASMModule *module, WASMModuleInstance *parent,
         global_data_end = global_data + module->global_data_size;
         global = globals;
         for (i = 0; i < global_count; i++, global++) {
+#if WASM_ENABLE_MIGRATION != 0
+            if (is_restore_inst
+                && (global_size = restored_global_size(global->type)) > 0) {
+                global_data += global_size;
+                continue;
+            }
+#endif
             switch (global->type) {
                 case VALUE_TYPE_I32:
                 case VALUE_TYPE_F32:
@@ -2474,6 +2534,12 @@ wasm_instantiate(WASMModule *module, WASMModuleInstance *parent,
                initialized */
             continue;
 
+#if WASM_ENABLE_MIGRATION != 0
+        if (is_restore_inst)
+            /* The memory data is restored from the checkpoint image */
+            continue;
+#endif
+
         /* has check it in loader */
         memory = module_inst->memories[data_seg->memory_index];
         bh_assert(memory);
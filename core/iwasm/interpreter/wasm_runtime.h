@@ -209,10 +209,6 @@ struct WASMFunctionInstance {
     uint16 ret_cell_num;
     /* cell num of local variables, 0 for import function */
     uint16 local_cell_num;
-#if WASM_ENABLE_FAST_INTERP != 0
-    /* cell num of consts */
-    uint16 const_cell_num;
-#endif
     uint16 *local_offsets;
     /* parameter types */
     uint8 *param_types;
@@ -297,6 +293,21 @@ typedef struct CApiFuncImport {
     void *env_arg;
 } CApiFuncImport;
 
+#if WASM_ENABLE_MIGRATION != 0
+/* Checkpoint and restore state of one instance, see
+   wasm_runtime_request_checkpoint and wasm_runtime_restore_instance */
+typedef struct WASMMigrationState {
+    /* exec_env of the main thread, the requests raise its suspend flags */
+    struct WASMExecEnv *exec_env;
+    /* Pending WASM_CHECKPOINT_REQUEST_* of this instance */
+    bh_atomic_32_t request;
+    /* Where the image of the requested checkpoint is written */
+    const char *sink;
+    /* Image restored by the next call into the instance */
+    const char *restore_source;
+} WASMMigrationState;
+#endif
+
 /* The common part of WASMModuleInstanceExtra and AOTModuleInstanceExtra */
 typedef struct WASMModuleInstanceExtraCommon {
 #if WASM_ENABLE_MODULE_INST_CONTEXT != 0
@@ -319,6 +330,9 @@ typedef struct WASMModuleInstanceExtraCommon {
     /* The gc heap created */
     void *gc_heap_handle;
 #endif
+#if WASM_ENABLE_MIGRATION != 0
+    WASMMigrationState migration;
+#endif
 } WASMModuleInstanceExtraCommon;
 
 /* Extra info of WASM module instance for interpreter/jit mode */
@@ -69,15 +69,17 @@ thread_start(void *arg)
     return NULL;
 }
 
+/* thread_id has been allocated by the caller and is released on failure,
+   prepare is called with the new instance before the thread starts */
 static int32
-thread_spawn_wrapper(wasm_exec_env_t exec_env, uint32 start_arg)
+spawn_thread(wasm_exec_env_t exec_env, uint32 start_arg, int32 thread_id,
+             void (*prepare)(wasm_module_inst_t, void *), void *prepare_arg)
 {
     wasm_module_t module = wasm_exec_env_get_module(exec_env);
     wasm_module_inst_t module_inst = get_module_inst(exec_env);
     wasm_module_inst_t new_module_inst = NULL;
     ThreadStartArg *thread_start_arg = NULL;
     wasm_function_inst_t start_func;
-    int32 thread_id;
     uint32 stack_size = 8192;
     int32 ret = -1;
 
@@ -88,7 +90,7 @@ thread_spawn_wrapper(wasm_exec_env_t exec_env, uint32 start_arg)
 
     if (!(new_module_inst = wasm_runtime_instantiate_internal(
               module, module_inst, exec_env, stack_size, 0, 0, NULL, 0)))
-        return -1;
+        goto thread_preparation_fail;
 
     wasm_runtime_set_custom_data_internal(
         new_module_inst, wasm_runtime_get_custom_data(module_inst));
@@ -111,27 +113,24 @@ thread_spawn_wrapper(wasm_exec_env_t exec_env, uint32 start_arg)
         goto thread_preparation_fail;
     }
 
-    thread_start_arg->thread_id = thread_id = allocate_thread_id();
-    if (thread_id < 0) {
-        LOG_ERROR("Failed to get thread identifier");
-        goto thread_preparation_fail;
-    }
+    thread_start_arg->thread_id = thread_id;
     thread_start_arg->arg = start_arg;
     thread_start_arg->start_func = start_func;
 
+    if (prepare)
+        prepare(new_module_inst, prepare_arg);
+
     ret = wasm_cluster_create_thread(exec_env, new_module_inst, false, 0, 0,
                                      thread_start, thread_start_arg);
     if (ret != 0) {
         LOG_ERROR("Failed to spawn a new thread");
-        goto thread_spawn_fail;
+        goto thread_preparation_fail;
     }
 
     return thread_id;
 
-thread_spawn_fail:
-    deallocate_thread_id(thread_id);
-
 thread_preparation_fail:
+    deallocate_thread_id(thread_id);
     if (new_module_inst)
         wasm_runtime_deinstantiate_internal(new_module_inst, true);
     if (thread_start_arg)
@@ -140,6 +139,52 @@ thread_preparation_fail:
     return -1;
 }
 
+static int32
+thread_spawn_wrapper(wasm_exec_env_t exec_env, uint32 start_arg)
+{
+    int32 thread_id = allocate_thread_id();
+
+    if (thread_id < 0) {
+        LOG_ERROR("Failed to get thread identifier");
+        return -1;
+    }
+
+    return spawn_thread(exec_env, start_arg, thread_id, NULL, NULL);
+}
+
+#if WASM_ENABLE_MIGRATION != 0
+int32
+wasi_threads_get_thread_id(wasm_exec_env_t exec_env)
+{
+    ThreadStartArg *thread_arg = exec_env->thread_arg;
+
+    if (exec_env->thread_start_routine != thread_start || !thread_arg)
+        return -1;
+    return thread_arg->thread_id;
+}
+
+int32
+wasi_threads_respawn_thread(wasm_exec_env_t exec_env, int32 thread_id,
+                            void (*prepare)(wasm_module_inst_t, void *),
+                            void *prepare_arg)
+{
+    bool reserved;
+
+    os_mutex_lock(&thread_id_lock);
+    reserved = tid_allocator_reserve_tid(&tid_allocator, thread_id);
+    os_mutex_unlock(&thread_id_lock);
+
+    if (!reserved) {
+        LOG_ERROR("Failed to reserve thread identifier %d", thread_id);
+        return -1;
+    }
+
+    /* The start arg is not used, the frames of the thread are rebuilt when
+       it enters the start function */
+    return spawn_thread(exec_env, 0, thread_id, prepare, prepare_arg);
+}
+#endif
+
 /* clang-format off */
 #define REG_NATIVE_FUNC(name, func_name, signature) \
     { name, func_name##_wrapper, signature, NULL }
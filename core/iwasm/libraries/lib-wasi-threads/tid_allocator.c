@@ -33,45 +33,81 @@ tid_allocator_deinit(TidAllocator *tid_allocator)
     wasm_runtime_free(tid_allocator->ids);
 }
 
+static bool
+tid_allocator_grow(TidAllocator *tid_allocator)
+{
+    if (tid_allocator->size == TID_MAX - TID_MIN + 1) {
+        LOG_ERROR("Maximum thread identifier reached");
+        return false;
+    }
+
+    uint32 old_size = tid_allocator->size;
+    uint32 new_size = MIN(tid_allocator->size * 2, TID_MAX - TID_MIN + 1);
+    if (new_size != TID_MAX - TID_MIN + 1
+        && new_size / 2 != tid_allocator->size) {
+        LOG_ERROR("Overflow detected during new size calculation");
+        return false;
+    }
+
+    size_t realloc_size = new_size * sizeof(int32);
+    if (realloc_size / sizeof(int32) != new_size) {
+        LOG_ERROR("Overflow detected during realloc");
+        return false;
+    }
+    int32 *tmp =
+        wasm_runtime_realloc(tid_allocator->ids, (uint32)realloc_size);
+    if (tmp == NULL) {
+        LOG_ERROR("Thread ID allocator realloc failed");
+        return false;
+    }
+
+    // Push the new thread ids below the available ones
+    uint32 added = new_size - old_size;
+    memmove(tmp + added, tmp, tid_allocator->pos * sizeof(int32));
+    for (int64 i = added - 1; i >= 0; i--)
+        tmp[i] = (uint32)(TID_MIN + (new_size - 1 - i));
+
+    tid_allocator->size = new_size;
+    tid_allocator->pos += added;
+    tid_allocator->ids = tmp;
+    return true;
+}
+
 int32
 tid_allocator_get_tid(TidAllocator *tid_allocator)
 {
     if (tid_allocator->pos == 0) { // Resize stack and push new thread ids
-        if (tid_allocator->size == TID_MAX - TID_MIN + 1) {
-            LOG_ERROR("Maximum thread identifier reached");
+        if (!tid_allocator_grow(tid_allocator))
             return -1;
-        }
+    }
 
-        uint32 old_size = tid_allocator->size;
-        uint32 new_size = MIN(tid_allocator->size * 2, TID_MAX - TID_MIN + 1);
-        if (new_size != TID_MAX - TID_MIN + 1
-            && new_size / 2 != tid_allocator->size) {
-            LOG_ERROR("Overflow detected during new size calculation");
-            return -1;
-        }
+    // Pop available thread identifier from the stack
+    return tid_allocator->ids[--tid_allocator->pos];
+}
 
-        size_t realloc_size = new_size * sizeof(int32);
-        if (realloc_size / sizeof(int32) != new_size) {
-            LOG_ERROR("Overflow detected during realloc");
-            return -1;
-        }
-        int32 *tmp =
-            wasm_runtime_realloc(tid_allocator->ids, (uint32)realloc_size);
-        if (tmp == NULL) {
-            LOG_ERROR("Thread ID allocator realloc failed");
-            return -1;
-        }
+bool
+tid_allocator_reserve_tid(TidAllocator *tid_allocator, int32 thread_id)
+{
+    if (thread_id < TID_MIN || thread_id > TID_MAX)
+        return false;
 
-        tid_allocator->size = new_size;
-        tid_allocator->pos = new_size - old_size;
-        tid_allocator->ids = tmp;
-        for (int64 i = tid_allocator->pos - 1; i >= 0; i--)
-            tid_allocator->ids[i] =
-                (uint32)(TID_MIN + (tid_allocator->size - 1 - i));
+    while ((uint32)(thread_id - TID_MIN) >= tid_allocator->size) {
+        if (!tid_allocator_grow(tid_allocator))
+            return false;
     }
 
-    // Pop available thread identifier from the stack
-    return tid_allocator->ids[--tid_allocator->pos];
+    // Remove the thread identifier from the available ones
+    for (uint32 i = 0; i < tid_allocator->pos; i++) {
+        if (tid_allocator->ids[i] == thread_id) {
+            memmove(tid_allocator->ids + i, tid_allocator->ids + i + 1,
+                    (tid_allocator->pos - i - 1) * sizeof(int32));
+            tid_allocator->pos--;
+            return true;
+        }
+    }
+
+    // Already in use
+    return false;
 }
 
 void
@@ -36,6 +36,11 @@ tid_allocator_deinit(TidAllocator *tid_allocator);
 int32
 tid_allocator_get_tid(TidAllocator *tid_allocator);
 
+/* Take a specific thread identifier, e.g. the one of a thread restored from
+   a checkpoint. Fails if it is already in use. */
+bool
+tid_allocator_reserve_tid(TidAllocator *tid_allocator, int32 thread_id);
+
 void
 tid_allocator_release_tid(TidAllocator *tid_allocator, int32 thread_id);
 
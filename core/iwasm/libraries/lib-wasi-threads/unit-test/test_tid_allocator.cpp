@@ -60,3 +60,20 @@ TEST_F(TidAllocatorTest, ShouldAllocateMoreThanAllowedTIDsIfOldTIDsAreReleased)
         ASSERT_TRUE(is_tid_valid(last_tid));
     }
 }
+
+TEST_F(TidAllocatorTest, ShouldReserveSpecificTID)
+{
+    int32 tid = TID_MIN + 2 * TID_ALLOCATOR_INIT_SIZE;
+
+    ASSERT_TRUE(tid_allocator_reserve_tid(&_allocator, tid));
+    ASSERT_FALSE(tid_allocator_reserve_tid(&_allocator, tid));
+
+    for (int32 i = 0; i < 4 * TID_ALLOCATOR_INIT_SIZE; i++) {
+        int32 last_tid = tid_allocator_get_tid(&_allocator);
+        ASSERT_TRUE(is_tid_valid(last_tid));
+        ASSERT_NE(last_tid, tid);
+    }
+
+    tid_allocator_release_tid(&_allocator, tid);
+    ASSERT_TRUE(tid_allocator_reserve_tid(&_allocator, tid));
+}
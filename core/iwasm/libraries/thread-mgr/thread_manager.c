@@ -1271,6 +1271,35 @@ wasm_cluster_suspend_all_except_self(WASMCluster *cluster,
     os_mutex_unlock(&cluster->lock);
 }
 
+#if WASM_ENABLE_MIGRATION != 0
+static void
+checkpoint_thread_visitor(void *node, void *user_data)
+{
+    WASMExecEnv *curr_exec_env = (WASMExecEnv *)node;
+    WASMExecEnv *exec_env = (WASMExecEnv *)user_data;
+
+    if (curr_exec_env == exec_env)
+        return;
+
+    WASM_SUSPEND_FLAGS_FETCH_OR(curr_exec_env->suspend_flags,
+                                WASM_SUSPEND_FLAG_CHECKPOINT);
+}
+
+uint32
+wasm_cluster_checkpoint_all_except_self(WASMCluster *cluster,
+                                        WASMExecEnv *exec_env)
+{
+    uint32 count;
+
+    os_mutex_lock(&cluster->lock);
+    traverse_list(&cluster->exec_env_list, checkpoint_thread_visitor,
+                  (void *)exec_env);
+    count = bh_list_length(&cluster->exec_env_list) - 1;
+    os_mutex_unlock(&cluster->lock);
+    return count;
+}
+#endif
+
 void
 wasm_cluster_resume_thread(WASMExecEnv *exec_env)
 {
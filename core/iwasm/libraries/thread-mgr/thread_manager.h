@@ -58,6 +58,19 @@ struct WASMCluster {
      */
     Vector exception_frames;
 #endif
+
+#if WASM_ENABLE_MIGRATION != 0
+    /* Threads parked for the checkpoint taken by the main thread, see
+       wasm_dump_park_thread */
+    struct WASMParkedThread *parked_threads;
+    uint32 parked_count;
+    /* Whether wasm_dump_stop_threads is still waiting for the threads to
+       park, a thread reaching its safepoint after it gave up doesn't park */
+    bool stopping_threads;
+    /* Threads respawned from a checkpoint image that haven't restored their
+       frames yet, see wasm_restore_begin_thread */
+    struct WASMRestoreThread *restore_threads;
+#endif
 };
 
 void
@@ -118,6 +131,14 @@ void
 wasm_cluster_suspend_all_except_self(WASMCluster *cluster,
                                      WASMExecEnv *exec_env);
 
+#if WASM_ENABLE_MIGRATION != 0
+/* Request all the threads except self to stop at their next safepoint for
+   a checkpoint, return the number of these threads */
+uint32
+wasm_cluster_checkpoint_all_except_self(WASMCluster *cluster,
+                                        WASMExecEnv *exec_env);
+#endif
+
 void
 wasm_cluster_suspend_thread(WASMExecEnv *exec_env);
 
@@ -0,0 +1,734 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../aot/aot_runtime.h"
+#include "wasm_migration.h"
+#include "wasm_dump.h"
+#include "wasm_restore.h"
+#include "wasm_image.h"
+#include "wasm_migration_stats.h"
+
+#if WASM_ENABLE_AOT != 0
+
+#define DUMP(buf, ptr, size)                                \
+    do {                                                    \
+        if (!wasm_image_buf_write(buf, ptr, size)) {        \
+            LOG_ERROR("failed to allocate image buffer\n"); \
+            return -1;                                      \
+        }                                                   \
+    } while (0)
+
+#define RESTORE(cursor, dst, size)                                 \
+    do {                                                           \
+        if (!wasm_image_cursor_read(cursor, dst, size)) {          \
+            LOG_ERROR("truncated section in checkpoint image\n"); \
+            return -1;                                             \
+        }                                                          \
+    } while (0)
+
+static AOTMemoryInstance *
+get_default_memory(AOTModuleInstance *module_inst)
+{
+    return module_inst->memories ? module_inst->memories[0] : NULL;
+}
+
+static AOTFuncCheckpointInfo *
+get_checkpoint_func(AOTModule *module, uint32 func_index)
+{
+    if (func_index < module->import_func_count
+        || func_index - module->import_func_count
+               >= module->checkpoint_func_count)
+        return NULL;
+    return module->checkpoint_funcs + (func_index - module->import_func_count);
+}
+
+static uint32
+get_max_local_cell_num(AOTModule *module, uint32 func_index)
+{
+    return module->max_local_cell_nums[func_index - module->import_func_count];
+}
+
+// safepointはip_offset順に並んでいるので二分探索する
+static AOTSafepoint *
+find_safepoint(AOTFuncCheckpointInfo *cp_func, uint32 ip_offset)
+{
+    uint32 low = 0, high = cp_func->safepoint_count, mid;
+
+    while (low < high) {
+        mid = low + (high - low) / 2;
+        if (cp_func->safepoints[mid].ip_offset < ip_offset)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    if (low == cp_func->safepoint_count
+        || cp_func->safepoints[low].ip_offset != ip_offset)
+        return NULL;
+    return cp_func->safepoints + low;
+}
+
+static uint32
+sum_cells(const uint8 *cells, uint32 count)
+{
+    uint32 cell_num = 0, i;
+
+    for (i = 0; i < count; i++)
+        cell_num += cells[i];
+    return cell_num;
+}
+
+// frameが止まっているsafepointを探す. topはloop, それ以外はcallで止まっている
+static AOTSafepoint *
+find_frame_safepoint(AOTModule *module, AOTFrame *frame, bool is_top)
+{
+    AOTFuncCheckpointInfo *cp_func;
+    AOTSafepoint *safepoint;
+
+    if (!(cp_func = get_checkpoint_func(module, (uint32)frame->func_index))) {
+        LOG_ERROR("can't checkpoint in import function %u\n",
+                  (uint32)frame->func_index);
+        return NULL;
+    }
+    safepoint = find_safepoint(cp_func, (uint32)frame->ip_offset);
+    if (!safepoint
+        || (is_top ? safepoint->kind != AOT_SAFEPOINT_LOOP
+                   : safepoint->kind == AOT_SAFEPOINT_LOOP)) {
+        LOG_ERROR("safepoint not found: func %u, ip offset %u\n",
+                  (uint32)frame->func_index, (uint32)frame->ip_offset);
+        return NULL;
+    }
+    return safepoint;
+}
+
+/* aot_checkpoint */
+int
+aot_checkpoint_dump_global(AOTModuleInstance *module_inst,
+                           WASMImageWriter *writer)
+{
+    AOTModule *module = (AOTModule *)module_inst->module;
+    WASMImageBuffer *buf =
+        wasm_image_writer_add_section(writer, IMAGE_SECTION_GLOBAL, 0);
+    uint32 i, data_offset;
+    uint8 type;
+
+    if (!buf)
+        return -1;
+
+    // interpreterと同じく、importのglobalから順に4/8byteずつ
+    for (i = 0; i < module->import_global_count + module->global_count; i++) {
+        if (i < module->import_global_count) {
+            type = module->import_globals[i].type.val_type;
+            data_offset = module->import_globals[i].data_offset;
+        }
+        else {
+            type = module->globals[i - module->import_global_count].type.val_type;
+            data_offset =
+                module->globals[i - module->import_global_count].data_offset;
+        }
+        switch (type) {
+            case VALUE_TYPE_I32:
+            case VALUE_TYPE_F32:
+                DUMP(buf, module_inst->global_data + data_offset,
+                     sizeof(uint32));
+                break;
+            case VALUE_TYPE_I64:
+            case VALUE_TYPE_F64:
+                DUMP(buf, module_inst->global_data + data_offset,
+                     sizeof(uint64));
+                break;
+            default:
+                LOG_ERROR("unsupported global type %u\n", type);
+                return -1;
+        }
+    }
+    return 0;
+}
+
+static int
+dump_frame(AOTModule *module, AOTFrame *frame, AOTSafepoint *safepoint,
+           AOTFrame *ret_frame, AOTSafepoint *ret_safepoint,
+           WASMImageBuffer *buf)
+{
+    AOTFuncCheckpointInfo *cp_func =
+        get_checkpoint_func(module, (uint32)frame->func_index);
+    uint32 value_count = safepoint->value_count - safepoint->arg_count;
+    uint32 full_type_stack_size, ctrl_stack_size, addr, i;
+    uint32 *values;
+
+    // リターンアドレス
+    // NOTE: 1番下のframeのときだけ、自分のsafepointを出力する
+    addr = (uint32)ret_frame->func_index;
+    DUMP(buf, &addr, sizeof(uint32));
+    DUMP(buf, &ret_safepoint->offset, sizeof(uint32));
+
+    // 型スタック. callの引数はcalleeのローカルにあるので含めない
+    full_type_stack_size = cp_func->local_count + value_count;
+    DUMP(buf, &full_type_stack_size, sizeof(uint32));
+    DUMP(buf, cp_func->local_cells, cp_func->local_count);
+    DUMP(buf, safepoint->value_cells, value_count);
+
+    // 値スタックの中身. AOTのコードがlpにspillしている
+    DUMP(buf, frame->lp,
+         sizeof(uint32) * sum_cells(cp_func->local_cells, cp_func->local_count));
+    values = frame->lp + get_max_local_cell_num(module, (uint32)frame->func_index);
+    DUMP(buf, values,
+         sizeof(uint32) * sum_cells(safepoint->value_cells, value_count));
+
+    // ラベルスタック. 関数のblockに続いてコンパイル時に記録したblock
+    ctrl_stack_size = safepoint->block_count + 1;
+    DUMP(buf, &ctrl_stack_size, sizeof(uint32));
+    addr = 0;
+    DUMP(buf, &addr, sizeof(uint32));
+    addr = cp_func->code_size - 1;
+    DUMP(buf, &addr, sizeof(uint32));
+    addr = 0;
+    DUMP(buf, &addr, sizeof(uint32));
+    DUMP(buf, &cp_func->ret_cell_num, sizeof(uint32));
+    for (i = 0; i < safepoint->block_count; i++) {
+        const uint32 *block = safepoint->blocks + i * 4;
+        DUMP(buf, &block[0], sizeof(uint32));
+        DUMP(buf, &block[1], sizeof(uint32));
+        // classicと同じくsp_bottomからのbyte数
+        addr = block[2] * sizeof(uint32);
+        DUMP(buf, &addr, sizeof(uint32));
+        DUMP(buf, &block[3], sizeof(uint32));
+    }
+    return 0;
+}
+
+// PROGRAM_COUNTERとSTACKをinterpreterと同じ形式で出力する
+static int
+dump_stack(AOTModule *module, AOTFrame *top_frame, WASMImageWriter *writer)
+{
+    WASMImageBuffer *pc_buf = wasm_image_writer_add_section(
+        writer, IMAGE_SECTION_PROGRAM_COUNTER, 0);
+    WASMImageBuffer *buf =
+        wasm_image_writer_add_section(writer, IMAGE_SECTION_STACK, 0);
+    AOTFrame *frame, *ret_frame;
+    AOTSafepoint *safepoint, *ret_safepoint;
+    uint32 i = 0, fidx, record_size;
+    uint64 record_start;
+
+    if (!pc_buf || !buf)
+        return -1;
+
+    if (!(safepoint = find_frame_safepoint(module, top_frame, true)))
+        return -1;
+    fidx = (uint32)top_frame->func_index;
+    DUMP(pc_buf, &fidx, sizeof(uint32));
+    DUMP(pc_buf, &safepoint->offset, sizeof(uint32));
+
+    // frame数は最後に埋める
+    DUMP(buf, &i, sizeof(uint32));
+
+    for (frame = top_frame; frame; frame = ret_frame) {
+        ret_frame = frame->prev_frame;
+        if (ret_frame) {
+            if (!(ret_safepoint = find_frame_safepoint(module, ret_frame, false)))
+                return -1;
+        }
+        else {
+            ret_safepoint = safepoint;
+        }
+
+        ++i;
+        record_size = 0;
+        DUMP(buf, &record_size, sizeof(uint32));
+        record_start = buf->size;
+
+        fidx = (uint32)frame->func_index;
+        DUMP(buf, &fidx, sizeof(uint32));
+        if (dump_frame(module, frame, safepoint, ret_frame ? ret_frame : frame,
+                       ret_safepoint, buf)
+            < 0)
+            return -1;
+
+        record_size = (uint32)(buf->size - record_start);
+        memcpy(buf->data + record_start - sizeof(uint32), &record_size,
+               sizeof(uint32));
+        safepoint = ret_safepoint;
+    }
+
+    // frame stackのサイズを保存
+    memcpy(buf->data, &i, sizeof(uint32));
+    wasm_migration_stats_add_frames(i);
+    // spawnされたthreadは止めないので、imageにはmainのthreadだけ
+    wasm_migration_stats_add_threads(1);
+    return 0;
+}
+
+bool
+aot_checkpoint(WASMExecEnv *exec_env)
+{
+    AOTModuleInstance *module_inst = (AOTModuleInstance *)exec_env->module_inst;
+    AOTModule *module = (AOTModule *)module_inst->module;
+    AOTMemoryInstance *memory = get_default_memory(module_inst);
+    WASMImageWriter writer;
+    uint32 request;
+    bool snapshot = false;
+    int rc = -1;
+    struct timespec ts1, ts2;
+
+    WASM_SUSPEND_FLAGS_FETCH_AND(exec_env->suspend_flags,
+                                 ~WASM_SUSPEND_FLAG_CHECKPOINT);
+    // spawnされたthreadはAOTでは止められないので、そのまま続ける
+    if (!wasm_dump_is_primary(exec_env))
+        return true;
+    request = wasm_get_checkpoint_request(exec_env);
+    if (request & WASM_CHECKPOINT_REQUEST_FINAL) {
+        wasm_migration_stats_begin(WASM_MIGRATION_CHECKPOINT);
+        if (wasm_dump_stop_threads(exec_env) < 0)
+            return !wasm_dump_end_checkpoint(exec_env, -1);
+        // 書き出し中のsnapshotと同じimageを書かないように待つ
+        wasm_dump_wait_snapshot();
+    }
+    else if (request & WASM_CHECKPOINT_REQUEST_SNAPSHOT) {
+        wasm_migration_stats_begin(WASM_MIGRATION_SNAPSHOT);
+        if (wasm_dump_stop_threads(exec_env) < 0) {
+            wasm_clear_checkpoint_request(exec_env,
+                                          WASM_CHECKPOINT_REQUEST_SNAPSHOT);
+            LOG_WARNING("failed to stop threads for snapshot\n");
+            return true;
+        }
+        // 親はそのまま続け、forkした子がimageを書く
+        if (wasm_dump_fork_snapshot(exec_env) != 0)
+            return true;
+        snapshot = true;
+    }
+    else {
+        // pre-copyのroundはAOTでは取らないので、requestを捨てて続ける
+        wasm_clear_checkpoint_request(exec_env,
+                                      WASM_CHECKPOINT_REQUEST_PRECOPY);
+        return true;
+    }
+
+    wasm_image_writer_init(&writer);
+
+    // dump linear memory
+    clock_gettime(CLOCK_MONOTONIC, &ts1);
+    if (memory)
+        rc = wasm_dump_memory(memory, &writer, NULL, 0);
+    clock_gettime(CLOCK_MONOTONIC, &ts2);
+    wasm_migration_stats_phase(WASM_MIGRATION_PHASE_MEMORY, get_time(ts1, ts2));
+    if (rc < 0) {
+        LOG_ERROR("Failed to dump linear memory\n");
+        goto fail;
+    }
+
+    // dump globals
+    clock_gettime(CLOCK_MONOTONIC, &ts1);
+    rc = aot_checkpoint_dump_global(module_inst, &writer);
+    clock_gettime(CLOCK_MONOTONIC, &ts2);
+    wasm_migration_stats_phase(WASM_MIGRATION_PHASE_GLOBAL, get_time(ts1, ts2));
+    if (rc < 0) {
+        LOG_ERROR("Failed to dump globals\n");
+        goto fail;
+    }
+
+    // dump program counter and stack
+    clock_gettime(CLOCK_MONOTONIC, &ts1);
+    rc = dump_stack(module, (AOTFrame *)exec_env->cur_frame, &writer);
+    clock_gettime(CLOCK_MONOTONIC, &ts2);
+    wasm_migration_stats_phase(WASM_MIGRATION_PHASE_STACK, get_time(ts1, ts2));
+    if (rc < 0) {
+        LOG_ERROR("Failed to dump frame\n");
+        goto fail;
+    }
+
+    // write image
+    clock_gettime(CLOCK_MONOTONIC, &ts1);
+    if (!wasm_dump_write_image(exec_env, &writer))
+        rc = -1;
+    clock_gettime(CLOCK_MONOTONIC, &ts2);
+    wasm_migration_stats_phase(WASM_MIGRATION_PHASE_WRITE, get_time(ts1, ts2));
+    if (rc < 0) {
+        LOG_ERROR("Failed to write checkpoint image\n");
+        goto fail;
+    }
+
+    wasm_image_writer_destroy(&writer);
+    LOG_VERBOSE("Success to dump img for wamr\n");
+    if (snapshot) {
+        wasm_migration_stats_end(true);
+        _exit(0);
+    }
+    // instanceへのrequestなら、exceptionでこのinstanceの呼び出しだけ終わる
+    wasm_dump_end_checkpoint(exec_env, 0);
+    return false;
+
+fail:
+    wasm_image_writer_destroy(&writer);
+    if (snapshot) {
+        wasm_migration_stats_end(false);
+        _exit(1);
+    }
+    return !wasm_dump_end_checkpoint(exec_env, -1);
+}
+
+/* aot_restore_frame */
+// imageのframeをbottomから順に、AOTのコードが関数に入るたびに1つずつ戻す
+// 別々のinstanceが別々のthreadで同時にrestoreできるよう、thread localに持つ
+static os_thread_local_attribute struct {
+    const uint8 **records;
+    uint32 *record_sizes;
+    uint32 frame_count;
+    // 次に戻すrecord (1-origin, topが1)
+    uint32 next;
+    uint32 pc_offset;
+    struct timespec ts;
+} aot_restore;
+
+static void
+finish_restore(WASMExecEnv *exec_env, bool success)
+{
+    wasm_migration_stats_end(success);
+    WASM_SUSPEND_FLAGS_FETCH_AND(exec_env->suspend_flags,
+                                 ~WASM_SUSPEND_FLAG_RESTORE);
+    free(aot_restore.records);
+    free(aot_restore.record_sizes);
+    memset(&aot_restore, 0, sizeof(aot_restore));
+    close_restore_image();
+}
+
+int
+aot_checkpoint_restore_global(AOTModuleInstance *module_inst,
+                              WASMImageReader *image)
+{
+    AOTModule *module = (AOTModule *)module_inst->module;
+    WASMImageCursor cursor;
+    uint32 i, data_offset;
+    uint8 type;
+
+    if (!wasm_image_reader_cursor(image, IMAGE_SECTION_GLOBAL, &cursor))
+        return -1;
+
+    for (i = 0; i < module->import_global_count + module->global_count; i++) {
+        if (i < module->import_global_count) {
+            type = module->import_globals[i].type.val_type;
+            data_offset = module->import_globals[i].data_offset;
+        }
+        else {
+            type = module->globals[i - module->import_global_count].type.val_type;
+            data_offset =
+                module->globals[i - module->import_global_count].data_offset;
+        }
+        switch (type) {
+            case VALUE_TYPE_I32:
+            case VALUE_TYPE_F32:
+                RESTORE(&cursor, module_inst->global_data + data_offset,
+                        sizeof(uint32));
+                break;
+            case VALUE_TYPE_I64:
+            case VALUE_TYPE_F64:
+                RESTORE(&cursor, module_inst->global_data + data_offset,
+                        sizeof(uint64));
+                break;
+            default:
+                LOG_ERROR("unsupported global type %u\n", type);
+                return -1;
+        }
+    }
+    return 0;
+}
+
+// STACK sectionの各recordの位置を集める. 1番下のframeの関数を返す
+static int
+load_records(WASMImageReader *image, uint32 *bottom_fidx)
+{
+    WASMImageCursor cursor;
+    uint32 pc_fidx, i;
+
+    if (wasm_image_reader_find(image, IMAGE_SECTION_THREADS)) {
+        LOG_ERROR("threads in checkpoint image can't be restored by AOT\n");
+        return -1;
+    }
+    if (read_program_counter(image, &pc_fidx, &aot_restore.pc_offset) < 0
+        || !wasm_image_reader_cursor(image, IMAGE_SECTION_STACK, &cursor))
+        return -1;
+    RESTORE(&cursor, &aot_restore.frame_count, sizeof(uint32));
+    if (aot_restore.frame_count == 0)
+        return -1;
+
+    aot_restore.records = malloc(sizeof(uint8 *) * aot_restore.frame_count);
+    aot_restore.record_sizes = malloc(sizeof(uint32) * aot_restore.frame_count);
+    if (!aot_restore.records || !aot_restore.record_sizes)
+        return -1;
+    for (i = 0; i < aot_restore.frame_count; i++) {
+        if (!wasm_image_cursor_read(&cursor, &aot_restore.record_sizes[i],
+                                    sizeof(uint32))
+            || aot_restore.record_sizes[i] < sizeof(uint32) * 3
+            || !(aot_restore.records[i] = wasm_image_cursor_skip(
+                     &cursor, aot_restore.record_sizes[i]))) {
+            LOG_ERROR("truncated stack section in checkpoint image\n");
+            return -1;
+        }
+    }
+
+    aot_restore.next = aot_restore.frame_count;
+    memcpy(bottom_fidx, aot_restore.records[aot_restore.frame_count - 1],
+           sizeof(uint32));
+    return 0;
+}
+
+bool
+aot_checkpoint_prepare_call(WASMExecEnv *exec_env,
+                            AOTFunctionInstance *function)
+{
+    AOTModuleInstance *module_inst = (AOTModuleInstance *)exec_env->module_inst;
+    AOTModule *module = (AOTModule *)module_inst->module;
+    AOTMemoryInstance *memory = get_default_memory(module_inst);
+    WASMImageReader *image;
+    uint32 bottom_fidx;
+    uint8 *maddr;
+    bool instance;
+    int rc;
+    struct timespec ts1, ts2;
+
+    if (!module->checkpoint_funcs)
+        return true;
+
+    wasm_dump_register_exec_env(exec_env);
+
+    // imageを取った関数が呼ばれたときだけrestoreする
+    if (exec_env->cur_frame)
+        return true;
+    if (!(instance = wasm_restore_begin_instance(exec_env))
+        && !get_restore_flag())
+        return true;
+    wasm_migration_stats_begin(WASM_MIGRATION_RESTORE);
+    if (!(image = get_restore_image()) || load_records(image, &bottom_fidx) < 0) {
+        finish_restore(exec_env, false);
+        aot_set_exception(module_inst, "failed to load checkpoint image");
+        return false;
+    }
+    // instanceのrestoreはinstantiateの後なので、最初の呼び出しがimageの関数のはず
+    if (instance && bottom_fidx != function->func_index) {
+        finish_restore(exec_env, false);
+        aot_set_exception(module_inst,
+                          "checkpoint image was taken in another function");
+        return false;
+    }
+    if (bottom_fidx != function->func_index) {
+        free(aot_restore.records);
+        free(aot_restore.record_sizes);
+        memset(&aot_restore, 0, sizeof(aot_restore));
+        return true;
+    }
+    set_restore_flag(false);
+    wasm_migration_stats_add_frames(aot_restore.frame_count);
+    wasm_migration_stats_add_threads(1);
+
+    // restore memory
+    clock_gettime(CLOCK_MONOTONIC, &ts1);
+    rc = memory ? wasm_restore_memory(module_inst, &memory, &maddr) : -1;
+    clock_gettime(CLOCK_MONOTONIC, &ts2);
+    wasm_migration_stats_phase(WASM_MIGRATION_PHASE_MEMORY, get_time(ts1, ts2));
+    if (rc < 0) {
+        LOG_ERROR("Failed to restore linear memory\n");
+        goto fail;
+    }
+
+    // restore globals
+    clock_gettime(CLOCK_MONOTONIC, &ts1);
+    rc = aot_checkpoint_restore_global(module_inst, image);
+    clock_gettime(CLOCK_MONOTONIC, &ts2);
+    wasm_migration_stats_phase(WASM_MIGRATION_PHASE_GLOBAL, get_time(ts1, ts2));
+    if (rc < 0) {
+        LOG_ERROR("Failed to restore globals\n");
+        goto fail;
+    }
+
+    // frameはAOTのコードがaot_restore_frameで1つずつ戻す
+    clock_gettime(CLOCK_MONOTONIC, &aot_restore.ts);
+    WASM_SUSPEND_FLAGS_FETCH_OR(exec_env->suspend_flags,
+                                WASM_SUSPEND_FLAG_RESTORE);
+    return true;
+
+fail:
+    finish_restore(exec_env, false);
+    aot_set_exception(module_inst, "failed to restore checkpoint");
+    return false;
+}
+
+// call_indirectの要素番号は、calleeを指すtableの要素から探す
+static int
+find_table_elem(AOTModuleInstance *module_inst, uint32 tbl_idx, uint32 fidx,
+                uint32 *elem_idx)
+{
+    AOTTableInstance *table;
+    uint32 i;
+
+    if (tbl_idx >= module_inst->table_count)
+        return -1;
+    table = module_inst->tables[tbl_idx];
+#if WASM_ENABLE_GC == 0
+    for (i = 0; i < table->cur_size; i++) {
+        if ((uint32)table->elems[i] == fidx) {
+            *elem_idx = i;
+            return 0;
+        }
+    }
+#else
+    (void)table;
+    (void)i;
+#endif
+    LOG_ERROR("function %u not found in table %u\n", fidx, tbl_idx);
+    return -1;
+}
+
+// callの引数はcalleeのrecordの先頭のローカルから戻す
+static int
+restore_call_args(AOTModuleInstance *module_inst, AOTSafepoint *safepoint,
+                  uint32 *args, uint32 callee_idx)
+{
+    WASMImageCursor callee;
+    uint32 fidx, full_type_stack_size, arg_cell_num, arg_count;
+
+    callee.p = aot_restore.records[callee_idx];
+    callee.end = callee.p + aot_restore.record_sizes[callee_idx];
+    RESTORE(&callee, &fidx, sizeof(uint32));
+    if (!wasm_image_cursor_skip(&callee, sizeof(uint32) * 2))
+        return -1;
+    RESTORE(&callee, &full_type_stack_size, sizeof(uint32));
+    if (!wasm_image_cursor_skip(&callee, full_type_stack_size))
+        return -1;
+
+    arg_count = safepoint->arg_count;
+    if (safepoint->kind == AOT_SAFEPOINT_CALL_INDIRECT)
+        arg_count--;
+    arg_cell_num = sum_cells(safepoint->value_cells + safepoint->value_count
+                                 - safepoint->arg_count,
+                             arg_count);
+    RESTORE(&callee, args, sizeof(uint32) * arg_cell_num);
+
+    if (safepoint->kind == AOT_SAFEPOINT_CALL_INDIRECT)
+        return find_table_elem(module_inst, safepoint->tbl_idx, fidx,
+                               args + arg_cell_num);
+    return 0;
+}
+
+static int
+restore_frame(AOTModuleInstance *module_inst, AOTFrame *frame,
+              WASMImageCursor *record, bool is_top, uint32 *p_index)
+{
+    AOTModule *module = (AOTModule *)module_inst->module;
+    AOTFuncCheckpointInfo *cp_func;
+    AOTSafepoint *safepoint = NULL;
+    uint32 fidx, offset_now, full_type_stack_size, value_count, ctrl_count, i;
+    uint32 *values;
+    const uint8 *type_stack;
+
+    RESTORE(record, &fidx, sizeof(uint32));
+    if (fidx != (uint32)frame->func_index
+        || !(cp_func = get_checkpoint_func(module, fidx))) {
+        LOG_ERROR("function mismatch in checkpoint image: %u\n", fidx);
+        return -1;
+    }
+
+    // topのframeはprogram counter, それ以外は1つ上のframeのリターンアドレスで止まっている
+    if (is_top)
+        offset_now = aot_restore.pc_offset;
+    else
+        memcpy(&offset_now,
+               aot_restore.records[aot_restore.next - 2] + sizeof(uint32) * 2,
+               sizeof(uint32));
+    for (i = 0; i < cp_func->safepoint_count; i++) {
+        if (cp_func->safepoints[i].offset == offset_now
+            && (cp_func->safepoints[i].kind == AOT_SAFEPOINT_LOOP) == is_top) {
+            safepoint = cp_func->safepoints + i;
+            break;
+        }
+    }
+    if (!safepoint) {
+        LOG_ERROR("safepoint not found in checkpoint image: func %u, "
+                  "offset %u\n",
+                  fidx, offset_now);
+        return -1;
+    }
+
+    // リターンアドレスはcallerのsafepointで決まるので読み飛ばす
+    if (!wasm_image_cursor_skip(record, sizeof(uint32) * 2))
+        return -1;
+
+    // 型スタックがsafepointのものと一致することを確認する
+    value_count = safepoint->value_count - safepoint->arg_count;
+    RESTORE(record, &full_type_stack_size, sizeof(uint32));
+    if (full_type_stack_size != cp_func->local_count + value_count
+        || !(type_stack = wasm_image_cursor_skip(record, full_type_stack_size))
+        || memcmp(type_stack, cp_func->local_cells, cp_func->local_count) != 0
+        || memcmp(type_stack + cp_func->local_count, safepoint->value_cells,
+                  value_count)
+               != 0) {
+        LOG_ERROR("type stack mismatch in checkpoint image: offset %u\n",
+                  offset_now);
+        return -1;
+    }
+
+    // 値スタックの中身
+    RESTORE(record, frame->lp,
+            sizeof(uint32)
+                * sum_cells(cp_func->local_cells, cp_func->local_count));
+    values = frame->lp + get_max_local_cell_num(module, fidx);
+    RESTORE(record, values,
+            sizeof(uint32) * sum_cells(safepoint->value_cells, value_count));
+
+    // ラベルスタックはAOTのコードが持っているので読み飛ばす
+    RESTORE(record, &ctrl_count, sizeof(uint32));
+    if (ctrl_count != safepoint->block_count + 1
+        || !wasm_image_cursor_skip(record, sizeof(uint32) * 4 * ctrl_count)) {
+        LOG_ERROR("invalid label stack in checkpoint image\n");
+        return -1;
+    }
+
+    if (!is_top
+        && restore_call_args(
+               module_inst, safepoint,
+               values + sum_cells(safepoint->value_cells, value_count),
+               aot_restore.next - 2)
+               < 0)
+        return -1;
+
+    // 次のcheckpointでこのframeのsafepointが見つかるように
+    frame->ip_offset = safepoint->ip_offset;
+    *p_index = (uint32)(safepoint - cp_func->safepoints);
+    return 0;
+}
+
+int32
+aot_restore_frame(WASMExecEnv *exec_env)
+{
+    AOTModuleInstance *module_inst = (AOTModuleInstance *)exec_env->module_inst;
+    WASMImageCursor record;
+    uint32 i = aot_restore.next, index;
+    bool is_top = (i == 1);
+    struct timespec ts;
+
+    if (i == 0) {
+        finish_restore(exec_env, false);
+        aot_set_exception(module_inst, "no frame to restore");
+        return -1;
+    }
+
+    record.p = aot_restore.records[i - 1];
+    record.end = record.p + aot_restore.record_sizes[i - 1];
+    if (restore_frame(module_inst, (AOTFrame *)exec_env->cur_frame, &record,
+                      is_top, &index)
+        < 0) {
+        finish_restore(exec_env, false);
+        aot_set_exception(module_inst, "failed to restore frame");
+        return -1;
+    }
+    aot_restore.next--;
+
+    if (is_top) {
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        wasm_migration_stats_phase(WASM_MIGRATION_PHASE_STACK,
+                                   get_time(aot_restore.ts, ts));
+        finish_restore(exec_env, true);
+    }
+    return (int32)index;
+}
+
+#endif /* end of WASM_ENABLE_AOT != 0 */
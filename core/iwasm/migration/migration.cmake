@@ -2,6 +2,11 @@ set (MIGRATION_DIR ${CMAKE_CURRENT_LIST_DIR})
 
 add_definitions (-DWASM_ENABLE_MIGRATION=1)
 
+# AOT code compiled with --enable-checkpoint keeps its frames in AOTFrame
+if (WAMR_BUILD_AOT EQUAL 1)
+    set (WAMR_BUILD_AOT_STACK_FRAME 1)
+endif ()
+
 include_directories(${MIGRATION_DIR})
 
 file (GLOB source_all ${MIGRATION_DIR}/*.c)
@@ -0,0 +1,507 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#ifdef BH_PLATFORM_LINUX
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/fs.h>
+#include <linux/userfaultfd.h>
+#endif
+
+#include "wasm_dirty_tracker.h"
+
+#define PAGEMAP_SOFT_DIRTY_BIT 55
+/* Number of pagemap entries read by one pread */
+#define PAGEMAP_BATCH 1024
+
+#if defined(PAGEMAP_SCAN) && defined(PAGE_IS_SOFT_DIRTY)
+#define PAGEMAP_SCAN_REGIONS 256
+static bool pagemap_scan_supported = true;
+#endif
+
+#if defined(PAGEMAP_SCAN) && defined(PAGE_IS_WRITTEN) \
+    && defined(UFFD_FEATURE_WP_ASYNC)
+#define DIRTY_TRACKER_UFFD_WP_SUPPORTED 1
+#endif
+
+static WASMDirtyTrackerMode tracker_mode = DIRTY_TRACKER_NONE;
+static uint8 *tracked_base = NULL;
+static uint64 tracked_size = 0;
+
+/* soft-dirty */
+static bool soft_dirty_probed = false;
+static bool soft_dirty_supported = false;
+static int pagemap_fd = -1;
+static int clear_refs_fd = -1;
+
+#ifdef DIRTY_TRACKER_UFFD_WP_SUPPORTED
+/* userfaultfd, the range registered to it */
+static bool uffd_probed = false;
+static bool uffd_supported = false;
+static int uffd = -1;
+static uint8 *uffd_base = NULL;
+static uint64 uffd_size = 0;
+#endif
+
+/* mprotect, one byte per page so that the signal handler can update it
+   without read-modify-write races */
+static volatile uint8 *wp_pages = NULL;
+static struct sigaction prev_sigsegv_act;
+static bool wp_handler_installed = false;
+
+static inline uint64
+page_count_of(uint64 size)
+{
+    return (size + DIRTY_TRACKER_PAGE_SIZE - 1) / DIRTY_TRACKER_PAGE_SIZE;
+}
+
+#ifdef BH_PLATFORM_LINUX
+static bool
+clear_soft_dirty()
+{
+    // "4"でプロセス全体のsoft-dirty bitをクリアする
+    return write(clear_refs_fd, "4", 1) == 1;
+}
+
+static int
+read_soft_dirty(const uint8 *addr)
+{
+    uint64 entry;
+    off_t offset =
+        (off_t)((uintptr_t)addr / DIRTY_TRACKER_PAGE_SIZE) * sizeof(uint64);
+
+    if (pread(pagemap_fd, &entry, sizeof(uint64), offset) != sizeof(uint64))
+        return -1;
+    return (entry >> PAGEMAP_SOFT_DIRTY_BIT) & 1;
+}
+
+#if defined(PAGEMAP_SCAN) && defined(PAGE_IS_SOFT_DIRTY)
+// Linux 6.7以降: categoryに当たるページの範囲だけをカーネルから受け取る
+static bool
+collect_scan(uint8 *base, uint64 page_count, uint8 *bitmap, uint64 category)
+{
+    struct page_region regions[PAGEMAP_SCAN_REGIONS];
+    struct pm_scan_arg arg;
+    uint64 end = (uint64)(uintptr_t)base + page_count * DIRTY_TRACKER_PAGE_SIZE;
+
+    memset(&arg, 0, sizeof(arg));
+    arg.size = sizeof(arg);
+    arg.start = (uint64)(uintptr_t)base;
+    arg.end = end;
+    arg.vec = (uint64)(uintptr_t)regions;
+    arg.vec_len = PAGEMAP_SCAN_REGIONS;
+    arg.category_mask = category;
+    arg.return_mask = category;
+
+    do {
+        int n = ioctl(pagemap_fd, PAGEMAP_SCAN, &arg);
+        if (n < 0)
+            return false;
+        for (int i = 0; i < n; i++) {
+            uint64 first =
+                (regions[i].start - (uint64)(uintptr_t)base)
+                / DIRTY_TRACKER_PAGE_SIZE;
+            uint64 last = (regions[i].end - (uint64)(uintptr_t)base)
+                          / DIRTY_TRACKER_PAGE_SIZE;
+            for (uint64 page = first; page < last; page++)
+                wasm_dirty_bitmap_set(bitmap, page);
+        }
+        arg.start = arg.walk_end;
+    } while (arg.walk_end < end);
+
+    return true;
+}
+#endif
+
+// pagemapを1ページずつではなく、PAGEMAP_BATCHエントリずつまとめて読む
+static bool
+collect_soft_dirty(uint8 *base, uint64 page_count, uint8 *bitmap)
+{
+    uint64 entries[PAGEMAP_BATCH];
+    uint64 first_pfn = (uint64)(uintptr_t)base / DIRTY_TRACKER_PAGE_SIZE;
+    uint64 i, j, n;
+
+#if defined(PAGEMAP_SCAN) && defined(PAGE_IS_SOFT_DIRTY)
+    if (pagemap_scan_supported) {
+        if (collect_scan(base, page_count, bitmap, PAGE_IS_SOFT_DIRTY))
+            return true;
+        // 古いカーネルではENOTTYになるので、以降はpreadを使う
+        pagemap_scan_supported = false;
+        memset(bitmap, 0, (page_count + 7) / 8);
+    }
+#endif
+
+    for (i = 0; i < page_count; i += n) {
+        ssize_t bytes;
+
+        n = page_count - i < PAGEMAP_BATCH ? page_count - i : PAGEMAP_BATCH;
+        bytes = pread(pagemap_fd, entries, n * sizeof(uint64),
+                      (off_t)((first_pfn + i) * sizeof(uint64)));
+        if (bytes <= 0)
+            return false;
+        n = (uint64)bytes / sizeof(uint64);
+        if (n == 0)
+            return false;
+
+        for (j = 0; j < n; j++) {
+            if ((entries[j] >> PAGEMAP_SOFT_DIRTY_BIT) & 1)
+                wasm_dirty_bitmap_set(bitmap, i + j);
+        }
+    }
+    return true;
+}
+
+// カーネルがCONFIG_MEM_SOFT_DIRTYでなければbitが立たないので、実際に書き込んで確認する
+static bool
+probe_soft_dirty()
+{
+    volatile uint8 *page;
+    bool ok = false;
+
+    if (os_getpagesize() != DIRTY_TRACKER_PAGE_SIZE)
+        return false;
+
+    clear_refs_fd = open("/proc/self/clear_refs", O_WRONLY);
+    pagemap_fd = open("/proc/self/pagemap", O_RDONLY);
+    if (clear_refs_fd < 0 || pagemap_fd < 0)
+        goto fail;
+
+    page = mmap(NULL, DIRTY_TRACKER_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (page == MAP_FAILED)
+        goto fail;
+
+    page[0] = 1;
+    if (clear_soft_dirty() && read_soft_dirty((uint8 *)page) == 0) {
+        page[0] = 2;
+        ok = read_soft_dirty((uint8 *)page) == 1;
+    }
+    munmap((void *)page, DIRTY_TRACKER_PAGE_SIZE);
+
+    if (ok)
+        return true;
+
+fail:
+    if (clear_refs_fd >= 0)
+        close(clear_refs_fd);
+    if (pagemap_fd >= 0)
+        close(pagemap_fd);
+    clear_refs_fd = pagemap_fd = -1;
+    return false;
+}
+
+#ifdef DIRTY_TRACKER_UFFD_WP_SUPPORTED
+static int
+open_uffd(uint64 features)
+{
+    struct uffdio_api api;
+    int fd;
+
+    // unprivileged_userfaultfd=0でもuser modeのfaultだけなら開ける
+    fd = (int)syscall(SYS_userfaultfd,
+                      O_CLOEXEC | O_NONBLOCK | UFFD_USER_MODE_ONLY);
+    if (fd < 0)
+        return -1;
+    memset(&api, 0, sizeof(api));
+    api.api = UFFD_API;
+    api.features = features;
+    if (ioctl(fd, UFFDIO_API, &api) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static bool
+probe_uffd_wp()
+{
+    if (os_getpagesize() != DIRTY_TRACKER_PAGE_SIZE)
+        return false;
+
+    // 触っていないページも保護できれば、読んだだけのページをdirtyと数えない
+    uffd = open_uffd(UFFD_FEATURE_WP_ASYNC | UFFD_FEATURE_WP_UNPOPULATED);
+    if (uffd < 0)
+        uffd = open_uffd(UFFD_FEATURE_WP_ASYNC);
+    if (uffd < 0)
+        return false;
+    if (pagemap_fd < 0
+        && (pagemap_fd = open("/proc/self/pagemap", O_RDONLY)) < 0) {
+        close(uffd);
+        uffd = -1;
+        return false;
+    }
+    return true;
+}
+
+static void
+unregister_uffd_range()
+{
+    struct uffdio_range range;
+
+    if (!uffd_base)
+        return;
+    // 登録を外すと書き込み保護も外れる
+    range.start = (uint64)(uintptr_t)uffd_base;
+    range.len = uffd_size;
+    ioctl(uffd, UFFDIO_UNREGISTER, &range);
+    uffd_base = NULL;
+    uffd_size = 0;
+}
+
+// 範囲だけを書き込み保護して次のepochを始める
+static bool
+protect_uffd_range(uint8 *base, uint64 size)
+{
+    struct uffdio_register reg;
+    struct uffdio_writeprotect wp;
+
+    // memory.growで大きさが変わったら登録し直す
+    if (base != uffd_base || size != uffd_size) {
+        unregister_uffd_range();
+        memset(&reg, 0, sizeof(reg));
+        reg.range.start = (uint64)(uintptr_t)base;
+        reg.range.len = size;
+        reg.mode = UFFDIO_REGISTER_MODE_WP;
+        if (ioctl(uffd, UFFDIO_REGISTER, &reg) != 0)
+            return false;
+        uffd_base = base;
+        uffd_size = size;
+    }
+
+    memset(&wp, 0, sizeof(wp));
+    wp.range.start = (uint64)(uintptr_t)base;
+    wp.range.len = size;
+    wp.mode = UFFDIO_WRITEPROTECT_MODE_WP;
+    return ioctl(uffd, UFFDIO_WRITEPROTECT, &wp) == 0;
+}
+#endif /* end of DIRTY_TRACKER_UFFD_WP_SUPPORTED */
+#endif /* end of BH_PLATFORM_LINUX */
+
+static void
+wp_signal_handler(int sig_num, siginfo_t *sig_info, void *sig_ucontext)
+{
+    uint8 *addr = sig_info->si_addr;
+
+    if (tracker_mode == DIRTY_TRACKER_MPROTECT && wp_pages
+        && addr >= tracked_base && addr < tracked_base + tracked_size) {
+        uint64 page = (uint64)(addr - tracked_base) / DIRTY_TRACKER_PAGE_SIZE;
+        if (!wp_pages[page]) {
+            wp_pages[page] = 1;
+            if (mprotect(tracked_base + page * DIRTY_TRACKER_PAGE_SIZE,
+                         DIRTY_TRACKER_PAGE_SIZE, PROT_READ | PROT_WRITE)
+                == 0)
+                return;
+        }
+    }
+
+    /* Not a tracked write, forward to the previous handler, e.g. the
+       runtime's out of bounds access handler */
+    if (prev_sigsegv_act.sa_flags & SA_SIGINFO) {
+        prev_sigsegv_act.sa_sigaction(sig_num, sig_info, sig_ucontext);
+    }
+    else if ((void *)prev_sigsegv_act.sa_handler != SIG_DFL
+             && (void *)prev_sigsegv_act.sa_handler != SIG_IGN) {
+        prev_sigsegv_act.sa_handler(sig_num);
+    }
+    else {
+        /* Let the faulting instruction raise the signal again */
+        signal(sig_num, SIG_DFL);
+    }
+}
+
+static bool
+install_wp_handler()
+{
+    struct sigaction sig_act;
+
+    if (wp_handler_installed)
+        return true;
+
+    memset(&sig_act, 0, sizeof(sig_act));
+    sig_act.sa_sigaction = wp_signal_handler;
+    sig_act.sa_flags = SA_SIGINFO | SA_NODEFER | SA_ONSTACK;
+    sigemptyset(&sig_act.sa_mask);
+    if (sigaction(SIGSEGV, &sig_act, &prev_sigsegv_act) != 0) {
+        LOG_ERROR("failed to install dirty tracker signal handler\n");
+        return false;
+    }
+    wp_handler_installed = true;
+    return true;
+}
+
+static bool
+write_protect_range()
+{
+    memset((void *)wp_pages, 0, page_count_of(tracked_size));
+    if (mprotect(tracked_base, tracked_size, PROT_READ) != 0) {
+        LOG_ERROR("failed to write protect linear memory\n");
+        return false;
+    }
+    return true;
+}
+
+static WASMDirtyTrackerMode
+select_mode()
+{
+#ifdef DIRTY_TRACKER_UFFD_WP_SUPPORTED
+    if (!uffd_probed) {
+        uffd_supported = probe_uffd_wp();
+        uffd_probed = true;
+    }
+    if (uffd_supported)
+        return DIRTY_TRACKER_UFFD_WP;
+#endif
+#ifdef BH_PLATFORM_LINUX
+    if (!soft_dirty_probed) {
+        soft_dirty_supported = probe_soft_dirty();
+        soft_dirty_probed = true;
+        if (!soft_dirty_supported)
+            LOG_VERBOSE("soft-dirty unavailable, use mprotect dirty tracker\n");
+    }
+    if (soft_dirty_supported)
+        return DIRTY_TRACKER_SOFT_DIRTY;
+#endif
+    return DIRTY_TRACKER_MPROTECT;
+}
+
+bool
+wasm_dirty_tracker_start(uint8 *base, uint64 size)
+{
+    WASMDirtyTrackerMode mode;
+
+    if (tracker_mode != DIRTY_TRACKER_NONE
+        && (base != tracked_base || size != tracked_size))
+        wasm_dirty_tracker_stop();
+
+    if (((uintptr_t)base & (DIRTY_TRACKER_PAGE_SIZE - 1)) != 0
+        || (size & (DIRTY_TRACKER_PAGE_SIZE - 1)) != 0 || size == 0)
+        return false;
+
+    mode = tracker_mode != DIRTY_TRACKER_NONE ? tracker_mode : select_mode();
+
+    switch (mode) {
+#ifdef DIRTY_TRACKER_UFFD_WP_SUPPORTED
+        case DIRTY_TRACKER_UFFD_WP:
+            if (!protect_uffd_range(base, size)) {
+                // 登録できないmappingなら、以降はsoft-dirtyかmprotectを使う
+                LOG_VERBOSE("userfaultfd unavailable, fall back to other "
+                            "dirty tracker\n");
+                unregister_uffd_range();
+                uffd_supported = false;
+                tracker_mode = DIRTY_TRACKER_NONE;
+                return wasm_dirty_tracker_start(base, size);
+            }
+            break;
+#endif
+#ifdef BH_PLATFORM_LINUX
+        case DIRTY_TRACKER_SOFT_DIRTY:
+            if (!clear_soft_dirty()) {
+                LOG_ERROR("failed to clear soft-dirty bits\n");
+                return false;
+            }
+            break;
+#endif
+        case DIRTY_TRACKER_MPROTECT:
+            if (!install_wp_handler())
+                return false;
+            if (!wp_pages && !(wp_pages = calloc(page_count_of(size), 1)))
+                return false;
+            tracked_base = base;
+            tracked_size = size;
+            if (!write_protect_range()) {
+                free((void *)wp_pages);
+                wp_pages = NULL;
+                return false;
+            }
+            break;
+        default:
+            return false;
+    }
+
+    tracked_base = base;
+    tracked_size = size;
+    tracker_mode = mode;
+    return true;
+}
+
+void
+wasm_dirty_tracker_stop()
+{
+#ifdef DIRTY_TRACKER_UFFD_WP_SUPPORTED
+    if (tracker_mode == DIRTY_TRACKER_UFFD_WP)
+        unregister_uffd_range();
+#endif
+    if (tracker_mode == DIRTY_TRACKER_MPROTECT) {
+        tracker_mode = DIRTY_TRACKER_NONE;
+        mprotect(tracked_base, tracked_size, PROT_READ | PROT_WRITE);
+        free((void *)wp_pages);
+        wp_pages = NULL;
+    }
+    tracker_mode = DIRTY_TRACKER_NONE;
+    tracked_base = NULL;
+    tracked_size = 0;
+}
+
+bool
+wasm_dirty_tracker_is_active()
+{
+    return tracker_mode != DIRTY_TRACKER_NONE;
+}
+
+WASMDirtyTrackerMode
+wasm_dirty_tracker_mode()
+{
+    return tracker_mode;
+}
+
+bool
+wasm_dirty_tracker_collect(uint8 *base, uint64 size, uint8 *bitmap)
+{
+    uint64 page_count = page_count_of(size);
+    uint64 tracked_pages = 0, i;
+
+    memset(bitmap, 0, (page_count + 7) / 8);
+
+    // 追跡範囲と一致するときのみ. memory_dataが移動していたら全ページdirty扱い
+    if (tracker_mode != DIRTY_TRACKER_NONE && base == tracked_base)
+        tracked_pages = page_count_of(tracked_size);
+    if (tracked_pages > page_count)
+        tracked_pages = page_count;
+
+    switch (tracker_mode) {
+#ifdef DIRTY_TRACKER_UFFD_WP_SUPPORTED
+        case DIRTY_TRACKER_UFFD_WP:
+            if (!collect_scan(base, tracked_pages, bitmap, PAGE_IS_WRITTEN)) {
+                LOG_WARNING("failed to scan pagemap, dump all pages\n");
+                memset(bitmap, 0xff, (tracked_pages + 7) / 8);
+            }
+            break;
+#endif
+#ifdef BH_PLATFORM_LINUX
+        case DIRTY_TRACKER_SOFT_DIRTY:
+            if (!collect_soft_dirty(base, tracked_pages, bitmap)) {
+                LOG_WARNING("failed to read pagemap, dump all pages\n");
+                memset(bitmap, 0xff, (tracked_pages + 7) / 8);
+            }
+            break;
+#endif
+        case DIRTY_TRACKER_MPROTECT:
+            for (i = 0; i < tracked_pages; i++) {
+                if (wp_pages[i])
+                    wasm_dirty_bitmap_set(bitmap, i);
+            }
+            break;
+        default:
+            break;
+    }
+    i = tracked_pages;
+
+    // memory.growで増えた分は追跡されていない
+    for (; i < page_count; i++)
+        wasm_dirty_bitmap_set(bitmap, i);
+
+    return true;
+}
@@ -0,0 +1,55 @@
+#ifndef _WASM_DIRTY_TRACKER_H
+#define _WASM_DIRTY_TRACKER_H
+
+#include "bh_platform.h"
+
+#define DIRTY_TRACKER_PAGE_SIZE 4096
+
+typedef enum WASMDirtyTrackerMode {
+    DIRTY_TRACKER_NONE = 0,
+    /* soft-dirty bits of /proc/self/pagemap, cleared via clear_refs */
+    DIRTY_TRACKER_SOFT_DIRTY,
+    /* write-protect the range and record the first write of each page
+       in the SIGSEGV handler */
+    DIRTY_TRACKER_MPROTECT,
+    /* userfaultfd async write protection of the range: the kernel resolves
+       the first write of each page without a signal, and PAGEMAP_SCAN
+       reports it as written. Unlike soft-dirty, starting an epoch only
+       touches the tracked range instead of the whole process. */
+    DIRTY_TRACKER_UFFD_WP,
+} WASMDirtyTrackerMode;
+
+/* Start a new tracking epoch over [base, base + size), every page written
+   after this call is reported by wasm_dirty_tracker_collect */
+bool
+wasm_dirty_tracker_start(uint8 *base, uint64 size);
+
+/* Stop tracking and release the write protection if any */
+void
+wasm_dirty_tracker_stop();
+
+bool
+wasm_dirty_tracker_is_active();
+
+WASMDirtyTrackerMode
+wasm_dirty_tracker_mode();
+
+/* Fill bitmap (one bit per page) with the pages of [base, base + size)
+   written since the epoch started. Pages that are outside the tracked
+   range, e.g. after memory.grow, are always reported dirty. */
+bool
+wasm_dirty_tracker_collect(uint8 *base, uint64 size, uint8 *bitmap);
+
+static inline bool
+wasm_dirty_bitmap_test(const uint8 *bitmap, uint64 page)
+{
+    return (bitmap[page >> 3] >> (page & 7)) & 1;
+}
+
+static inline void
+wasm_dirty_bitmap_set(uint8 *bitmap, uint64 page)
+{
+    bitmap[page >> 3] |= (uint8)(1 << (page & 7));
+}
+
+#endif // _WASM_DIRTY_TRACKER_H
@@ -1,2 +0,0 @@
-#include "../interpreter/wasm_runtime.h"
-uint8* dispatch(uint8 *ip, uint8 *ip_end);
\ No newline at end of file
@@ -1,13 +1,30 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
 
 #include "../interpreter/wasm_runtime.h"
 #include "wasm_migration.h"
 #include "wasm_dump.h"
-#include "wasm_dispatch.h"
+#include "wasm_image.h"
+#include "wasm_image_compress.h"
+#include "wasm_image_flusher.h"
+#include "wasm_dirty_tracker.h"
+#include "wasm_type_stack.h"
+#include "wasm_migration_stats.h"
+#include "wasm_page_pool.h"
+#if WASM_ENABLE_THREAD_MGR != 0
+#include "../libraries/thread-mgr/thread_manager.h"
+#endif
+#if WASM_ENABLE_AOT != 0
+#include "../aot/aot_runtime.h"
+#endif
 
-#define BH_PLATFORM_LINUX 0
+#if WASM_ENABLE_LIB_WASI_THREADS != 0
+int32
+wasi_threads_get_thread_id(wasm_exec_env_t exec_env);
+#endif
 
 // #define skip_leb(p) while (*p++ & 0x80)
 #define skip_leb(p)                     \
@@ -23,20 +40,45 @@ int64_t get_time(struct timespec ts1, struct timespec ts2) {
   return sec * 1e9 + nsec;
 }
 
-/* common_functions */
-int dump_value(void *ptr, size_t size, size_t nmemb, FILE *stream) {
-    if (stream == NULL) {
-        return -1;
+WASMMigrationState *
+wasm_migration_get_state(WASMModuleInstanceCommon *module_inst)
+{
+#if WASM_ENABLE_AOT != 0
+    if (module_inst->module_type == Wasm_Module_AoT)
+        return &((AOTModuleInstanceExtra *)((AOTModuleInstance *)module_inst)
+                     ->e)
+                    ->common.migration;
+#endif
+    return &((WASMModuleInstance *)module_inst)->e->common.migration;
+}
+
+bool
+wasm_migration_is_supported(WASMModuleInstanceCommon *module_inst)
+{
+    if (module_inst->module_type == Wasm_Module_Bytecode
+        && wasm_runtime_get_running_mode(module_inst) != Mode_Interp) {
+        LOG_ERROR("checkpoint and restore are only supported by the "
+                  "interpreter and AOT running modes\n");
+        return false;
     }
-    return fwrite(ptr, size, nmemb, stream);
+    return true;
 }
 
+/* common_functions */
+#define DUMP(buf, ptr, size)                                \
+    do {                                                    \
+        if (!wasm_image_buf_write(buf, ptr, size)) {        \
+            LOG_ERROR("failed to allocate image buffer\n"); \
+            return -1;                                      \
+        }                                                   \
+    } while (0)
+
 int debug_memories(WASMModuleInstance *module) {
     printf("=== debug memories ===\n");
     printf("memory_count: %d\n", module->memory_count);
     
     // bytes_per_page
-    for (int i = 0; i < module->memory_count; i++) {
+    for (uint32 i = 0; i < module->memory_count; i++) {
         WASMMemoryInstance *memory = (WASMMemoryInstance *)(module->memories[i]);
         printf("%d) bytes_per_page: %d\n", i, memory->num_bytes_per_page);
         printf("%d) cur_page_count: %d\n", i, memory->cur_page_count);
@@ -50,7 +92,7 @@ int debug_memories(WASMModuleInstance *module) {
 
 // 積まれてるframe stackを出力する
 void debug_frame_info(WASMExecEnv* exec_env, WASMInterpFrame *frame) {
-    WASMModuleInstance *module = exec_env->module_inst;
+    WASMModuleInstance *module = (WASMModuleInstance *)exec_env->module_inst;
 
     int cnt = 0;
     printf("=== DEBUG Frame Stack ===\n");
@@ -68,117 +110,79 @@ void debug_frame_info(WASMExecEnv* exec_env, WASMInterpFrame *frame) {
 
 // func_instの先頭からlimitまでのopcodeを出力する
 int debug_function_opcodes(WASMModuleInstance *module, WASMFunctionInstance* func, uint32 limit) {
+    if (func->is_import_func) return -1;
     FILE *fp = fopen("wamr_opcode.log", "a");
     if (fp == NULL) return -1;
 
     fprintf(fp, "fidx: %ld\n", func - module->e->functions);
-    uint8 *ip = wasm_get_func_code(func);
-    uint8 *ip_end = wasm_get_func_code_end(func);
-    
-    for (int i = 0; i < (int)limit; i++) {
-        fprintf(fp, "%d) opcode: 0x%x\n", i+1, *ip);
-        ip = dispatch(ip, ip_end);
-        if (ip >= ip_end) break;
+    const WASMTypeStackTable *table = &func->u.func->type_stack_table;
+    uint8 *code = func->u.func->code;
+    uint32 code_size = func->u.func->code_size, offset, i = 0;
+
+    // loaderが記録した命令境界をたどるので、bytecodeをdecodeし直さない
+    for (offset = 0; offset < code_size && i < limit; offset++) {
+        if (wasm_type_stack_is_instr(table, offset))
+            fprintf(fp, "%d) opcode: 0x%x\n", ++i, code[offset]);
     }
 
     fclose(fp);
     return 0;
 }
 
-// int debug_flag = 0;
-// ipからip_limまでにopcodeがいくつかるかを返す
-int get_opcode_offset(uint8 *ip, uint8 *ip_lim) {
-    uint32 cnt = 0;
+// funcの先頭からip(元のbytecodeの位置)までにopcodeがいくつあるかを返す
+int get_opcode_offset(WASMFunctionInstance *func, uint8 *ip) {
     bh_assert(ip != NULL);
-    bh_assert(ip_lim != NULL);
-    bh_assert(ip <= ip_lim);
-    if (ip > ip_lim) return -1;
-    if (ip == ip_lim) return 0;
-    while (1) {
-        // LOG_DEBUG("get_opcode_offset::ip: 0x%x\n", *ip);
-        // if (debug_flag) {
-        //     printf("(cnt, opcode) = (%d, 0x%x)\n", cnt, *ip);
-        // }
-        ip = dispatch(ip, ip_lim);
-        cnt++;
-        if (ip >= ip_lim) break;
+    if (func->is_import_func) return -1;
+    uint8 *code = func->u.func->code;
+    if (ip < code || ip > code + func->u.func->code_size) return -1;
+    return wasm_type_stack_instr_index(&func->u.func->type_stack_table,
+                                       (uint32)(ip - code));
+}
+
+// 統一フォーマットの型スタック (ローカル + オペランドスタックの各値のセル数) を出力する
+static int
+dump_type_stack(WASMImageBuffer *buf, WASMFunctionInstance *func,
+                const WASMTypeStackEntry *entry)
+{
+    const WASMTypeStackTable *table = &func->u.func->type_stack_table;
+    uint32 stack_size, full_type_stack_size, i;
+    uint8 cell_num;
+
+    stack_size = wasm_type_stack_value_count(table, entry);
+    full_type_stack_size = func->param_count + func->local_count + stack_size;
+    DUMP(buf, &full_type_stack_size, sizeof(uint32));
+    for (i = 0; i < func->param_count; ++i) {
+        cell_num = (uint8)wasm_value_type_cell_num(func->param_types[i]);
+        DUMP(buf, &cell_num, sizeof(uint8));
+    }
+    for (i = 0; i < func->local_count; ++i) {
+        cell_num = (uint8)wasm_value_type_cell_num(func->local_types[i]);
+        DUMP(buf, &cell_num, sizeof(uint8));
     }
-    return cnt;
+    DUMP(buf, wasm_type_stack_cells(table, entry), stack_size);
+    return 0;
 }
 
-// TODO: コードごちゃごちゃで読めないので、整理する
-uint8* get_type_stack(uint32 fidx, uint32 offset, uint32* type_stack_size, bool is_return_address) {
-    FILE *tablemap_func = fopen("tablemap_func", "rb");
-    if (!tablemap_func) printf("not found tablemap_func\n");
-    FILE *tablemap_offset = fopen("tablemap_offset", "rb");
-    if (!tablemap_func) printf("not found tablemap_offset\n");
-    FILE *type_table = fopen("type_table", "rb");
-    if (!tablemap_func) printf("not found type_table\n");
-    
-    /// tablemap_func
-    fseek(tablemap_func, fidx*sizeof(uint32)*3, SEEK_SET);
-    uint32 ffidx;
-    uint64 tablemap_offset_addr;
-    fread(&ffidx, sizeof(uint32), 1, tablemap_func);
-    if (fidx != ffidx) {
-        perror("tablemap_funcがおかしい\n");
-        exit(1);
-    }
-    fread(&tablemap_offset_addr, sizeof(uint64), 1, tablemap_func);
-
-    /// tablemap_offset
-    fseek(tablemap_offset, tablemap_offset_addr, SEEK_SET);
-    // 関数fidxのローカルを取得
-    uint32 locals_size;
-    fread(&locals_size, sizeof(uint32), 1, tablemap_offset);
-    uint8 locals[locals_size];
-    fread(locals, sizeof(uint8), locals_size, tablemap_offset);
-    // 対応するoffsetまで移動
-    uint32 ooffset;
-    uint64 type_table_addr, pre_type_table_addr;
-    while(!feof(tablemap_offset)) {
-       fread(&ooffset, sizeof(uint32), 1, tablemap_offset); 
-       fread(&type_table_addr, sizeof(uint64), 1, tablemap_offset); 
-       if (offset == ooffset) break;
-       pre_type_table_addr = type_table_addr;
-    }
-    if (feof(tablemap_offset)) {
-        perror("tablemap_offsetがおかしい\n");
-        exit(1);
-    }
-    // type_table_addr = pre_type_table_addr;
-
-    /// type_table
-    fseek(type_table, type_table_addr, SEEK_SET);
-    uint32 stack_size;
-    fread(&stack_size, sizeof(uint32), 1, type_table);
-    uint8 stack[stack_size];
-    fread(stack, sizeof(uint8), stack_size, type_table);
-
-    if (is_return_address) {
-        fread(&stack_size, sizeof(uint32), 1, type_table);
-        fread(stack, sizeof(uint8), stack_size, type_table);
-    }
-
-    // uint8 type_stack[locals_size + stack_size];
-    uint8* type_stack = malloc(locals_size + stack_size);
-    for (uint32 i = 0; i < locals_size; ++i) type_stack[i] = locals[i];
-    for (uint32 i = 0; i < stack_size; ++i) type_stack[locals_size + i] = stack[i];
-
-    fclose(tablemap_func);
-    fclose(tablemap_offset);
-    fclose(type_table);
-
-    *type_stack_size = locals_size + stack_size;
-    return type_stack;
+#if WASM_ENABLE_FAST_INTERP == 0
+// is_return_addressのとき、ipはcall命令の直後で、calleeの引数をpopし戻り値をpushする前の型スタックになる
+static const WASMTypeStackEntry *
+find_frame_entry(WASMFunctionInstance *func, uint8 *ip, bool is_return_address)
+{
+    uint32 offset = ip - wasm_get_func_code(func);
+    const WASMTypeStackEntry *entry = wasm_type_stack_lookup(
+        &func->u.func->type_stack_table, offset, is_return_address);
+
+    if (!entry)
+        LOG_ERROR("type stack not found: offset %u\n", offset);
+    return entry;
 }
 
 /* wasm_dump */
-static void
-_dump_stack(WASMExecEnv *exec_env, struct WASMInterpFrame *frame, FILE *fp, bool is_top)
+static int
+_dump_stack(WASMExecEnv *exec_env, struct WASMInterpFrame *frame, WASMImageBuffer *buf, bool is_top)
 {
-    int i;
-    WASMModuleInstance *module = exec_env->module_inst;
+    uint32 i;
+    WASMModuleInstance *module = (WASMModuleInstance *)exec_env->module_inst;
 
     // Entry function
     // wasm_dump_stackの方でdump
@@ -188,35 +192,24 @@ _dump_stack(WASMExecEnv *exec_env, struct WASMInterpFrame *frame, FILE *fp, bool
     WASMInterpFrame* prev_frame = (frame->prev_frame->function ? frame->prev_frame : frame);
     uint32 fidx = prev_frame->function - module->e->functions;
     uint32 offset = prev_frame->ip - wasm_get_func_code(prev_frame->function);
-    fwrite(&fidx, sizeof(uint32), 1, fp);
-    fwrite(&offset, sizeof(uint32), 1, fp);
+    DUMP(buf, &fidx, sizeof(uint32));
+    DUMP(buf, &offset, sizeof(uint32));
 
-    // 型スタックのサイズ
+    // 型スタック
     WASMFunctionInstance *func = frame->function;
-    uint32 locals = func->param_count + func->local_count;
-    // uint32 type_stack_size = (frame->tsp - frame->tsp_bottom);
-    // uint32 full_type_stack_size = type_stack_size + locals;
-    // fwrite(&full_type_stack_size, sizeof(uint32), 1, fp);
-
-    // 型スタックの中身
-    uint32 type_stack_size_from_file;
-    uint32 fidx_now = frame->function - module->e->functions;
-    uint32 offset_now = frame->ip - wasm_get_func_code(frame->function);
-    // printf("[DEBUG]now addr: (%d, %d)\n", fidx_now, offset_now);
-    uint8* type_stack_from_file = get_type_stack(fidx_now, offset_now, &type_stack_size_from_file, !is_top);
-    fwrite(&type_stack_size_from_file, sizeof(uint32), 1, fp);
-    fwrite(type_stack_from_file, sizeof(uint8), type_stack_size_from_file, fp);
-    free(type_stack_from_file);
+    const WASMTypeStackEntry *entry = find_frame_entry(func, frame->ip, !is_top);
+    if (!entry || dump_type_stack(buf, func, entry) < 0)
+        return -1;
 
     // 値スタックの中身
     uint32 local_cell_num = func->param_cell_num + func->local_cell_num;
     uint32 value_stack_size = frame->sp - frame->sp_bottom;
-    fwrite(frame->lp, sizeof(uint32), local_cell_num, fp);
-    fwrite(frame->sp_bottom, sizeof(uint32), value_stack_size, fp);
+    DUMP(buf, frame->lp, sizeof(uint32) * local_cell_num);
+    DUMP(buf, frame->sp_bottom, sizeof(uint32) * value_stack_size);
 
     // ラベルスタックのサイズ
     uint32 ctrl_stack_size = frame->csp - frame->csp_bottom;
-    fwrite(&ctrl_stack_size, sizeof(uint32), 1, fp);
+    DUMP(buf, &ctrl_stack_size, sizeof(uint32));
 
     // ラベルスタックの中身
     WASMBranchBlock *csp = frame->csp_bottom;
@@ -225,161 +218,559 @@ _dump_stack(WASMExecEnv *exec_env, struct WASMInterpFrame *frame, FILE *fp, bool
     for (i = 0; i < ctrl_stack_size; ++i, ++csp) {
         // uint8 *begin_addr;
         addr = get_addr_offset(csp->begin_addr, ip_start);
-        fwrite(&addr, sizeof(uint32), 1, fp);
+        DUMP(buf, &addr, sizeof(uint32));
 
         // uint8 *target_addr;
         addr = get_addr_offset(csp->target_addr, ip_start);
-        fwrite(&addr, sizeof(uint32), 1, fp);
+        DUMP(buf, &addr, sizeof(uint32));
 
         // uint32 *frame_sp;
         addr = get_addr_offset(csp->frame_sp, frame->sp_bottom);
-        fwrite(&addr, sizeof(uint32), 1, fp);
+        DUMP(buf, &addr, sizeof(uint32));
 
         // uint32 *frame_tsp;
         // addr = get_addr_offset(csp->frame_tsp, frame->tsp_bottom);
         // fwrite(&addr, sizeof(uint32), 1, fp);
         
         // uint32 cell_num;
-        fwrite(&csp->cell_num, sizeof(uint32), 1, fp);
+        DUMP(buf, &csp->cell_num, sizeof(uint32));
 
         // uint32 count;
         // fwrite(&csp->count, sizeof(uint32), 1, fp);
     }
+    return 0;
+}
+#else
+// fast-interpのframe->ipはコンパイル後のコードを指すので、loaderの表で元のbytecodeの位置に戻す
+// NOTE: topのframeは命令の途中で止まることがないよう、wasm_dump_is_safepointで確認してからdumpする
+static const WASMTypeStackEntry *
+find_frame_entry(WASMFunctionInstance *func, uint8 *ip, bool is_return_address)
+{
+    uint32 compiled_offset = ip - wasm_get_func_code(func);
+    const WASMTypeStackEntry *entry = wasm_type_stack_lookup_compiled(
+        &func->u.func->type_stack_table, compiled_offset, is_return_address);
+
+    if (!entry)
+        LOG_ERROR("type stack not found: compiled offset %u\n",
+                  compiled_offset);
+    return entry;
+}
+
+bool
+wasm_dump_is_safepoint(WASMFunctionInstance *func, uint8 *frame_ip)
+{
+    return wasm_type_stack_lookup_compiled(
+               &func->u.func->type_stack_table,
+               frame_ip - wasm_get_func_code(func), false)
+           != NULL;
+}
+
+static int
+dump_ctrl_stack(WASMImageBuffer *buf, WASMFunctionInstance *func,
+                const WASMTypeStackEntry *entry)
+{
+    const WASMTypeStackTable *table = &func->u.func->type_stack_table;
+    const WASMTypeStackBlock *block;
+    const uint32 *blocks;
+    uint32 count, ctrl_stack_size, addr, i;
+
+    // fast-interpはラベルスタックを持たないので、loaderが記録したblockからclassicのものを作る
+    blocks = wasm_type_stack_blocks(table, entry, &count);
+    ctrl_stack_size = count + 1;
+    DUMP(buf, &ctrl_stack_size, sizeof(uint32));
+
+    // 関数のblock
+    addr = 0;
+    DUMP(buf, &addr, sizeof(uint32));
+    addr = func->u.func->code_size - 1;
+    DUMP(buf, &addr, sizeof(uint32));
+    addr = 0;
+    DUMP(buf, &addr, sizeof(uint32));
+    addr = func->ret_cell_num;
+    DUMP(buf, &addr, sizeof(uint32));
+
+    for (i = 0; i < count; ++i) {
+        block = &table->block_infos[blocks[i]];
+        DUMP(buf, &block->begin_offset, sizeof(uint32));
+        DUMP(buf, &block->target_offset, sizeof(uint32));
+        // classicと同じくsp_bottomからのbyte数
+        addr = block->frame_sp * sizeof(uint32);
+        DUMP(buf, &addr, sizeof(uint32));
+        DUMP(buf, &block->cell_num, sizeof(uint32));
+    }
+    return 0;
 }
 
+/* wasm_dump */
+static int
+_dump_stack(WASMExecEnv *exec_env, struct WASMInterpFrame *frame, WASMImageBuffer *buf, bool is_top)
+{
+    WASMModuleInstance *module = (WASMModuleInstance *)exec_env->module_inst;
+    WASMFunctionInstance *func = frame->function;
+    const WASMTypeStackTable *table = &func->u.func->type_stack_table;
+    const WASMTypeStackEntry *entry, *ret_entry;
+    const uint8 *cells;
+    uint32 value_count, i;
 
+    // Entry function
+    // wasm_dump_stackの方でdump
+
+    // リターンアドレス
+    // NOTE: 1番下のframeのときだけ、prev_frameではなくframeのリターンアドレスを出力する
+    WASMInterpFrame* prev_frame = (frame->prev_frame->function ? frame->prev_frame : frame);
+    if (!(ret_entry = find_frame_entry(prev_frame->function, prev_frame->ip,
+                                       prev_frame != frame || !is_top)))
+        return -1;
+    uint32 fidx = prev_frame->function - module->e->functions;
+    DUMP(buf, &fidx, sizeof(uint32));
+    DUMP(buf, &ret_entry->offset, sizeof(uint32));
+
+    // 型スタック
+    if (!(entry = find_frame_entry(func, frame->ip, !is_top))
+        || dump_type_stack(buf, func, entry) < 0)
+        return -1;
+
+    // 値スタックの中身
+    // ローカルはclassicと同じ並びで、オペランドスタックの値は各slotから集める
+    uint32 local_cell_num = func->param_cell_num + func->local_cell_num;
+    DUMP(buf, frame->lp, sizeof(uint32) * local_cell_num);
+    value_count = wasm_type_stack_value_count(table, entry);
+    cells = wasm_type_stack_cells(table, entry);
+    for (i = 0; i < value_count; ++i) {
+        DUMP(buf, frame->lp + wasm_type_stack_slot(table, entry, i),
+             sizeof(uint32) * cells[i]);
+    }
+
+    // ラベルスタック
+    return dump_ctrl_stack(buf, func, entry);
+}
+#endif
+
+// STACK section: frame数, 続いてtopからbottomの順に (record size, record)
 int
-wasm_dump_stack(WASMExecEnv *exec_env, struct WASMInterpFrame *frame)
+wasm_dump_stack(WASMExecEnv *exec_env, struct WASMInterpFrame *frame,
+                WASMImageWriter *writer)
 {
     WASMModuleInstance *module =
         (WASMModuleInstance *)exec_env->module_inst;
+    WASMImageBuffer *buf =
+        wasm_image_writer_add_section(writer, IMAGE_SECTION_STACK, 0);
+    uint32 i = 0, record_size;
+    uint64 record_start;
+
+    if (!buf)
+        return -1;
+
+    // frame数は最後に埋める
+    DUMP(buf, &i, sizeof(uint32));
 
     // frameをtopからbottomまで走査する
-    char file[32];
-    int i = 0;
     do {
         // dummy framenならbreak
         if (frame->function == NULL) break;
 
         ++i;
-        sprintf(file, "stack%d.img", i);
-        FILE *fp = open_image(file, "wb");
+        record_size = 0;
+        DUMP(buf, &record_size, sizeof(uint32));
+        record_start = buf->size;
 
         uint32 entry_fidx = frame->function - module->e->functions;
-        fwrite(&entry_fidx, sizeof(uint32), 1, fp);
+        DUMP(buf, &entry_fidx, sizeof(uint32));
 
-        _dump_stack(exec_env, frame, fp, (i==1));
-        fclose(fp);
+        if (_dump_stack(exec_env, frame, buf, (i==1)) < 0)
+            return -1;
+
+        record_size = (uint32)(buf->size - record_start);
+        memcpy(buf->data + record_start - sizeof(uint32), &record_size,
+               sizeof(uint32));
     } while((frame = frame->prev_frame));
 
     // frame stackのサイズを保存
-    FILE *fp = open_image("frame.img", "wb");
-    fwrite(&i, sizeof(uint32), 1, fp);
-    fclose(fp);
+    memcpy(buf->data, &i, sizeof(uint32));
+    wasm_migration_stats_add_frames(i);
 
     return 0;
 }
 
-int is_dirty(uint64 pagemap_entry) {
-    return (pagemap_entry>>62&1) | (pagemap_entry>>63&1);
+static bool
+is_zero_page(const uint8 *page, uint32 page_size)
+{
+    const uint64 *p = (const uint64 *)page;
+    uint32 i;
+    for (i = 0; i < page_size / sizeof(uint64); i++) {
+        if (p[i] != 0)
+            return false;
+    }
+    for (i *= sizeof(uint64); i < page_size; i++) {
+        if (page[i] != 0)
+            return false;
+    }
+    return true;
+}
+
+static bool checkpoint_compress = false;
+void set_checkpoint_compress(bool f) {
+    checkpoint_compress = f;
 }
 
-int is_soft_dirty(uint64 pagemap_entry) {
-    return (pagemap_entry >> 55 & 1);
+/* page pool */
+static const char *page_pool_path = NULL;
+static WASMPagePool *page_pool = NULL;
+static pid_t page_pool_pid = -1;
+static korp_mutex page_pool_lock = OS_THREAD_MUTEX_INITIALIZER;
+void set_checkpoint_page_pool(const char *path) {
+    page_pool_path = path;
 }
 
-// 副作用あり
-int get_pagemap(unsigned long memory_addr) {
-    const int PAGE_SIZE = 4096;
-    int fd;
-    // プロセスのpagemapを開く
-    fd = open("/proc/self/pagemap", O_RDONLY);
-    if (fd == -1) {
-        perror("Error opening pagemap");
-        return -1;
+// 最初のcheckpointで開き、以降のcheckpointとpre-copyのroundで使い回す
+static WASMPagePool *
+get_page_pool()
+{
+    WASMPagePool *pool;
+
+    if (!page_pool_path)
+        return NULL;
+    os_mutex_lock(&page_pool_lock);
+    // forkしたsnapshotの子は、親とflockを共有しないように開き直す
+    // 親のthreadがlockを持ったままかもしれないので、親のpoolは閉じない
+    if (page_pool && page_pool_pid != getpid())
+        page_pool = NULL;
+    if (!page_pool && (page_pool = wasm_page_pool_open(page_pool_path, true)))
+        page_pool_pid = getpid();
+    pool = page_pool;
+    os_mutex_unlock(&page_pool_lock);
+    if (!pool)
+        LOG_WARNING("page pool unavailable, pages are written to the image\n");
+    return pool;
+}
+
+// WASM_IMAGE_BLOCK_SIZEごとに、workerがextentを作り、DATAのextentを圧縮する
+typedef struct MemoryBlock {
+    WASMImageBuffer extents;
+    // LZ4のextentのデータ, extentの順に詰める
+    uint8 *data;
+    uint64 data_size;
+    bool failed;
+} MemoryBlock;
+
+typedef struct MemoryDumpContext {
+    uint8 *memory_data;
+    uint64 memory_size;
+    const uint8 *dirty_bitmap;
+    bool compress;
+    MemoryBlock *blocks;
+    // poolに入れるなら、DATAのページのhash. ページ番号で引く
+    WASMPagePool *pool;
+    uint64 *page_hashes;
+    uint64 pool_new_pages;
+} MemoryDumpContext;
+
+static void
+add_block_extent(MemoryDumpContext *dump, MemoryBlock *block,
+                 WASMImageMemoryExtent *extent)
+{
+    const uint64 capacity = wasm_image_compress_bound(WASM_IMAGE_BLOCK_SIZE);
+    uint64 size;
+
+    if (extent->size == 0)
+        return;
+
+    // 縮まなかったextentはDATAのままlinear memoryを参照する
+    if (extent->kind == IMAGE_EXTENT_DATA && dump->compress
+        && (block->data || (block->data = malloc(capacity)))) {
+        size = wasm_image_compress(dump->memory_data + extent->offset,
+                                   extent->size, block->data + block->data_size,
+                                   capacity - block->data_size);
+        if (size > 0 && size < extent->size) {
+            extent->kind = IMAGE_EXTENT_LZ4;
+            extent->data_size = (uint32)size;
+            block->data_size += size;
+        }
     }
+    if (!wasm_image_buf_write(&block->extents, extent,
+                              sizeof(WASMImageMemoryExtent)))
+        block->failed = true;
+    memset(extent, 0, sizeof(WASMImageMemoryExtent));
+}
 
-    // pfnに対応するpagemapエントリを取得
-    unsigned long pfn = memory_addr / PAGE_SIZE;
-    off_t offset = sizeof(uint64) * pfn;
-    if (lseek(fd, offset, SEEK_SET) == -1) {
-        perror("Error seeking to pagemap entry");
-        close(fd);
-        return -1;
+// dirty_bitmapがNULLなら全ページ, そうでなければbitの立ったページだけdump
+// 連続するページは1つのextentにまとめ、ゼロページは中身を書かない
+static void
+dump_memory_block(void *ctx, uint32 index)
+{
+    const uint32 PAGE_SIZE = 4096;
+    MemoryDumpContext *dump = ctx;
+    MemoryBlock *block = &dump->blocks[index];
+    WASMImageMemoryExtent extent = { 0 };
+    uint64 begin = (uint64)index * WASM_IMAGE_BLOCK_SIZE;
+    uint64 end = dump->memory_size - begin < WASM_IMAGE_BLOCK_SIZE
+                     ? dump->memory_size
+                     : begin + WASM_IMAGE_BLOCK_SIZE;
+
+    for (uint64 offset = begin; offset < end; offset += PAGE_SIZE) {
+        if (dump->dirty_bitmap
+            && !wasm_dirty_bitmap_test(dump->dirty_bitmap,
+                                       offset / PAGE_SIZE)) {
+            add_block_extent(dump, block, &extent);
+            continue;
+        }
+
+        // 最後のページはPAGE_SIZEに満たないことがある
+        uint32 size = end - offset < PAGE_SIZE ? (uint32)(end - offset)
+                                               : PAGE_SIZE;
+        uint32 kind = is_zero_page(dump->memory_data + offset, size)
+                          ? IMAGE_EXTENT_ZERO
+                          : IMAGE_EXTENT_DATA;
+        // hashはblockごとに並列に求め、poolへの追加は順番に行う
+        if (kind == IMAGE_EXTENT_DATA && dump->page_hashes
+            && size == PAGE_SIZE)
+            dump->page_hashes[offset / PAGE_SIZE] =
+                wasm_page_pool_hash(dump->memory_data + offset);
+        if (extent.size > 0
+            && (extent.kind != kind || extent.offset + extent.size != offset))
+            add_block_extent(dump, block, &extent);
+        if (extent.size == 0) {
+            extent.offset = offset;
+            extent.kind = kind;
+        }
+        extent.size += size;
+    }
+    add_block_extent(dump, block, &extent);
+
+    if (block->data_size == 0) {
+        free(block->data);
+        block->data = NULL;
+    }
+    else {
+        // 使わなかった分は返す
+        uint8 *data = realloc(block->data, block->data_size);
+        if (data)
+            block->data = data;
     }
-    return fd;
 }
 
-// dirty pageの場合1を返す. not dirtyならば0. ただし、Linux以外は必ず1を返す
-int check_soft_dirty(int fd, uint8* addr) {
-#if BH_PLATFORM_LINUX == 1
-    const int PAGEMAP_LENGTH = 8;
-    const int PAGE_SIZE = 4096;
-    uint64 pagemap_entry;
-    unsigned long pfn = (unsigned long)addr / PAGE_SIZE;
-    off_t offset = sizeof(uint64) * pfn;
-    if (lseek(fd, offset, SEEK_SET) == -1) {
-        perror("Error seeking to pagemap entry");
-        close(fd);
+// DATAのextentのページをpoolに入れ、page idが連続する範囲ごとにPOOLのextentにする
+static int
+flush_pool_extent(MemoryDumpContext *dump, WASMImageBuffer *extents,
+                  const WASMImageMemoryExtent *extent)
+{
+    uint64 first = extent->offset / WASM_PAGE_POOL_PAGE_SIZE;
+    uint64 count = extent->size / WASM_PAGE_POOL_PAGE_SIZE;
+    uint64 *ids, new_pages, i, j;
+    WASMImageMemoryExtent e = { 0 };
+    int rc = -1;
+
+    if (!(ids = malloc(sizeof(uint64) * count)))
         return -1;
+    if (!wasm_page_pool_store(dump->pool, dump->memory_data + extent->offset,
+                              dump->page_hashes + first, count, ids,
+                              &new_pages))
+        goto fail;
+    dump->pool_new_pages += new_pages;
+
+    for (i = 0; i < count; i = j) {
+        // page idはextentのdata_sizeに入れる
+        if (ids[i] > UINT32_MAX) {
+            LOG_ERROR("page pool has too many pages\n");
+            goto fail;
+        }
+        for (j = i + 1; j < count && ids[j] == ids[j - 1] + 1
+                        && ids[j] <= UINT32_MAX;
+             j++)
+            ;
+        e.offset = extent->offset + i * WASM_PAGE_POOL_PAGE_SIZE;
+        e.size = (j - i) * WASM_PAGE_POOL_PAGE_SIZE;
+        e.kind = IMAGE_EXTENT_POOL;
+        e.data_size = (uint32)ids[i];
+        if (!wasm_image_buf_write(extents, &e, sizeof(e)))
+            goto fail;
     }
+    rc = 0;
+
+fail:
+    free(ids);
+    return rc;
+}
 
-    if (read(fd, &pagemap_entry, PAGEMAP_LENGTH) != PAGEMAP_LENGTH) {
-        perror("Error reading pagemap entry");
-        close(fd);
+static int
+flush_extent(MemoryDumpContext *dump, WASMImageBuffer *extents,
+             WASMImageSection *pages, WASMImageMemoryExtent *extent)
+{
+    if (extent->size == 0)
+        return 0;
+    if (extent->kind == IMAGE_EXTENT_DATA && dump->pool
+        && extent->size % WASM_PAGE_POOL_PAGE_SIZE == 0) {
+        if (flush_pool_extent(dump, extents, extent) < 0)
+            return -1;
+        extent->size = 0;
+        return 0;
+    }
+    if (!wasm_image_buf_write(extents, extent, sizeof(WASMImageMemoryExtent)))
+        return -1;
+    // DATAのextentはlinear memoryをそのまま参照し、1つのiovecで書き出される
+    if (extent->kind == IMAGE_EXTENT_DATA
+        && !wasm_image_section_add_chunk(pages,
+                                         dump->memory_data + extent->offset,
+                                         extent->size))
         return -1;
+    extent->size = 0;
+    return 0;
+}
+
+// blockのextentを順に並べ、blockをまたいで連続するDATAとZEROはつなげる
+static int
+merge_memory_blocks(MemoryDumpContext *dump, uint32 block_count,
+                    WASMImageWriter *writer, WASMImageBuffer *extents,
+                    WASMImageSection *pages)
+{
+    WASMImageMemoryExtent extent = { 0 };
+    uint32 i;
+    int rc = -1;
+
+    for (i = 0; i < block_count; i++) {
+        MemoryBlock *block = &dump->blocks[i];
+        WASMImageMemoryExtent *e =
+            (WASMImageMemoryExtent *)block->extents.data;
+        uint32 count =
+            (uint32)(block->extents.size / sizeof(WASMImageMemoryExtent));
+        const uint8 *data = block->data;
+
+        // 圧縮したデータはwriterと一緒に解放する
+        block->data = NULL;
+        if (block->failed || (data && !wasm_image_writer_attach(writer, (void *)data)))
+            goto fail;
+
+        for (uint32 j = 0; j < count; j++, e++) {
+            if (e->kind == IMAGE_EXTENT_LZ4) {
+                if (flush_extent(dump, extents, pages, &extent) < 0
+                    || !wasm_image_buf_write(extents, e, sizeof(*e))
+                    || !wasm_image_section_add_chunk(pages, data,
+                                                     e->data_size))
+                    goto fail;
+                data += e->data_size;
+                continue;
+            }
+            if (extent.size > 0
+                && (extent.kind != e->kind
+                    || extent.offset + extent.size != e->offset)
+                && flush_extent(dump, extents, pages, &extent) < 0)
+                goto fail;
+            if (extent.size == 0)
+                extent = *e;
+            else
+                extent.size += e->size;
+        }
     }
+    rc = flush_extent(dump, extents, pages, &extent);
 
-    // dirty pageのみdump
-    // if (is_dirty(pagemap_entry)) {
-    return is_soft_dirty(pagemap_entry);
-#else
-    // linux以外は確定で1を返す
-    return 1;
-#endif
+fail:
+    for (i = 0; i < block_count; i++) {
+        free(dump->blocks[i].extents.data);
+        free(dump->blocks[i].data);
+    }
+    return rc;
 }
 
-int dump_dirty_memory(WASMMemoryInstance *memory) {
-    const int PAGE_SIZE = 4096;
-    FILE *memory_fp = open_image("memory.img", "wb");
-    uint64 pagemap_entry;
+// まとめ終わったextentからページ数と圧縮後のサイズを数える
+static void
+add_page_stats(const MemoryDumpContext *dump, const WASMImageBuffer *extents)
+{
+    const uint32 PAGE_SIZE = 4096;
+    const WASMImageMemoryExtent *e =
+        (const WASMImageMemoryExtent *)extents->data;
+    uint32 count = (uint32)(extents->size / sizeof(WASMImageMemoryExtent));
+    uint64 dirty = 0, zero = 0, raw = 0, stored = 0;
+
+    for (uint32 i = 0; i < count; i++, e++) {
+        dirty += (e->size + PAGE_SIZE - 1) / PAGE_SIZE;
+        if (e->kind == IMAGE_EXTENT_ZERO) {
+            zero += (e->size + PAGE_SIZE - 1) / PAGE_SIZE;
+            continue;
+        }
+        raw += e->size;
+        if (e->kind == IMAGE_EXTENT_LZ4)
+            stored += e->data_size;
+        else if (e->kind == IMAGE_EXTENT_DATA)
+            stored += e->size;
+    }
+    // POOLのextentは、poolに新しく書いたページだけを数える
+    stored += dump->pool_new_pages * WASM_PAGE_POOL_PAGE_SIZE;
+    wasm_migration_stats_add_pages(
+        (dump->memory_size + PAGE_SIZE - 1) / PAGE_SIZE, dirty, zero, raw,
+        stored);
+}
 
-#if BH_PLATFORM_LINUX == 1
-    int fd = get_pagemap(memory->memory_data);
-#else
-    // check_soft_dirtyでfdを使っているのでダミー用. 
-    // もっといい実装がありそう
-    int fd = 0;
-#endif
+int dump_dirty_memory(WASMMemoryInstance *memory, WASMImageWriter *writer,
+                      const uint8 *dirty_bitmap, bool compress,
+                      WASMPagePool *pool) {
+    WASMImageBuffer *extents = wasm_image_writer_add_section(
+        writer, IMAGE_SECTION_MEMORY_EXTENTS, 0);
+    WASMImageSection *pages = wasm_image_writer_add_chunked_section(
+        writer, IMAGE_SECTION_MEMORY_PAGES, IMAGE_SECTION_FLAG_PAGE_ALIGNED);
+    WASMImageBuffer *pool_buf;
+    MemoryDumpContext dump = { 0 };
+    uint32 block_count;
+    int rc;
 
-    uint8* memory_data = memory->memory_data;
-    uint8* memory_data_end = memory->memory_data_end;
-    int i = 0;
-    for (uint8* addr = memory->memory_data; addr < memory_data_end; addr += PAGE_SIZE, ++i) {
-        if (check_soft_dirty(fd, addr)) {
-            uint32 offset = (uint64)addr - (uint64)memory_data;
-            fwrite(&offset, sizeof(uint32), 1, memory_fp);
-            fwrite(addr, PAGE_SIZE, 1, memory_fp);
+    if (!extents || !pages)
+        return -1;
+
+    dump.memory_data = memory->memory_data;
+    dump.memory_size = memory->memory_data_size;
+    dump.dirty_bitmap = dirty_bitmap;
+    // poolのページはrestoreでmapするので圧縮しない
+    dump.compress = compress && !pool;
+    dump.pool = pool;
+    block_count = (uint32)((dump.memory_size + WASM_IMAGE_BLOCK_SIZE - 1)
+                           / WASM_IMAGE_BLOCK_SIZE);
+    if (block_count == 0)
+        return 0;
+    if (pool) {
+        // restoreはここに書いたpoolのページをmapする
+        const char *path = wasm_page_pool_path(pool);
+        if (!(pool_buf = wasm_image_writer_add_section(
+                  writer, IMAGE_SECTION_PAGE_POOL, 0)))
+            return -1;
+        DUMP(pool_buf, path, strlen(path) + 1);
+        if (!(dump.page_hashes =
+                  malloc(sizeof(uint64) * (dump.memory_size
+                                           / WASM_PAGE_POOL_PAGE_SIZE + 1)))) {
+            LOG_ERROR("failed to allocate page hashes\n");
+            return -1;
         }
     }
+    if (!(dump.blocks = calloc(block_count, sizeof(MemoryBlock)))) {
+        LOG_ERROR("failed to allocate memory blocks\n");
+        free(dump.page_hashes);
+        return -1;
+    }
 
-#if BH_PLATFORM_LINUX == 1
-    close(fd);
-#endif
-    fclose(memory_fp);
-    return 0;
+    // ゼロページの判定と圧縮はblockごとに並列に行い、並べるのは順番に行う
+    wasm_image_run_parallel(block_count, dump_memory_block, &dump);
+    rc = merge_memory_blocks(&dump, block_count, writer, extents, pages);
+    free(dump.blocks);
+    free(dump.page_hashes);
+    if (rc == 0)
+        add_page_stats(&dump, extents);
+    return rc;
 }
 
-int wasm_dump_memory(WASMMemoryInstance *memory) {
-    FILE *mem_size_fp = open_image("mem_page_count.img", "wb");
-
-    dump_dirty_memory(memory);
+static int
+dump_memory(WASMMemoryInstance *memory, WASMImageWriter *writer,
+            const uint8 *dirty_bitmap, uint32 delta_count, bool compress,
+            WASMPagePool *pool) {
+    WASMImageBuffer *meta = wasm_image_writer_add_section(
+        writer, IMAGE_SECTION_MEMORY_META, 0);
 
+    if (!meta)
+        return -1;
 
-    printf("page_count: %d\n", memory->cur_page_count);
-    fwrite(&(memory->cur_page_count), sizeof(uint32), 1, mem_size_fp);
+    DUMP(meta, &(memory->cur_page_count), sizeof(uint32));
+    // このimageより前に適用するpre-copy imageの数
+    DUMP(meta, &delta_count, sizeof(uint32));
 
-    fclose(mem_size_fp);
+    if (dump_dirty_memory(memory, writer, dirty_bitmap, compress, pool) < 0)
+        return -1;
 
     // デバッグのために、すべてのメモリも保存
     // FILE *all_memory_fp = open_image("all_memory.img", "wb");
@@ -389,28 +780,271 @@ int wasm_dump_memory(WASMMemoryInstance *memory) {
     return 0;
 }
 
-int wasm_dump_global(WASMModuleInstance *module, WASMGlobalInstance *globals, uint8* global_data) {
-    FILE *fp;
-    const char *file = "global.img";
-    fp = fopen(file, "wb");
-    if (fp == NULL) {
-        fprintf(stderr, "failed to open %s\n", file);
+int wasm_dump_memory(WASMMemoryInstance *memory, WASMImageWriter *writer,
+                     const uint8 *dirty_bitmap, uint32 delta_count) {
+    return dump_memory(memory, writer, dirty_bitmap, delta_count,
+                       checkpoint_compress, get_page_pool());
+}
+
+/* checkpoint target */
+static const char *checkpoint_target = NULL;
+void set_checkpoint_target(const char *target) {
+    checkpoint_target = target;
+}
+
+static bool
+is_process_request(WASMExecEnv *exec_env, uint32 request);
+static const char *
+instance_sink(WASMExecEnv *exec_env);
+
+// streamに書くのは最後のcheckpointだけで、何度も取るsnapshotはfileに書く
+// wasm_runtime_request_checkpointのrequestは、そのsinkに書く
+static const char *
+image_target(WASMExecEnv *exec_env, bool snapshot)
+{
+    const char *target = checkpoint_target;
+
+    if (!snapshot
+        && !is_process_request(exec_env, WASM_CHECKPOINT_REQUEST_FINAL))
+        target = instance_sink(exec_env);
+    if (!target || (snapshot && wasm_image_is_stream(target)))
+        return WASM_IMAGE_DEFAULT_FILE;
+    return target;
+}
+
+/* asynchronous write */
+static bool checkpoint_async = false;
+void set_checkpoint_async(bool f) {
+    // threadはdirty trackerのSIGSEGV handlerより前に作っておく
+    checkpoint_async = f && wasm_image_flusher_start();
+}
+
+static wasm_checkpoint_callback_t checkpoint_callback = NULL;
+static void *checkpoint_callback_data = NULL;
+// writer threadで書けなかったpre-copyのroundがあるか
+static bh_atomic_32_t precopy_write_failed = 0;
+
+static void
+image_written(const char *target, bool success, void *user_data)
+{
+    wasm_migration_kind_t kind = (wasm_migration_kind_t)(uintptr_t)user_data;
+
+    if (!success && kind == WASM_MIGRATION_PRECOPY)
+        BH_ATOMIC_32_STORE(precopy_write_failed, 1);
+    if (checkpoint_callback)
+        checkpoint_callback(kind, target, success, checkpoint_callback_data);
+}
+
+// asyncならlinear memoryから切り離したimageをwriter threadに渡し、guestはすぐに再開する
+// 渡せなければその場で書く
+static bool
+write_image(WASMImageWriter *writer, const char *target,
+            wasm_migration_kind_t kind, bool async)
+{
+    void *user_data = (void *)(uintptr_t)kind;
+    uint64 size;
+    bool ok;
+
+    if (async) {
+        size = wasm_image_writer_size(writer);
+        if (wasm_image_writer_detach(writer)
+            && wasm_image_flusher_submit(writer, target, image_written,
+                                         user_data)) {
+            wasm_migration_stats_add_written(size);
+            return true;
+        }
+        LOG_WARNING("failed to write %s in background, writing it now\n",
+                    target);
+    }
+    ok = wasm_image_writer_write_to(writer, target);
+    image_written(target, ok, user_data);
+    return ok;
+}
+
+/* pre-copy */
+static uint32 precopy_round = 0;
+
+// 前回のroundからdirtyになったページを集め、次のepochを始める
+static uint8 *
+collect_dirty_pages(WASMMemoryInstance *memory)
+{
+    uint64 page_count = (memory->memory_data_size + DIRTY_TRACKER_PAGE_SIZE - 1)
+                        / DIRTY_TRACKER_PAGE_SIZE;
+    uint8 *bitmap = malloc((page_count + 7) / 8 + 1);
+
+    if (!bitmap)
+        return NULL;
+    wasm_dirty_tracker_collect(memory->memory_data, memory->memory_data_size,
+                               bitmap);
+    return bitmap;
+}
+
+// 書けなかったroundがあるとdeltaを適用できないので、最初のroundからやり直す
+// waitなら書き出し中のroundが終わるのを待ってから確かめる
+static void
+check_precopy_rounds(bool wait)
+{
+    if (precopy_round == 0)
+        return;
+    if (wait && checkpoint_async)
+        wasm_image_flusher_wait();
+    if (BH_ATOMIC_32_LOAD(precopy_write_failed)) {
+        LOG_WARNING("failed to write a pre-copy round, starting over\n");
+        wasm_dirty_tracker_stop();
+        precopy_round = 0;
+    }
+    BH_ATOMIC_32_STORE(precopy_write_failed, 0);
+}
+
+int wasm_dump_precopy(WASMMemoryInstance *memory) {
+    WASMImageWriter writer;
+    char path[PATH_MAX];
+    uint8 *dirty_bitmap = NULL;
+    int rc = -1;
+    struct timespec ts1, ts2;
+
+    check_precopy_rounds(false);
+    wasm_migration_stats_begin(WASM_MIGRATION_PRECOPY);
+    wasm_migration_stats_set_round(precopy_round);
+    wasm_image_writer_init(&writer);
+
+    // 最初のroundは全ページ(base image), 以降は前回からのdelta
+    if (precopy_round > 0
+        && !(dirty_bitmap = collect_dirty_pages(memory)))
+        goto fail;
+
+    // 書き出している間にdirtyになったページは次のroundで拾う
+    if (!wasm_dirty_tracker_start(memory->memory_data,
+                                  memory->memory_data_size)) {
+        LOG_WARNING("dirty page tracking unavailable, pre-copy disabled\n");
+        goto fail;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &ts1);
+    rc = wasm_dump_memory(memory, &writer, dirty_bitmap, 0);
+    clock_gettime(CLOCK_MONOTONIC, &ts2);
+    wasm_migration_stats_phase(WASM_MIGRATION_PHASE_MEMORY, get_time(ts1, ts2));
+    if (rc < 0)
+        goto fail;
+
+    // roundは最後のimageと同じ場所に置き、restore-fromの隣から読む
+    if (!wasm_image_precopy_path(checkpoint_target, precopy_round, path,
+                                 sizeof(path))) {
+        rc = -1;
+        goto fail;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &ts1);
+    if (!write_image(&writer, path, WASM_MIGRATION_PRECOPY, checkpoint_async))
+        rc = -1;
+    clock_gettime(CLOCK_MONOTONIC, &ts2);
+    wasm_migration_stats_phase(WASM_MIGRATION_PHASE_WRITE, get_time(ts1, ts2));
+    if (rc < 0)
+        goto fail;
+
+    precopy_round++;
+
+fail:
+    wasm_image_writer_destroy(&writer);
+    free(dirty_bitmap);
+    wasm_migration_stats_end(rc == 0);
+    if (rc < 0) {
+        // 途中のroundが欠けるとrestoreできないので最初からやり直す
+        wasm_dirty_tracker_stop();
+        precopy_round = 0;
+    }
+    return rc;
+}
+
+/* snapshot */
+static pid_t snapshot_pid = -1;
+// forkしたsnapshotの子の中か
+static bool in_snapshot = false;
+
+// snapshotを書いている子プロセスを回収する. blockしないときは終わっていなければfalse
+static bool
+wait_snapshot(bool block)
+{
+    int status;
+    pid_t pid;
+
+    if (snapshot_pid < 0)
+        return true;
+    pid = waitpid(snapshot_pid, &status, block ? 0 : WNOHANG);
+    if (pid == 0)
+        return false;
+    if (pid < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        LOG_WARNING("failed to write snapshot image\n");
+    snapshot_pid = -1;
+    return true;
+}
+
+bool wasm_dump_write_image(WASMExecEnv *exec_env, WASMImageWriter *writer) {
+    // snapshotの子はすぐに_exitするので、その場で書き、callbackも呼ばない
+    if (in_snapshot)
+        return wasm_image_writer_write_to(writer, image_target(exec_env, true));
+    // process全体へのrequestは書いたら終了するので、切り離す必要はない
+    return write_image(
+        writer, image_target(exec_env, false), WASM_MIGRATION_CHECKPOINT,
+        checkpoint_async
+            && !is_process_request(exec_env, WASM_CHECKPOINT_REQUEST_FINAL));
+}
+
+void wasm_dump_wait_snapshot() {
+    wait_snapshot(true);
+}
+
+int wasm_dump_fork_snapshot(WASMExecEnv *exec_env) {
+    pid_t pid;
+    struct timespec ts1, ts2;
+
+    wasm_clear_checkpoint_request(exec_env, WASM_CHECKPOINT_REQUEST_SNAPSHOT);
+    // 前のsnapshotを書き終わるまでguestを止めないように、このrequestは捨てる
+    if (!wait_snapshot(false)) {
+        LOG_WARNING("previous snapshot is still being written, skipped\n");
+        return 1;
+    }
+
+    // guestが止まるのはforkの間だけで、memoryはcopy-on-writeで子に渡る
+    clock_gettime(CLOCK_MONOTONIC, &ts1);
+    pid = fork();
+    if (pid < 0) {
+        LOG_WARNING("failed to fork for snapshot\n");
         return -1;
     }
+    if (pid == 0) {
+        // 子はfork時点のmemoryを全部書く. 親のpre-copyのroundには依存しない
+        // snapshotの統計は子が書き終えてから出す
+        clock_gettime(CLOCK_MONOTONIC, &ts2);
+        wasm_migration_stats_phase(WASM_MIGRATION_PHASE_FORK,
+                                   get_time(ts1, ts2));
+        precopy_round = 0;
+        in_snapshot = true;
+        return 0;
+    }
+    snapshot_pid = pid;
+    return 1;
+}
+
+int wasm_dump_global(WASMModuleInstance *module, WASMGlobalInstance *globals, uint8* global_data, WASMImageWriter *writer) {
+    WASMImageBuffer *buf =
+        wasm_image_writer_add_section(writer, IMAGE_SECTION_GLOBAL, 0);
+
+    if (!buf)
+        return -1;
 
     // WASMMemoryInstance *memory = module->default_memory;
     uint8 *global_addr;
-    for (int i = 0; i < module->e->global_count; i++) {
+    for (uint32 i = 0; i < module->e->global_count; i++) {
         switch (globals[i].type) {
             case VALUE_TYPE_I32:
             case VALUE_TYPE_F32:
                 global_addr = get_global_addr_for_migration(global_data, (globals+i));
-                fwrite(global_addr, sizeof(uint32), 1, fp);
+                DUMP(buf, global_addr, sizeof(uint32));
                 break;
             case VALUE_TYPE_I64:
             case VALUE_TYPE_F64:
                 global_addr = get_global_addr_for_migration(global_data, (globals+i));
-                fwrite(global_addr, sizeof(uint64), 1, fp);
+                DUMP(buf, global_addr, sizeof(uint64));
                 break;
             default:
                 printf("type error:B\n");
@@ -418,34 +1052,265 @@ int wasm_dump_global(WASMModuleInstance *module, WASMGlobalInstance *globals, ui
         }
     }
 
-    fclose(fp);
     return 0;
 }
 
 int wasm_dump_program_counter(
     WASMModuleInstance *module,
     WASMFunctionInstance *func,
-    uint8 *frame_ip
+    uint8 *frame_ip,
+    WASMImageWriter *writer
 )
 {
-    FILE *fp;
-    const char *file = "program_counter.img";
-    fp = fopen(file, "wb");
-    if (fp == NULL) {
-        fprintf(stderr, "failed to open %s\n", file);
+    WASMImageBuffer *buf = wasm_image_writer_add_section(
+        writer, IMAGE_SECTION_PROGRAM_COUNTER, 0);
+
+    if (!buf)
         return -1;
-    }
 
     uint32 fidx, p_offset;
     fidx = func - module->e->functions;
+#if WASM_ENABLE_FAST_INTERP == 0
     p_offset = frame_ip - wasm_get_func_code(func);
+#else
+    const WASMTypeStackEntry *entry = find_frame_entry(func, frame_ip, false);
+    if (!entry)
+        return -1;
+    p_offset = entry->offset;
+#endif
+
+    DUMP(buf, &fidx, sizeof(uint32));
+    DUMP(buf, &p_offset, sizeof(uint32));
+
+    return 0;
+}
+
+/* cluster */
+#if WASM_ENABLE_THREAD_MGR != 0
+// 他のthreadは自分のframeを書き出し、coordinatorが再開させるまで止まる
+typedef struct WASMParkedThread {
+    struct WASMParkedThread *next;
+    WASMExecEnv *exec_env;
+    int32 tid;
+    int rc;
+    bool parked;
+    // GLOBAL, PROGRAM_COUNTER, STACK
+    WASMImageWriter writer;
+} WASMParkedThread;
+
+void wasm_dump_park_thread(WASMExecEnv *exec_env,
+                           WASMModuleInstance *module,
+                           WASMGlobalInstance *globals,
+                           uint8 *global_data,
+                           WASMFunctionInstance *cur_func,
+                           struct WASMInterpFrame *frame,
+                           uint8 *frame_ip)
+{
+    WASMCluster *cluster = wasm_exec_env_get_cluster(exec_env);
+    WASMParkedThread thread = { 0 };
 
-    dump_value(&fidx, sizeof(uint32), 1, fp);
-    dump_value(&p_offset, sizeof(uint32), 1, fp);
+    thread.exec_env = exec_env;
+    thread.parked = true;
+#if WASM_ENABLE_LIB_WASI_THREADS != 0
+    thread.tid = wasi_threads_get_thread_id(exec_env);
+#else
+    thread.tid = -1;
+#endif
+
+    // 止まる前に自分のframeを書き出しておく. 各threadが並列に行う
+    wasm_image_writer_init(&thread.writer);
+    if (thread.tid < 0) {
+        LOG_ERROR("only the threads spawned by wasi-threads can be "
+                  "checkpointed\n");
+        thread.rc = -1;
+    }
+    else if (wasm_dump_global(module, globals, global_data, &thread.writer) < 0
+             || wasm_dump_program_counter(module, cur_func, frame_ip,
+                                          &thread.writer) < 0
+             || wasm_dump_stack(exec_env, frame, &thread.writer) < 0) {
+        LOG_ERROR("Failed to dump thread %d\n", thread.tid);
+        thread.rc = -1;
+    }
 
+    // clusterのlockで守る
+    // coordinatorが待つのを諦めた後に着いたthreadは、止まらずに続ける
+    os_mutex_lock(&cluster->lock);
+    if (!cluster->stopping_threads) {
+        os_mutex_unlock(&cluster->lock);
+        thread.parked = false;
+    }
+    else {
+        thread.next = cluster->parked_threads;
+        cluster->parked_threads = &thread;
+        cluster->parked_count++;
+        os_mutex_unlock(&cluster->lock);
+    }
+
+    os_mutex_lock(&exec_env->wait_lock);
+    while (thread.parked)
+        os_cond_wait(&exec_env->wait_cond, &exec_env->wait_lock);
+    os_mutex_unlock(&exec_env->wait_lock);
+
+    wasm_image_writer_destroy(&thread.writer);
+    // 止まっている間にcoordinatorがもう一度立てたflagは捨てる
+    WASM_SUSPEND_FLAGS_FETCH_AND(exec_env->suspend_flags,
+                                 ~WASM_SUSPEND_FLAG_CHECKPOINT);
+}
+
+// 自分でframeを書き出して止まれるのはinterpreterのthreadだけ
+static bool
+can_park_threads(WASMExecEnv *exec_env)
+{
+    return exec_env->module_inst->module_type == Wasm_Module_Bytecode;
+}
+
+// host関数の中でblockしたままのthreadを待ち続けないための上限
+#ifndef WASM_DUMP_STOP_THREADS_TIMEOUT_MS
+#define WASM_DUMP_STOP_THREADS_TIMEOUT_MS 5000
+#endif
+
+int wasm_dump_stop_threads(WASMExecEnv *exec_env) {
+    WASMCluster *cluster = wasm_exec_env_get_cluster(exec_env);
+    WASMParkedThread *thread;
+    uint32 count, parked, waited = 0;
+    struct timespec ts1, ts2;
+
+    if (!cluster)
+        return 0;
+
+    // 止められないthreadにはflagを立てない
+    os_mutex_lock(&cluster->lock);
+    count = bh_list_length(&cluster->exec_env_list) - 1;
+    os_mutex_unlock(&cluster->lock);
+    if (count == 0)
+        return 0;
+    if (!can_park_threads(exec_env)) {
+        LOG_ERROR("checkpoint of multiple threads is only supported by "
+                  "the interpreter\n");
+        return -1;
+    }
+
+    os_mutex_lock(&cluster->lock);
+    cluster->stopping_threads = true;
+    os_mutex_unlock(&cluster->lock);
+
+    clock_gettime(CLOCK_MONOTONIC, &ts1);
+    while (1) {
+        // 途中で生まれたthreadにも伝わるよう、毎回flagを立て直す
+        count = wasm_cluster_checkpoint_all_except_self(cluster, exec_env);
+        if (count == 0)
+            break;
+
+        os_mutex_lock(&cluster->lock);
+        parked = cluster->parked_count;
+        os_mutex_unlock(&cluster->lock);
+        if (parked >= count)
+            break;
+
+        // host関数の中にいるthreadは、wasmに戻るまで止まらない
+        // 止まったthreadを再開して、このcheckpointは諦める
+        clock_gettime(CLOCK_MONOTONIC, &ts2);
+        if (get_time(ts1, ts2)
+            >= (int64_t)WASM_DUMP_STOP_THREADS_TIMEOUT_MS * 1000000) {
+            LOG_ERROR("%u threads didn't stop for checkpoint in %u ms\n",
+                      count - parked, WASM_DUMP_STOP_THREADS_TIMEOUT_MS);
+            wasm_dump_resume_threads(exec_env);
+            return -1;
+        }
+        if (++waited % 1000 == 0)
+            LOG_WARNING("waiting for %u threads to stop for checkpoint\n",
+                        count - parked);
+        os_usleep(1000);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &ts2);
+    wasm_migration_stats_phase(WASM_MIGRATION_PHASE_STOP_THREADS,
+                               get_time(ts1, ts2));
+
+    for (thread = cluster->parked_threads; thread; thread = thread->next) {
+        if (thread->rc < 0) {
+            wasm_dump_resume_threads(exec_env);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void wasm_dump_resume_threads(WASMExecEnv *exec_env) {
+    WASMCluster *cluster = wasm_exec_env_get_cluster(exec_env);
+    WASMParkedThread *thread, *next;
+
+    if (!cluster)
+        return;
+
+    os_mutex_lock(&cluster->lock);
+    thread = cluster->parked_threads;
+    cluster->parked_threads = NULL;
+    cluster->parked_count = 0;
+    cluster->stopping_threads = false;
+    os_mutex_unlock(&cluster->lock);
+
+    // 再開したthreadのrecordは消えるので、nextを先に読む
+    for (; thread; thread = next) {
+        next = thread->next;
+        os_mutex_lock(&thread->exec_env->wait_lock);
+        thread->parked = false;
+        os_cond_broadcast(&thread->exec_env->wait_cond);
+        os_mutex_unlock(&thread->exec_env->wait_lock);
+    }
+}
+
+static int
+dump_threads(WASMExecEnv *exec_env, WASMImageWriter *writer)
+{
+    WASMCluster *cluster = wasm_exec_env_get_cluster(exec_env);
+    WASMImageBuffer *buf;
+    WASMParkedThread *thread;
+    uint32 i, record_size;
+    uint64 record_start;
+
+    if (!cluster || !cluster->parked_threads)
+        return 0;
+    if (!(buf = wasm_image_writer_add_section(writer, IMAGE_SECTION_THREADS,
+                                              0)))
+        return -1;
+
+    DUMP(buf, &cluster->parked_count, sizeof(uint32));
+    wasm_migration_stats_add_threads(cluster->parked_count);
+    for (thread = cluster->parked_threads; thread; thread = thread->next) {
+        DUMP(buf, &thread->tid, sizeof(int32));
+        record_size = 0;
+        DUMP(buf, &record_size, sizeof(uint32));
+        record_start = buf->size;
+
+        for (i = 0; i < thread->writer.section_count; i++) {
+            const WASMImageSection *section = &thread->writer.sections[i];
+            uint32 size = (uint32)section->buf.size, frame_count;
+            // STACK sectionの先頭はframe数
+            if (section->type == IMAGE_SECTION_STACK
+                && size >= sizeof(uint32)) {
+                memcpy(&frame_count, section->buf.data, sizeof(uint32));
+                wasm_migration_stats_add_frames(frame_count);
+            }
+            DUMP(buf, &section->type, sizeof(uint32));
+            DUMP(buf, &size, sizeof(uint32));
+            DUMP(buf, section->buf.data, size);
+        }
+
+        record_size = (uint32)(buf->size - record_start);
+        memcpy(buf->data + record_start - sizeof(uint32), &record_size,
+               sizeof(uint32));
+    }
+    return 0;
+}
+#else
+int wasm_dump_stop_threads(WASMExecEnv *exec_env) {
     return 0;
 }
 
+void wasm_dump_resume_threads(WASMExecEnv *exec_env) {
+}
+#endif
+
 int wasm_dump(WASMExecEnv *exec_env,
          WASMModuleInstance *module,
          WASMMemoryInstance *memory,
@@ -464,64 +1329,316 @@ int wasm_dump(WASMExecEnv *exec_env,
          uint8 *maddr,
          bool done_flag)
 {
+    WASMImageWriter writer;
+    uint8 *dirty_bitmap = NULL;
     int rc;
     struct timespec ts1, ts2;
+
+    // 書き出し中のsnapshotと同じimageを書かないように待つ
+    wait_snapshot(true);
+
+    // 全stateを1つのimageに集めてから書き出す
+    wasm_image_writer_init(&writer);
+
     // dump linear memory
     clock_gettime(CLOCK_MONOTONIC, &ts1);
-    rc = wasm_dump_memory(memory);
+    // pre-copyしていれば、最後のroundからdirtyになったページだけでよい
+    // streamの受け手はpre-copyのimageを持っていないので、全ページを送る
+    // pre-copyのroundはprocess全体のrequestで取るので、instanceへのrequestも全ページ
+    if (wasm_image_is_stream(image_target(exec_env, in_snapshot))
+        || (!in_snapshot
+            && !is_process_request(exec_env, WASM_CHECKPOINT_REQUEST_FINAL))) {
+        rc = wasm_dump_memory(memory, &writer, NULL, 0);
+    }
+    else {
+        // deltaにするかは、書き出し中のroundがすべて書けてから決める
+        check_precopy_rounds(true);
+        if (precopy_round > 0
+            && !(dirty_bitmap = collect_dirty_pages(memory)))
+            rc = -1;
+        else
+            rc = wasm_dump_memory(memory, &writer, dirty_bitmap,
+                                  precopy_round);
+    }
     clock_gettime(CLOCK_MONOTONIC, &ts2);
-    fprintf(stderr, "memory, %lu\n", get_time(ts1, ts2));
+    wasm_migration_stats_phase(WASM_MIGRATION_PHASE_MEMORY, get_time(ts1, ts2));
     if (rc < 0) {
         LOG_ERROR("Failed to dump linear memory\n");
-        return rc;
+        goto fail;
     }
 
     // dump globals
     clock_gettime(CLOCK_MONOTONIC, &ts1);
-    rc = wasm_dump_global(module, globals, global_data);
+    rc = wasm_dump_global(module, globals, global_data, &writer);
     clock_gettime(CLOCK_MONOTONIC, &ts2);
-    fprintf(stderr, "global, %lu\n", get_time(ts1, ts2));
+    wasm_migration_stats_phase(WASM_MIGRATION_PHASE_GLOBAL, get_time(ts1, ts2));
     if (rc < 0) {
         LOG_ERROR("Failed to dump globals\n");
-        return rc;
+        goto fail;
     }
 
     // dump program counter
     clock_gettime(CLOCK_MONOTONIC, &ts1);
-    rc = wasm_dump_program_counter(module, cur_func, frame_ip);
+    rc = wasm_dump_program_counter(module, cur_func, frame_ip, &writer);
     clock_gettime(CLOCK_MONOTONIC, &ts2);
-    fprintf(stderr, "program counter, %lu\n", get_time(ts1, ts2));
+    wasm_migration_stats_phase(WASM_MIGRATION_PHASE_PROGRAM_COUNTER, get_time(ts1, ts2));
     if (rc < 0) {
         LOG_ERROR("Failed to dump program_counter\n");
-        return rc;
+        goto fail;
     }
 
     // dump stack
     clock_gettime(CLOCK_MONOTONIC, &ts1);
-    rc = wasm_dump_stack(exec_env, frame);
+    rc = wasm_dump_stack(exec_env, frame, &writer);
     clock_gettime(CLOCK_MONOTONIC, &ts2);
-    fprintf(stderr, "stack, %lu\n", get_time(ts1, ts2));
+    wasm_migration_stats_phase(WASM_MIGRATION_PHASE_STACK, get_time(ts1, ts2));
     if (rc < 0) {
         LOG_ERROR("Failed to dump frame\n");
-        return rc;
+        goto fail;
+    }
+
+    wasm_migration_stats_add_threads(1);
+#if WASM_ENABLE_THREAD_MGR != 0
+    // 止めてある他のthreadのframe
+    clock_gettime(CLOCK_MONOTONIC, &ts1);
+    rc = dump_threads(exec_env, &writer);
+    clock_gettime(CLOCK_MONOTONIC, &ts2);
+    wasm_migration_stats_phase(WASM_MIGRATION_PHASE_THREADS,
+                               get_time(ts1, ts2));
+    if (rc < 0) {
+        LOG_ERROR("Failed to dump threads\n");
+        goto fail;
+    }
+#endif
+
+    // write image
+    clock_gettime(CLOCK_MONOTONIC, &ts1);
+    if (!wasm_dump_write_image(exec_env, &writer))
+        rc = -1;
+    clock_gettime(CLOCK_MONOTONIC, &ts2);
+    wasm_migration_stats_phase(WASM_MIGRATION_PHASE_WRITE, get_time(ts1, ts2));
+    if (rc < 0) {
+        LOG_ERROR("Failed to write checkpoint image\n");
+        goto fail;
     }
 
+    wasm_image_writer_destroy(&writer);
+    free(dirty_bitmap);
     LOG_VERBOSE("Success to dump img for wamr\n");
     return 0;
+
+fail:
+    wasm_image_writer_destroy(&writer);
+    free(dirty_bitmap);
+    return rc;
+}
+
+int wasm_dump_snapshot(WASMModuleInstance *module, const char *path)
+{
+    WASMMemoryInstance *memory =
+        module->memory_count > 0 ? module->memories[0] : NULL;
+    WASMImageWriter writer;
+    int rc = 0;
+
+    wasm_image_writer_init(&writer);
+
+    // 圧縮したページはmapできないので、全ページをそのまま書く
+    if (memory && dump_memory(memory, &writer, NULL, 0, false, NULL) < 0) {
+        LOG_ERROR("Failed to dump linear memory\n");
+        rc = -1;
+        goto fail;
+    }
+
+#if WASM_ENABLE_AOT != 0
+    if (module->module_type == Wasm_Module_AoT)
+        rc = aot_checkpoint_dump_global(module, &writer);
+    else
+#endif
+        rc = wasm_dump_global(module, module->e->globals, module->global_data,
+                              &writer);
+    if (rc < 0) {
+        LOG_ERROR("Failed to dump globals\n");
+        goto fail;
+    }
+
+    // 全instanceがmapするので、streamではなくfileに書く
+    if (!wasm_image_writer_write_file(&writer, path)) {
+        LOG_ERROR("Failed to write snapshot image\n");
+        rc = -1;
+    }
+
+fail:
+    wasm_image_writer_destroy(&writer);
+    return rc;
+}
+
+/* checkpoint requests */
+// wasm_runtime_checkpointなどprocess全体へのrequest. 最後に登録されたexec_envが受け取る
+// signal handlerからも更新するので、read-modify-writeはatomicに行う
+static bh_atomic_32_t sig_flag = 0;
+static WASMExecEnv *volatile checkpoint_exec_env = NULL;
+// instanceのexec_envとsinkを守る. requestはhostの任意のthreadから来るので、
+// 登録を外したexec_envが破棄される前に、そのsuspend_flagsに触れないようにする
+static korp_mutex checkpoint_lock = OS_THREAD_MUTEX_INITIALIZER;
+
+static bool
+is_process_request(WASMExecEnv *exec_env, uint32 request)
+{
+    return exec_env == checkpoint_exec_env
+           && (BH_ATOMIC_32_LOAD(sig_flag) & request);
+}
+
+static const char *
+instance_sink(WASMExecEnv *exec_env)
+{
+    const char *sink;
+
+    os_mutex_lock(&checkpoint_lock);
+    sink = wasm_migration_get_state(exec_env->module_inst)->sink;
+    os_mutex_unlock(&checkpoint_lock);
+    return sink;
+}
+
+// interpreterとAOTのコードは次のloop/callでこのflagを確認する
+static void
+raise_checkpoint(WASMExecEnv *exec_env)
+{
+    if (exec_env)
+        WASM_SUSPEND_FLAGS_FETCH_OR(exec_env->suspend_flags,
+                                    WASM_SUSPEND_FLAG_CHECKPOINT);
 }
 
-static bool sig_flag = false;
+static void
+request_checkpoint(uint32 request)
+{
+    BH_ATOMIC_32_FETCH_OR(sig_flag, request);
+    raise_checkpoint(checkpoint_exec_env);
+}
 
 void wasm_runtime_checkpoint() {
-    wasm_set_checkpoint(true);
+    request_checkpoint(WASM_CHECKPOINT_REQUEST_FINAL);
+}
+
+bool
+wasm_runtime_request_checkpoint(WASMModuleInstanceCommon *module_inst,
+                                const char *sink)
+{
+    WASMMigrationState *state;
+
+    if (!module_inst || !wasm_migration_is_supported(module_inst))
+        return false;
+    state = wasm_migration_get_state(module_inst);
+    os_mutex_lock(&checkpoint_lock);
+    state->sink = sink;
+    BH_ATOMIC_32_FETCH_OR(state->request, WASM_CHECKPOINT_REQUEST_FINAL);
+    // まだwasmに入っていなければ、登録したときに伝わる
+    raise_checkpoint(state->exec_env);
+    os_mutex_unlock(&checkpoint_lock);
+    return true;
+}
+
+void
+wasm_runtime_set_checkpoint_callback(wasm_checkpoint_callback_t callback,
+                                     void *user_data)
+{
+    checkpoint_callback_data = user_data;
+    checkpoint_callback = callback;
+}
+
+void wasm_dump_register_exec_env(WASMExecEnv *exec_env) {
+    WASMMigrationState *state;
+
+#if WASM_ENABLE_THREAD_MGR != 0
+    // clusterの他のthreadはmainのthreadが止めるので登録しない
+    if (exec_env->thread_start_routine)
+        return;
+#endif
+    state = wasm_migration_get_state(exec_env->module_inst);
+    os_mutex_lock(&checkpoint_lock);
+    state->exec_env = exec_env;
+    checkpoint_exec_env = exec_env;
+    // 登録前に来たrequestも伝える
+    if (BH_ATOMIC_32_LOAD(sig_flag) || BH_ATOMIC_32_LOAD(state->request))
+        raise_checkpoint(exec_env);
+    os_mutex_unlock(&checkpoint_lock);
+}
+
+void wasm_dump_unregister_exec_env(WASMExecEnv *exec_env) {
+    WASMMigrationState *state;
+
+    os_mutex_lock(&checkpoint_lock);
+    if (checkpoint_exec_env == exec_env)
+        checkpoint_exec_env = NULL;
+    if (exec_env->module_inst) {
+        state = wasm_migration_get_state(exec_env->module_inst);
+        if (state->exec_env == exec_env)
+            state->exec_env = NULL;
+    }
+    os_mutex_unlock(&checkpoint_lock);
+}
+
+bool wasm_dump_is_primary(WASMExecEnv *exec_env) {
+    return exec_env == wasm_migration_get_state(exec_env->module_inst)->exec_env;
+}
+
+bool wasm_dump_end_checkpoint(WASMExecEnv *exec_env, int rc) {
+    // process全体へのrequestは、これまでどおりimageを書いたら終了する
+    // writer threadが書いているpre-copyのroundも書き終えてから終了する
+    // 失敗したらrequestを捨てて、止めたthreadと一緒にそのまま続ける
+    if (is_process_request(exec_env, WASM_CHECKPOINT_REQUEST_FINAL)) {
+        wasm_image_flusher_wait();
+        wasm_migration_stats_end(rc == 0);
+        if (rc == 0)
+            exit(0);
+        LOG_ERROR("failed to take checkpoint, continuing\n");
+        wasm_clear_checkpoint_request(exec_env, WASM_CHECKPOINT_REQUEST_FINAL);
+        wasm_dump_resume_threads(exec_env);
+        return false;
+    }
+
+    // instanceへのrequestは、そのinstanceだけを止める
+    // asyncならimageはまだ書き出し中で、書けたことはcallbackで伝える
+    // exceptionはclusterの他のthreadにも伝わり、再開したthreadも終了する
+    wasm_migration_stats_end(rc == 0);
+    wasm_clear_checkpoint_request(exec_env, WASM_CHECKPOINT_REQUEST_FINAL);
+    wasm_runtime_set_exception(exec_env->module_inst,
+                               rc < 0 ? "failed to take checkpoint"
+                                      : "checkpointed");
+    wasm_dump_resume_threads(exec_env);
+    return true;
+}
+
+void wasm_runtime_checkpoint_precopy() {
+    request_checkpoint(WASM_CHECKPOINT_REQUEST_PRECOPY);
+}
+
+void wasm_runtime_checkpoint_snapshot() {
+    request_checkpoint(WASM_CHECKPOINT_REQUEST_SNAPSHOT);
 }
 
 inline 
 void wasm_set_checkpoint(bool f) {
-    sig_flag = f;
+    BH_ATOMIC_32_STORE(sig_flag, f ? WASM_CHECKPOINT_REQUEST_FINAL : 0);
 }
 
 inline 
 bool wasm_get_checkpoint() {
-    return sig_flag;
-}
\ No newline at end of file
+    return BH_ATOMIC_32_LOAD(sig_flag) != 0;
+}
+
+uint32 wasm_get_checkpoint_request(WASMExecEnv *exec_env) {
+    WASMMigrationState *state = wasm_migration_get_state(exec_env->module_inst);
+    uint32 request = BH_ATOMIC_32_LOAD(state->request);
+
+    if (exec_env == checkpoint_exec_env)
+        request |= BH_ATOMIC_32_LOAD(sig_flag);
+    return request;
+}
+
+void wasm_clear_checkpoint_request(WASMExecEnv *exec_env, uint32 request) {
+    WASMMigrationState *state = wasm_migration_get_state(exec_env->module_inst);
+
+    BH_ATOMIC_32_FETCH_AND(state->request, ~request);
+    if (exec_env == checkpoint_exec_env)
+        BH_ATOMIC_32_FETCH_AND(sig_flag, ~request);
+}
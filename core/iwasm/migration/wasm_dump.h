@@ -3,10 +3,112 @@
 
 #include "../common/wasm_exec_env.h"
 #include "../interpreter/wasm_interp.h"
+#include "wasm_image.h"
+#include "wasm_migration_stats.h"
+
+/* Kinds of pending checkpoint requests */
+#define WASM_CHECKPOINT_REQUEST_FINAL 0x1
+#define WASM_CHECKPOINT_REQUEST_PRECOPY 0x2
+#define WASM_CHECKPOINT_REQUEST_SNAPSHOT 0x4
 
 void wasm_set_checkpoint(bool f);
 bool wasm_get_checkpoint();
 
+/* Requests pending for exec_env: the ones of its instance, and the process
+   wide ones of wasm_runtime_checkpoint() if exec_env is the last registered
+   one */
+uint32 wasm_get_checkpoint_request(WASMExecEnv *exec_env);
+void wasm_clear_checkpoint_request(WASMExecEnv *exec_env, uint32 request);
+
+/* The classic interpreter and AOT code poll the suspend flags of the
+   exec_env at loops and calls, a request is also raised there */
+void wasm_dump_register_exec_env(WASMExecEnv *exec_env);
+void wasm_dump_unregister_exec_env(WASMExecEnv *exec_env);
+
+/* Whether the exec_env is the one registered for its instance, the other
+   threads of its cluster only stop for the checkpoint taken by it */
+bool wasm_dump_is_primary(WASMExecEnv *exec_env);
+
+/* Stop the other threads of the cluster at their safepoints. Each of them
+   dumps its own frames in wasm_dump_park_thread and waits there until
+   wasm_dump_resume_threads, wasm_dump then writes them with the shared
+   memory. Only the interpreters can park threads, this fails for AOT when
+   the cluster has more than one thread. If the threads don't all park
+   within WASM_DUMP_STOP_THREADS_TIMEOUT_MS, e.g. one is blocked in a host
+   function, the parked ones are resumed and -1 is returned. */
+int wasm_dump_stop_threads(WASMExecEnv *exec_env);
+void wasm_dump_resume_threads(WASMExecEnv *exec_env);
+
+#if WASM_ENABLE_THREAD_MGR != 0
+void wasm_dump_park_thread(WASMExecEnv *exec_env,
+                           WASMModuleInstance *module,
+                           WASMGlobalInstance *globals,
+                           uint8 *global_data,
+                           WASMFunctionInstance *cur_func,
+                           struct WASMInterpFrame *frame,
+                           uint8 *frame_ip);
+#endif
+
+/* Where the final checkpoint image is written, see wasm_image_is_stream.
+   Defaults to checkpoint.img. Snapshots and pre-copy rounds are still
+   written to files, the image sent to a stream holds all the pages. */
+void set_checkpoint_target(const char *target);
+
+/* Write the image of a final checkpoint or a snapshot to its target, the
+   sink of wasm_runtime_request_checkpoint for a request of the instance */
+bool wasm_dump_write_image(WASMExecEnv *exec_env, WASMImageWriter *writer);
+
+/* Finish the final checkpoint of exec_env, rc < 0 if it failed. A process
+   wide request exits the process once the image is written, a failed one
+   is logged and dropped and the threads resume. A request of the instance
+   resumes its threads and raises the "checkpointed" exception, so that
+   only the call into this instance returns. Returns whether the exception
+   was raised, false if the caller continues executing. */
+bool wasm_dump_end_checkpoint(WASMExecEnv *exec_env, int rc);
+
+/* Compress the linear memory pages in the LZ4 block format, pages that do
+   not shrink are stored as they are */
+void set_checkpoint_compress(bool f);
+
+/* Store the non-zero pages in the page pool at path instead of the image,
+   NULL to store them in the image. Compression is not applied to them. */
+void set_checkpoint_page_pool(const char *path);
+
+/* Write the images of the pre-copy rounds and of the checkpoints requested
+   for an instance on a background thread: the guest only waits for its
+   state to be copied, wasm_runtime_set_checkpoint_callback reports when the
+   image is written. A checkpoint of the whole process is still written
+   before it exits. */
+void set_checkpoint_async(bool f);
+
+int wasm_dump_memory(WASMMemoryInstance *memory, WASMImageWriter *writer,
+                     const uint8 *dirty_bitmap, uint32 delta_count);
+
+/* Write the next pre-copy memory image, the first round is a full base
+   image and later rounds only contain pages dirtied since the previous one */
+int wasm_dump_precopy(WASMMemoryInstance *memory);
+
+/* Fork a child process that writes the checkpoint image of the state at
+   the fork while the parent keeps running. Returns 0 in the child, which
+   must write the image and _exit(), 1 in the parent and -1 on failure.
+   A request arriving while the previous snapshot is written is dropped. */
+int wasm_dump_fork_snapshot(WASMExecEnv *exec_env);
+
+/* Wait for the snapshot being written, so that the final checkpoint does
+   not race with it on the image file */
+void wasm_dump_wait_snapshot();
+
+/* Write a snapshot image of an instance that is not running: its linear
+   memory uncompressed, so that wasm_restore_snapshot can map every page,
+   and its globals. It has no stack and is always written to a file. */
+int wasm_dump_snapshot(WASMModuleInstance *module, const char *path);
+
+#if WASM_ENABLE_FAST_INTERP != 0
+/* Whether frame_ip is the start of an instruction of the original bytecode,
+   a checkpoint can only be taken there */
+bool wasm_dump_is_safepoint(WASMFunctionInstance *func, uint8 *frame_ip);
+#endif
+
 int wasm_dump(WASMExecEnv *exec_env,
          WASMModuleInstance *module,
          WASMMemoryInstance *memory,
@@ -0,0 +1,1000 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "wasm_image.h"
+#include "wasm_image_compress.h"
+#include "wasm_migration_stats.h"
+
+#define IMAGE_IOV_BATCH 512
+/* Size of the writes of an O_DIRECT image */
+#define IMAGE_STAGE_SIZE (4 * 1024 * 1024)
+/* Wait up to 10s for the restoring side to listen */
+#define IMAGE_CONNECT_RETRY 100
+#define IMAGE_CONNECT_INTERVAL_US 100000
+
+/* CRC-32 (IEEE 802.3, reflected polynomial 0xEDB88320) of each byte.
+   Precomputed, since the dump and flusher threads compute CRCs
+   concurrently. */
+static const uint32 crc32_table[256] = {
+    0x00000000, 0x77073096, 0xee0e612c, 0x990951ba, 0x076dc419, 0x706af48f,
+    0xe963a535, 0x9e6495a3, 0x0edb8832, 0x79dcb8a4, 0xe0d5e91e, 0x97d2d988,
+    0x09b64c2b, 0x7eb17cbd, 0xe7b82d07, 0x90bf1d91, 0x1db71064, 0x6ab020f2,
+    0xf3b97148, 0x84be41de, 0x1adad47d, 0x6ddde4eb, 0xf4d4b551, 0x83d385c7,
+    0x136c9856, 0x646ba8c0, 0xfd62f97a, 0x8a65c9ec, 0x14015c4f, 0x63066cd9,
+    0xfa0f3d63, 0x8d080df5, 0x3b6e20c8, 0x4c69105e, 0xd56041e4, 0xa2677172,
+    0x3c03e4d1, 0x4b04d447, 0xd20d85fd, 0xa50ab56b, 0x35b5a8fa, 0x42b2986c,
+    0xdbbbc9d6, 0xacbcf940, 0x32d86ce3, 0x45df5c75, 0xdcd60dcf, 0xabd13d59,
+    0x26d930ac, 0x51de003a, 0xc8d75180, 0xbfd06116, 0x21b4f4b5, 0x56b3c423,
+    0xcfba9599, 0xb8bda50f, 0x2802b89e, 0x5f058808, 0xc60cd9b2, 0xb10be924,
+    0x2f6f7c87, 0x58684c11, 0xc1611dab, 0xb6662d3d, 0x76dc4190, 0x01db7106,
+    0x98d220bc, 0xefd5102a, 0x71b18589, 0x06b6b51f, 0x9fbfe4a5, 0xe8b8d433,
+    0x7807c9a2, 0x0f00f934, 0x9609a88e, 0xe10e9818, 0x7f6a0dbb, 0x086d3d2d,
+    0x91646c97, 0xe6635c01, 0x6b6b51f4, 0x1c6c6162, 0x856530d8, 0xf262004e,
+    0x6c0695ed, 0x1b01a57b, 0x8208f4c1, 0xf50fc457, 0x65b0d9c6, 0x12b7e950,
+    0x8bbeb8ea, 0xfcb9887c, 0x62dd1ddf, 0x15da2d49, 0x8cd37cf3, 0xfbd44c65,
+    0x4db26158, 0x3ab551ce, 0xa3bc0074, 0xd4bb30e2, 0x4adfa541, 0x3dd895d7,
+    0xa4d1c46d, 0xd3d6f4fb, 0x4369e96a, 0x346ed9fc, 0xad678846, 0xda60b8d0,
+    0x44042d73, 0x33031de5, 0xaa0a4c5f, 0xdd0d7cc9, 0x5005713c, 0x270241aa,
+    0xbe0b1010, 0xc90c2086, 0x5768b525, 0x206f85b3, 0xb966d409, 0xce61e49f,
+    0x5edef90e, 0x29d9c998, 0xb0d09822, 0xc7d7a8b4, 0x59b33d17, 0x2eb40d81,
+    0xb7bd5c3b, 0xc0ba6cad, 0xedb88320, 0x9abfb3b6, 0x03b6e20c, 0x74b1d29a,
+    0xead54739, 0x9dd277af, 0x04db2615, 0x73dc1683, 0xe3630b12, 0x94643b84,
+    0x0d6d6a3e, 0x7a6a5aa8, 0xe40ecf0b, 0x9309ff9d, 0x0a00ae27, 0x7d079eb1,
+    0xf00f9344, 0x8708a3d2, 0x1e01f268, 0x6906c2fe, 0xf762575d, 0x806567cb,
+    0x196c3671, 0x6e6b06e7, 0xfed41b76, 0x89d32be0, 0x10da7a5a, 0x67dd4acc,
+    0xf9b9df6f, 0x8ebeeff9, 0x17b7be43, 0x60b08ed5, 0xd6d6a3e8, 0xa1d1937e,
+    0x38d8c2c4, 0x4fdff252, 0xd1bb67f1, 0xa6bc5767, 0x3fb506dd, 0x48b2364b,
+    0xd80d2bda, 0xaf0a1b4c, 0x36034af6, 0x41047a60, 0xdf60efc3, 0xa867df55,
+    0x316e8eef, 0x4669be79, 0xcb61b38c, 0xbc66831a, 0x256fd2a0, 0x5268e236,
+    0xcc0c7795, 0xbb0b4703, 0x220216b9, 0x5505262f, 0xc5ba3bbe, 0xb2bd0b28,
+    0x2bb45a92, 0x5cb36a04, 0xc2d7ffa7, 0xb5d0cf31, 0x2cd99e8b, 0x5bdeae1d,
+    0x9b64c2b0, 0xec63f226, 0x756aa39c, 0x026d930a, 0x9c0906a9, 0xeb0e363f,
+    0x72076785, 0x05005713, 0x95bf4a82, 0xe2b87a14, 0x7bb12bae, 0x0cb61b38,
+    0x92d28e9b, 0xe5d5be0d, 0x7cdcefb7, 0x0bdbdf21, 0x86d3d2d4, 0xf1d4e242,
+    0x68ddb3f8, 0x1fda836e, 0x81be16cd, 0xf6b9265b, 0x6fb077e1, 0x18b74777,
+    0x88085ae6, 0xff0f6a70, 0x66063bca, 0x11010b5c, 0x8f659eff, 0xf862ae69,
+    0x616bffd3, 0x166ccf45, 0xa00ae278, 0xd70dd2ee, 0x4e048354, 0x3903b3c2,
+    0xa7672661, 0xd06016f7, 0x4969474d, 0x3e6e77db, 0xaed16a4a, 0xd9d65adc,
+    0x40df0b66, 0x37d83bf0, 0xa9bcae53, 0xdebb9ec5, 0x47b2cf7f, 0x30b5ffe9,
+    0xbdbdf21c, 0xcabac28a, 0x53b39330, 0x24b4a3a6, 0xbad03605, 0xcdd70693,
+    0x54de5729, 0x23d967bf, 0xb3667a2e, 0xc4614ab8, 0x5d681b02, 0x2a6f2b94,
+    0xb40bbe37, 0xc30c8ea1, 0x5a05df1b, 0x2d02ef8d
+};
+
+uint32
+wasm_image_crc32(uint32 crc, const uint8 *data, uint64 size)
+{
+    crc = ~crc;
+    for (uint64 i = 0; i < size; i++)
+        crc = crc32_table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+bool
+wasm_image_buf_write(WASMImageBuffer *buf, const void *data, uint64 size)
+{
+    if (buf->size + size > buf->capacity) {
+        uint64 capacity = buf->capacity ? buf->capacity : 256;
+        uint8 *new_data;
+        while (capacity < buf->size + size)
+            capacity *= 2;
+        if (!(new_data = realloc(buf->data, capacity)))
+            return false;
+        buf->data = new_data;
+        buf->capacity = capacity;
+    }
+    memcpy(buf->data + buf->size, data, size);
+    buf->size += size;
+    return true;
+}
+
+void
+wasm_image_writer_init(WASMImageWriter *writer)
+{
+    memset(writer, 0, sizeof(WASMImageWriter));
+}
+
+void
+wasm_image_writer_destroy(WASMImageWriter *writer)
+{
+    for (uint32 i = 0; i < writer->section_count; i++) {
+        free(writer->sections[i].buf.data);
+        free(writer->sections[i].chunks);
+    }
+    for (uint32 i = 0; i < writer->attached_count; i++)
+        free(writer->attached[i]);
+    free(writer->attached);
+    memset(writer, 0, sizeof(WASMImageWriter));
+}
+
+static WASMImageSection *
+add_section(WASMImageWriter *writer, uint32 type, uint32 flags)
+{
+    WASMImageSection *section;
+
+    if (writer->section_count >= WASM_IMAGE_MAX_SECTIONS) {
+        LOG_ERROR("too many sections in checkpoint image\n");
+        return NULL;
+    }
+    section = &writer->sections[writer->section_count++];
+    memset(section, 0, sizeof(WASMImageSection));
+    section->type = type;
+    section->flags = flags;
+    return section;
+}
+
+WASMImageBuffer *
+wasm_image_writer_add_section(WASMImageWriter *writer, uint32 type,
+                              uint32 flags)
+{
+    WASMImageSection *section = add_section(writer, type, flags);
+    return section ? &section->buf : NULL;
+}
+
+WASMImageSection *
+wasm_image_writer_add_chunked_section(WASMImageWriter *writer, uint32 type,
+                                      uint32 flags)
+{
+    return add_section(writer, type, flags);
+}
+
+bool
+wasm_image_section_add_chunk(WASMImageSection *section, const uint8 *data,
+                             uint64 size)
+{
+    if (section->chunk_count >= section->chunk_capacity) {
+        uint32 capacity =
+            section->chunk_capacity ? section->chunk_capacity * 2 : 64;
+        WASMImageChunk *chunks =
+            realloc(section->chunks, sizeof(WASMImageChunk) * capacity);
+        if (!chunks)
+            return false;
+        section->chunks = chunks;
+        section->chunk_capacity = capacity;
+    }
+    section->chunks[section->chunk_count].data = data;
+    section->chunks[section->chunk_count].size = size;
+    section->chunk_count++;
+    return true;
+}
+
+bool
+wasm_image_writer_attach(WASMImageWriter *writer, void *data)
+{
+    if (writer->attached_count >= writer->attached_capacity) {
+        uint32 capacity =
+            writer->attached_capacity ? writer->attached_capacity * 2 : 64;
+        void **attached =
+            realloc(writer->attached, sizeof(void *) * capacity);
+        if (!attached) {
+            free(data);
+            return false;
+        }
+        writer->attached = attached;
+        writer->attached_capacity = capacity;
+    }
+    writer->attached[writer->attached_count++] = data;
+    return true;
+}
+
+static uint64
+section_size(const WASMImageSection *section)
+{
+    uint64 size = section->buf.size;
+    for (uint32 i = 0; i < section->chunk_count; i++)
+        size += section->chunks[i].size;
+    return size;
+}
+
+static uint32
+section_checksum(const WASMImageSection *section)
+{
+    uint32 crc = wasm_image_crc32(0, section->buf.data, section->buf.size);
+    for (uint32 i = 0; i < section->chunk_count; i++)
+        crc = wasm_image_crc32(crc, section->chunks[i].data,
+                               section->chunks[i].size);
+    return crc;
+}
+
+/* A WASM_IMAGE_BLOCK_SIZE piece of the copy of the chunks of a section is
+   a task of wasm_image_run_parallel */
+typedef struct DetachContext {
+    const WASMImageSection *section;
+    /* Offset of each chunk in data */
+    uint64 *offsets;
+    uint8 *data;
+    uint64 size;
+} DetachContext;
+
+static void
+copy_chunk_block(void *ctx, uint32 index)
+{
+    DetachContext *detach = ctx;
+    const WASMImageSection *section = detach->section;
+    uint64 begin = (uint64)index * WASM_IMAGE_BLOCK_SIZE;
+    uint64 end = detach->size - begin < WASM_IMAGE_BLOCK_SIZE
+                     ? detach->size
+                     : begin + WASM_IMAGE_BLOCK_SIZE;
+    uint32 lo = 0, hi = section->chunk_count, mid;
+
+    /* the last chunk starting at or before begin */
+    while (hi - lo > 1) {
+        mid = lo + (hi - lo) / 2;
+        if (detach->offsets[mid] <= begin)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    for (uint32 i = lo; begin < end; i++) {
+        uint64 skip = begin - detach->offsets[i];
+        uint64 n = section->chunks[i].size - skip;
+        if (n > end - begin)
+            n = end - begin;
+        memcpy(detach->data + begin, section->chunks[i].data + skip, n);
+        begin += n;
+    }
+}
+
+bool
+wasm_image_writer_detach(WASMImageWriter *writer)
+{
+    uint8 *copies[WASM_IMAGE_MAX_SECTIONS] = { 0 };
+    uint64 sizes[WASM_IMAGE_MAX_SECTIONS] = { 0 };
+    DetachContext detach;
+    uint32 copy_count = 0, i;
+    void **attached;
+
+    for (i = 0; i < writer->section_count; i++) {
+        WASMImageSection *section = &writer->sections[i];
+        sizes[i] = section_size(section) - section->buf.size;
+        if (sizes[i] == 0)
+            continue;
+        if (!(copies[i] = malloc(sizes[i]))) {
+            LOG_ERROR("failed to allocate %" PRIu64 " bytes to detach the "
+                      "checkpoint image\n",
+                      sizes[i]);
+            goto fail;
+        }
+        copy_count++;
+    }
+    /* the buffers replace the attached ones, which can't fail after that */
+    if (writer->attached_capacity < copy_count) {
+        if (!(attached = realloc(writer->attached, sizeof(void *) * copy_count)))
+            goto fail;
+        writer->attached = attached;
+        writer->attached_capacity = copy_count;
+    }
+
+    for (i = 0; i < writer->section_count; i++) {
+        WASMImageSection *section = &writer->sections[i];
+        uint64 offset = 0;
+        if (!copies[i])
+            continue;
+        if (!(detach.offsets =
+                  malloc(sizeof(uint64) * section->chunk_count)))
+            goto fail;
+        for (uint32 j = 0; j < section->chunk_count; j++) {
+            detach.offsets[j] = offset;
+            offset += section->chunks[j].size;
+        }
+        detach.section = section;
+        detach.data = copies[i];
+        detach.size = sizes[i];
+        wasm_image_run_parallel(
+            (uint32)((sizes[i] + WASM_IMAGE_BLOCK_SIZE - 1)
+                     / WASM_IMAGE_BLOCK_SIZE),
+            copy_chunk_block, &detach);
+        free(detach.offsets);
+    }
+
+    for (i = 0; i < writer->attached_count; i++)
+        free(writer->attached[i]);
+    writer->attached_count = 0;
+    for (i = 0; i < writer->section_count; i++) {
+        if (!copies[i])
+            continue;
+        writer->sections[i].chunks[0].data = copies[i];
+        writer->sections[i].chunks[0].size = sizes[i];
+        writer->sections[i].chunk_count = 1;
+        writer->attached[writer->attached_count++] = copies[i];
+    }
+    return true;
+
+fail:
+    for (i = 0; i < writer->section_count; i++)
+        free(copies[i]);
+    return false;
+}
+
+/* File images are opened with O_DIRECT and fdatasync'ed, see
+   wasm_image_set_direct_io and wasm_image_set_sync */
+static bool direct_io = false;
+static bool sync_files = false;
+
+void
+wasm_image_set_direct_io(bool f)
+{
+    direct_io = f;
+}
+
+void
+wasm_image_set_sync(bool f)
+{
+    sync_files = f;
+}
+
+static bool
+write_all(int fd, const void *data, uint64 size)
+{
+    const uint8 *p = data;
+    while (size > 0) {
+        ssize_t n = write(fd, p, size);
+        if (n < 0)
+            return false;
+        p += n;
+        size -= n;
+    }
+    return true;
+}
+
+/* Flush the pending iovecs, handling short writes */
+static bool
+flush_iov(int fd, struct iovec *iov, int count)
+{
+    while (count > 0) {
+        ssize_t n = writev(fd, iov, count);
+        if (n < 0)
+            return false;
+        while (count > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (uint8 *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return true;
+}
+
+/* Where the image is written: batches of iovecs, or for O_DIRECT an aligned
+   staging buffer that is written in IMAGE_STAGE_SIZE pieces */
+typedef struct ImageSink {
+    int fd;
+    struct iovec iov[IMAGE_IOV_BATCH];
+    int iov_count;
+    uint8 *stage;
+    uint64 staged;
+    /* Bytes of the image put so far */
+    uint64 size;
+} ImageSink;
+
+static bool
+sink_put(ImageSink *sink, const void *data, uint64 size)
+{
+    const uint8 *p = data;
+    uint64 n;
+
+    sink->size += size;
+    if (size == 0)
+        return true;
+    if (!sink->stage) {
+        if (sink->iov_count == IMAGE_IOV_BATCH) {
+            if (!flush_iov(sink->fd, sink->iov, sink->iov_count))
+                return false;
+            sink->iov_count = 0;
+        }
+        sink->iov[sink->iov_count].iov_base = (void *)data;
+        sink->iov[sink->iov_count].iov_len = (size_t)size;
+        sink->iov_count++;
+        return true;
+    }
+
+    while (size > 0) {
+        n = IMAGE_STAGE_SIZE - sink->staged;
+        if (n > size)
+            n = size;
+        memcpy(sink->stage + sink->staged, p, n);
+        sink->staged += n;
+        p += n;
+        size -= n;
+        if (sink->staged == IMAGE_STAGE_SIZE) {
+            if (!write_all(sink->fd, sink->stage, IMAGE_STAGE_SIZE))
+                return false;
+            sink->staged = 0;
+        }
+    }
+    return true;
+}
+
+/* Write what is left. The last staged piece is padded up to a page, the
+   file is truncated to sink->size afterwards. */
+static bool
+sink_flush(ImageSink *sink)
+{
+    uint64 size;
+
+    if (!sink->stage)
+        return flush_iov(sink->fd, sink->iov, sink->iov_count);
+    if (sink->staged == 0)
+        return true;
+    size = (sink->staged + WASM_IMAGE_PAGE_SIZE - 1)
+           & ~((uint64)WASM_IMAGE_PAGE_SIZE - 1);
+    memset(sink->stage + sink->staged, 0, size - sink->staged);
+    return write_all(sink->fd, sink->stage, size);
+}
+
+/* Sections are laid out with the small ones first and the page aligned
+   ones, i.e. linear memory, last, so that a reader of a stream can restore
+   the frames before the memory arrives */
+static void
+layout_order(const WASMImageWriter *writer, uint32 *order)
+{
+    uint32 i, n = 0;
+
+    for (i = 0; i < writer->section_count; i++) {
+        if (!(writer->sections[i].flags & IMAGE_SECTION_FLAG_PAGE_ALIGNED))
+            order[n++] = i;
+    }
+    for (i = 0; i < writer->section_count; i++) {
+        if (writer->sections[i].flags & IMAGE_SECTION_FLAG_PAGE_ALIGNED)
+            order[n++] = i;
+    }
+}
+
+/* Fill the section table except the checksums, returns the image size */
+static uint64
+layout_sections(const WASMImageWriter *writer, WASMImageSectionEntry *entries)
+{
+    uint32 order[WASM_IMAGE_MAX_SECTIONS];
+    uint64 offset;
+
+    offset = sizeof(WASMImageHeader)
+             + sizeof(WASMImageSectionEntry) * writer->section_count;
+    layout_order(writer, order);
+    for (uint32 k = 0; k < writer->section_count; k++) {
+        uint32 i = order[k];
+        const WASMImageSection *section = &writer->sections[i];
+        if (section->flags & IMAGE_SECTION_FLAG_PAGE_ALIGNED)
+            offset = (offset + WASM_IMAGE_PAGE_SIZE - 1)
+                     & ~((uint64)WASM_IMAGE_PAGE_SIZE - 1);
+        entries[i].type = section->type;
+        entries[i].flags = section->flags;
+        entries[i].offset = offset;
+        entries[i].size = section_size(section);
+        offset += entries[i].size;
+    }
+    return offset;
+}
+
+uint64
+wasm_image_writer_size(const WASMImageWriter *writer)
+{
+    WASMImageSectionEntry entries[WASM_IMAGE_MAX_SECTIONS];
+
+    return layout_sections(writer, entries);
+}
+
+static bool
+write_payloads(ImageSink *sink, const WASMImageWriter *writer,
+               const WASMImageSectionEntry *entries, uint64 offset)
+{
+    uint32 order[WASM_IMAGE_MAX_SECTIONS];
+    static const uint8 zero_page[WASM_IMAGE_PAGE_SIZE] = { 0 };
+
+    layout_order(writer, order);
+    for (uint32 k = 0; k < writer->section_count; k++) {
+        uint32 i = order[k];
+        const WASMImageSection *section = &writer->sections[i];
+
+        /* padding up to the aligned section start */
+        bh_assert(entries[i].offset >= offset);
+        if (!sink_put(sink, zero_page, entries[i].offset - offset))
+            return false;
+        offset = entries[i].offset;
+
+        if (!sink_put(sink, section->buf.data, section->buf.size))
+            return false;
+        for (uint32 j = 0; j < section->chunk_count; j++) {
+            if (!sink_put(sink, section->chunks[j].data,
+                          section->chunks[j].size))
+                return false;
+        }
+        offset += entries[i].size;
+    }
+    return true;
+}
+
+static bool
+write_image(WASMImageWriter *writer, ImageSink *sink)
+{
+    WASMImageHeader header = { 0 };
+    WASMImageSectionEntry entries[WASM_IMAGE_MAX_SECTIONS] = { 0 };
+
+    header.file_size = layout_sections(writer, entries);
+    for (uint32 i = 0; i < writer->section_count; i++)
+        entries[i].checksum = section_checksum(&writer->sections[i]);
+
+    header.magic = WASM_IMAGE_MAGIC;
+    header.version = WASM_IMAGE_VERSION;
+    header.section_count = writer->section_count;
+    header.checksum = wasm_image_crc32(0, (uint8 *)&header, sizeof(header));
+    header.checksum =
+        wasm_image_crc32(header.checksum, (uint8 *)entries,
+                         sizeof(WASMImageSectionEntry) * header.section_count);
+
+    /* the iovecs refer to header and entries until sink_flush */
+    if (!sink_put(sink, &header, sizeof(header))
+        || !sink_put(sink, entries,
+                     sizeof(WASMImageSectionEntry) * header.section_count)
+        || !write_payloads(sink, writer, entries,
+                           sizeof(header)
+                               + sizeof(WASMImageSectionEntry)
+                                     * header.section_count)
+        || !sink_flush(sink))
+        return false;
+    wasm_migration_stats_add_written(header.file_size);
+    return true;
+}
+
+/* Open the temporary file of an image, with O_DIRECT if it is enabled and
+   the file system supports it */
+static int
+open_image_file(const char *path, bool *p_direct)
+{
+    int flags = O_WRONLY | O_CREAT | O_TRUNC, fd;
+
+    *p_direct = false;
+#ifdef O_DIRECT
+    if (direct_io) {
+        if ((fd = open(path, flags | O_DIRECT, 0644)) >= 0) {
+            *p_direct = true;
+            return fd;
+        }
+        /* e.g. tmpfs */
+        if (errno != EINVAL)
+            return -1;
+        LOG_WARNING("O_DIRECT is not supported for %s\n", path);
+    }
+#endif
+    return open(path, flags, 0644);
+}
+
+/* Make the rename of an image in the directory of path durable */
+static bool
+sync_dir(const char *path)
+{
+    char dir[PATH_MAX];
+    const char *slash = strrchr(path, '/');
+    int fd;
+    bool ret;
+
+    if (!slash)
+        snprintf(dir, sizeof(dir), ".");
+    else if (slash == path)
+        snprintf(dir, sizeof(dir), "/");
+    else
+        snprintf(dir, sizeof(dir), "%.*s", (int)(slash - path), path);
+    if ((fd = open(dir, O_RDONLY)) < 0)
+        return false;
+    ret = fsync(fd) == 0;
+    close(fd);
+    return ret;
+}
+
+bool
+wasm_image_writer_write_file(WASMImageWriter *writer, const char *path)
+{
+    char tmp_path[PATH_MAX];
+    ImageSink sink = { 0 };
+    bool direct, ret;
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    sink.fd = open_image_file(tmp_path, &direct);
+    if (sink.fd < 0) {
+        fprintf(stderr, "failed to open %s\n", tmp_path);
+        return false;
+    }
+    if (direct
+        && posix_memalign((void **)&sink.stage, WASM_IMAGE_PAGE_SIZE,
+                          IMAGE_STAGE_SIZE)
+               != 0) {
+        close(sink.fd);
+        unlink(tmp_path);
+        return false;
+    }
+
+    ret = write_image(writer, &sink)
+          && (!direct || ftruncate(sink.fd, (off_t)sink.size) == 0)
+          && (!sync_files || fdatasync(sink.fd) == 0);
+    free(sink.stage);
+    if (!ret) {
+        fprintf(stderr, "failed to write %s\n", tmp_path);
+        close(sink.fd);
+        unlink(tmp_path);
+        return false;
+    }
+    close(sink.fd);
+
+    if (rename(tmp_path, path) != 0) {
+        fprintf(stderr, "failed to rename %s to %s\n", tmp_path, path);
+        unlink(tmp_path);
+        return false;
+    }
+    if (sync_files && !sync_dir(path)) {
+        fprintf(stderr, "failed to sync the directory of %s\n", path);
+        return false;
+    }
+    return true;
+}
+
+bool
+wasm_image_is_stream(const char *target)
+{
+    return !strncmp(target, "fd:", 3) || !strncmp(target, "unix:", 5);
+}
+
+bool
+wasm_image_precopy_path(const char *image, uint32 round, char *buf,
+                        uint32 buf_size)
+{
+    int n;
+
+    if (!image || wasm_image_is_stream(image))
+        image = WASM_IMAGE_DEFAULT_FILE;
+    n = snprintf(buf, buf_size, "%s.%u", image, round);
+    if (n < 0 || (uint32)n >= buf_size) {
+        fprintf(stderr, "pre-copy image path of %s is too long\n", image);
+        return false;
+    }
+    return true;
+}
+
+static bool
+parse_fd(const char *target, int *fd)
+{
+    char *end;
+    long n = strtol(target + 3, &end, 10);
+
+    if (target[3] == '\0' || *end != '\0' || n < 0 || n > INT_MAX) {
+        fprintf(stderr, "invalid checkpoint stream %s\n", target);
+        return false;
+    }
+    *fd = (int)n;
+    return true;
+}
+
+static bool
+make_unix_addr(const char *target, struct sockaddr_un *addr)
+{
+    const char *path = target + 5;
+
+    memset(addr, 0, sizeof(struct sockaddr_un));
+    addr->sun_family = AF_UNIX;
+    if (path[0] == '\0' || strlen(path) >= sizeof(addr->sun_path)) {
+        fprintf(stderr, "invalid checkpoint stream %s\n", target);
+        return false;
+    }
+    strcpy(addr->sun_path, path);
+    return true;
+}
+
+int
+wasm_image_connect_stream(const char *target)
+{
+    struct sockaddr_un addr;
+    int fd, retry;
+
+    if (!strncmp(target, "fd:", 3))
+        return parse_fd(target, &fd) ? fd : -1;
+
+    if (!make_unix_addr(target, &addr)
+        || (fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+        return -1;
+    /* the restoring side may still be starting up */
+    for (retry = 0; retry < IMAGE_CONNECT_RETRY; retry++) {
+        if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0)
+            return fd;
+        if (errno != ENOENT && errno != ECONNREFUSED)
+            break;
+        usleep(IMAGE_CONNECT_INTERVAL_US);
+    }
+    fprintf(stderr, "failed to connect to %s\n", target);
+    close(fd);
+    return -1;
+}
+
+int
+wasm_image_accept_stream(const char *target)
+{
+    struct sockaddr_un addr;
+    int listen_fd, fd = -1;
+
+    if (!strncmp(target, "fd:", 3))
+        return parse_fd(target, &fd) ? fd : -1;
+
+    if (!make_unix_addr(target, &addr)
+        || (listen_fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+        return -1;
+    unlink(addr.sun_path);
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0
+        || listen(listen_fd, 1) != 0) {
+        fprintf(stderr, "failed to listen on %s\n", target);
+        close(listen_fd);
+        return -1;
+    }
+    while ((fd = accept(listen_fd, NULL, NULL)) < 0 && errno == EINTR)
+        ;
+    if (fd < 0)
+        fprintf(stderr, "failed to accept on %s\n", target);
+    close(listen_fd);
+    unlink(addr.sun_path);
+    return fd;
+}
+
+bool
+wasm_image_writer_write_to(WASMImageWriter *writer, const char *target)
+{
+    ImageSink sink = { 0 };
+    bool ret;
+
+    if (!wasm_image_is_stream(target))
+        return wasm_image_writer_write_file(writer, target);
+
+    if ((sink.fd = wasm_image_connect_stream(target)) < 0)
+        return false;
+    if (!(ret = write_image(writer, &sink)))
+        fprintf(stderr, "failed to write to %s\n", target);
+    /* the reader sees the end of the image */
+    close(sink.fd);
+    return ret;
+}
+
+/* Check the header and the section table, both must be in base */
+static bool
+check_header(WASMImageReader *reader, const char *name)
+{
+    WASMImageHeader header;
+    uint64 table_size;
+    uint32 crc;
+
+    reader->header = (const WASMImageHeader *)reader->base;
+    reader->sections =
+        (const WASMImageSectionEntry *)(reader->base + sizeof(WASMImageHeader));
+
+    header = *reader->header;
+    header.checksum = 0;
+    table_size = sizeof(WASMImageSectionEntry) * header.section_count;
+    crc = wasm_image_crc32(0, (uint8 *)&header, sizeof(header));
+    crc = wasm_image_crc32(crc, (const uint8 *)reader->sections, table_size);
+    if (crc != reader->header->checksum) {
+        fprintf(stderr, "checksum mismatch in header of %s\n", name);
+        return false;
+    }
+
+    for (uint32 i = 0; i < reader->header->section_count; i++) {
+        const WASMImageSectionEntry *entry = &reader->sections[i];
+        if (entry->offset > reader->size
+            || entry->size > reader->size - entry->offset) {
+            fprintf(stderr, "section %u out of range in %s\n", entry->type,
+                    name);
+            return false;
+        }
+    }
+    return true;
+}
+
+/* The file_size of a stream comes from the peer and is mapped before the
+   section table arrives, so it is bounded here */
+static bool
+is_valid_header(const WASMImageHeader *header)
+{
+    return header->magic == WASM_IMAGE_MAGIC
+           && header->version == WASM_IMAGE_VERSION
+           && header->section_count <= WASM_IMAGE_MAX_SECTIONS
+           && header->file_size <= WASM_IMAGE_MAX_SIZE
+           && sizeof(WASMImageHeader)
+                      + sizeof(WASMImageSectionEntry) * header->section_count
+                  <= header->file_size;
+}
+
+bool
+wasm_image_reader_open(WASMImageReader *reader, const char *path)
+{
+    struct stat st;
+
+    memset(reader, 0, sizeof(WASMImageReader));
+    reader->stream_fd = -1;
+    reader->fd = open(path, O_RDONLY);
+    if (reader->fd < 0) {
+        fprintf(stderr, "failed to open %s\n", path);
+        return false;
+    }
+
+    if (fstat(reader->fd, &st) != 0
+        || (uint64)st.st_size < sizeof(WASMImageHeader)) {
+        fprintf(stderr, "invalid checkpoint image %s\n", path);
+        goto fail;
+    }
+    reader->size = reader->received = (uint64)st.st_size;
+
+    reader->base =
+        mmap(NULL, reader->size, PROT_READ, MAP_PRIVATE, reader->fd, 0);
+    if (reader->base == MAP_FAILED) {
+        reader->base = NULL;
+        fprintf(stderr, "failed to mmap %s\n", path);
+        goto fail;
+    }
+
+    if (!is_valid_header((const WASMImageHeader *)reader->base)
+        || ((const WASMImageHeader *)reader->base)->file_size != reader->size) {
+        fprintf(stderr, "invalid checkpoint image %s\n", path);
+        goto fail;
+    }
+    if (!check_header(reader, path))
+        goto fail;
+    return true;
+
+fail:
+    wasm_image_reader_close(reader);
+    return false;
+}
+
+bool
+wasm_image_reader_open_stream(WASMImageReader *reader, int fd,
+                              const char *name)
+{
+    WASMImageHeader header;
+    uint64 received = 0;
+
+    memset(reader, 0, sizeof(WASMImageReader));
+    reader->fd = -1;
+    reader->stream_fd = fd;
+
+    while (received < sizeof(header)) {
+        ssize_t n = read(fd, (uint8 *)&header + received,
+                         sizeof(header) - received);
+        if (n <= 0 && !(n < 0 && errno == EINTR)) {
+            fprintf(stderr, "failed to read %s\n", name);
+            goto fail;
+        }
+        if (n > 0)
+            received += n;
+    }
+    if (!is_valid_header(&header)) {
+        fprintf(stderr, "invalid checkpoint image %s\n", name);
+        goto fail;
+    }
+
+    /* the rest of the image is received into place as it is needed */
+    reader->size = header.file_size;
+    reader->base = mmap(NULL, reader->size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (reader->base == MAP_FAILED) {
+        reader->base = NULL;
+        fprintf(stderr, "failed to allocate %s\n", name);
+        goto fail;
+    }
+    memcpy(reader->base, &header, sizeof(header));
+    reader->received = sizeof(header);
+
+    if (!wasm_image_reader_wait(reader,
+                                sizeof(header)
+                                    + sizeof(WASMImageSectionEntry)
+                                          * header.section_count)
+        || !check_header(reader, name))
+        goto fail;
+    return true;
+
+fail:
+    wasm_image_reader_close(reader);
+    return false;
+}
+
+bool
+wasm_image_reader_open_from(WASMImageReader *reader, const char *source)
+{
+    int fd;
+
+    if (!wasm_image_is_stream(source))
+        return wasm_image_reader_open(reader, source);
+    if ((fd = wasm_image_accept_stream(source)) < 0)
+        return false;
+    return wasm_image_reader_open_stream(reader, fd, source);
+}
+
+bool
+wasm_image_reader_wait(WASMImageReader *reader, uint64 end)
+{
+    bh_assert(end <= reader->size);
+
+    while (reader->received < end) {
+        ssize_t n = read(reader->stream_fd, reader->base + reader->received,
+                         reader->size - reader->received);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            fprintf(stderr, "checkpoint stream closed at %lu of %lu bytes\n",
+                    (unsigned long)reader->received,
+                    (unsigned long)reader->size);
+            return false;
+        }
+        reader->received += n;
+    }
+    return true;
+}
+
+void
+wasm_image_reader_close(WASMImageReader *reader)
+{
+    if (reader->base)
+        munmap(reader->base, reader->size);
+    if (reader->fd >= 0)
+        close(reader->fd);
+    if (reader->stream_fd >= 0)
+        close(reader->stream_fd);
+    memset(reader, 0, sizeof(WASMImageReader));
+    reader->fd = -1;
+    reader->stream_fd = -1;
+}
+
+const WASMImageSectionEntry *
+wasm_image_reader_find(const WASMImageReader *reader, uint32 type)
+{
+    if (!reader->header)
+        return NULL;
+    for (uint32 i = 0; i < reader->header->section_count; i++) {
+        if (reader->sections[i].type == type)
+            return &reader->sections[i];
+    }
+    return NULL;
+}
+
+const uint8 *
+wasm_image_reader_get(WASMImageReader *reader, uint32 type, uint64 *p_size)
+{
+    const WASMImageSectionEntry *entry = wasm_image_reader_find(reader, type);
+    const uint8 *data;
+
+    if (!entry) {
+        fprintf(stderr, "section %u not found in checkpoint image\n", type);
+        return NULL;
+    }
+
+    if (!wasm_image_reader_wait(reader, entry->offset + entry->size))
+        return NULL;
+
+    data = reader->base + entry->offset;
+    if (wasm_image_crc32(0, data, entry->size) != entry->checksum) {
+        fprintf(stderr, "checksum mismatch in section %u\n", type);
+        return NULL;
+    }
+
+    if (p_size)
+        *p_size = entry->size;
+    return data;
+}
+
+bool
+wasm_image_reader_cursor(WASMImageReader *reader, uint32 type,
+                         WASMImageCursor *cursor)
+{
+    uint64 size;
+    const uint8 *data = wasm_image_reader_get(reader, type, &size);
+
+    if (!data)
+        return false;
+    cursor->p = data;
+    cursor->end = data + size;
+    return true;
+}
@@ -0,0 +1,287 @@
+#ifndef _WASM_IMAGE_H
+#define _WASM_IMAGE_H
+
+#include "bh_platform.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Single-file checkpoint image.
+ *
+ * +----------------------+  offset 0
+ * | WASMImageHeader      |
+ * +----------------------+
+ * | WASMImageSectionEntry| x section_count
+ * +----------------------+
+ * | section payloads     |  sections flagged PAGE_ALIGNED start on a
+ * | ...                  |  WASM_IMAGE_PAGE_SIZE boundary so that they
+ * +----------------------+  can be mmap'ed in place
+ *
+ * All integers are little endian, every section carries a CRC32 of its
+ * payload and the header carries a CRC32 of the header and section table.
+ */
+
+#define WASM_IMAGE_MAGIC 0x54504b43 /* "CKPT" */
+#define WASM_IMAGE_VERSION 2
+#define WASM_IMAGE_PAGE_SIZE 4096
+#define WASM_IMAGE_MAX_SECTIONS 16
+/* 4GB of linear memory and as much again for the other sections */
+#define WASM_IMAGE_MAX_SIZE ((uint64)8 * 1024 * 1024 * 1024)
+#define WASM_IMAGE_DEFAULT_FILE "checkpoint.img"
+
+typedef enum WASMImageSectionType {
+    IMAGE_SECTION_MEMORY_META = 1,
+    IMAGE_SECTION_MEMORY_EXTENTS,
+    IMAGE_SECTION_MEMORY_PAGES,
+    IMAGE_SECTION_GLOBAL,
+    IMAGE_SECTION_PROGRAM_COUNTER,
+    IMAGE_SECTION_STACK,
+    /* The other threads of the cluster, the sections above are of the main
+       thread. u32 thread count, then for each thread: i32 wasi-threads tid,
+       u32 record size and its GLOBAL, PROGRAM_COUNTER and STACK sections,
+       each as u32 type, u32 size and the payload. */
+    IMAGE_SECTION_THREADS,
+    /* NUL terminated absolute path of the page pool that the POOL extents
+       refer to, see wasm_page_pool.h */
+    IMAGE_SECTION_PAGE_POOL,
+} WASMImageSectionType;
+
+#define IMAGE_SECTION_FLAG_PAGE_ALIGNED 0x1
+
+typedef struct WASMImageHeader {
+    uint32 magic;
+    uint32 version;
+    uint32 section_count;
+    uint32 flags;
+    uint64 file_size;
+    /* CRC32 of the header (with this field zeroed) and the section table */
+    uint32 checksum;
+    uint32 reserved;
+} WASMImageHeader;
+
+typedef struct WASMImageSectionEntry {
+    uint32 type;
+    uint32 flags;
+    uint64 offset;
+    uint64 size;
+    uint32 checksum;
+    uint32 reserved;
+} WASMImageSectionEntry;
+
+/* Linear memory page range, the data of the DATA and LZ4 extents are
+   stored back to back in the MEMORY_PAGES section in the order of the
+   table, ZERO extents are holes that have no data. An LZ4 extent is one
+   block of the LZ4 block format that decompresses to size bytes, it never
+   crosses a WASM_IMAGE_BLOCK_SIZE boundary of linear memory. A POOL
+   extent has no data either, its pages are the consecutive pages of the
+   PAGE_POOL section's pool starting at the page id in data_size. */
+typedef enum WASMImageExtentKind {
+    IMAGE_EXTENT_DATA = 0,
+    IMAGE_EXTENT_ZERO,
+    IMAGE_EXTENT_LZ4,
+    IMAGE_EXTENT_POOL,
+} WASMImageExtentKind;
+
+typedef struct WASMImageMemoryExtent {
+    uint64 offset;
+    uint64 size;
+    uint32 kind;
+    /* Size of the compressed data of an LZ4 extent, the first page id of a
+       POOL extent, 0 for the others */
+    uint32 data_size;
+} WASMImageMemoryExtent;
+
+/* Growable buffer used to build small sections */
+typedef struct WASMImageBuffer {
+    uint8 *data;
+    uint64 size;
+    uint64 capacity;
+} WASMImageBuffer;
+
+typedef struct WASMImageChunk {
+    const uint8 *data;
+    uint64 size;
+} WASMImageChunk;
+
+typedef struct WASMImageSection {
+    uint32 type;
+    uint32 flags;
+    /* payload owned by the writer */
+    WASMImageBuffer buf;
+    /* or payload referenced in place, e.g. linear memory */
+    WASMImageChunk *chunks;
+    uint32 chunk_count;
+    uint32 chunk_capacity;
+} WASMImageSection;
+
+typedef struct WASMImageWriter {
+    WASMImageSection sections[WASM_IMAGE_MAX_SECTIONS];
+    uint32 section_count;
+    /* Buffers referenced by chunks and freed with the writer */
+    void **attached;
+    uint32 attached_count;
+    uint32 attached_capacity;
+} WASMImageWriter;
+
+typedef struct WASMImageReader {
+    uint8 *base;
+    uint64 size;
+    /* The file mapped at base, -1 for a stream */
+    int fd;
+    /* The stream received into base, -1 for a file */
+    int stream_fd;
+    /* Bytes of the image available at base, less than size while a
+       stream is being received */
+    uint64 received;
+    const WASMImageHeader *header;
+    const WASMImageSectionEntry *sections;
+} WASMImageReader;
+
+/* Sequential reader over a section payload */
+typedef struct WASMImageCursor {
+    const uint8 *p;
+    const uint8 *end;
+} WASMImageCursor;
+
+uint32
+wasm_image_crc32(uint32 crc, const uint8 *data, uint64 size);
+
+bool
+wasm_image_buf_write(WASMImageBuffer *buf, const void *data, uint64 size);
+
+void
+wasm_image_writer_init(WASMImageWriter *writer);
+
+void
+wasm_image_writer_destroy(WASMImageWriter *writer);
+
+WASMImageBuffer *
+wasm_image_writer_add_section(WASMImageWriter *writer, uint32 type,
+                              uint32 flags);
+
+WASMImageSection *
+wasm_image_writer_add_chunked_section(WASMImageWriter *writer, uint32 type,
+                                      uint32 flags);
+
+bool
+wasm_image_section_add_chunk(WASMImageSection *section, const uint8 *data,
+                             uint64 size);
+
+/* Hand a buffer over to the writer, it is freed by
+   wasm_image_writer_destroy, or right away if this fails */
+bool
+wasm_image_writer_attach(WASMImageWriter *writer, void *data);
+
+/* Copy the payloads referenced by the chunks, e.g. linear memory, into
+   buffers of the writer, so that the image can be written after the state
+   changes. The writer is left as it is if this fails. */
+bool
+wasm_image_writer_detach(WASMImageWriter *writer);
+
+/* Size of the image that the writer writes */
+uint64
+wasm_image_writer_size(const WASMImageWriter *writer);
+
+/* Open the files of the images with O_DIRECT and write them in large
+   aligned pieces, where the file system supports it */
+void
+wasm_image_set_direct_io(bool f);
+
+/* fdatasync the files of the images before they are renamed into place,
+   and their directory after it. Streams are not synced. */
+void
+wasm_image_set_sync(bool f);
+
+/* Write the image to a temporary file and atomically rename it to path */
+bool
+wasm_image_writer_write_file(WASMImageWriter *writer, const char *path);
+
+/* A checkpoint target or a restore source is "fd:N" for an open file
+   descriptor, "unix:/path" for a UNIX socket or a file path. The image is
+   streamed in the order of its layout, the restoring side listens on the
+   socket and the checkpointing side connects to it. */
+bool
+wasm_image_is_stream(const char *target);
+
+/* Path of the memory-only image of a pre-copy round, applied in order
+   before the final image: "<image>.<round>" next to a file image, and
+   next to checkpoint.img for a stream, which can't carry the rounds.
+   Returns false if the path doesn't fit in buf. */
+bool
+wasm_image_precopy_path(const char *image, uint32 round, char *buf,
+                        uint32 buf_size);
+
+int
+wasm_image_connect_stream(const char *target);
+
+int
+wasm_image_accept_stream(const char *target);
+
+/* Write the image to a file or a stream, see wasm_image_is_stream */
+bool
+wasm_image_writer_write_to(WASMImageWriter *writer, const char *target);
+
+bool
+wasm_image_reader_open(WASMImageReader *reader, const char *path);
+
+/* Read the header and the section table from fd, the sections are
+   received by wasm_image_reader_wait */
+bool
+wasm_image_reader_open_stream(WASMImageReader *reader, int fd,
+                              const char *name);
+
+bool
+wasm_image_reader_open_from(WASMImageReader *reader, const char *source);
+
+/* Receive the stream up to end bytes of the image, always true for a file */
+bool
+wasm_image_reader_wait(WASMImageReader *reader, uint64 end);
+
+static inline bool
+wasm_image_reader_is_stream(const WASMImageReader *reader)
+{
+    return reader->stream_fd >= 0;
+}
+
+void
+wasm_image_reader_close(WASMImageReader *reader);
+
+const WASMImageSectionEntry *
+wasm_image_reader_find(const WASMImageReader *reader, uint32 type);
+
+/* Verify the checksum and return the payload of a section, a stream is
+   received up to the end of the section first */
+const uint8 *
+wasm_image_reader_get(WASMImageReader *reader, uint32 type, uint64 *p_size);
+
+bool
+wasm_image_reader_cursor(WASMImageReader *reader, uint32 type,
+                         WASMImageCursor *cursor);
+
+static inline bool
+wasm_image_cursor_read(WASMImageCursor *cursor, void *dst, uint64 size)
+{
+    if ((uint64)(cursor->end - cursor->p) < size)
+        return false;
+    memcpy(dst, cursor->p, size);
+    cursor->p += size;
+    return true;
+}
+
+static inline const uint8 *
+wasm_image_cursor_skip(WASMImageCursor *cursor, uint64 size)
+{
+    const uint8 *p = cursor->p;
+    if ((uint64)(cursor->end - cursor->p) < size)
+        return NULL;
+    cursor->p += size;
+    return p;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _WASM_IMAGE_H
@@ -0,0 +1,282 @@
+#include <unistd.h>
+
+#include "wasm_image_compress.h"
+#include "bh_atomic.h"
+
+/* LZ4 block format */
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_LOG 12
+#define LZ_MAX_OFFSET 65535
+// 最後の5byteはliteral, 最後のmatchはblockの終わりから12byte以上前で始まる
+#define LZ_LAST_LITERALS 5
+#define LZ_MF_LIMIT 12
+// matchが見つからない間は探す間隔を広げ、圧縮できないデータを早く読み飛ばす
+#define LZ_SKIP_TRIGGER 6
+
+static inline uint32
+read32(const uint8 *p)
+{
+    uint32 v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64
+read64(const uint8 *p)
+{
+    uint64 v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32
+hash32(uint32 v)
+{
+    return (v * 2654435761U) >> (32 - LZ_HASH_LOG);
+}
+
+static uint8 *
+write_length(uint8 *op, uint64 length)
+{
+    while (length >= 255) {
+        *op++ = 255;
+        length -= 255;
+    }
+    *op++ = (uint8)length;
+    return op;
+}
+
+// token, literal, (offset, match length)の1つのsequenceを書く
+static uint8 *
+write_sequence(uint8 *op, uint8 *op_end, const uint8 *literal,
+               uint64 literal_length, uint32 offset, uint64 match_length)
+{
+    uint8 *token;
+
+    if ((uint64)(op_end - op) < 1 + literal_length / 255 + 1 + literal_length
+                                    + 2 + match_length / 255 + 1)
+        return NULL;
+
+    token = op++;
+    *token = (uint8)((literal_length >= 15 ? 15 : literal_length) << 4);
+    if (literal_length >= 15)
+        op = write_length(op, literal_length - 15);
+    memcpy(op, literal, literal_length);
+    op += literal_length;
+
+    // 最後のsequenceはliteralだけ
+    if (offset == 0)
+        return op;
+
+    *op++ = (uint8)offset;
+    *op++ = (uint8)(offset >> 8);
+    *token |= (uint8)(match_length >= 15 ? 15 : match_length);
+    if (match_length >= 15)
+        op = write_length(op, match_length - 15);
+    return op;
+}
+
+uint64
+wasm_image_compress_bound(uint64 size)
+{
+    return size + size / 255 + 16;
+}
+
+uint64
+wasm_image_compress(const uint8 *src, uint64 size, uint8 *dst,
+                    uint64 capacity)
+{
+    uint32 table[1 << LZ_HASH_LOG];
+    const uint8 *ip = src, *anchor = src, *end = src + size;
+    const uint8 *match_limit = end - LZ_LAST_LITERALS;
+    uint8 *op = dst, *op_end = dst + capacity;
+    uint32 misses = 0;
+
+    bh_assert(size <= UINT32_MAX);
+
+    if (size > LZ_MF_LIMIT) {
+        memset(table, 0, sizeof(table));
+        ip++;
+        while (ip < end - LZ_MF_LIMIT) {
+            uint32 seq = read32(ip), h = hash32(seq);
+            const uint8 *ref = src + table[h], *mp, *rp;
+
+            table[h] = (uint32)(ip - src);
+            if (ref >= ip || ip - ref > LZ_MAX_OFFSET || read32(ref) != seq) {
+                ip += 1 + (misses++ >> LZ_SKIP_TRIGGER);
+                continue;
+            }
+            misses = 0;
+
+            // matchを前後に伸ばす
+            while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+                ip--;
+                ref--;
+            }
+            mp = ip + LZ_MIN_MATCH;
+            rp = ref + LZ_MIN_MATCH;
+            while (mp + sizeof(uint64) <= match_limit
+                   && read64(mp) == read64(rp)) {
+                mp += sizeof(uint64);
+                rp += sizeof(uint64);
+            }
+            while (mp < match_limit && *mp == *rp) {
+                mp++;
+                rp++;
+            }
+
+            if (!(op = write_sequence(op, op_end, anchor, ip - anchor,
+                                      (uint32)(ip - ref),
+                                      mp - ip - LZ_MIN_MATCH)))
+                return 0;
+            ip = anchor = mp;
+
+            // match中の位置も1つ登録しておくと、次のmatchが見つかりやすい
+            if (ip < end - LZ_MF_LIMIT)
+                table[hash32(read32(ip - 2))] = (uint32)(ip - 2 - src);
+        }
+    }
+
+    if (!(op = write_sequence(op, op_end, anchor, end - anchor, 0, 0)))
+        return 0;
+    return op - dst;
+}
+
+static bool
+read_length(const uint8 **p_ip, const uint8 *ip_end, uint64 *length)
+{
+    const uint8 *ip = *p_ip;
+    uint8 b;
+
+    do {
+        if (ip >= ip_end)
+            return false;
+        b = *ip++;
+        *length += b;
+    } while (b == 255);
+    *p_ip = ip;
+    return true;
+}
+
+bool
+wasm_image_decompress(const uint8 *src, uint64 src_size, uint8 *dst,
+                      uint64 size)
+{
+    const uint8 *ip = src, *ip_end = src + src_size;
+    uint8 *op = dst, *op_end = dst + size;
+
+    while (ip < ip_end) {
+        uint8 token = *ip++;
+        uint64 literal_length = token >> 4, match_length = token & 15;
+        const uint8 *ref;
+        uint32 offset;
+
+        if (literal_length == 15
+            && !read_length(&ip, ip_end, &literal_length))
+            return false;
+        if (literal_length > (uint64)(ip_end - ip)
+            || literal_length > (uint64)(op_end - op))
+            return false;
+        memcpy(op, ip, literal_length);
+        op += literal_length;
+        ip += literal_length;
+
+        // 最後のsequenceにはmatchがない
+        if (ip == ip_end)
+            break;
+
+        if (ip_end - ip < 2)
+            return false;
+        offset = ip[0] | ((uint32)ip[1] << 8);
+        ip += 2;
+        if (match_length == 15 && !read_length(&ip, ip_end, &match_length))
+            return false;
+        match_length += LZ_MIN_MATCH;
+        if (offset == 0 || offset > (uint64)(op - dst)
+            || match_length > (uint64)(op_end - op))
+            return false;
+
+        // 重なるmatchは、コピー済みの範囲を倍々に広げながらコピーする
+        ref = op - offset;
+        while (match_length > 0) {
+            uint64 n = op - ref;
+            if (n > match_length)
+                n = match_length;
+            memcpy(op, ref, n);
+            op += n;
+            match_length -= n;
+        }
+    }
+    return op == op_end;
+}
+
+/* worker threads */
+static uint32 worker_count = 0;
+
+void
+wasm_image_set_worker_count(uint32 count)
+{
+    worker_count = count;
+}
+
+uint32
+wasm_image_get_worker_count()
+{
+    long n;
+
+    if (worker_count > 0)
+        return worker_count;
+    n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (uint32)n : 1;
+}
+
+typedef struct ParallelContext {
+    bh_atomic_32_t next;
+    uint32 task_count;
+    WASMImageTask task;
+    void *ctx;
+} ParallelContext;
+
+static void *
+run_tasks(void *arg)
+{
+    ParallelContext *parallel = arg;
+    uint32 i;
+
+    while ((i = BH_ATOMIC_32_FETCH_ADD(parallel->next, 1))
+           < parallel->task_count)
+        parallel->task(parallel->ctx, i);
+    return NULL;
+}
+
+void
+wasm_image_run_parallel(uint32 task_count, WASMImageTask task, void *ctx)
+{
+    ParallelContext parallel = { 0 };
+    korp_tid *tids;
+    uint32 thread_count = wasm_image_get_worker_count(), created = 0;
+
+    parallel.task_count = task_count;
+    parallel.task = task;
+    parallel.ctx = ctx;
+
+    if (thread_count > task_count)
+        thread_count = task_count;
+    // 呼び出したthreadも1つのworkerになる
+    if (thread_count > 1
+        && (tids = malloc(sizeof(korp_tid) * (thread_count - 1)))) {
+        for (; created < thread_count - 1; created++) {
+            // threadを作れなくても、残りのtaskは作れたthreadで処理する
+            if (os_thread_create(&tids[created], run_tasks, &parallel,
+                                 APP_THREAD_STACK_SIZE_DEFAULT)
+                != BHT_OK)
+                break;
+        }
+        run_tasks(&parallel);
+        for (uint32 i = 0; i < created; i++)
+            os_thread_join(tids[i], NULL);
+        free(tids);
+        return;
+    }
+    run_tasks(&parallel);
+}
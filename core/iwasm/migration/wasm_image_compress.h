@@ -0,0 +1,48 @@
+#ifndef _WASM_IMAGE_COMPRESS_H
+#define _WASM_IMAGE_COMPRESS_H
+
+#include "bh_platform.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Linear memory is dumped and restored in blocks of this size, each block
+   is a unit of work of the worker threads and is compressed on its own */
+#define WASM_IMAGE_BLOCK_SIZE (256 * 1024)
+
+/* Worst case size of the compressed data of size bytes */
+uint64
+wasm_image_compress_bound(uint64 size);
+
+/* Compress src in the LZ4 block format. Returns the compressed size, or 0
+   if it does not fit in capacity. size must be less than 4GB. */
+uint64
+wasm_image_compress(const uint8 *src, uint64 size, uint8 *dst,
+                    uint64 capacity);
+
+/* Decompress a LZ4 block into exactly size bytes of dst */
+bool
+wasm_image_decompress(const uint8 *src, uint64 src_size, uint8 *dst,
+                      uint64 size);
+
+/* Number of the threads that dump and restore linear memory, 0 uses the
+   number of online CPUs */
+void
+wasm_image_set_worker_count(uint32 count);
+
+uint32
+wasm_image_get_worker_count();
+
+typedef void (*WASMImageTask)(void *ctx, uint32 index);
+
+/* Run task(ctx, i) for every i in [0, task_count) on the worker threads
+   and the calling thread, and return when all of them are done */
+void
+wasm_image_run_parallel(uint32 task_count, WASMImageTask task, void *ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _WASM_IMAGE_COMPRESS_H
@@ -0,0 +1,136 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "wasm_image_flusher.h"
+
+// 書いているimageと、次に書くimageの2つ
+#define FLUSH_SLOT_COUNT 2
+
+typedef struct FlushSlot {
+    WASMImageWriter writer;
+    char *target;
+    WASMImageFlushDone done;
+    void *user_data;
+} FlushSlot;
+
+static korp_mutex flush_lock = OS_THREAD_MUTEX_INITIALIZER;
+// slotが空いたときと、imageが書けたときの両方で起こす
+static korp_cond flush_cond;
+static bool flush_started = false;
+static FlushSlot slots[FLUSH_SLOT_COUNT];
+// 書いている(または次に書く)slotと、待っているimageの数
+static uint32 head = 0;
+static uint32 pending = 0;
+static bool failed = false;
+
+static void *
+flush_thread(void *arg)
+{
+    FlushSlot *slot;
+    bool ok;
+
+    (void)arg;
+    os_mutex_lock(&flush_lock);
+    for (;;) {
+        while (pending == 0)
+            os_cond_wait(&flush_cond, &flush_lock);
+        // 書き終わるまでslotは空けない. waitはpendingが0になるのを待つ
+        slot = &slots[head];
+        os_mutex_unlock(&flush_lock);
+
+        ok = wasm_image_writer_write_to(&slot->writer, slot->target);
+        if (slot->done)
+            slot->done(slot->target, ok, slot->user_data);
+        wasm_image_writer_destroy(&slot->writer);
+        free(slot->target);
+
+        os_mutex_lock(&flush_lock);
+        if (!ok)
+            failed = true;
+        head = (head + 1) % FLUSH_SLOT_COUNT;
+        pending--;
+        os_cond_broadcast(&flush_cond);
+    }
+    os_mutex_unlock(&flush_lock);
+    return NULL;
+}
+
+// flush_lockを取ってから呼ぶ. threadは一度だけ作り、processが終わるまで残す
+static bool
+start_flusher()
+{
+    korp_tid tid;
+
+    if (flush_started)
+        return true;
+    if (os_cond_init(&flush_cond) != BHT_OK)
+        return false;
+    if (os_thread_create(&tid, flush_thread, NULL,
+                         APP_THREAD_STACK_SIZE_DEFAULT)
+        != BHT_OK) {
+        os_cond_destroy(&flush_cond);
+        LOG_WARNING("failed to create the checkpoint writer thread\n");
+        return false;
+    }
+    flush_started = true;
+    return true;
+}
+
+bool
+wasm_image_flusher_start()
+{
+    bool ret;
+
+    os_mutex_lock(&flush_lock);
+    ret = start_flusher();
+    os_mutex_unlock(&flush_lock);
+    return ret;
+}
+
+bool
+wasm_image_flusher_submit(WASMImageWriter *writer, const char *target,
+                          WASMImageFlushDone done, void *user_data)
+{
+    FlushSlot *slot;
+    char *copy;
+
+    // targetはprecopyのpathなど呼び出し側のbufferのことがある
+    if (!(copy = strdup(target)))
+        return false;
+
+    os_mutex_lock(&flush_lock);
+    if (!start_flusher()) {
+        os_mutex_unlock(&flush_lock);
+        free(copy);
+        return false;
+    }
+    // 2つとも埋まっていれば、書いている方が終わるまでguestを止める
+    while (pending == FLUSH_SLOT_COUNT)
+        os_cond_wait(&flush_cond, &flush_lock);
+    slot = &slots[(head + pending) % FLUSH_SLOT_COUNT];
+    slot->writer = *writer;
+    slot->target = copy;
+    slot->done = done;
+    slot->user_data = user_data;
+    wasm_image_writer_init(writer);
+    pending++;
+    os_cond_broadcast(&flush_cond);
+    os_mutex_unlock(&flush_lock);
+    return true;
+}
+
+bool
+wasm_image_flusher_wait()
+{
+    bool ok;
+
+    os_mutex_lock(&flush_lock);
+    if (flush_started) {
+        while (pending > 0)
+            os_cond_wait(&flush_cond, &flush_lock);
+    }
+    ok = !failed;
+    failed = false;
+    os_mutex_unlock(&flush_lock);
+    return ok;
+}
@@ -0,0 +1,46 @@
+#ifndef _WASM_IMAGE_FLUSHER_H
+#define _WASM_IMAGE_FLUSHER_H
+
+#include "wasm_image.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Background writer of checkpoint images.
+ *
+ * The guest thread captures its state into a WASMImageWriter, detaches it
+ * from linear memory with wasm_image_writer_detach and submits it, then
+ * resumes while the writer thread writes the image. Images are written one
+ * at a time in the order they are submitted: one is written while the next
+ * one is captured, and a submit waits while both are pending.
+ */
+
+/* Called on the writer thread when an image is written or failed */
+typedef void (*WASMImageFlushDone)(const char *target, bool success,
+                                   void *user_data);
+
+/* Start the writer thread, otherwise it is started by the first submit.
+   A new thread installs the signal handlers of the runtime again, so this
+   must be called before the dirty tracker write protects linear memory. */
+bool
+wasm_image_flusher_start();
+
+/* Take over the sections of writer, which is left empty, and write them to
+   target with wasm_image_writer_write_to. Returns false with writer left as
+   it is if the writer thread can't be started. */
+bool
+wasm_image_flusher_submit(WASMImageWriter *writer, const char *target,
+                          WASMImageFlushDone done, void *user_data);
+
+/* Wait until the submitted images are written. Returns false if any of
+   them failed since the previous wait. */
+bool
+wasm_image_flusher_wait();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _WASM_IMAGE_FLUSHER_H
@@ -6,6 +6,17 @@
 
 int64_t get_time(struct timespec ts1, struct timespec ts2);
 
+/* Per-instance checkpoint and restore state, in the common part of the
+   module instance of both the interpreter and AOT */
+WASMMigrationState *
+wasm_migration_get_state(WASMModuleInstanceCommon *module_inst);
+
+/* Whether the running mode of the instance can take and restore
+   checkpoints: the interpreters and AOT can, the jitted code of Fast JIT
+   and LLVM JIT neither polls the requests nor rebuilds frames */
+bool
+wasm_migration_is_supported(WASMModuleInstanceCommon *module_inst);
+
 static inline uint8 *
 get_global_addr_for_migration(uint8 *global_data, const WASMGlobalInstance *global)
 {
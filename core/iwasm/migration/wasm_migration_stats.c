@@ -0,0 +1,167 @@
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "wasm_migration_stats.h"
+
+static const char *kind_names[WASM_MIGRATION_KIND_COUNT] = {
+    "checkpoint", "precopy", "snapshot", "restore",
+};
+
+static const char *phase_names[WASM_MIGRATION_PHASE_COUNT] = {
+    "stop_threads", "fork", "memory", "global", "program_counter", "stack",
+    "threads", "write",
+};
+
+// 別々のinstanceが別々のthreadで同時にcheckpointできるよう、thread localに持つ
+static os_thread_local_attribute wasm_migration_stats_t current;
+static os_thread_local_attribute uint64 current_start;
+
+// kindごとに最後に終わったもの
+static korp_mutex stats_lock = OS_THREAD_MUTEX_INITIALIZER;
+static wasm_migration_stats_t last_stats[WASM_MIGRATION_KIND_COUNT];
+static bool has_stats[WASM_MIGRATION_KIND_COUNT];
+static int stats_fd = -1;
+
+static uint64
+now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void
+wasm_migration_stats_begin(wasm_migration_kind_t kind)
+{
+    memset(&current, 0, sizeof(current));
+    current.kind = kind;
+    current_start = now_ns();
+}
+
+void
+wasm_migration_stats_phase(wasm_migration_phase_t phase, uint64 ns)
+{
+    current.phase_ns[phase] += ns;
+}
+
+void
+wasm_migration_stats_add_written(uint64 bytes)
+{
+    current.bytes_written += bytes;
+}
+
+void
+wasm_migration_stats_add_read(uint64 bytes)
+{
+    current.bytes_read += bytes;
+}
+
+void
+wasm_migration_stats_add_pages(uint64 memory_pages, uint64 dirty_pages,
+                               uint64 zero_pages, uint64 raw_bytes,
+                               uint64 stored_bytes)
+{
+    current.memory_pages += memory_pages;
+    current.dirty_pages += dirty_pages;
+    current.zero_pages += zero_pages;
+    current.raw_page_bytes += raw_bytes;
+    current.stored_page_bytes += stored_bytes;
+}
+
+void
+wasm_migration_stats_add_frames(uint32 frame_count)
+{
+    current.frame_count += frame_count;
+}
+
+void
+wasm_migration_stats_add_threads(uint32 thread_count)
+{
+    current.thread_count += thread_count;
+}
+
+void
+wasm_migration_stats_set_round(uint32 precopy_round)
+{
+    current.precopy_round = precopy_round;
+}
+
+// 1つのwriteで書けば、複数のthreadの行が混ざらない
+static void
+write_json(int fd, const wasm_migration_stats_t *stats)
+{
+    char buf[1024];
+    int len, n;
+
+    len = snprintf(buf, sizeof(buf),
+                   "{\"kind\":\"%s\",\"success\":%s,\"timestamp_ns\":%" PRIu64
+                   ",\"total_ns\":%" PRIu64 ",\"phase_ns\":{",
+                   kind_names[stats->kind], stats->success ? "true" : "false",
+                   stats->timestamp_ns, stats->total_ns);
+    for (uint32 i = 0; i < WASM_MIGRATION_PHASE_COUNT; i++)
+        len += snprintf(buf + len, sizeof(buf) - len, "%s\"%s\":%" PRIu64,
+                        i > 0 ? "," : "", phase_names[i], stats->phase_ns[i]);
+    len += snprintf(
+        buf + len, sizeof(buf) - len,
+        "},\"bytes_written\":%" PRIu64 ",\"bytes_read\":%" PRIu64
+        ",\"memory_pages\":%" PRIu64 ",\"dirty_pages\":%" PRIu64
+        ",\"zero_pages\":%" PRIu64 ",\"raw_page_bytes\":%" PRIu64
+        ",\"stored_page_bytes\":%" PRIu64 ",\"compression_ratio\":%.4f"
+        ",\"frame_count\":%u,\"thread_count\":%u,\"precopy_round\":%u}\n",
+        stats->bytes_written, stats->bytes_read, stats->memory_pages,
+        stats->dirty_pages, stats->zero_pages, stats->raw_page_bytes,
+        stats->stored_page_bytes, stats->compression_ratio, stats->frame_count,
+        stats->thread_count, stats->precopy_round);
+
+    for (int off = 0; off < len; off += n) {
+        if ((n = write(fd, buf + off, len - off)) <= 0)
+            break;
+    }
+}
+
+void
+wasm_migration_stats_end(bool success)
+{
+    int fd;
+
+    current.success = success;
+    current.timestamp_ns = now_ns();
+    current.total_ns = current.timestamp_ns - current_start;
+    current.compression_ratio =
+        current.raw_page_bytes > 0
+            ? (double)current.stored_page_bytes / current.raw_page_bytes
+            : 1.0;
+
+    os_mutex_lock(&stats_lock);
+    last_stats[current.kind] = current;
+    has_stats[current.kind] = true;
+    fd = stats_fd;
+    os_mutex_unlock(&stats_lock);
+
+    if (fd >= 0)
+        write_json(fd, &current);
+}
+
+bool
+wasm_runtime_get_migration_stats(wasm_migration_kind_t kind,
+                                 wasm_migration_stats_t *stats)
+{
+    bool ret;
+
+    if (kind >= WASM_MIGRATION_KIND_COUNT)
+        return false;
+    os_mutex_lock(&stats_lock);
+    if ((ret = has_stats[kind]))
+        *stats = last_stats[kind];
+    os_mutex_unlock(&stats_lock);
+    return ret;
+}
+
+void
+wasm_runtime_set_migration_stats_fd(int fd)
+{
+    os_mutex_lock(&stats_lock);
+    stats_fd = fd;
+    os_mutex_unlock(&stats_lock);
+}
@@ -0,0 +1,40 @@
+#ifndef _WASM_MIGRATION_STATS_H
+#define _WASM_MIGRATION_STATS_H
+
+#include "bh_platform.h"
+#include "wasm_export.h"
+
+/* The statistics of the operation running on this thread. begin resets
+   them, the others add to them and end publishes them for
+   wasm_runtime_get_migration_stats and writes the JSON line. */
+void
+wasm_migration_stats_begin(wasm_migration_kind_t kind);
+
+void
+wasm_migration_stats_phase(wasm_migration_phase_t phase, uint64 ns);
+
+void
+wasm_migration_stats_add_written(uint64 bytes);
+
+void
+wasm_migration_stats_add_read(uint64 bytes);
+
+/* Pages of one dumped linear memory, see wasm_migration_stats_t */
+void
+wasm_migration_stats_add_pages(uint64 memory_pages, uint64 dirty_pages,
+                               uint64 zero_pages, uint64 raw_bytes,
+                               uint64 stored_bytes);
+
+void
+wasm_migration_stats_add_frames(uint32 frame_count);
+
+void
+wasm_migration_stats_add_threads(uint32 thread_count);
+
+void
+wasm_migration_stats_set_round(uint32 precopy_round);
+
+void
+wasm_migration_stats_end(bool success);
+
+#endif // _WASM_MIGRATION_STATS_H
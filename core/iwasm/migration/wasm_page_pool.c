@@ -0,0 +1,342 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+
+#include "wasm_page_pool.h"
+
+struct WASMPagePool {
+    char path[PATH_MAX];
+    int fd;
+    int idx_fd;
+    bool writable;
+    // hash -> page idのopen addressingのtable. 同じhashのページは続けて並ぶ
+    WASMPagePoolEntry *table;
+    uint64 table_size;
+    uint64 entry_count;
+    // 読み込んだ.idxのentry数. 他のprocessが足した分は次のstoreで読む
+    uint64 loaded_count;
+    // 同じprocessの別々のinstanceが同時にcheckpointできるように
+    korp_mutex lock;
+};
+
+static inline uint64
+read64(const uint8 *p)
+{
+    uint64 v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+uint64
+wasm_page_pool_hash(const uint8 *page)
+{
+    const uint64 K1 = 0x9e3779b97f4a7c15ULL, K2 = 0xc2b2ae3d27d4eb4fULL;
+    uint64 h = WASM_PAGE_POOL_PAGE_SIZE * K1;
+
+    for (uint32 i = 0; i < WASM_PAGE_POOL_PAGE_SIZE; i += sizeof(uint64)) {
+        h ^= read64(page + i) * K2;
+        h = ((h << 31) | (h >> 33)) * K1;
+    }
+    h ^= h >> 29;
+    h *= K2;
+    return h ^ (h >> 32);
+}
+
+static bool
+table_insert(WASMPagePool *pool, uint64 hash, uint64 page_id);
+
+static bool
+grow_table(WASMPagePool *pool)
+{
+    WASMPagePoolEntry *old = pool->table;
+    uint64 old_size = pool->table_size;
+    uint64 size = old_size ? old_size * 2 : 1024;
+
+    // page idは1から数えて入れ、0を空きにする
+    if (!(pool->table = calloc(size, sizeof(WASMPagePoolEntry)))) {
+        pool->table = old;
+        return false;
+    }
+    pool->table_size = size;
+    pool->entry_count = 0;
+    for (uint64 i = 0; i < old_size; i++) {
+        if (old[i].page_id != 0)
+            table_insert(pool, old[i].hash, old[i].page_id - 1);
+    }
+    free(old);
+    return true;
+}
+
+static bool
+table_insert(WASMPagePool *pool, uint64 hash, uint64 page_id)
+{
+    uint64 i;
+
+    if ((pool->entry_count + 1) * 2 > pool->table_size && !grow_table(pool))
+        return false;
+    for (i = hash & (pool->table_size - 1); pool->table[i].page_id != 0;
+         i = (i + 1) & (pool->table_size - 1))
+        ;
+    pool->table[i].hash = hash;
+    pool->table[i].page_id = page_id + 1;
+    pool->entry_count++;
+    return true;
+}
+
+static bool
+read_all(int fd, void *buf, uint64 size, uint64 offset)
+{
+    uint8 *p = buf;
+    ssize_t n;
+
+    while (size > 0) {
+        n = pread(fd, p, size, (off_t)offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        size -= n;
+        offset += n;
+    }
+    return true;
+}
+
+static bool
+write_all(int fd, const void *buf, uint64 size, uint64 offset)
+{
+    const uint8 *p = buf;
+    ssize_t n;
+
+    while (size > 0) {
+        n = pwrite(fd, p, size, (off_t)offset);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        p += n;
+        size -= n;
+        offset += n;
+    }
+    return true;
+}
+
+// 他のprocessが.idxに足したentryを読み込む. flockを取ってから呼ぶ
+static bool
+load_entries(WASMPagePool *pool)
+{
+    WASMPagePoolEntry entries[256];
+    struct stat st;
+    uint64 count, n;
+
+    if (fstat(pool->idx_fd, &st) != 0)
+        return false;
+    count = (uint64)st.st_size / sizeof(WASMPagePoolEntry);
+    while (pool->loaded_count < count) {
+        n = count - pool->loaded_count < 256 ? count - pool->loaded_count
+                                             : 256;
+        if (!read_all(pool->idx_fd, entries, n * sizeof(WASMPagePoolEntry),
+                      pool->loaded_count * sizeof(WASMPagePoolEntry)))
+            return false;
+        for (uint64 i = 0; i < n; i++) {
+            if (!table_insert(pool, entries[i].hash, entries[i].page_id))
+                return false;
+        }
+        pool->loaded_count += n;
+    }
+    return true;
+}
+
+// 空のpoolならheaderを書き、そうでなければheaderを確かめる
+static bool
+init_header(WASMPagePool *pool)
+{
+    WASMPagePoolHeader header = { 0 };
+    uint8 page[WASM_PAGE_POOL_PAGE_SIZE] = { 0 };
+    struct stat st;
+
+    if (fstat(pool->fd, &st) != 0)
+        return false;
+    if (st.st_size == 0 && pool->writable) {
+        header.magic = WASM_PAGE_POOL_MAGIC;
+        header.version = WASM_PAGE_POOL_VERSION;
+        header.page_size = WASM_PAGE_POOL_PAGE_SIZE;
+        memcpy(page, &header, sizeof(header));
+        return write_all(pool->fd, page, sizeof(page), 0);
+    }
+    return read_all(pool->fd, &header, sizeof(header), 0)
+           && header.magic == WASM_PAGE_POOL_MAGIC
+           && header.version == WASM_PAGE_POOL_VERSION
+           && header.page_size == WASM_PAGE_POOL_PAGE_SIZE;
+}
+
+WASMPagePool *
+wasm_page_pool_open(const char *path, bool writable)
+{
+    char idx_path[PATH_MAX + 8];
+    int flags = writable ? O_RDWR | O_CREAT : O_RDONLY;
+    WASMPagePool *pool;
+    bool ok;
+
+    if (!(pool = calloc(1, sizeof(WASMPagePool))))
+        return NULL;
+    pool->writable = writable;
+    pool->fd = pool->idx_fd = -1;
+    if (os_mutex_init(&pool->lock) != BHT_OK) {
+        free(pool);
+        return NULL;
+    }
+
+    snprintf(idx_path, sizeof(idx_path), "%s.idx", path);
+    if ((pool->fd = open(path, flags, 0644)) < 0
+        || (writable && (pool->idx_fd = open(idx_path, flags, 0644)) < 0)) {
+        fprintf(stderr, "failed to open page pool %s\n", path);
+        goto fail;
+    }
+    // imageには絶対pathを書き、別のdirectoryからrestoreしても見つかるようにする
+    if (!realpath(path, pool->path)) {
+        fprintf(stderr, "failed to resolve page pool %s\n", path);
+        goto fail;
+    }
+
+    if (writable && flock(pool->fd, LOCK_EX) != 0)
+        goto fail;
+    ok = init_header(pool) && (!writable || load_entries(pool));
+    if (writable)
+        flock(pool->fd, LOCK_UN);
+    if (!ok) {
+        fprintf(stderr, "invalid page pool %s\n", path);
+        goto fail;
+    }
+    return pool;
+
+fail:
+    wasm_page_pool_close(pool);
+    return NULL;
+}
+
+void
+wasm_page_pool_close(WASMPagePool *pool)
+{
+    if (!pool)
+        return;
+    if (pool->fd >= 0)
+        close(pool->fd);
+    if (pool->idx_fd >= 0)
+        close(pool->idx_fd);
+    free(pool->table);
+    os_mutex_destroy(&pool->lock);
+    free(pool);
+}
+
+const char *
+wasm_page_pool_path(const WASMPagePool *pool)
+{
+    return pool->path;
+}
+
+int
+wasm_page_pool_fd(const WASMPagePool *pool)
+{
+    return pool->fd;
+}
+
+// 同じhashのpoolのページと中身を比べ、同じならそのpage idを返す
+static bool
+find_page(WASMPagePool *pool, const uint8 *page, uint64 hash, uint64 *id)
+{
+    uint8 stored[WASM_PAGE_POOL_PAGE_SIZE];
+    uint64 i;
+
+    if (pool->table_size == 0)
+        return false;
+    for (i = hash & (pool->table_size - 1); pool->table[i].page_id != 0;
+         i = (i + 1) & (pool->table_size - 1)) {
+        if (pool->table[i].hash != hash)
+            continue;
+        if (read_all(pool->fd, stored, sizeof(stored),
+                     wasm_page_pool_offset(pool->table[i].page_id - 1))
+            && memcmp(stored, page, sizeof(stored)) == 0) {
+            *id = pool->table[i].page_id - 1;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool
+wasm_page_pool_store(WASMPagePool *pool, const uint8 *data,
+                     const uint64 *hashes, uint64 page_count, uint64 *ids,
+                     uint64 *new_pages)
+{
+    WASMPagePoolEntry entry;
+    struct stat st;
+    uint64 next_id;
+    bool ok = false;
+
+    *new_pages = 0;
+    if (!pool->writable)
+        return false;
+
+    os_mutex_lock(&pool->lock);
+    if (flock(pool->fd, LOCK_EX) != 0) {
+        os_mutex_unlock(&pool->lock);
+        return false;
+    }
+    if (!load_entries(pool) || fstat(pool->fd, &st) != 0)
+        goto fail;
+    // 書きかけで終わったページがあれば上書きする
+    next_id = (uint64)st.st_size / WASM_PAGE_POOL_PAGE_SIZE - 1;
+
+    for (uint64 i = 0; i < page_count; i++) {
+        const uint8 *page = data + i * WASM_PAGE_POOL_PAGE_SIZE;
+        if (find_page(pool, page, hashes[i], &ids[i]))
+            continue;
+
+        // ページを書いてから.idxに足す. 途中で落ちても参照されないページが残るだけ
+        entry.hash = hashes[i];
+        entry.page_id = next_id;
+        if (!write_all(pool->fd, page, WASM_PAGE_POOL_PAGE_SIZE,
+                       wasm_page_pool_offset(next_id))
+            || !write_all(pool->idx_fd, &entry, sizeof(entry),
+                          pool->loaded_count * sizeof(entry))
+            || !table_insert(pool, entry.hash, entry.page_id)) {
+            fprintf(stderr, "failed to write page pool %s\n", pool->path);
+            goto fail;
+        }
+        pool->loaded_count++;
+        ids[i] = next_id++;
+        (*new_pages)++;
+    }
+    ok = true;
+
+fail:
+    flock(pool->fd, LOCK_UN);
+    os_mutex_unlock(&pool->lock);
+    return ok;
+}
+
+bool
+wasm_page_pool_contains(WASMPagePool *pool, uint64 page_id,
+                        uint64 page_count)
+{
+    struct stat st;
+
+    return fstat(pool->fd, &st) == 0
+           && page_id + page_count >= page_id
+           && wasm_page_pool_offset(page_id + page_count)
+                  <= (uint64)st.st_size;
+}
+
+bool
+wasm_page_pool_read(WASMPagePool *pool, uint64 page_id, uint64 page_count,
+                    uint8 *buf)
+{
+    return read_all(pool->fd, buf, page_count * WASM_PAGE_POOL_PAGE_SIZE,
+                    wasm_page_pool_offset(page_id));
+}
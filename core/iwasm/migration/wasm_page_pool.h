@@ -0,0 +1,88 @@
+#ifndef _WASM_PAGE_POOL_H
+#define _WASM_PAGE_POOL_H
+
+#include "bh_platform.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Content-addressed store of linear memory pages shared by checkpoint
+ * images.
+ *
+ * <path>      WASM_PAGE_POOL_PAGE_SIZE header, then the pages. Page id n
+ *             is at offset (n + 1) * WASM_PAGE_POOL_PAGE_SIZE, so that it
+ *             can be mmap'ed in place.
+ * <path>.idx  WASMPagePoolEntry per page, in the order of the pages.
+ *
+ * Both files are append-only, a page never changes once it is stored, and
+ * appends are serialized with flock so that the processes of a fleet can
+ * share one pool. Pages with the same hash are compared byte by byte, so
+ * a hash collision only costs a duplicate page.
+ */
+
+#define WASM_PAGE_POOL_MAGIC 0x4c504750 /* "PGPL" */
+#define WASM_PAGE_POOL_VERSION 1
+#define WASM_PAGE_POOL_PAGE_SIZE 4096
+
+typedef struct WASMPagePoolHeader {
+    uint32 magic;
+    uint32 version;
+    uint32 page_size;
+    uint32 reserved;
+} WASMPagePoolHeader;
+
+typedef struct WASMPagePoolEntry {
+    uint64 hash;
+    uint64 page_id;
+} WASMPagePoolEntry;
+
+typedef struct WASMPagePool WASMPagePool;
+
+/* Open or create the pool at path. A read-only pool only serves
+   wasm_page_pool_fd and wasm_page_pool_read. */
+WASMPagePool *
+wasm_page_pool_open(const char *path, bool writable);
+
+void
+wasm_page_pool_close(WASMPagePool *pool);
+
+/* Absolute path of the pool, recorded in the images that refer to it */
+const char *
+wasm_page_pool_path(const WASMPagePool *pool);
+
+uint64
+wasm_page_pool_hash(const uint8 *page);
+
+/* Store page_count pages at data whose hashes are given, and return the
+   page id of each page in ids. *new_pages is the number of the pages that
+   were not in the pool yet. */
+bool
+wasm_page_pool_store(WASMPagePool *pool, const uint8 *data,
+                     const uint64 *hashes, uint64 page_count, uint64 *ids,
+                     uint64 *new_pages);
+
+/* Whether [page_id, page_id + page_count) are all stored */
+bool
+wasm_page_pool_contains(WASMPagePool *pool, uint64 page_id,
+                        uint64 page_count);
+
+int
+wasm_page_pool_fd(const WASMPagePool *pool);
+
+static inline uint64
+wasm_page_pool_offset(uint64 page_id)
+{
+    return (page_id + 1) * WASM_PAGE_POOL_PAGE_SIZE;
+}
+
+bool
+wasm_page_pool_read(WASMPagePool *pool, uint64 page_id, uint64 page_count,
+                    uint8 *buf);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _WASM_PAGE_POOL_H
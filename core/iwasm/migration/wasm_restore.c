@@ -1,11 +1,295 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/mman.h>
 
 #include "../common/wasm_exec_env.h"
 #include "../common/wasm_memory.h"
 #include "../interpreter/wasm_runtime.h"
+#include "../interpreter/wasm_loader.h"
+#if WASM_ENABLE_AOT != 0
+#include "../aot/aot_runtime.h"
+#endif
 #include "wasm_migration.h"
 #include "wasm_restore.h"
+#include "wasm_image.h"
+#include "wasm_image_compress.h"
+#include "wasm_type_stack.h"
+#include "wasm_migration_stats.h"
+#include "wasm_page_pool.h"
+#if WASM_ENABLE_LIB_WASI_THREADS != 0
+#include "../libraries/thread-mgr/thread_manager.h"
+
+int32
+wasi_threads_respawn_thread(wasm_exec_env_t exec_env, int32 thread_id,
+                            void (*prepare)(wasm_module_inst_t, void *),
+                            void *prepare_arg);
+#endif
+
+#define RESTORE(cursor, dst, size)                                 \
+    do {                                                           \
+        if (!wasm_image_cursor_read(cursor, dst, size)) {          \
+            LOG_ERROR("truncated section in checkpoint image\n"); \
+            return -1;                                             \
+        }                                                          \
+    } while (0)
+
+// wasm_restore_stackで開いて、wasm_restoreの最後に閉じる
+// 別々のinstanceが別々のthreadで同時にrestoreできるよう、thread localに持つ
+static os_thread_local_attribute WASMImageReader restore_image;
+static os_thread_local_attribute bool restore_image_opened = false;
+// wasm_runtime_restore_instanceで選ばれたinstanceのimage
+static os_thread_local_attribute const char *instance_source = NULL;
+
+static const char *restore_source = NULL;
+void set_restore_source(const char *source)
+{
+    restore_source = source;
+}
+
+static const char *
+get_restore_source()
+{
+    const char *source = instance_source ? instance_source : restore_source;
+
+    return source ? source : WASM_IMAGE_DEFAULT_FILE;
+}
+
+WASMImageReader *
+get_restore_image()
+{
+    if (!restore_image_opened) {
+        // streamなら、ここで送り手からの接続を待つ
+        if (!wasm_image_reader_open_from(&restore_image, get_restore_source()))
+            return NULL;
+        restore_image_opened = true;
+    }
+    return &restore_image;
+}
+
+void
+close_restore_image()
+{
+    if (restore_image_opened) {
+        wasm_image_reader_close(&restore_image);
+        restore_image_opened = false;
+    }
+    instance_source = NULL;
+}
+
+bool
+wasm_runtime_restore_instance(WASMModuleInstanceCommon *module_inst,
+                              const char *source)
+{
+    if (!module_inst || !wasm_migration_is_supported(module_inst))
+        return false;
+    wasm_migration_get_state(module_inst)->restore_source =
+        source ? source : WASM_IMAGE_DEFAULT_FILE;
+    return true;
+}
+
+bool
+wasm_restore_begin_instance(WASMExecEnv *exec_env)
+{
+    WASMMigrationState *state = wasm_migration_get_state(exec_env->module_inst);
+
+    if (!state->restore_source)
+        return false;
+    // このthreadのrestoreは、このinstanceのimageを読む
+    close_restore_image();
+    instance_source = state->restore_source;
+    state->restore_source = NULL;
+    return true;
+}
+
+/* threads */
+#if WASM_ENABLE_LIB_WASI_THREADS != 0
+// respawnしたthreadのsection. threadがwasi_thread_startに入ったときに取り出す
+typedef struct WASMRestoreThread {
+    struct WASMRestoreThread *next;
+    WASMCluster *cluster;
+    wasm_module_inst_t module_inst;
+    uint32 size;
+    uint8 data[1];
+} WASMRestoreThread;
+
+// 全clusterのrestore待ちのthreadの数. 0ならclusterを見ずに済ませる
+static bh_atomic_32_t restore_thread_count = 0;
+// このthreadがrestore中のrecord. mainのthreadではNULL
+static os_thread_local_attribute WASMRestoreThread *restoring_thread = NULL;
+
+static void
+prepare_thread(wasm_module_inst_t module_inst, void *arg)
+{
+    WASMRestoreThread *thread = arg;
+
+    thread->module_inst = module_inst;
+    // clusterのlockで守る
+    os_mutex_lock(&thread->cluster->lock);
+    thread->next = thread->cluster->restore_threads;
+    thread->cluster->restore_threads = thread;
+    BH_ATOMIC_32_FETCH_ADD(restore_thread_count, 1);
+    os_mutex_unlock(&thread->cluster->lock);
+}
+#endif
+
+bool
+wasm_restore_begin_thread(WASMExecEnv *exec_env)
+{
+#if WASM_ENABLE_LIB_WASI_THREADS != 0
+    WASMCluster *cluster;
+    WASMRestoreThread **p;
+
+    if (BH_ATOMIC_32_LOAD(restore_thread_count) == 0
+        || !(cluster = wasm_exec_env_get_cluster(exec_env)))
+        return false;
+
+    os_mutex_lock(&cluster->lock);
+    for (p = &cluster->restore_threads; *p; p = &(*p)->next) {
+        if ((*p)->module_inst == exec_env->module_inst) {
+            restoring_thread = *p;
+            *p = restoring_thread->next;
+            BH_ATOMIC_32_FETCH_SUB(restore_thread_count, 1);
+            break;
+        }
+    }
+    os_mutex_unlock(&cluster->lock);
+    return restoring_thread != NULL;
+#else
+    return false;
+#endif
+}
+
+static bool
+is_restoring_thread()
+{
+#if WASM_ENABLE_LIB_WASI_THREADS != 0
+    return restoring_thread != NULL;
+#else
+    return false;
+#endif
+}
+
+static void
+end_restore()
+{
+#if WASM_ENABLE_LIB_WASI_THREADS != 0
+    // threadはimageを開いていない
+    if (restoring_thread) {
+        free(restoring_thread);
+        restoring_thread = NULL;
+        return;
+    }
+#endif
+    close_restore_image();
+}
+
+// restore中のthreadならそのrecordの, mainのthreadならimageのsection
+static bool
+get_section(uint32 type, WASMImageCursor *cursor)
+{
+    WASMImageReader *image;
+
+#if WASM_ENABLE_LIB_WASI_THREADS != 0
+    if (restoring_thread) {
+        WASMImageCursor record;
+        uint32 section_type, size;
+        const uint8 *payload;
+
+        record.p = restoring_thread->data;
+        record.end = record.p + restoring_thread->size;
+        while (wasm_image_cursor_read(&record, &section_type, sizeof(uint32))
+               && wasm_image_cursor_read(&record, &size, sizeof(uint32))
+               && (payload = wasm_image_cursor_skip(&record, size))) {
+            if (section_type == type) {
+                cursor->p = payload;
+                cursor->end = payload + size;
+                return true;
+            }
+        }
+        LOG_ERROR("section %u of thread not found in checkpoint image\n",
+                  type);
+        return false;
+    }
+#endif
+
+    return (image = get_restore_image())
+           && wasm_image_reader_cursor(image, type, cursor);
+}
+
+// imageの他のthreadを元のthread idでrespawnする
+static int
+restore_threads_of_image(WASMExecEnv *exec_env)
+{
+    WASMImageReader *image = get_restore_image();
+    WASMImageCursor cursor;
+    uint32 count;
+
+    // single threadのimageにはsectionがない
+    if (!image || !wasm_image_reader_find(image, IMAGE_SECTION_THREADS))
+        return 0;
+    if (!wasm_image_reader_cursor(image, IMAGE_SECTION_THREADS, &cursor))
+        return -1;
+    RESTORE(&cursor, &count, sizeof(uint32));
+    wasm_migration_stats_add_threads(count);
+
+#if WASM_ENABLE_LIB_WASI_THREADS != 0
+    WASMCluster *cluster = wasm_exec_env_get_cluster(exec_env);
+    if (count > 0 && !cluster) {
+        LOG_ERROR("no cluster to restore threads\n");
+        return -1;
+    }
+    for (uint32 i = 0; i < count; i++) {
+        WASMRestoreThread *thread;
+        WASMImageCursor record;
+        const uint8 *data, *payload;
+        int32 tid;
+        uint32 size, section_type, section_size, frame_count;
+
+        RESTORE(&cursor, &tid, sizeof(int32));
+        RESTORE(&cursor, &size, sizeof(uint32));
+        if (!(data = wasm_image_cursor_skip(&cursor, size))) {
+            LOG_ERROR("truncated section in checkpoint image\n");
+            return -1;
+        }
+
+        // threadのframeはrespawnした先で戻すので、数はここで数える
+        record.p = data;
+        record.end = data + size;
+        while (wasm_image_cursor_read(&record, &section_type, sizeof(uint32))
+               && wasm_image_cursor_read(&record, &section_size,
+                                         sizeof(uint32))
+               && (payload = wasm_image_cursor_skip(&record, section_size))) {
+            if (section_type == IMAGE_SECTION_STACK
+                && section_size >= sizeof(uint32)) {
+                memcpy(&frame_count, payload, sizeof(uint32));
+                wasm_migration_stats_add_frames(frame_count);
+            }
+        }
+
+        // imageは先に閉じるので、threadのsectionはcopyしておく
+        if (!(thread = malloc(offsetof(WASMRestoreThread, data) + size))) {
+            LOG_ERROR("failed to allocate thread record\n");
+            return -1;
+        }
+        thread->cluster = cluster;
+        thread->module_inst = NULL;
+        thread->size = size;
+        memcpy(thread->data, data, size);
+        if (wasi_threads_respawn_thread(exec_env, tid, prepare_thread, thread)
+            < 0) {
+            LOG_ERROR("failed to respawn thread %d\n", tid);
+            return -1;
+        }
+    }
+    return 0;
+#else
+    if (count > 0) {
+        LOG_ERROR("restoring threads requires wasi-threads\n");
+        return -1;
+    }
+    return 0;
+#endif
+}
 
 static bool restore_flag;
 void set_restore_flag(bool f)
@@ -17,6 +301,20 @@ bool get_restore_flag()
     return restore_flag;
 }
 
+// wasm_runtime_instantiate_from_snapshotがinstantiateしている間だけ立てる
+static os_thread_local_attribute bool instantiating_snapshot = false;
+static os_thread_local_attribute uint32 snapshot_page_count = 0;
+
+static bool restore_lazy;
+void set_restore_lazy(bool f)
+{
+    restore_lazy = f;
+}
+bool get_restore_lazy()
+{
+    return restore_lazy;
+}
+
 
 static inline WASMInterpFrame *
 wasm_alloc_frame(WASMExecEnv *exec_env, uint32 size, WASMInterpFrame *prev_frame)
@@ -26,7 +324,7 @@ wasm_alloc_frame(WASMExecEnv *exec_env, uint32 size, WASMInterpFrame *prev_frame
     if (frame) {
         frame->prev_frame = prev_frame;
 #if WASM_ENABLE_PERF_PROFILING != 0
-        frame->time_started = os_time_get_boot_microsecond();
+        frame->time_started = os_time_get_boot_us();
 #endif
     }
     else {
@@ -38,17 +336,16 @@ wasm_alloc_frame(WASMExecEnv *exec_env, uint32 size, WASMInterpFrame *prev_frame
 }
 
 
-static void
-_restore_stack(WASMExecEnv *exec_env, WASMInterpFrame *frame, FILE *fp)
+#if WASM_ENABLE_FAST_INTERP == 0
+static int
+_restore_stack(WASMExecEnv *exec_env, WASMInterpFrame *frame, WASMImageCursor *cursor)
 {
-    WASMModuleInstance *module_inst = exec_env->module_inst;
     WASMFunctionInstance *func = frame->function;
-    int read_size = 0;
 
     // 初期化
     frame->sp_bottom = frame->lp + func->param_cell_num + func->local_cell_num;
     frame->sp_boundary = frame->sp_bottom + func->u.func->max_stack_cell_num;
-    frame->csp_bottom = frame->sp_boundary;
+    frame->csp_bottom = (WASMBranchBlock *)frame->sp_boundary;
     frame->csp_boundary = frame->csp_bottom + func->u.func->max_block_num;
     // frame->tsp_bottom = frame->csp_boundary;
     // frame->tsp_boundary = frame->tsp_bottom + func->u.func->max_stack_cell_num;
@@ -56,61 +353,72 @@ _restore_stack(WASMExecEnv *exec_env, WASMInterpFrame *frame, FILE *fp)
     // リターンアドレス
     WASMInterpFrame* prev_frame = frame->prev_frame;
     uint32 fidx, offset;
-    read_size = fread(&fidx, sizeof(uint32), 1, fp);
-    fread(&offset, sizeof(uint32), 1, fp);
+    RESTORE(cursor, &fidx, sizeof(uint32));
+    RESTORE(cursor, &offset, sizeof(uint32));
     if (prev_frame->function != NULL)
         prev_frame->ip = wasm_get_func_code(prev_frame->function) + offset;
 
     // 型スタックのサイズ
     uint32 locals = func->param_count + func->local_count;
     uint32 full_type_stack_size, type_stack_size;
-    fread(&full_type_stack_size, sizeof(uint32), 1, fp);
+    RESTORE(cursor, &full_type_stack_size, sizeof(uint32));
+    if (full_type_stack_size < locals) {
+        LOG_ERROR("invalid type stack in checkpoint image\n");
+        return -1;
+    }
     type_stack_size = full_type_stack_size - locals;                                      // 統一フォーマットでは、ローカルも型/値スタックに入れているが、WAMRの型/値スタックのサイズはローカル抜き
     // frame->tsp = frame->tsp_bottom + type_stack_size;
 
     // 型スタックの中身
-    fseek(fp, sizeof(uint8)*locals, SEEK_CUR);                      // localのやつはWAMRでは必要ないので飛ばす
-
-    uint8 type_stack[type_stack_size];
-    // uint32* tsp_bottom = frame->tsp_bottom;
-    for (uint32 i = 0; i < type_stack_size; ++i) {
-        fread(&type_stack[i], sizeof(uint8), 1, fp);
+    // localのやつはWAMRでは必要ないので飛ばす
+    const uint8 *type_stack;
+    if (!wasm_image_cursor_skip(cursor, sizeof(uint8)*locals)
+        || !(type_stack = wasm_image_cursor_skip(cursor, type_stack_size))) {
+        LOG_ERROR("truncated section in checkpoint image\n");
+        return -1;
     }
 
     // 値スタックのサイズ
     // uint32 *tsp = frame->tsp_bottom;
+    // CRCは壊れたimageしか見つけられないので、frameの外に書かないように確かめる
     uint32 value_stack_size = 0;
     for (uint32 i = 0; i < type_stack_size; ++i) {
         value_stack_size += type_stack[i];
+        if (value_stack_size > func->u.func->max_stack_cell_num) {
+            LOG_ERROR("invalid value stack in checkpoint image\n");
+            return -1;
+        }
     }
     frame->sp = frame->sp_bottom + value_stack_size;
 
     // 値スタックの中身
     uint32 local_cell_num = func->param_cell_num + func->local_cell_num;
-    fread(frame->lp, sizeof(uint32), local_cell_num, fp);
-    fread(frame->sp_bottom, sizeof(uint32), value_stack_size, fp);
+    RESTORE(cursor, frame->lp, sizeof(uint32) * local_cell_num);
+    RESTORE(cursor, frame->sp_bottom, sizeof(uint32) * value_stack_size);
 
     // ラベルスタックのサイズ
     uint32 ctrl_stack_size;
-    fread(&ctrl_stack_size, sizeof(uint32), 1, fp);
+    RESTORE(cursor, &ctrl_stack_size, sizeof(uint32));
+    if (ctrl_stack_size > func->u.func->max_block_num) {
+        LOG_ERROR("invalid label stack in checkpoint image\n");
+        return -1;
+    }
     frame->csp = frame->csp_bottom + ctrl_stack_size;
 
 
     // ラベルスタックの中身
     WASMBranchBlock *csp = frame->csp_bottom;
-    for (int i = 0; i < ctrl_stack_size; ++i, ++csp) {
-        uint64 offset;
-
+    for (uint32 i = 0; i < ctrl_stack_size; ++i, ++csp) {
         // uint8 *begin_addr;
-        fread(&offset, sizeof(uint32), 1, fp);
+        RESTORE(cursor, &offset, sizeof(uint32));
         csp->begin_addr = set_addr_offset(wasm_get_func_code(frame->function), offset);
 
         // uint8 *target_addr;
-        fread(&offset, sizeof(uint32), 1, fp);
+        RESTORE(cursor, &offset, sizeof(uint32));
         csp->target_addr = set_addr_offset(wasm_get_func_code(frame->function), offset);
 
         // uint32 *frame_sp;
-        fread(&offset, sizeof(uint32), 1, fp);
+        RESTORE(cursor, &offset, sizeof(uint32));
         csp->frame_sp = set_addr_offset(frame->sp_bottom, offset);
 
         // uint32 *frame_tsp
@@ -118,11 +426,144 @@ _restore_stack(WASMExecEnv *exec_env, WASMInterpFrame *frame, FILE *fp)
         // csp->frame_tsp = set_addr_offset(frame->tsp_bottom, offset);
 
         // uint32 cell_num;
-        fread(&csp->cell_num, sizeof(uint32), 1, fp);
+        RESTORE(cursor, &csp->cell_num, sizeof(uint32));
 
         // uint32 count;
         // fread(&csp->count, sizeof(uint32), 1, fp);
     }
+    return 0;
+}
+
+#else
+// callの直後に戻るようにする. calleeの戻り値はcall命令が指定したslotに書かれる
+static int
+restore_return_address(WASMInterpFrame *frame, uint32 offset)
+{
+    const WASMTypeStackTable *table =
+        &frame->function->u.func->type_stack_table;
+    const WASMTypeStackEntry *ret_entry, *entry;
+    uint32 value_count;
+
+    ret_entry = wasm_type_stack_lookup(table, offset, true);
+    entry = wasm_type_stack_lookup(table, offset, false);
+    if (!ret_entry || !entry || entry->offset != offset) {
+        LOG_ERROR("invalid return address in checkpoint image: offset %u\n",
+                  offset);
+        return -1;
+    }
+    frame->ip = wasm_get_func_code(frame->function) + ret_entry->compiled_offset;
+
+    // call直後の型スタックでは、call前のスタックの上に戻り値が積まれている
+    value_count = wasm_type_stack_value_count(table, ret_entry);
+    frame->ret_offset =
+        value_count < wasm_type_stack_value_count(table, entry)
+            ? (uint32)wasm_type_stack_slot(table, entry, value_count)
+            : 0;
+    return 0;
+}
+
+// offset_nowはこのframeが止まっているbytecodeの位置
+static int
+_restore_stack(WASMExecEnv *exec_env, WASMInterpFrame *frame,
+               WASMImageCursor *cursor, uint32 offset_now, bool is_top)
+{
+    WASMFunctionInstance *func = frame->function;
+    WASMFunction *wasm_func = func->u.func;
+    const WASMTypeStackTable *table = &wasm_func->type_stack_table;
+    const WASMTypeStackEntry *entry;
+
+    // 初期化
+    frame->lp = frame->operand + wasm_func->const_cell_num;
+    if (wasm_func->const_cell_num > 0)
+        memcpy(frame->operand, wasm_func->consts,
+               sizeof(uint32) * wasm_func->const_cell_num);
+
+    // リターンアドレス
+    WASMInterpFrame* prev_frame = frame->prev_frame;
+    uint32 fidx, offset;
+    RESTORE(cursor, &fidx, sizeof(uint32));
+    RESTORE(cursor, &offset, sizeof(uint32));
+    if (prev_frame->function != NULL
+        && restore_return_address(prev_frame, offset) < 0)
+        return -1;
+
+    // 型スタック
+    // 各値のslotはloaderの表から引くので、imageの型スタックが表と一致することを確認する
+    if (!(entry = wasm_type_stack_lookup(table, offset_now, !is_top))) {
+        LOG_ERROR("type stack not found: offset %u\n", offset_now);
+        return -1;
+    }
+    uint32 locals = func->param_count + func->local_count;
+    uint32 full_type_stack_size, type_stack_size;
+    uint32 value_count = wasm_type_stack_value_count(table, entry);
+    const uint8 *cells = wasm_type_stack_cells(table, entry);
+    const uint8 *type_stack;
+    RESTORE(cursor, &full_type_stack_size, sizeof(uint32));
+    if (full_type_stack_size < locals) {
+        LOG_ERROR("invalid type stack in checkpoint image\n");
+        return -1;
+    }
+    type_stack_size = full_type_stack_size - locals;
+    if (!wasm_image_cursor_skip(cursor, sizeof(uint8)*locals)
+        || !(type_stack = wasm_image_cursor_skip(cursor, type_stack_size))) {
+        LOG_ERROR("truncated section in checkpoint image\n");
+        return -1;
+    }
+    if (type_stack_size != value_count
+        || memcmp(type_stack, cells, value_count) != 0) {
+        LOG_ERROR("type stack mismatch in checkpoint image: offset %u\n",
+                  offset_now);
+        return -1;
+    }
+
+    // 値スタックの中身
+    // 定数のslot(負のoffset)にある値は元から入っているので読み飛ばす
+    uint32 local_cell_num = func->param_cell_num + func->local_cell_num;
+    RESTORE(cursor, frame->lp, sizeof(uint32) * local_cell_num);
+    for (uint32 i = 0; i < value_count; ++i) {
+        int16 slot = wasm_type_stack_slot(table, entry, i);
+        if (slot >= 0) {
+            RESTORE(cursor, frame->lp + slot, sizeof(uint32) * cells[i]);
+        }
+        else if (!wasm_image_cursor_skip(cursor, sizeof(uint32) * cells[i])) {
+            LOG_ERROR("truncated section in checkpoint image\n");
+            return -1;
+        }
+    }
+
+    // ラベルスタックはfast-interpでは使わないので読み飛ばす
+    uint32 ctrl_stack_size;
+    RESTORE(cursor, &ctrl_stack_size, sizeof(uint32));
+    if (!wasm_image_cursor_skip(cursor, sizeof(uint32) * 4 * (uint64)ctrl_stack_size)) {
+        LOG_ERROR("truncated section in checkpoint image\n");
+        return -1;
+    }
+    return 0;
+}
+#endif
+
+int
+read_program_counter(WASMImageReader *image, uint32 *fidx, uint32 *offset)
+{
+    WASMImageCursor cursor;
+
+    if (!wasm_image_reader_cursor(image, IMAGE_SECTION_PROGRAM_COUNTER, &cursor))
+        return -1;
+    RESTORE(&cursor, fidx, sizeof(uint32));
+    RESTORE(&cursor, offset, sizeof(uint32));
+    return 0;
+}
+
+static int
+read_thread_program_counter(uint32 *fidx, uint32 *offset)
+{
+    WASMImageCursor cursor;
+
+    if (!get_section(IMAGE_SECTION_PROGRAM_COUNTER, &cursor))
+        return -1;
+    RESTORE(&cursor, fidx, sizeof(uint32));
+    RESTORE(&cursor, offset, sizeof(uint32));
+    return 0;
 }
 
 WASMInterpFrame*
@@ -134,25 +575,80 @@ wasm_restore_stack(WASMExecEnv **_exec_env)
     WASMInterpFrame *frame, *prev_frame = wasm_exec_env_get_cur_frame(exec_env);
     frame = prev_frame;
     WASMFunctionInstance *function;
-    uint32 func_idx, frame_size, all_cell_num;
-    FILE *fp;
+    uint32 frame_size, all_cell_num;
+    WASMImageCursor cursor, record;
+    const uint8 **records;
+    uint32 *record_sizes;
 
     uint32 frame_stack_size;
-    fp = open_image("frame.img", "rb");
-    fread(&frame_stack_size, sizeof(uint32), 1, fp);
-    fclose(fp);
+    if (!get_section(IMAGE_SECTION_STACK, &cursor)
+        || !wasm_image_cursor_read(&cursor, &frame_stack_size, sizeof(uint32))
+        || frame_stack_size == 0) {
+        end_restore();
+        return NULL;
+    }
+    wasm_migration_stats_add_frames(frame_stack_size);
+
+#if WASM_ENABLE_FAST_INTERP != 0
+    uint32 pc_fidx, pc_offset;
+    if (read_thread_program_counter(&pc_fidx, &pc_offset) < 0) {
+        end_restore();
+        return NULL;
+    }
+#endif
+
+    // imageにはtopからbottomの順に並んでいるので、先に各frameの位置を集める
+    records = malloc(sizeof(uint8 *) * frame_stack_size);
+    record_sizes = malloc(sizeof(uint32) * frame_stack_size);
+    if (!records || !record_sizes) {
+        LOG_ERROR("failed to allocate memory for the frames of checkpoint "
+                  "image\n");
+        frame = NULL;
+        goto fail;
+    }
+    for (uint32 i = 0; i < frame_stack_size; ++i) {
+        if (!wasm_image_cursor_read(&cursor, &record_sizes[i], sizeof(uint32))
+            || record_sizes[i] < sizeof(uint32) * 3
+            || !(records[i] = wasm_image_cursor_skip(&cursor, record_sizes[i]))) {
+            LOG_ERROR("truncated stack section in checkpoint image\n");
+            frame = NULL;
+            goto fail;
+        }
+    }
 
-    char file[32];
     uint32 fidx = 0;
     for (uint32 i = frame_stack_size; i > 0; --i) {
-        sprintf(file, "stack%d.img", i);
-        fp = open_image(file, "rb");
+        record.p = records[i - 1];
+        record.end = record.p + record_sizes[i - 1];
 
-        fread(&fidx, sizeof(uint32), 1, fp);
+        if (!wasm_image_cursor_read(&record, &fidx, sizeof(uint32))
+            || fidx >= module_inst->e->function_count) {
+            LOG_ERROR("invalid function index in checkpoint image\n");
+            frame = NULL;
+            goto fail;
+        }
         // 関数からスタックサイズを計算し,ALLOC
         // 前のframe2のenter_func_idxが、このframe->functionに対応
         function = module_inst->e->functions + fidx;
 
+#if WASM_ENABLE_FAST_INTERP != 0
+        // lazy translationのmoduleでは、まだ呼ばれていない関数をここで変換する
+        char error_buf[128];
+        if (function->is_import_func
+            || !wasm_loader_translate_function(
+                module_inst->module,
+                fidx - module_inst->module->import_function_count, error_buf,
+                sizeof(error_buf))) {
+            LOG_ERROR("failed to translate function %u in checkpoint image: "
+                      "%s\n",
+                      fidx, function->is_import_func ? "import function"
+                                                     : error_buf);
+            frame = NULL;
+            goto fail;
+        }
+#endif
+
+#if WASM_ENABLE_FAST_INTERP == 0
         // TODO: uint64になってるけど、多分uint32
         all_cell_num = (uint32)function->param_cell_num
                         + (uint32)function->local_cell_num
@@ -160,76 +656,540 @@ wasm_restore_stack(WASMExecEnv **_exec_env)
                         + ((uint32)function->u.func->max_block_num)
                                 * sizeof(WASMBranchBlock) / 4
                         + (uint32)function->u.func->max_stack_cell_num;
+#else
+        all_cell_num = (uint32)function->u.func->const_cell_num
+                        + (uint32)function->param_cell_num
+                        + (uint32)function->local_cell_num
+                        + (uint32)function->u.func->max_stack_cell_num;
+#endif
         frame_size = wasm_interp_interp_frame_size(all_cell_num);
         frame = wasm_alloc_frame(exec_env, frame_size,
                             (WASMInterpFrame *)prev_frame);
+        if (!frame)
+            goto fail;
 
         // フレームをrestore
         frame->function = function;
-        _restore_stack(exec_env, frame, fp);
+#if WASM_ENABLE_FAST_INTERP == 0
+        if (_restore_stack(exec_env, frame, &record) < 0) {
+#else
+        // topのframeはprogram counter, それ以外は1つ上のframeのリターンアドレスで止まっている
+        uint32 offset_now;
+        if (i == 1)
+            offset_now = pc_offset;
+        else
+            memcpy(&offset_now, records[i - 2] + sizeof(uint32) * 2,
+                   sizeof(uint32));
+        if (_restore_stack(exec_env, frame, &record, offset_now, i == 1) < 0) {
+#endif
+            frame = NULL;
+            goto fail;
+        }
 
         prev_frame = frame;
-        fclose(fp);
     }
 
     wasm_exec_env_set_cur_frame(exec_env, frame);
     
     _exec_env = &exec_env;
 
+fail:
+    free(records);
+    free(record_sizes);
+    if (!frame)
+        end_restore();
     return frame;
 }
 
-void restore_dirty_memory(WASMMemoryInstance **memory, FILE* memory_fp) {
-    const int PAGE_SIZE = 4096;
-    while (!feof(memory_fp)) {
-        if (feof(memory_fp)) break;
-        uint32 offset;
-        uint32 len;
-        len = fread(&offset, sizeof(uint32), 1, memory_fp);
-        if (len == 0) break;
-        // printf("len: %d\n", len);
-        // printf("i: %d\n", offset);
+// linear memoryがmmapで全体を予約されている場合のみ、imageをその上にmapできる
+static bool
+can_map_memory_lazily(WASMMemoryInstance *memory)
+{
+#if defined(OS_ENABLE_HW_BOUND_CHECK) && WASM_MEM_ALLOC_WITH_USAGE == 0
+    return os_getpagesize() == WASM_IMAGE_PAGE_SIZE
+           && ((uintptr_t)memory->memory_data & (WASM_IMAGE_PAGE_SIZE - 1)) == 0;
+#else
+    (void)memory;
+    return false;
+#endif
+}
+
+static inline bool
+is_page_aligned(uint64 v)
+{
+    return (v & (WASM_IMAGE_PAGE_SIZE - 1)) == 0;
+}
+
+// 隣り合うZERO、lazyのDATA、POOLのextentは1つのrunにまとめて1回でmapする
+// extentはWASM_IMAGE_BLOCK_SIZEをまたがないので、まとめないとmapが多すぎる
+typedef struct MemoryMapRun {
+    uint32 kind;
+    uint64 offset;
+    uint64 size;
+    // DATAはimageのfile offset、POOLはpoolの先頭のpage id
+    uint64 source;
+} MemoryMapRun;
 
-        uint8* addr = (*memory)->memory_data + offset;
-        len = fread(addr, PAGE_SIZE, 1, memory_fp);
-        // printf("PAGESIZE: %d\n", len);
+typedef struct MemoryMapper {
+    WASMMemoryInstance *memory;
+    const WASMImageReader *image;
+    WASMPagePool *pool;
+    // falseならmapせずにコピーする. mapに失敗したらそれ以降もコピーする
+    bool enabled;
+    MemoryMapRun run;
+} MemoryMapper;
+
+static bool
+extends_map_run(const MemoryMapRun *run, uint32 kind, uint64 offset,
+                uint64 source)
+{
+    if (run->size == 0 || run->kind != kind
+        || run->offset + run->size != offset)
+        return false;
+    if (kind == IMAGE_EXTENT_DATA)
+        return run->source + run->size == source;
+    if (kind == IMAGE_EXTENT_POOL)
+        return run->source + run->size / WASM_PAGE_POOL_PAGE_SIZE == source;
+    return true;
+}
+
+// restore_extentsがmapするrunの数を、extentを適用する前に数える
+static uint64
+count_map_runs(WASMImageCursor extents, uint64 pages_offset, bool lazy)
+{
+    WASMImageMemoryExtent extent;
+    MemoryMapRun run = { 0 };
+    uint64 data_offset = 0, count = 0;
+
+    while (wasm_image_cursor_read(&extents, &extent, sizeof(extent))) {
+        uint64 source = extent.kind == IMAGE_EXTENT_POOL
+                            ? extent.data_size
+                            : pages_offset + data_offset;
+        if (extent.kind == IMAGE_EXTENT_ZERO
+            || extent.kind == IMAGE_EXTENT_POOL
+            || (extent.kind == IMAGE_EXTENT_DATA && lazy)) {
+            if (extends_map_run(&run, extent.kind, extent.offset, source))
+                run.size += extent.size;
+            else {
+                run = (MemoryMapRun){ extent.kind, extent.offset, extent.size,
+                                      source };
+                count++;
+            }
+        }
+        else
+            run.size = 0;
+        if (extent.kind == IMAGE_EXTENT_LZ4)
+            data_offset += extent.data_size;
+        else if (extent.kind == IMAGE_EXTENT_DATA)
+            data_offset += extent.size;
     }
+    return count;
 }
 
-int wasm_restore_memory(WASMModuleInstance *module, WASMMemoryInstance **memory, uint8** maddr) {
-    FILE* memory_fp = open_image("memory.img", "rb");
-    FILE* mem_size_fp = open_image("mem_page_count.img", "rb");
+// 予約の中にMAP_FIXEDでmapすると、runごとにmapが1つずつ増える
+// vm.max_map_countを超えるとmmapが失敗し始めるので、先に確かめる
+// 上限の半分に収まるなら、/proc/self/mapsは数えない
+static bool
+map_count_allows(uint64 run_count)
+{
+#if defined(__linux__)
+    static uint64 max_count = 0;
+    FILE *fp;
+    uint64 count = 0;
+    int c;
 
-    // restore page_count
-    uint32 page_count;
-    fread(&page_count, sizeof(uint32), 1, mem_size_fp);
-    wasm_enlarge_memory(module, page_count- (*memory)->cur_page_count);
-    *maddr = page_count * (*memory)->num_bytes_per_page;
+    if (max_count == 0) {
+        if (!(fp = fopen("/proc/sys/vm/max_map_count", "r")))
+            return true;
+        if (fscanf(fp, "%" SCNu64, &max_count) != 1)
+            max_count = 0;
+        fclose(fp);
+        if (max_count == 0)
+            return true;
+    }
+    if (run_count + 1 <= max_count / 2)
+        return true;
+    if (!(fp = fopen("/proc/self/maps", "r")))
+        return true;
+    while ((c = fgetc(fp)) != EOF) {
+        if (c == '\n')
+            count++;
+    }
+    fclose(fp);
+    if (count + run_count + 1 <= max_count)
+        return true;
+    LOG_WARNING("checkpoint memory needs %" PRIu64 " maps, more than "
+                "vm.max_map_count %" PRIu64 " allows, copy it instead\n",
+                run_count, max_count);
+    return false;
+#else
+    (void)run_count;
+    return true;
+#endif
+}
 
-    restore_dirty_memory(memory, memory_fp);
-    // restore memory_data
-    // fread((*memory)->memory_data, sizeof(uint8),
-    //         (*memory)->num_bytes_per_page * (*memory)->cur_page_count, memory_fp);
+static bool
+map_pages(MemoryMapper *mapper, uint8 *addr, uint64 size, int flags, int fd,
+          uint64 file_offset)
+{
+    if (!mapper->enabled)
+        return false;
+    if (mmap(addr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED | flags,
+             fd, (off_t)file_offset)
+        != MAP_FAILED)
+        return true;
+    LOG_WARNING("failed to map checkpoint memory, fall back to copy\n");
+    mapper->enabled = false;
+    return false;
+}
 
-    fclose(memory_fp);
-    fclose(mem_size_fp);
+static int
+flush_map_run(MemoryMapper *mapper)
+{
+    MemoryMapRun *run = &mapper->run;
+    uint8 *addr = mapper->memory->memory_data + run->offset;
+    uint64 size = run->size;
+
+    run->size = 0;
+    if (size == 0)
+        return 0;
+    switch (run->kind) {
+        case IMAGE_EXTENT_ZERO:
+            // anonymousのページで置き換えれば、触るまで物理メモリを使わない
+            if (!is_page_aligned(size)
+                || !map_pages(mapper, addr, size, MAP_ANONYMOUS, -1, 0))
+                memset(addr, 0, size);
+            return 0;
+        case IMAGE_EXTENT_DATA:
+            // MAP_PRIVATEなので書き込まれたページだけがコピーされる
+            if (!is_page_aligned(run->source) || !is_page_aligned(size)
+                || !map_pages(mapper, addr, size, 0, mapper->image->fd,
+                              run->source))
+                memcpy(addr, mapper->image->base + run->source, size);
+            return 0;
+        default:
+            // poolのページはfileのまま共有し、書き込まれたページだけがコピーされる
+            if (map_pages(mapper, addr, size, 0,
+                          wasm_page_pool_fd(mapper->pool),
+                          wasm_page_pool_offset(run->source))
+                || wasm_page_pool_read(mapper->pool, run->source,
+                                       size / WASM_PAGE_POOL_PAGE_SIZE, addr))
+                return 0;
+            LOG_ERROR("failed to read page pool\n");
+            return -1;
+    }
+}
+
+static int
+add_map_run(MemoryMapper *mapper, uint32 kind, uint64 offset, uint64 size,
+            uint64 source)
+{
+    if (extends_map_run(&mapper->run, kind, offset, source)) {
+        mapper->run.size += size;
+        return 0;
+    }
+    if (flush_map_run(mapper) < 0)
+        return -1;
+    mapper->run = (MemoryMapRun){ kind, offset, size, source };
     return 0;
 }
 
-int wasm_restore_global(const WASMModuleInstance *module, const WASMGlobalInstance *globals, uint8 **global_data, uint8 **global_addr) {
-    FILE* fp = open_image("global.img", "rb");
+// DATAのコピーとLZ4の展開は、blockごとのjobにして並列に行う
+typedef struct MemoryRestoreJob {
+    uint8 *dst;
+    const uint8 *src;
+    uint64 src_size;
+    uint64 size;
+    uint32 kind;
+} MemoryRestoreJob;
+
+typedef struct MemoryRestoreContext {
+    MemoryRestoreJob *jobs;
+    bh_atomic_32_t failed;
+} MemoryRestoreContext;
+
+static void
+restore_memory_job(void *ctx, uint32 index)
+{
+    MemoryRestoreContext *restore = ctx;
+    MemoryRestoreJob *job = &restore->jobs[index];
+
+    if (job->kind == IMAGE_EXTENT_DATA)
+        memcpy(job->dst, job->src, job->size);
+    else if (!wasm_image_decompress(job->src, job->src_size, job->dst,
+                                    job->size))
+        BH_ATOMIC_32_STORE(restore->failed, 1);
+}
+
+static bool
+add_restore_job(WASMImageBuffer *jobs, uint8 *dst, const uint8 *src,
+                uint64 src_size, uint64 size, uint32 kind)
+{
+    MemoryRestoreJob job = { dst, src, src_size, size, kind };
+    return wasm_image_buf_write(jobs, &job, sizeof(job));
+}
+
+// extentごとに、DATAはコピー(lazyならmap)、LZ4は展開、ZEROはゼロ埋めする
+static void
+run_restore_jobs(WASMImageBuffer *jobs, MemoryRestoreContext *restore)
+{
+    restore->jobs = (MemoryRestoreJob *)jobs->data;
+    wasm_image_run_parallel((uint32)(jobs->size / sizeof(MemoryRestoreJob)),
+                            restore_memory_job, restore);
+    jobs->size = 0;
+}
+
+static int
+restore_extents(WASMMemoryInstance *memory, WASMImageCursor *extents,
+                WASMImageReader *image,
+                const WASMImageSectionEntry *pages_entry, WASMPagePool *pool,
+                bool lazy)
+{
+    WASMImageMemoryExtent extent;
+    WASMImageBuffer jobs = { 0 };
+    MemoryRestoreContext restore = { 0 };
+    MemoryMapper mapper = { memory, image, pool, false, { 0 } };
+    uint64 data_offset = 0;
+    uint64 memory_size = memory->memory_data_size;
+    int rc = -1;
+
+    mapper.enabled =
+        can_map_memory_lazily(memory)
+        && map_count_allows(count_map_runs(*extents, pages_entry->offset, lazy));
+    lazy = lazy && mapper.enabled;
+
+    while (wasm_image_cursor_read(extents, &extent, sizeof(extent))) {
+        // ZEROとPOOLのextentはMEMORY_PAGESにデータを持たない
+        bool has_data = extent.kind != IMAGE_EXTENT_ZERO
+                        && extent.kind != IMAGE_EXTENT_POOL;
+        uint64 data_size = extent.kind == IMAGE_EXTENT_LZ4 ? extent.data_size
+                                                           : extent.size;
+        if (extent.offset > memory_size
+            || extent.size > memory_size - extent.offset
+            || (has_data && data_size > pages_entry->size - data_offset)) {
+            LOG_ERROR("memory extent out of range in checkpoint image\n");
+            goto fail;
+        }
+
+        uint8 *addr = memory->memory_data + extent.offset;
+        const uint8 *data = image->base + pages_entry->offset + data_offset;
+        uint64 data_end = pages_entry->offset + data_offset + data_size;
+        // streamでまだ届いていないページは、届いた分を適用してから受け取る
+        if (has_data && image->received < data_end) {
+            run_restore_jobs(&jobs, &restore);
+            if (!wasm_image_reader_wait(image, data_end))
+                goto fail;
+        }
+        switch (extent.kind) {
+            case IMAGE_EXTENT_ZERO:
+                if (add_map_run(&mapper, extent.kind, extent.offset,
+                                extent.size, 0)
+                    < 0)
+                    goto fail;
+                break;
+            case IMAGE_EXTENT_DATA:
+                if (lazy && mapper.enabled) {
+                    if (add_map_run(&mapper, extent.kind, extent.offset,
+                                    extent.size,
+                                    pages_entry->offset + data_offset)
+                        < 0)
+                        goto fail;
+                    break;
+                }
+                for (uint64 off = 0; off < extent.size;
+                     off += WASM_IMAGE_BLOCK_SIZE) {
+                    uint64 size = extent.size - off < WASM_IMAGE_BLOCK_SIZE
+                                      ? extent.size - off
+                                      : WASM_IMAGE_BLOCK_SIZE;
+                    if (!add_restore_job(&jobs, addr + off, data + off, size,
+                                         size, IMAGE_EXTENT_DATA))
+                        goto fail;
+                }
+                break;
+            case IMAGE_EXTENT_LZ4:
+                // 圧縮したページはlazyでもmapできないので展開する
+                if (!add_restore_job(&jobs, addr, data, data_size,
+                                     extent.size, IMAGE_EXTENT_LZ4))
+                    goto fail;
+                break;
+            case IMAGE_EXTENT_POOL:
+                if (!pool || !is_page_aligned(extent.offset)
+                    || !is_page_aligned(extent.size)
+                    || !wasm_page_pool_contains(
+                        pool, extent.data_size,
+                        extent.size / WASM_PAGE_POOL_PAGE_SIZE)) {
+                    LOG_ERROR("page pool extent out of range in checkpoint "
+                              "image\n");
+                    goto fail;
+                }
+                if (add_map_run(&mapper, extent.kind, extent.offset,
+                                extent.size, extent.data_size)
+                    < 0)
+                    goto fail;
+                break;
+            default:
+                LOG_ERROR("unknown memory extent kind %u\n", extent.kind);
+                goto fail;
+        }
+        if (has_data)
+            data_offset += data_size;
+    }
+
+    if (flush_map_run(&mapper) < 0)
+        goto fail;
+    run_restore_jobs(&jobs, &restore);
+    if (BH_ATOMIC_32_LOAD(restore.failed)) {
+        LOG_ERROR("corrupted memory extent in checkpoint image\n");
+        goto fail;
+    }
+    rc = 0;
+
+fail:
+    free(jobs.data);
+    return rc;
+}
 
-    for (int i = 0; i < module->e->global_count; i++) {
+// imageのextentをlinear memoryに適用する. lazyならできる限りmapする
+static int
+restore_memory_image(WASMMemoryInstance **memory, WASMImageReader *image,
+                     bool lazy)
+{
+    WASMImageCursor extents, pool_path;
+    const WASMImageSectionEntry *pages_entry;
+    WASMPagePool *pool = NULL;
+    bool stream = wasm_image_reader_is_stream(image);
+    int rc = -1;
+    // streamはfileとしてmapできない
+    lazy = lazy && !stream && can_map_memory_lazily(*memory);
+
+    if (!wasm_image_reader_cursor(image, IMAGE_SECTION_MEMORY_EXTENTS, &extents)
+        || !(pages_entry = wasm_image_reader_find(image, IMAGE_SECTION_MEMORY_PAGES)))
+        return -1;
+
+    // checksumを確認すると全ページを読み込んでしまうので、lazyの場合は確認しない
+    // streamは受け取りながら適用し、最後に確認する
+    if (!lazy && !stream
+        && !wasm_image_reader_get(image, IMAGE_SECTION_MEMORY_PAGES, NULL))
+        return -1;
+
+    // POOLのextentのページは、imageに書かれたpoolから読む
+    if (wasm_image_reader_find(image, IMAGE_SECTION_PAGE_POOL)) {
+        if (!wasm_image_reader_cursor(image, IMAGE_SECTION_PAGE_POOL,
+                                      &pool_path)
+            || pool_path.p == pool_path.end || pool_path.end[-1] != '\0')
+            return -1;
+        if (!(pool = wasm_page_pool_open((const char *)pool_path.p, false)))
+            return -1;
+    }
+
+    // mapしたページはpoolを閉じても残る
+    if (restore_extents(*memory, &extents, image, pages_entry, pool, lazy) == 0
+        && (!stream
+            || wasm_image_reader_get(image, IMAGE_SECTION_MEMORY_PAGES, NULL)))
+        rc = 0;
+    wasm_page_pool_close(pool);
+    return rc;
+}
+
+// pre-copyのimageを古い順に適用する
+// roundは最後のimageの隣にあるfileで、streamでは送られてこない
+static int
+restore_precopy_images(WASMMemoryInstance **memory, uint32 delta_count)
+{
+    const char *source = get_restore_source();
+    WASMImageReader delta;
+    char path[PATH_MAX];
+
+    if (delta_count > 0 && wasm_image_is_stream(source)) {
+        LOG_ERROR("%s refers to %u pre-copy images, which can't be restored "
+                  "from a stream\n",
+                  source, delta_count);
+        return -1;
+    }
+    for (uint32 i = 0; i < delta_count; i++) {
+        if (!wasm_image_precopy_path(source, i, path, sizeof(path))
+            || !wasm_image_reader_open(&delta, path))
+            return -1;
+        wasm_migration_stats_add_read(delta.size);
+        if (restore_memory_image(memory, &delta, restore_lazy) < 0) {
+            wasm_image_reader_close(&delta);
+            return -1;
+        }
+        wasm_image_reader_close(&delta);
+    }
+    return 0;
+}
+
+uint32
+wasm_restore_get_page_count()
+{
+    WASMImageReader *image;
+    WASMImageCursor meta;
+    uint32 page_count;
+
+    if (instantiating_snapshot)
+        return snapshot_page_count;
+    if (!(image = get_restore_image())
+        || !wasm_image_reader_cursor(image, IMAGE_SECTION_MEMORY_META, &meta)
+        || !wasm_image_cursor_read(&meta, &page_count, sizeof(uint32)))
+        return 0;
+    return page_count;
+}
+
+int wasm_restore_memory(WASMModuleInstance *module, WASMMemoryInstance **memory, uint8** maddr) {
+    WASMImageReader *image = get_restore_image();
+    WASMImageCursor meta;
+
+    if (!image
+        || !wasm_image_reader_cursor(image, IMAGE_SECTION_MEMORY_META, &meta))
+        return -1;
+
+    // restore page_count
+    uint32 page_count, delta_count;
+    RESTORE(&meta, &page_count, sizeof(uint32));
+    RESTORE(&meta, &delta_count, sizeof(uint32));
+    // linear memoryは縮まないので、imageのページ数はinstanceの今のページ数以上になる
+    // max_page_countを超えるimageはinstantiateでも合わせていない
+    if (page_count < (*memory)->cur_page_count
+        || page_count > (*memory)->max_page_count) {
+        LOG_ERROR("checkpoint image has %u pages, the memory has %u of at "
+                  "most %u pages\n",
+                  page_count, (*memory)->cur_page_count,
+                  (*memory)->max_page_count);
+        return -1;
+    }
+    if (page_count > (*memory)->cur_page_count
+        && !wasm_enlarge_memory(module,
+                                page_count - (*memory)->cur_page_count)) {
+        LOG_ERROR("failed to enlarge memory to %u pages\n", page_count);
+        return -1;
+    }
+    // maddrはメモリアクセスのたびに計算し直されるので、先頭を指しておく
+    *maddr = (*memory)->memory_data;
+
+    if (restore_precopy_images(memory, delta_count) < 0)
+        return -1;
+
+    wasm_migration_stats_add_read(image->size);
+    return restore_memory_image(memory, image, restore_lazy);
+}
+
+static int
+restore_globals(WASMImageCursor *cursor, const WASMModuleInstance *module,
+                const WASMGlobalInstance *globals, uint8 *global_data,
+                uint8 **global_addr)
+{
+    for (uint32 i = 0; i < module->e->global_count; i++) {
         switch (globals[i].type) {
             case VALUE_TYPE_I32:
             case VALUE_TYPE_F32:
-                *global_addr = get_global_addr_for_migration(*global_data, globals + i);
-                fread(*global_addr, sizeof(uint32), 1, fp);
+                *global_addr = get_global_addr_for_migration(global_data, globals + i);
+                RESTORE(cursor, *global_addr, sizeof(uint32));
                 break;
             case VALUE_TYPE_I64:
             case VALUE_TYPE_F64:
-                *global_addr = get_global_addr_for_migration(*global_data, globals + i);
-                fread(*global_addr, sizeof(uint64), 1, fp);
+                *global_addr = get_global_addr_for_migration(global_data, globals + i);
+                RESTORE(cursor, *global_addr, sizeof(uint64));
                 break;
             default:
                 perror("wasm_restore_global:type error:A\n");
@@ -237,22 +1197,90 @@ int wasm_restore_global(const WASMModuleInstance *module, const WASMGlobalInstan
         }
     }
 
-    fclose(fp);
     return 0;
 }
 
+int wasm_restore_global(const WASMModuleInstance *module, const WASMGlobalInstance *globals, uint8 **global_data, uint8 **global_addr) {
+    WASMImageCursor cursor;
+
+    if (!get_section(IMAGE_SECTION_GLOBAL, &cursor))
+        return -1;
+
+    return restore_globals(&cursor, module, globals, *global_data, global_addr);
+}
+
+/* snapshot */
+void
+wasm_restore_begin_snapshot(uint32 page_count)
+{
+    instantiating_snapshot = true;
+    snapshot_page_count = page_count;
+}
+
+void
+wasm_restore_end_snapshot()
+{
+    instantiating_snapshot = false;
+    snapshot_page_count = 0;
+}
+
+bool
+wasm_restore_skips_init()
+{
+    return restore_flag || instantiating_snapshot;
+}
+
+int
+wasm_restore_snapshot(WASMModuleInstance *module, WASMImageReader *image,
+                      uint32 page_count)
+{
+    WASMMemoryInstance *memory =
+        module->memory_count > 0 ? module->memories[0] : NULL;
+    WASMImageCursor cursor;
+    uint8 *global_addr;
+
+    if (memory) {
+        // instantiateでページ数を合わせられなかった場合だけ増やす
+        if (page_count > memory->cur_page_count
+            && !wasm_enlarge_memory(module,
+                                    page_count - memory->cur_page_count))
+            return -1;
+        // 全instanceが同じfileをMAP_PRIVATEでmapし、書いたページだけコピーされる
+        if (restore_memory_image(&memory, image, true) < 0)
+            return -1;
+    }
+
+#if WASM_ENABLE_AOT != 0
+    if (module->module_type == Wasm_Module_AoT)
+        return aot_checkpoint_restore_global(module, image);
+#endif
+    if (!wasm_image_reader_cursor(image, IMAGE_SECTION_GLOBAL, &cursor))
+        return -1;
+    return restore_globals(&cursor, module, module->e->globals,
+                           module->global_data, &global_addr);
+}
+
 
 int wasm_restore_program_counter(
     WASMModuleInstance *module,
     uint8 **frame_ip)
 {
-    FILE* fp = open_image("program_counter.img", "rb");
-
     uint32 fidx, offset;
-    fread(&fidx, sizeof(uint32), 1, fp);
-    fread(&offset, sizeof(uint32), 1, fp);
 
-    *frame_ip = wasm_get_func_code(module->e->functions + fidx) + offset;
+    if (read_thread_program_counter(&fidx, &offset) < 0
+        || fidx >= module->e->function_count)
+        return -1;
+
+    WASMFunctionInstance *func = module->e->functions + fidx;
+#if WASM_ENABLE_FAST_INTERP == 0
+    *frame_ip = wasm_get_func_code(func) + offset;
+#else
+    const WASMTypeStackEntry *entry =
+        wasm_type_stack_lookup(&func->u.func->type_stack_table, offset, false);
+    if (!entry)
+        return -1;
+    *frame_ip = wasm_get_func_code(func) + entry->compiled_offset;
+#endif
 
     return 0;
 }
@@ -277,26 +1305,63 @@ int wasm_restore(WASMModuleInstance **module,
             bool *done_flag)
 {
     struct timespec ts1, ts2;
+    int rc;
+    bool is_thread = is_restoring_thread();
+
     // restore memory
-    clock_gettime(CLOCK_MONOTONIC, &ts1);
-    wasm_restore_memory(*module, memory, maddr);
-    clock_gettime(CLOCK_MONOTONIC, &ts2);
-    fprintf(stderr, "memory, %lu\n", get_time(ts1, ts2));
-    // printf("Success to restore linear memory\n");
+    // 共有しているmemoryはmainのthreadが戻す
+    if (!is_thread) {
+        clock_gettime(CLOCK_MONOTONIC, &ts1);
+        rc = wasm_restore_memory(*module, memory, maddr);
+        clock_gettime(CLOCK_MONOTONIC, &ts2);
+        wasm_migration_stats_phase(WASM_MIGRATION_PHASE_MEMORY,
+                                   get_time(ts1, ts2));
+        if (rc < 0) {
+            LOG_ERROR("Failed to restore linear memory\n");
+            goto fail;
+        }
+    }
 
     // restore globals
     clock_gettime(CLOCK_MONOTONIC, &ts1);
-    wasm_restore_global(*module, *globals, global_data, global_addr);
+    rc = wasm_restore_global(*module, *globals, global_data, global_addr);
     clock_gettime(CLOCK_MONOTONIC, &ts2);
-    fprintf(stderr, "global, %lu\n", get_time(ts1, ts2));
-    // printf("Success to restore globals\n");
+    wasm_migration_stats_phase(WASM_MIGRATION_PHASE_GLOBAL,
+                               get_time(ts1, ts2));
+    if (rc < 0) {
+        LOG_ERROR("Failed to restore globals\n");
+        goto fail;
+    }
 
     // restore program counter
     clock_gettime(CLOCK_MONOTONIC, &ts1);
-    wasm_restore_program_counter(*module, frame_ip);
+    rc = wasm_restore_program_counter(*module, frame_ip);
     clock_gettime(CLOCK_MONOTONIC, &ts2);
-    fprintf(stderr, "program counter, %lu\n", get_time(ts1, ts2));
-    // printf("Success to program counter\n");
+    wasm_migration_stats_phase(WASM_MIGRATION_PHASE_PROGRAM_COUNTER,
+                               get_time(ts1, ts2));
+    if (rc < 0) {
+        LOG_ERROR("Failed to restore program counter\n");
+        goto fail;
+    }
 
-    return 0;
+    // restore threads
+    if (!is_thread) {
+        wasm_migration_stats_add_threads(1);
+        clock_gettime(CLOCK_MONOTONIC, &ts1);
+        rc = restore_threads_of_image(*exec_env);
+        clock_gettime(CLOCK_MONOTONIC, &ts2);
+        wasm_migration_stats_phase(WASM_MIGRATION_PHASE_THREADS,
+                                   get_time(ts1, ts2));
+        if (rc < 0) {
+            LOG_ERROR("Failed to restore threads\n");
+            goto fail;
+        }
+    }
+
+fail:
+    end_restore();
+    // respawnしたthreadはmainのthreadのrestoreの一部として数える
+    if (!is_thread)
+        wasm_migration_stats_end(rc == 0);
+    return rc;
 }
\ No newline at end of file
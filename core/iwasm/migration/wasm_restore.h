@@ -3,10 +3,56 @@
 
 #include "../common/wasm_exec_env.h"
 #include "../interpreter/wasm_interp.h"
+#include "wasm_image.h"
 
 void set_restore_flag(bool f);
 bool get_restore_flag();
 
+void set_restore_lazy(bool f);
+bool get_restore_lazy();
+
+/* Where the image is restored from, see wasm_image_is_stream. Defaults to
+   checkpoint.img. */
+void set_restore_source(const char *source);
+
+/* The image being restored, opened on first use */
+WASMImageReader *get_restore_image();
+void close_restore_image();
+
+/* Whether the exec_env is of a thread respawned from the image, its frames
+   are restored instead of calling the start function. The main thread
+   restores the memory and respawns the threads. */
+bool wasm_restore_begin_thread(WASMExecEnv *exec_env);
+
+/* Whether wasm_runtime_restore_instance has set an image for the instance
+   of exec_env. The image is then restored instead of the process wide one
+   by this thread, and the instance doesn't restore it again. */
+bool wasm_restore_begin_instance(WASMExecEnv *exec_env);
+
+int read_program_counter(WASMImageReader *image, uint32 *fidx, uint32 *offset);
+
+/* Page count of the linear memory recorded in the image, 0 if the image
+   can't be read. The memory is instantiated with this many pages. */
+uint32 wasm_restore_get_page_count();
+
+int wasm_restore_memory(WASMModuleInstance *module, WASMMemoryInstance **memory, uint8** maddr);
+
+/* Instantiation of a snapshot, see wasm_runtime_instantiate_from_snapshot.
+   Between these the instance being instantiated by this thread gets
+   page_count pages of linear memory and is not initialized. */
+void wasm_restore_begin_snapshot(uint32 page_count);
+void wasm_restore_end_snapshot();
+
+/* Whether the main instance being instantiated is overwritten by an image
+   afterwards, so that its memory, globals and start function are skipped */
+bool wasm_restore_skips_init();
+
+/* Restore the linear memory and the globals of a snapshot into a fresh
+   instance. The pages are mapped copy-on-write from the image file when
+   the memory allows it, or copied. */
+int wasm_restore_snapshot(WASMModuleInstance *module, WASMImageReader *image,
+                          uint32 page_count);
+
 WASMInterpFrame*
 wasm_restore_stack(WASMExecEnv **exec_env);
 
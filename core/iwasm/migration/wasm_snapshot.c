@@ -0,0 +1,174 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../common/wasm_runtime_common.h"
+#include "../interpreter/wasm_runtime.h"
+#include "wasm_migration.h"
+#include "wasm_dump.h"
+#include "wasm_restore.h"
+#include "wasm_image.h"
+#include "wasm_migration_stats.h"
+
+// 初期化済みのinstanceのimage. 読み込んだimageを全instanceで共有する
+typedef struct WASMSnapshot {
+    WASMImageReader image;
+    uint32 page_count;
+} WASMSnapshot;
+
+static void
+set_error_buf(char *error_buf, uint32 error_buf_size, const char *string)
+{
+    if (error_buf != NULL)
+        snprintf(error_buf, error_buf_size, "%s", string);
+}
+
+static bool
+call_init_func(WASMModuleInstanceCommon *module_inst, const char *init_func)
+{
+    WASMFunctionInstanceCommon *func;
+    WASMExecEnv *exec_env;
+    wasm_val_t *results = NULL;
+    uint32 result_count;
+    bool ret;
+
+    if (!(func = wasm_runtime_lookup_function(module_inst, init_func))) {
+        LOG_ERROR("snapshot init function %s not found\n", init_func);
+        return false;
+    }
+    if (wasm_func_get_param_count(func, module_inst) > 0) {
+        LOG_ERROR("snapshot init function %s takes parameters\n", init_func);
+        return false;
+    }
+    if (!(exec_env = wasm_runtime_get_exec_env_singleton(module_inst)))
+        return false;
+
+    // 戻り値は使わない
+    result_count = wasm_func_get_result_count(func, module_inst);
+    if (result_count > 0
+        && !(results = calloc(result_count, sizeof(wasm_val_t))))
+        return false;
+    ret = wasm_runtime_call_wasm_a(exec_env, func, result_count, results, 0,
+                                   NULL);
+    free(results);
+    if (!ret)
+        LOG_ERROR("snapshot init function %s failed: %s\n", init_func,
+                  wasm_runtime_get_exception(module_inst));
+    return ret;
+}
+
+bool
+wasm_runtime_create_snapshot(WASMModuleInstanceCommon *module_inst,
+                             const char *init_func, const char *path)
+{
+    struct timespec ts1, ts2;
+    int rc;
+
+    if (init_func && !call_init_func(module_inst, init_func))
+        return false;
+
+    wasm_migration_stats_begin(WASM_MIGRATION_SNAPSHOT);
+    clock_gettime(CLOCK_MONOTONIC, &ts1);
+    rc = wasm_dump_snapshot((WASMModuleInstance *)module_inst,
+                            path ? path : WASM_IMAGE_DEFAULT_FILE);
+    clock_gettime(CLOCK_MONOTONIC, &ts2);
+    // memoryとglobalを集めて書くまでを1つのphaseとして数える
+    wasm_migration_stats_phase(WASM_MIGRATION_PHASE_WRITE, get_time(ts1, ts2));
+    wasm_migration_stats_end(rc == 0);
+    return rc == 0;
+}
+
+WASMSnapshot *
+wasm_runtime_load_snapshot(const char *path, char *error_buf,
+                           uint32 error_buf_size)
+{
+    WASMSnapshot *snapshot;
+    WASMImageCursor meta;
+
+    if (!(snapshot = calloc(1, sizeof(WASMSnapshot)))) {
+        set_error_buf(error_buf, error_buf_size, "allocate memory failed");
+        return NULL;
+    }
+    if (!wasm_image_reader_open(&snapshot->image,
+                                path ? path : WASM_IMAGE_DEFAULT_FILE)) {
+        set_error_buf(error_buf, error_buf_size,
+                      "failed to open snapshot image");
+        free(snapshot);
+        return NULL;
+    }
+
+    // 実行中のcheckpointのimageからは、frameを戻さないinstanceは作れない
+    if (wasm_image_reader_find(&snapshot->image, IMAGE_SECTION_STACK)) {
+        set_error_buf(error_buf, error_buf_size,
+                      "checkpoint image of a running instance is not a "
+                      "snapshot");
+        goto fail;
+    }
+
+    // checksumはここで一度だけ確かめ、instantiateのたびには読まない
+    if (!wasm_image_reader_get(&snapshot->image, IMAGE_SECTION_GLOBAL, NULL)
+        || (wasm_image_reader_find(&snapshot->image, IMAGE_SECTION_MEMORY_META)
+            && (!wasm_image_reader_get(&snapshot->image,
+                                       IMAGE_SECTION_MEMORY_EXTENTS, NULL)
+                || !wasm_image_reader_get(&snapshot->image,
+                                          IMAGE_SECTION_MEMORY_PAGES, NULL)
+                || !wasm_image_reader_cursor(&snapshot->image,
+                                             IMAGE_SECTION_MEMORY_META, &meta)
+                || !wasm_image_cursor_read(&meta, &snapshot->page_count,
+                                           sizeof(uint32))))) {
+        set_error_buf(error_buf, error_buf_size, "corrupted snapshot image");
+        goto fail;
+    }
+    return snapshot;
+
+fail:
+    wasm_image_reader_close(&snapshot->image);
+    free(snapshot);
+    return NULL;
+}
+
+void
+wasm_runtime_unload_snapshot(WASMSnapshot *snapshot)
+{
+    if (!snapshot)
+        return;
+    // mapしたinstanceのページはfileを参照し続けるので、閉じてもよい
+    wasm_image_reader_close(&snapshot->image);
+    free(snapshot);
+}
+
+WASMModuleInstanceCommon *
+wasm_runtime_instantiate_from_snapshot(WASMModuleCommon *module,
+                                       WASMSnapshot *snapshot,
+                                       uint32 stack_size, uint32 heap_size,
+                                       char *error_buf, uint32 error_buf_size)
+{
+    WASMModuleInstanceCommon *module_inst;
+    struct timespec ts1, ts2;
+    int rc;
+
+    // imageで上書きするmemoryとglobalは初期化せず、start functionも呼ばない
+    wasm_restore_begin_snapshot(snapshot->page_count);
+    module_inst = wasm_runtime_instantiate(module, stack_size, heap_size,
+                                           error_buf, error_buf_size);
+    wasm_restore_end_snapshot();
+    if (!module_inst)
+        return NULL;
+
+    wasm_migration_stats_begin(WASM_MIGRATION_RESTORE);
+    wasm_migration_stats_add_read(snapshot->image.size);
+    clock_gettime(CLOCK_MONOTONIC, &ts1);
+    rc = wasm_restore_snapshot((WASMModuleInstance *)module_inst,
+                               &snapshot->image, snapshot->page_count);
+    clock_gettime(CLOCK_MONOTONIC, &ts2);
+    // globalもmemoryと一緒に戻すので、MEMORYに数える
+    wasm_migration_stats_phase(WASM_MIGRATION_PHASE_MEMORY, get_time(ts1, ts2));
+    wasm_migration_stats_end(rc >= 0);
+    if (rc < 0) {
+        set_error_buf(error_buf, error_buf_size,
+                      "failed to restore snapshot image");
+        wasm_runtime_deinstantiate(module_inst);
+        return NULL;
+    }
+    return module_inst;
+}
@@ -0,0 +1,68 @@
+#include "wasm_type_stack.h"
+
+// offset以上の最初のentryを二分探索する
+static uint32
+lower_bound(const WASMTypeStackEntry *entries, uint32 count, uint32 offset)
+{
+    uint32 low = 0, high = count, mid;
+
+    while (low < high) {
+        mid = low + (high - low) / 2;
+        if (entries[mid].offset < offset)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    return low;
+}
+
+const WASMTypeStackEntry *
+wasm_type_stack_lookup(const WASMTypeStackTable *table, uint32 offset,
+                       bool is_return_address)
+{
+    const WASMTypeStackEntry *entries =
+        is_return_address ? table->return_entries : table->entries;
+    uint32 count = is_return_address ? table->return_entry_count
+                                     : table->entry_count;
+    uint32 i = lower_bound(entries, count, offset);
+
+    if (i == count || entries[i].offset != offset)
+        return NULL;
+    return entries + i;
+}
+
+uint32
+wasm_type_stack_instr_index(const WASMTypeStackTable *table, uint32 offset)
+{
+    uint32 index = 0, i;
+
+    // offsetより前の命令の先頭を数える. loaderがpatchしたNOPは次の命令と同じindexになる
+    for (i = 0; i < offset; i++)
+        index += wasm_type_stack_is_instr(table, i);
+    return index;
+}
+
+#if WASM_ENABLE_FAST_INTERP != 0
+const WASMTypeStackEntry *
+wasm_type_stack_lookup_compiled(const WASMTypeStackTable *table,
+                                uint32 compiled_offset, bool is_return_address)
+{
+    const WASMTypeStackEntry *entries =
+        is_return_address ? table->return_entries : table->entries;
+    uint32 count = is_return_address ? table->return_entry_count
+                                     : table->entry_count;
+    uint32 low = 0, high = count, mid;
+
+    // compiled_offsetもoffset順に単調増加なので、compiled_offsetより大きい最初のentryの1つ前
+    while (low < high) {
+        mid = low + (high - low) / 2;
+        if (entries[mid].compiled_offset <= compiled_offset)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    if (low == 0 || entries[low - 1].compiled_offset != compiled_offset)
+        return NULL;
+    return entries + low - 1;
+}
+#endif
@@ -0,0 +1,77 @@
+#ifndef _WASM_TYPE_STACK_H
+#define _WASM_TYPE_STACK_H
+
+#include "../interpreter/wasm.h"
+
+/* Find the entry of the safepoint at the bytecode offset, NULL if the
+   offset is not a safepoint */
+const WASMTypeStackEntry *
+wasm_type_stack_lookup(const WASMTypeStackTable *table, uint32 offset,
+                       bool is_return_address);
+
+/* Index of the instruction at the bytecode offset, i.e. the number of the
+   instructions of the original bytecode before it. The instruction
+   boundaries are recorded by the loader, so the function body is not
+   decoded again. */
+uint32
+wasm_type_stack_instr_index(const WASMTypeStackTable *table, uint32 offset);
+
+/* Whether an instruction of the original bytecode starts at offset */
+static inline bool
+wasm_type_stack_is_instr(const WASMTypeStackTable *table, uint32 offset)
+{
+    return (table->instr_starts[offset / 8] >> (offset % 8)) & 1;
+}
+
+#if WASM_ENABLE_FAST_INTERP != 0
+/* Find the entry of a position in the compiled code. Several instructions
+   may emit no code and share a compiled offset, the last of them describes
+   the state the next compiled instruction runs on. NULL if the position is
+   not the start of an instruction of the original bytecode. */
+const WASMTypeStackEntry *
+wasm_type_stack_lookup_compiled(const WASMTypeStackTable *table,
+                                uint32 compiled_offset, bool is_return_address);
+#endif
+
+static inline uint32
+wasm_type_stack_value_count(const WASMTypeStackTable *table,
+                            const WASMTypeStackEntry *entry)
+{
+    uint32 value_count;
+    memcpy(&value_count, table->stacks + entry->stack, sizeof(uint32));
+    return value_count;
+}
+
+/* cell num of each value from the bottom */
+static inline const uint8 *
+wasm_type_stack_cells(const WASMTypeStackTable *table,
+                      const WASMTypeStackEntry *entry)
+{
+    return table->stacks + entry->stack + sizeof(uint32);
+}
+
+#if WASM_ENABLE_FAST_INTERP != 0
+/* slot of the i-th value from the frame lp */
+static inline int16
+wasm_type_stack_slot(const WASMTypeStackTable *table,
+                     const WASMTypeStackEntry *entry, uint32 i)
+{
+    uint32 value_count = wasm_type_stack_value_count(table, entry);
+    int16 slot;
+    memcpy(&slot,
+           wasm_type_stack_cells(table, entry) + value_count
+               + sizeof(int16) * i,
+           sizeof(int16));
+    return slot;
+}
+
+static inline const uint32 *
+wasm_type_stack_blocks(const WASMTypeStackTable *table,
+                       const WASMTypeStackEntry *entry, uint32 *count)
+{
+    *count = table->blocks[entry->blocks];
+    return table->blocks + entry->blocks + 1;
+}
+#endif
+
+#endif // _WASM_TYPE_STACK_H
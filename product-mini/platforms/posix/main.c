@@ -10,6 +10,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <sys/time.h>
 
 #include "bh_platform.h"
 #include "bh_read_file.h"
@@ -26,12 +27,26 @@
 static int app_argc;
 static char **app_argv;
 
+#if WASM_ENABLE_MIGRATION != 0
 void
 wasm_interp_sigint(int signum)
 {
     wasm_runtime_checkpoint();
 }
 
+void
+wasm_interp_sigusr1(int signum)
+{
+    wasm_runtime_checkpoint_precopy();
+}
+
+void
+wasm_interp_snapshot(int signum)
+{
+    wasm_runtime_checkpoint_snapshot();
+}
+#endif
+
 /* clang-format off */
 static int
 print_help()
@@ -62,6 +77,12 @@ print_help()
     printf("  --jit-codecache-size=n   Set fast jit maximum code cache size in bytes,\n");
     printf("                           default is %u KB\n", FAST_JIT_DEFAULT_CODE_CACHE_SIZE / 1024);
 #endif
+#if WASM_ENABLE_FAST_INTERP != 0
+    printf("  --loader-threads=n       Validate and translate the functions of the wasm app\n");
+    printf("                           with n threads, default is 1\n");
+    printf("  --lazy-translation       Translate each function of the wasm app on its\n");
+    printf("                           first call instead of at load time\n");
+#endif
 #if WASM_ENABLE_GC != 0
     printf("  --gc-heap-size=n         Set maximum gc heap size in bytes,\n");
     printf("                           default is %u KB\n", GC_HEAP_SIZE_DEFAULT / 1024);
@@ -113,7 +134,34 @@ print_help()
 #if WASM_ENABLE_STATIC_PGO != 0
     printf("  --gen-prof-file=<path>   Generate LLVM PGO (Profile-Guided Optimization) profile file\n");
 #endif
-    printf("  --restore                Restore from frame.img and interp.img\n");
+#if WASM_ENABLE_MIGRATION != 0
+    printf("  --restore                Restore from checkpoint.img\n");
+    printf("  --restore-lazy           Restore from checkpoint.img, mapping the saved linear\n"
+           "                           memory copy-on-write so pages are loaded on first access\n");
+    printf("  --snapshot-interval=ms   Write checkpoint.img every ms milliseconds from a forked\n"
+           "                           process while execution continues, SIGUSR2 also takes one\n");
+    printf("  --checkpoint-to=target   Write the checkpoint image to target instead of\n"
+           "                           checkpoint.img: fd:N, unix:/path or a file path\n");
+    printf("  --restore-from=source    Restore from source instead of checkpoint.img, a\n"
+           "                           unix:/path source listens for --checkpoint-to\n");
+    printf("  --checkpoint-compress    Compress the linear memory in checkpoint.img\n");
+    printf("  --checkpoint-page-pool=path\n"
+           "                           Store each distinct linear memory page once in the\n"
+           "                           shared page pool at path, checkpoint.img refers to it\n");
+    printf("  --checkpoint-threads=n   Dump and restore the linear memory with n threads,\n"
+           "                           default is the number of online CPUs\n");
+    printf("  --checkpoint-async       Write the pre-copy images and the instance checkpoints\n"
+           "                           on a background thread while execution continues,\n"
+           "                           the final checkpoint waits for them before exiting\n");
+    printf("  --checkpoint-direct-io   Write the checkpoint images with O_DIRECT\n");
+    printf("  --checkpoint-sync        fdatasync the checkpoint images before renaming them\n");
+    printf("  --snapshot-init=func     Call the exported func and write the initialized instance\n"
+           "                           to checkpoint.img or --checkpoint-to, then exit\n");
+    printf("  --from-snapshot=path     Instantiate from a snapshot written by --snapshot-init,\n"
+           "                           skipping the start function\n");
+    printf("  --migration-stats-fd=n   Write the statistics of each checkpoint and restore to\n"
+           "                           the file descriptor n, one JSON object per line\n");
+#endif
     printf("  --version                Show version information\n");
     return 1;
 }
@@ -574,8 +622,15 @@ main(int argc, char *argv[])
     clock_gettime(CLOCK_MONOTONIC, &ts1);
     // fprintf(stderr, "boot_start, %lu\n", (uint64_t)(ts1.tv_sec*1e9) + ts1.tv_nsec);
 
+#if WASM_ENABLE_MIGRATION != 0
     // signal handler for checkpoint
     signal(SIGINT, &wasm_interp_sigint);
+    // signal handler for pre-copy round
+    signal(SIGUSR1, &wasm_interp_sigusr1);
+    // signal handler for snapshot, the timer of --snapshot-interval too
+    signal(SIGUSR2, &wasm_interp_snapshot);
+    signal(SIGALRM, &wasm_interp_snapshot);
+#endif
 
     int32 ret = -1;
     char *wasm_file = NULL;
@@ -584,6 +639,22 @@ main(int argc, char *argv[])
     uint32 wasm_file_size;
     uint32 stack_size = 64 * 1024;
     bool restore_flag = false;
+    bool restore_lazy = false;
+#if WASM_ENABLE_MIGRATION != 0
+    uint32 snapshot_interval = 0;
+    const char *checkpoint_target = NULL;
+    const char *restore_source = NULL;
+    bool checkpoint_compress = false;
+    uint32 checkpoint_threads = 0;
+    const char *checkpoint_page_pool = NULL;
+    bool checkpoint_async = false;
+    bool checkpoint_direct_io = false;
+    bool checkpoint_sync = false;
+    const char *snapshot_init = NULL;
+    const char *snapshot_path = NULL;
+    wasm_snapshot_t snapshot = NULL;
+    int migration_stats_fd = -1;
+#endif
 #if WASM_ENABLE_LIBC_WASI != 0
     uint32 heap_size = 0;
 #else
@@ -592,6 +663,10 @@ main(int argc, char *argv[])
 #if WASM_ENABLE_FAST_JIT != 0
     uint32 jit_code_cache_size = FAST_JIT_DEFAULT_CODE_CACHE_SIZE;
 #endif
+#if WASM_ENABLE_FAST_INTERP != 0
+    uint32 loader_threads = 0;
+    bool lazy_translation = false;
+#endif
 #if WASM_ENABLE_GC != 0
     uint32 gc_heap_size = GC_HEAP_SIZE_DEFAULT;
 #endif
@@ -702,6 +777,16 @@ main(int argc, char *argv[])
             jit_code_cache_size = atoi(argv[0] + 21);
         }
 #endif
+#if WASM_ENABLE_FAST_INTERP != 0
+        else if (!strncmp(argv[0], "--loader-threads=", 17)) {
+            if (argv[0][17] == '\0')
+                return print_help();
+            loader_threads = atoi(argv[0] + 17);
+        }
+        else if (!strcmp(argv[0], "--lazy-translation")) {
+            lazy_translation = true;
+        }
+#endif
 #if WASM_ENABLE_GC != 0
         else if (!strncmp(argv[0], "--gc-heap-size=", 15)) {
             if (argv[0][15] == '\0')
@@ -810,9 +895,67 @@ main(int argc, char *argv[])
             gen_prof_file = argv[0] + 16;
         }
 #endif
+#if WASM_ENABLE_MIGRATION != 0
+        else if (!strncmp(argv[0], "--restore-from=", 15)) {
+            if (argv[0][15] == '\0')
+                return print_help();
+            restore_source = argv[0] + 15;
+        }
+        else if (!strncmp(argv[0], "--checkpoint-to=", 16)) {
+            if (argv[0][16] == '\0')
+                return print_help();
+            checkpoint_target = argv[0] + 16;
+        }
+        else if (!strcmp(argv[0], "--restore-lazy")) {
+           restore_flag = true;
+           restore_lazy = true;
+        }
         else if (!strncmp(argv[0], "--restore", 9)) {
            restore_flag = true;
         }
+        else if (!strncmp(argv[0], "--snapshot-interval=", 20)) {
+            if (argv[0][20] == '\0')
+                return print_help();
+            snapshot_interval = atoi(argv[0] + 20);
+        }
+        else if (!strcmp(argv[0], "--checkpoint-compress")) {
+            checkpoint_compress = true;
+        }
+        else if (!strncmp(argv[0], "--checkpoint-page-pool=", 23)) {
+            if (argv[0][23] == '\0')
+                return print_help();
+            checkpoint_page_pool = argv[0] + 23;
+        }
+        else if (!strncmp(argv[0], "--checkpoint-threads=", 21)) {
+            if (argv[0][21] == '\0')
+                return print_help();
+            checkpoint_threads = atoi(argv[0] + 21);
+        }
+        else if (!strcmp(argv[0], "--checkpoint-async")) {
+            checkpoint_async = true;
+        }
+        else if (!strcmp(argv[0], "--checkpoint-direct-io")) {
+            checkpoint_direct_io = true;
+        }
+        else if (!strcmp(argv[0], "--checkpoint-sync")) {
+            checkpoint_sync = true;
+        }
+        else if (!strncmp(argv[0], "--snapshot-init=", 16)) {
+            if (argv[0][16] == '\0')
+                return print_help();
+            snapshot_init = argv[0] + 16;
+        }
+        else if (!strncmp(argv[0], "--from-snapshot=", 16)) {
+            if (argv[0][16] == '\0')
+                return print_help();
+            snapshot_path = argv[0] + 16;
+        }
+        else if (!strncmp(argv[0], "--migration-stats-fd=", 21)) {
+            if (argv[0][21] == '\0')
+                return print_help();
+            migration_stats_fd = atoi(argv[0] + 21);
+        }
+#endif
         else if (!strncmp(argv[0], "--version", 9)) {
             uint32 major, minor, patch;
             wasm_runtime_get_version(&major, &minor, &patch);
@@ -845,10 +988,34 @@ main(int argc, char *argv[])
     app_argc = argc;
     app_argv = argv;
 
+#if WASM_ENABLE_MIGRATION != 0
+    if (snapshot_interval > 0) {
+        struct itimerval timer;
+        timer.it_interval.tv_sec = snapshot_interval / 1000;
+        timer.it_interval.tv_usec = (snapshot_interval % 1000) * 1000;
+        timer.it_value = timer.it_interval;
+        if (setitimer(ITIMER_REAL, &timer, NULL) != 0) {
+            printf("Set snapshot interval failed.\n");
+            return -1;
+        }
+    }
+#endif
+
     memset(&init_args, 0, sizeof(RuntimeInitArgs));
 
     init_args.running_mode = running_mode;
     init_args.restore_flag = restore_flag;
+    init_args.restore_lazy = restore_lazy;
+#if WASM_ENABLE_MIGRATION != 0
+    init_args.checkpoint_target = checkpoint_target;
+    init_args.restore_source = restore_source;
+    init_args.checkpoint_compress = checkpoint_compress;
+    init_args.checkpoint_threads = checkpoint_threads;
+    init_args.checkpoint_page_pool = checkpoint_page_pool;
+    init_args.checkpoint_async = checkpoint_async;
+    init_args.checkpoint_direct_io = checkpoint_direct_io;
+    init_args.checkpoint_sync = checkpoint_sync;
+#endif
 #if WASM_ENABLE_GLOBAL_HEAP_POOL != 0
     init_args.mem_alloc_type = Alloc_With_Pool;
     init_args.mem_alloc_option.pool.heap_buf = global_heap_buf;
@@ -868,6 +1035,11 @@ main(int argc, char *argv[])
     init_args.fast_jit_code_cache_size = jit_code_cache_size;
 #endif
 
+#if WASM_ENABLE_FAST_INTERP != 0
+    init_args.loader_threads = loader_threads;
+    init_args.lazy_translation = lazy_translation;
+#endif
+
 #if WASM_ENABLE_GC != 0
     init_args.gc_heap_size = gc_heap_size;
 #endif
@@ -894,6 +1066,10 @@ main(int argc, char *argv[])
         return -1;
     }
 
+#if WASM_ENABLE_MIGRATION != 0
+    wasm_runtime_set_migration_stats_fd(migration_stats_fd);
+#endif
+
 #if WASM_ENABLE_LOG != 0
     bh_log_set_verbose_level(log_verbose_level);
 #endif
@@ -954,13 +1130,41 @@ main(int argc, char *argv[])
 #endif
 
     /* instantiate the module */
-    if (!(wasm_module_inst =
-              wasm_runtime_instantiate(wasm_module, stack_size, heap_size,
-                                       error_buf, sizeof(error_buf)))) {
+#if WASM_ENABLE_MIGRATION != 0
+    if (snapshot_path) {
+        if (!(snapshot = wasm_runtime_load_snapshot(snapshot_path, error_buf,
+                                                    sizeof(error_buf)))) {
+            printf("%s\n", error_buf);
+            goto fail3;
+        }
+        wasm_module_inst = wasm_runtime_instantiate_from_snapshot(
+            wasm_module, snapshot, stack_size, heap_size, error_buf,
+            sizeof(error_buf));
+        wasm_runtime_unload_snapshot(snapshot);
+        if (!wasm_module_inst) {
+            printf("%s\n", error_buf);
+            goto fail3;
+        }
+    }
+    else
+#endif
+        if (!(wasm_module_inst =
+                  wasm_runtime_instantiate(wasm_module, stack_size, heap_size,
+                                           error_buf, sizeof(error_buf)))) {
         printf("%s\n", error_buf);
         goto fail3;
     }
 
+#if WASM_ENABLE_MIGRATION != 0
+    if (snapshot_init) {
+        ret = wasm_runtime_create_snapshot(wasm_module_inst, snapshot_init,
+                                           checkpoint_target)
+                  ? 0
+                  : 1;
+        goto fail4;
+    }
+#endif
+
 #if WASM_CONFIGURABLE_BOUNDS_CHECKS != 0
     if (disable_bounds_checks) {
         wasm_runtime_set_bounds_checks(wasm_module_inst, false);
@@ -1046,7 +1250,7 @@ main(int argc, char *argv[])
 #if WASM_ENABLE_THREAD_MGR != 0
 fail5:
 #endif
-#if WASM_ENABLE_DEBUG_INTERP != 0
+#if WASM_ENABLE_DEBUG_INTERP != 0 || WASM_ENABLE_MIGRATION != 0
 fail4:
 #endif
     /* destroy the module instance */
@@ -0,0 +1,38 @@
+#!/bin/bash
+
+# Copyright (C) 2019 Intel Corporation.  All rights reserved.
+# SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+
+PLATFORM=$(uname -s | tr A-Z a-z)
+
+WAMR_DIR="../../.."
+PLATFORM_DIR="${WAMR_DIR}/product-mini/platforms/${PLATFORM}"
+
+if [ ! -e "coremark.wasm" ]; then
+    echo "coremark.wasm doesn't exist, please run build.sh first"
+    exit
+fi
+
+# Build iwasm of the classic and fast interpreters with and without the
+# checkpoint polls to measure their cost
+for interp in classic fast
+do
+    fast_interp=$([ "${interp}" = "fast" ] && echo 1 || echo 0)
+    for migration in 1 0
+    do
+        echo "Build iwasm ${interp} interpreter with WAMR_BUILD_MIGRATION=${migration} .."
+        cmake -S ${PLATFORM_DIR} -B build_${interp}_migration_${migration} \
+              -DWAMR_BUILD_FAST_INTERP=${fast_interp} \
+              -DWAMR_BUILD_MIGRATION=${migration} > /dev/null
+        cmake --build build_${interp}_migration_${migration} -j > /dev/null
+    done
+done
+
+for interp in classic fast
+do
+    for migration in 1 0
+    do
+        echo "Run coremark with iwasm ${interp} interpreter mode (WAMR_BUILD_MIGRATION=${migration}) .."
+        build_${interp}_migration_${migration}/iwasm coremark.wasm
+    done
+done
@@ -0,0 +1,81 @@
+#!/bin/bash
+
+# Copyright (C) 2019 Intel Corporation.  All rights reserved.
+# SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+
+PLATFORM=$(uname -s | tr A-Z a-z)
+
+CUR_DIR=$PWD
+OUT_DIR=$CUR_DIR/out
+WAMR_DIR=$CUR_DIR/../../..
+PLATFORM_DIR=${WAMR_DIR}/product-mini/platforms/${PLATFORM}
+WAMRC_CMD=${WAMR_DIR}/wamr-compiler/build/wamrc
+WASI_CC=/opt/wasi-sdk/bin/clang
+
+POLYBENCH_CASES="linear-algebra/kernels/2mm linear-algebra/blas/gemm \
+                 stencils/jacobi-2d stencils/seidel-2d \
+                 medley/floyd-warshall medley/nussinov"
+COREMARK_ITERATIONS=${COREMARK_ITERATIONS:-4000}
+
+mkdir -p ${OUT_DIR}
+
+# iwasm of each interpreter with the migration support, and without it to
+# measure the steady-state slowdown
+for interp in classic fast
+do
+    if [[ ${interp} == "fast" ]]; then
+        fast_interp=1
+    else
+        fast_interp=0
+    fi
+    for migration in 1 0
+    do
+        echo "Build iwasm ${interp} interpreter with WAMR_BUILD_MIGRATION=${migration} .."
+        cmake -S ${PLATFORM_DIR} -B build_${interp}_${migration} \
+              -DWAMR_BUILD_FAST_INTERP=${fast_interp} \
+              -DWAMR_BUILD_MIGRATION=${migration} > /dev/null
+        cmake --build build_${interp}_${migration} -j > /dev/null
+    done
+done
+
+echo "Build heap_stack.wasm .."
+${WASI_CC} -O2 -o ${OUT_DIR}/heap_stack.wasm heap_stack.c
+
+if [ ! -d PolyBenchC-4.2.1 ]; then
+    git clone https://github.com/MatthiasJReisinger/PolyBenchC-4.2.1.git
+fi
+
+cd PolyBenchC-4.2.1
+for case in $POLYBENCH_CASES
+do
+    name=${case##*/}
+    echo "Build ${name}.wasm .."
+    ${WASI_CC} -O3 -I utilities -I ${case} utilities/polybench.c \
+            ${case}/${name}.c -DMEDIUM_DATASET \
+            -D_WASI_EMULATED_PROCESS_CLOCKS -o ${OUT_DIR}/${name}.wasm
+done
+cd ..
+
+if [ ! -d coremark ]; then
+    git clone https://github.com/eembc/coremark.git
+fi
+
+cd coremark
+echo "Build coremark.wasm .."
+${WASI_CC} -O3 -Iposix -I. -DFLAGS_STR=\""-O3 -DPERFORMANCE_RUN=1"\" \
+        -DITERATIONS=${COREMARK_ITERATIONS} -DSEED_METHOD=SEED_VOLATILE \
+        -DPERFORMANCE_RUN=1 -Wl,--export=main -Wl,--allow-undefined \
+        core_list_join.c core_main.c core_matrix.c core_state.c \
+        core_util.c posix/core_portme.c -o ${OUT_DIR}/coremark.wasm
+cd ..
+
+# AOT files with the checkpoint safepoints, and without them for the
+# steady-state slowdown
+for wasm in ${OUT_DIR}/*.wasm
+do
+    echo "Compile ${wasm##*/} into AOT .."
+    ${WAMRC_CMD} --enable-checkpoint -o ${wasm%.wasm}.aot ${wasm} > /dev/null
+    ${WAMRC_CMD} -o ${wasm%.wasm}_plain.aot ${wasm} > /dev/null
+done
+
+echo "Done"
@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2019 Intel Corporation.  All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+ */
+
+/*
+ * Synthetic workload of the migration benchmark.
+ *
+ *   heap_stack.wasm <heap MB> <stack depth> <rounds>
+ *
+ * It fills a heap of the given size, recurses to the given depth and then
+ * updates one page in eight of the heap in every round from the deepest
+ * frame. "ready" is printed once the heap and the stack are built, so that
+ * the checkpoint is taken with both of them in place.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define PAGE_WORDS (4096 / sizeof(uint64_t))
+
+static uint64_t *heap;
+static size_t heap_words;
+
+static uint64_t
+work(uint32_t rounds)
+{
+    uint64_t sum = 0;
+    uint32_t r;
+    size_t i;
+
+    for (r = 0; r < rounds; r++) {
+        for (i = (r % 8) * PAGE_WORDS; i < heap_words; i += 8 * PAGE_WORDS) {
+            heap[i] = heap[i] * 6364136223846793005ULL + r;
+            sum ^= heap[i];
+        }
+    }
+    return sum;
+}
+
+static uint64_t
+descend(uint32_t depth, uint32_t rounds)
+{
+    /* keep a value in every frame */
+    volatile uint64_t local = depth;
+
+    if (depth == 0) {
+        printf("ready\n");
+        fflush(stdout);
+        return work(rounds);
+    }
+    return descend(depth - 1, rounds) + local;
+}
+
+int
+main(int argc, char **argv)
+{
+    uint32_t heap_mb = argc > 1 ? atoi(argv[1]) : 64;
+    uint32_t depth = argc > 2 ? atoi(argv[2]) : 16;
+    uint32_t rounds = argc > 3 ? atoi(argv[3]) : 4096;
+    uint64_t x = 88172645463325252ULL;
+    size_t i;
+
+    heap_words = (size_t)heap_mb * 1024 * 1024 / sizeof(uint64_t);
+    if (!(heap = malloc(heap_words * sizeof(uint64_t)))) {
+        printf("failed to allocate %u MB\n", heap_mb);
+        return 1;
+    }
+    for (i = 0; i < heap_words; i++) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        heap[i] = x;
+    }
+
+    printf("checksum %016llx\n", (unsigned long long)descend(depth, rounds));
+    return 0;
+}
@@ -0,0 +1,236 @@
+#!/usr/bin/env python3
+
+#
+# Copyright (C) 2019 Intel Corporation.  All rights reserved.
+# SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+#
+
+"""
+Checkpoint/restore benchmark of the migration support.
+
+Each case runs a workload to completion with and without the migration
+support to get the steady-state slowdown, then checkpoints it with SIGINT
+and restores it. One JSON object is written per case, with the times in
+nanoseconds:
+
+  dump_ns          checkpoint time reported by --migration-stats-fd
+  dump_wall_ns     from SIGINT to the exit of the checkpointed process
+  restore_ns       restore time reported by --migration-stats-fd
+  ttfi_ns          time to first instruction, from the launch of the
+                   restoring process to the end of the restore
+  image_bytes      size of checkpoint.img and the pre-copy images
+  slowdown         uninterrupted run time with the migration support over
+                   the one without it
+"""
+
+import argparse
+import json
+import os
+import signal
+import subprocess
+import sys
+import tempfile
+import time
+
+CUR_DIR = os.path.dirname(os.path.abspath(__file__))
+OUT_DIR = os.path.join(CUR_DIR, "out")
+
+POLYBENCH_CASES = ["2mm", "gemm", "jacobi-2d", "seidel-2d", "floyd-warshall",
+                   "nussinov"]
+
+STATS_FILE = "stats.jsonl"
+
+
+def engine_commands(engine):
+    """iwasm and the module suffix with and without the migration support"""
+    if engine == "aot":
+        return (os.path.join(CUR_DIR, "build_classic_1", "iwasm"), ".aot",
+                os.path.join(CUR_DIR, "build_classic_0", "iwasm"), "_plain.aot")
+    return (os.path.join(CUR_DIR, f"build_{engine}_1", "iwasm"), ".wasm",
+            os.path.join(CUR_DIR, f"build_{engine}_0", "iwasm"), ".wasm")
+
+
+def stats_fd(cwd):
+    """A file that iwasm writes the statistics to with --migration-stats-fd"""
+    return os.open(os.path.join(cwd, STATS_FILE),
+                   os.O_WRONLY | os.O_CREAT | os.O_TRUNC)
+
+
+def read_stats(cwd, kind):
+    """The last statistics of kind written by iwasm"""
+    stats = None
+    with open(os.path.join(cwd, STATS_FILE)) as f:
+        for line in f:
+            record = json.loads(line)
+            if record["kind"] == kind:
+                stats = record
+    return stats
+
+
+def phases_of(stats):
+    return {k: v for k, v in stats["phase_ns"].items() if v} if stats else {}
+
+
+def run_to_end(cmd, cwd):
+    start = time.monotonic_ns()
+    p = subprocess.run(cmd, cwd=cwd, capture_output=True, text=True)
+    return time.monotonic_ns() - start, p
+
+
+def image_size(cwd):
+    return sum(os.path.getsize(os.path.join(cwd, f)) for f in os.listdir(cwd)
+               if f.startswith("checkpoint.img"))
+
+
+def checkpoint(cmd, cwd, wait_ready, delay_ns):
+    """Run cmd and checkpoint it after "ready" or after delay_ns"""
+    fd = stats_fd(cwd)
+    p = subprocess.Popen([cmd[0], f"--migration-stats-fd={fd}"] + cmd[1:],
+                         cwd=cwd, stdout=subprocess.PIPE,
+                         stderr=subprocess.DEVNULL, text=True, pass_fds=(fd,))
+    os.close(fd)
+    if wait_ready:
+        for line in p.stdout:
+            if line.strip() == "ready":
+                break
+    else:
+        time.sleep(delay_ns / 1e9)
+    start = time.monotonic_ns()
+    p.send_signal(signal.SIGINT)
+    p.communicate()
+    wall = time.monotonic_ns() - start
+    return p.returncode, wall, read_stats(cwd, "checkpoint")
+
+
+def restore(cmd, cwd):
+    fd = stats_fd(cwd)
+    start = time.monotonic_ns()
+    p = subprocess.run([cmd[0], f"--migration-stats-fd={fd}"] + cmd[1:],
+                       cwd=cwd, capture_output=True, text=True,
+                       pass_fds=(fd,))
+    os.close(fd)
+    stats = read_stats(cwd, "restore")
+    # timestamp_ns is CLOCK_MONOTONIC, the clock of time.monotonic_ns
+    ttfi = stats["timestamp_ns"] - start if stats else None
+    return p, stats, ttfi
+
+
+def result_of(stdout):
+    """The lines that a restored run must print as well"""
+    return [l for l in stdout.splitlines()
+            if l.startswith("checksum") or "Correct operation" in l]
+
+
+def run_case(args, engine, workload, module, module_args, wait_ready,
+             heap_mb=None, stack_depth=None):
+    iwasm, suffix, base_iwasm, base_suffix = engine_commands(engine)
+    file = os.path.join(OUT_DIR, module + suffix)
+    base_file = os.path.join(OUT_DIR, module + base_suffix)
+    record = {
+        "workload": workload,
+        "engine": engine,
+        "module": module,
+        "args": module_args,
+        "heap_mb": heap_mb,
+        "stack_depth": stack_depth,
+    }
+
+    if not os.path.exists(file) or not os.path.exists(iwasm):
+        record["error"] = "not built, run build.sh first"
+        return record
+
+    with tempfile.TemporaryDirectory() as cwd:
+        base_ns, _ = run_to_end([base_iwasm, base_file] + module_args, cwd)
+        migration_ns, p = run_to_end([iwasm, file] + module_args, cwd)
+        expected = result_of(p.stdout)
+        record["baseline_ns"] = base_ns
+        record["migration_ns"] = migration_ns
+        record["slowdown"] = migration_ns / base_ns if base_ns else None
+
+        rc, dump_wall, dump = checkpoint(
+            [iwasm] + args.checkpoint_opts.split() + [file] + module_args,
+            cwd, wait_ready, migration_ns * args.delay)
+        record["dump_ns"] = dump["total_ns"] if dump else None
+        record["dump_wall_ns"] = dump_wall
+        record["dump_phases"] = phases_of(dump)
+        record["image_bytes"] = image_size(cwd)
+        if dump:
+            record["dirty_pages"] = dump["dirty_pages"]
+            record["zero_pages"] = dump["zero_pages"]
+            record["compression_ratio"] = dump["compression_ratio"]
+            record["frame_count"] = dump["frame_count"]
+        if (rc != 0 or not dump or not dump["success"]
+                or not os.path.exists(os.path.join(cwd, "checkpoint.img"))):
+            record["error"] = "checkpoint failed"
+            return record
+
+        p, restored, ttfi = restore(
+            [iwasm, "--restore"] + args.restore_opts.split() + [file]
+            + module_args, cwd)
+        record["restore_ns"] = restored["total_ns"] if restored else None
+        record["restore_phases"] = phases_of(restored)
+        record["ttfi_ns"] = ttfi
+        record["ok"] = (p.returncode == 0 and restored is not None
+                        and restored["success"]
+                        and result_of(p.stdout) == expected)
+    return record
+
+
+def cases(args):
+    for engine in args.engines.split(","):
+        if "heap_stack" in args.workloads:
+            for heap_mb in args.heap_sizes.split(","):
+                for depth in args.stack_depths.split(","):
+                    yield (engine, "heap_stack", "heap_stack",
+                           [heap_mb, depth, str(args.rounds)], True,
+                           int(heap_mb), int(depth))
+        if "polybench" in args.workloads:
+            for name in POLYBENCH_CASES:
+                yield (engine, "polybench", name, [], False, None, None)
+        if "coremark" in args.workloads:
+            yield (engine, "coremark", "coremark", [], False, None, None)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().split("\n")[0])
+    parser.add_argument("--engines", default="classic,fast,aot",
+                        help="comma separated: classic, fast, aot")
+    parser.add_argument("--workloads", default="heap_stack,polybench,coremark",
+                        help="comma separated: heap_stack, polybench, coremark")
+    parser.add_argument("--heap-sizes", default="16,64,256",
+                        help="heap sizes of heap_stack in MB")
+    parser.add_argument("--stack-depths", default="1,64,1024",
+                        help="stack depths of heap_stack")
+    parser.add_argument("--rounds", type=int, default=4096,
+                        help="rounds of heap updates of heap_stack")
+    parser.add_argument("--delay", type=float, default=0.5,
+                        help="checkpoint polybench and coremark after this "
+                        "fraction of their run time")
+    parser.add_argument("--repeat", type=int, default=1,
+                        help="number of runs of each case")
+    parser.add_argument("--checkpoint-opts", default="",
+                        help="extra iwasm options of the checkpointed run, "
+                        "e.g. --checkpoint-compress")
+    parser.add_argument("--restore-opts", default="",
+                        help="extra iwasm options of the restore, "
+                        "e.g. --restore-lazy")
+    parser.add_argument("-o", "--output", help="JSON lines file, "
+                        "default is stdout")
+    args = parser.parse_args()
+
+    out = open(args.output, "w") if args.output else sys.stdout
+    failed = 0
+    for case in cases(args):
+        for i in range(args.repeat):
+            record = run_case(args, *case)
+            record["run"] = i
+            if "error" in record or not record.get("ok"):
+                failed += 1
+            print(json.dumps(record), file=out, flush=True)
+    if out is not sys.stdout:
+        out.close()
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
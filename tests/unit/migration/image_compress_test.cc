@@ -0,0 +1,136 @@
+/*
+ * Copyright (C) 2019 Intel Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+ */
+
+#include "gtest/gtest.h"
+
+#include "wasm_image_compress.h"
+
+#include <vector>
+
+class image_compress_test : public testing::Test
+{
+  protected:
+    void SetUp()
+    {
+        uint32 seed = 1;
+
+        /* repeated records with a changing counter, like a heap of small
+           objects, and bytes with no repetition at all */
+        data.resize(WASM_IMAGE_BLOCK_SIZE);
+        for (uint32 i = 0; i < data.size(); i++)
+            data[i] = i % 64 < 48 ? (uint8)(i % 7) : (uint8)(i / 64);
+        noise.resize(WASM_IMAGE_BLOCK_SIZE);
+        for (uint32 i = 0; i < noise.size(); i++) {
+            seed = seed * 1103515245 + 12345;
+            noise[i] = (uint8)(seed >> 16);
+        }
+    }
+
+    /* Compress src and return the LZ4 block */
+    std::vector<uint8> compress(const std::vector<uint8> &src)
+    {
+        std::vector<uint8> dst(wasm_image_compress_bound(src.size()));
+        uint64 size =
+            wasm_image_compress(src.data(), src.size(), dst.data(), dst.size());
+
+        EXPECT_GT(size, 0u);
+        dst.resize(size);
+        return dst;
+    }
+
+    std::vector<uint8> data;
+    std::vector<uint8> noise;
+};
+
+TEST_F(image_compress_test, round_trip)
+{
+    std::vector<uint8> compressed, out(WASM_IMAGE_BLOCK_SIZE);
+
+    compressed = compress(data);
+    EXPECT_LT(compressed.size(), data.size() / 4);
+    ASSERT_TRUE(wasm_image_decompress(compressed.data(), compressed.size(),
+                                      out.data(), out.size()));
+    EXPECT_EQ(out, data);
+
+    /* what doesn't compress still fits in the bound */
+    compressed = compress(noise);
+    EXPECT_LE(compressed.size(), wasm_image_compress_bound(noise.size()));
+    ASSERT_TRUE(wasm_image_decompress(compressed.data(), compressed.size(),
+                                      out.data(), out.size()));
+    EXPECT_EQ(out, noise);
+
+    /* shorter than the literals a block ends with */
+    std::vector<uint8> tiny(data.begin(), data.begin() + 3);
+    compressed = compress(tiny);
+    out.resize(tiny.size());
+    ASSERT_TRUE(wasm_image_decompress(compressed.data(), compressed.size(),
+                                      out.data(), out.size()));
+    EXPECT_EQ(out, tiny);
+}
+
+TEST_F(image_compress_test, small_capacity)
+{
+    std::vector<uint8> dst(noise.size() / 2);
+
+    EXPECT_EQ(wasm_image_compress(noise.data(), noise.size(), dst.data(),
+                                  dst.size()),
+              0u);
+}
+
+/* A match may start less than its length before the output, it then
+   repeats the bytes it has just produced */
+TEST_F(image_compress_test, overlapping_match)
+{
+    /* "ab", then 20 bytes from 2 back and a last literal "c" */
+    const uint8 block[] = { 0x2f, 'a', 'b', 2, 0, 20 - 4 - 15, 0x10, 'c' };
+    const char expected[] = "abababababababababababc";
+    std::vector<uint8> out(sizeof(expected) - 1);
+
+    ASSERT_TRUE(
+        wasm_image_decompress(block, sizeof(block), out.data(), out.size()));
+    EXPECT_EQ(memcmp(out.data(), expected, out.size()), 0);
+
+    /* a page of one byte is a single match one back */
+    std::vector<uint8> page(4096, 0x5a), compressed = compress(page);
+    EXPECT_LT(compressed.size(), 64u);
+    out.resize(page.size());
+    ASSERT_TRUE(wasm_image_decompress(compressed.data(), compressed.size(),
+                                      out.data(), out.size()));
+    EXPECT_EQ(out, page);
+}
+
+TEST_F(image_compress_test, truncated_input)
+{
+    std::vector<uint8> part(data.begin(), data.begin() + 16 * 1024);
+    std::vector<uint8> compressed = compress(part), out(part.size());
+
+    /* every prefix of the block leaves the output short or ends in the
+       middle of a sequence */
+    for (uint64 size = 0; size < compressed.size(); size++)
+        EXPECT_FALSE(wasm_image_decompress(compressed.data(), size,
+                                           out.data(), out.size()))
+            << size;
+
+    /* the output size has to match too */
+    EXPECT_FALSE(wasm_image_decompress(compressed.data(), compressed.size(),
+                                       out.data(), out.size() - 1));
+    out.resize(part.size() + 1);
+    EXPECT_FALSE(wasm_image_decompress(compressed.data(), compressed.size(),
+                                       out.data(), out.size()));
+}
+
+TEST_F(image_compress_test, invalid_offset)
+{
+    /* a match before the start of the output */
+    const uint8 before_start[] = { 0x10, 'a', 2, 0, 0x10, 'b' };
+    /* offset 0 */
+    const uint8 zero_offset[] = { 0x10, 'a', 0, 0, 0x10, 'b' };
+    uint8 out[6];
+
+    EXPECT_FALSE(wasm_image_decompress(before_start, sizeof(before_start),
+                                       out, sizeof(out)));
+    EXPECT_FALSE(wasm_image_decompress(zero_offset, sizeof(zero_offset), out,
+                                       sizeof(out)));
+}
@@ -0,0 +1,159 @@
+/*
+ * Copyright (C) 2019 Intel Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+ */
+
+#include "test_helper.h"
+#include "gtest/gtest.h"
+
+#include "wasm_image_flusher.h"
+
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+/* The targets whose done callback ran, in the order it ran */
+static std::vector<std::string> flushed;
+static std::vector<bool> flush_results;
+
+static void
+flush_done(const char *target, bool success, void *user_data)
+{
+    (void)user_data;
+    flushed.push_back(target);
+    flush_results.push_back(success);
+}
+
+/* An image of a small buffered section with an odd size and a page
+   aligned chunked one that refers to memory, as the dump writes the
+   globals and the linear memory */
+class image_flusher_test : public testing::TestWithParam<bool>
+{
+  protected:
+    void SetUp()
+    {
+        for (uint32 i = 0; i < sizeof(memory); i++)
+            memory[i] = (uint8)(i * 13 + 5);
+        wasm_image_set_direct_io(GetParam());
+        wasm_image_set_sync(GetParam());
+        flushed.clear();
+        flush_results.clear();
+    }
+
+    void TearDown()
+    {
+        wasm_image_set_direct_io(false);
+        wasm_image_set_sync(false);
+        for (const std::string &file : files)
+            unlink(file.c_str());
+    }
+
+    void build(WASMImageWriter *writer, uint8 tag)
+    {
+        uint8 globals[37];
+        WASMImageBuffer *buf;
+        WASMImageSection *section;
+
+        memset(globals, tag, sizeof(globals));
+        wasm_image_writer_init(writer);
+        buf = wasm_image_writer_add_section(writer, IMAGE_SECTION_GLOBAL, 0);
+        ASSERT_TRUE(buf != NULL);
+        ASSERT_TRUE(wasm_image_buf_write(buf, globals, sizeof(globals)));
+        section = wasm_image_writer_add_chunked_section(
+            writer, IMAGE_SECTION_MEMORY_PAGES,
+            IMAGE_SECTION_FLAG_PAGE_ALIGNED);
+        ASSERT_TRUE(section != NULL);
+        ASSERT_TRUE(wasm_image_section_add_chunk(section, memory,
+                                                 sizeof(memory)));
+    }
+
+    /* Whether the image at path holds the sections of build(tag) with the
+       given memory */
+    void check(const std::string &path, uint8 tag, const uint8 *expected)
+    {
+        WASMImageReader reader;
+        const uint8 *data;
+        uint64 size;
+
+        ASSERT_TRUE(wasm_image_reader_open(&reader, path.c_str()));
+        data = wasm_image_reader_get(&reader, IMAGE_SECTION_GLOBAL, &size);
+        ASSERT_TRUE(data != NULL);
+        ASSERT_EQ(size, 37u);
+        for (uint64 i = 0; i < size; i++)
+            EXPECT_EQ(data[i], tag);
+        data = wasm_image_reader_get(&reader, IMAGE_SECTION_MEMORY_PAGES,
+                                     &size);
+        ASSERT_TRUE(data != NULL);
+        ASSERT_EQ(size, sizeof(memory));
+        EXPECT_EQ(memcmp(data, expected, size), 0);
+        wasm_image_reader_close(&reader);
+    }
+
+    /* the writer thread is created by the runtime */
+    WAMRRuntimeRAII<512 * 1024> runtime;
+    std::vector<std::string> files;
+    uint8 memory[WASM_IMAGE_PAGE_SIZE * 3];
+};
+
+TEST_P(image_flusher_test, write_file)
+{
+    WASMImageWriter writer;
+    std::string path = "image_flusher_test.img";
+
+    files.push_back(path);
+    build(&writer, 1);
+    ASSERT_TRUE(wasm_image_writer_write_file(&writer, path.c_str()));
+    wasm_image_writer_destroy(&writer);
+    check(path, 1, memory);
+}
+
+/* The memory keeps changing after a submit, the images hold it as it was
+   when they were detached, written in the order they were submitted */
+TEST_P(image_flusher_test, submit)
+{
+    uint8 snapshots[3][sizeof(memory)];
+
+    for (uint8 i = 0; i < 3; i++) {
+        WASMImageWriter writer;
+        std::string path =
+            "image_flusher_test." + std::to_string(i) + ".img";
+
+        files.push_back(path);
+        memory[i * 100] = 0xf0 + i;
+        memcpy(snapshots[i], memory, sizeof(memory));
+        build(&writer, i);
+        ASSERT_TRUE(wasm_image_writer_detach(&writer));
+        ASSERT_TRUE(wasm_image_flusher_submit(&writer, path.c_str(),
+                                              flush_done, NULL));
+        wasm_image_writer_destroy(&writer);
+        memset(memory, 0, sizeof(memory));
+    }
+    ASSERT_TRUE(wasm_image_flusher_wait());
+
+    ASSERT_EQ(flushed.size(), 3u);
+    for (uint8 i = 0; i < 3; i++) {
+        EXPECT_EQ(flushed[i], files[i]);
+        EXPECT_TRUE(flush_results[i]);
+        check(files[i], i, snapshots[i]);
+    }
+}
+
+/* A failed image is reported to its callback and to the next wait only */
+TEST_P(image_flusher_test, submit_failure)
+{
+    WASMImageWriter writer;
+
+    build(&writer, 1);
+    ASSERT_TRUE(wasm_image_writer_detach(&writer));
+    ASSERT_TRUE(wasm_image_flusher_submit(
+        &writer, "image_flusher_test.missing/x.img", flush_done, NULL));
+    wasm_image_writer_destroy(&writer);
+
+    EXPECT_FALSE(wasm_image_flusher_wait());
+    ASSERT_EQ(flush_results.size(), 1u);
+    EXPECT_FALSE(flush_results[0]);
+    EXPECT_TRUE(wasm_image_flusher_wait());
+}
+
+INSTANTIATE_TEST_SUITE_P(DirectIO, image_flusher_test,
+                         testing::Values(false, true));
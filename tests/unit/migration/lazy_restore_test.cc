@@ -0,0 +1,229 @@
+/*
+ * Copyright (C) 2019 Intel Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+ */
+
+#include "test_helper.h"
+#include "gtest/gtest.h"
+
+#include "bh_read_file.h"
+#include "wasm_export.h"
+
+#include <limits.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+static const char *IMAGE_FILE = "lazy_restore_test.img";
+
+/* pages.wasm calls env.tick(i) in each iteration of its second loop, the
+   native requests the checkpoint of the instance at checkpoint_tick and
+   counts the maps of the image at the first tick after the restore */
+static const int32 NO_CHECKPOINT = -1;
+static int32 checkpoint_tick = NO_CHECKPOINT;
+static bool count_image_maps = false;
+static uint64 image_maps = 0;
+
+/* The lines of /proc/self/maps that contain name, all of them if NULL */
+static uint64
+count_proc_maps(const char *name)
+{
+    char line[PATH_MAX + 128];
+    FILE *fp = fopen("/proc/self/maps", "r");
+    uint64 count = 0;
+
+    if (!fp)
+        return 0;
+    while (fgets(line, sizeof(line), fp)) {
+        if (!name || strstr(line, name))
+            count++;
+    }
+    fclose(fp);
+    return count;
+}
+
+static uint64
+max_map_count()
+{
+    FILE *fp = fopen("/proc/sys/vm/max_map_count", "r");
+    unsigned long long count = 0;
+
+    if (!fp)
+        return 0;
+    if (fscanf(fp, "%llu", &count) != 1)
+        count = 0;
+    fclose(fp);
+    return count;
+}
+
+static void
+tick_wrapper(wasm_exec_env_t exec_env, int32 i)
+{
+    if (count_image_maps) {
+        count_image_maps = false;
+        image_maps = count_proc_maps(IMAGE_FILE);
+    }
+    if (i == checkpoint_tick) {
+        checkpoint_tick = NO_CHECKPOINT;
+        wasm_runtime_request_checkpoint(wasm_runtime_get_module_inst(exec_env),
+                                        IMAGE_FILE);
+    }
+}
+
+static NativeSymbol native_symbols[] = {
+    { "tick", (void *)tick_wrapper, "(i)", NULL },
+};
+
+class lazy_restore_test : public testing::TestWithParam<const char *>
+{
+  protected:
+    void SetUp()
+    {
+        RuntimeInitArgs init_args;
+
+        memset(&init_args, 0, sizeof(RuntimeInitArgs));
+        init_args.mem_alloc_type = Alloc_With_Pool;
+        init_args.mem_alloc_option.pool.heap_buf = heap_buf;
+        init_args.mem_alloc_option.pool.heap_size = sizeof(heap_buf);
+        init_args.native_module_name = "env";
+        init_args.native_symbols = native_symbols;
+        init_args.n_native_symbols =
+            sizeof(native_symbols) / sizeof(NativeSymbol);
+        init_args.restore_lazy = true;
+        ASSERT_TRUE(wasm_runtime_full_init(&init_args));
+        runtime_inited = true;
+
+        buffer = (uint8 *)bh_read_file_to_buffer(GetParam(), &buffer_size);
+        ASSERT_TRUE(buffer != NULL);
+        module = wasm_runtime_load(buffer, buffer_size, error_buf,
+                                   sizeof(error_buf));
+        ASSERT_TRUE(module != NULL) << error_buf;
+    }
+
+    void TearDown()
+    {
+        if (module)
+            wasm_runtime_unload(module);
+        if (buffer)
+            BH_FREE(buffer);
+        if (runtime_inited)
+            wasm_runtime_destroy();
+        unlink(IMAGE_FILE);
+    }
+
+    /* Split an inaccessible mapping into separate maps until the process
+       has at least count of them */
+    void fill_proc_maps(uint64 count)
+    {
+        uint64 page = (uint64)getpagesize();
+        uint64 have = count_proc_maps(NULL);
+        uint64 splits = count > have ? (count - have) / 2 + 1 : 0;
+
+        filler_size = (splits * 2 + 1) * page;
+        filler = (uint8 *)mmap(NULL, filler_size, PROT_NONE,
+                               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        ASSERT_TRUE(filler != MAP_FAILED);
+        /* each page made readable between two inaccessible ones adds two
+           maps */
+        for (uint64 i = 0; i < splits; i++)
+            ASSERT_EQ(mprotect(filler + (2 * i + 1) * page, page, PROT_READ),
+                      0);
+    }
+
+    /* Call run(n) in a new instance, restored from IMAGE_FILE first if
+       restore is set. The maps of fill_maps are held during the call. */
+    bool run(uint32 n, bool restore, uint64 fill_maps, uint64 *result)
+    {
+        wasm_module_inst_t module_inst;
+        wasm_exec_env_t exec_env = NULL;
+        wasm_function_inst_t func;
+        uint32 argv[2] = { n, 0 };
+        bool ret = false;
+
+        module_inst = wasm_runtime_instantiate(module, 16 * 1024, 0, error_buf,
+                                               sizeof(error_buf));
+        if (!module_inst)
+            return false;
+        if (!(exec_env = wasm_runtime_create_exec_env(module_inst, 16 * 1024))
+            || !(func = wasm_runtime_lookup_function(module_inst, "run"))
+            || (restore
+                && !wasm_runtime_restore_instance(module_inst, IMAGE_FILE)))
+            goto fail;
+
+        if (fill_maps > 0) {
+            fill_proc_maps(fill_maps);
+            if (HasFatalFailure())
+                goto fail;
+        }
+        if (wasm_runtime_call_wasm(exec_env, func, 1, argv)) {
+            memcpy(result, argv, sizeof(uint64));
+            ret = true;
+        }
+
+    fail:
+        if (filler && filler != MAP_FAILED)
+            munmap(filler, filler_size);
+        filler = NULL;
+        if (exec_env)
+            wasm_runtime_destroy_exec_env(exec_env);
+        wasm_runtime_deinstantiate(module_inst);
+        return ret;
+    }
+
+    /* Run pages.wasm to the end, then checkpoint it half way and restore
+       it with fill_maps held, the result must be the same */
+    void checkpoint_and_restore(uint32 n, uint64 fill_maps)
+    {
+        uint64 expected, result;
+
+        checkpoint_tick = NO_CHECKPOINT;
+        ASSERT_TRUE(run(n, false, 0, &expected));
+
+        checkpoint_tick = (int32)(n / 2);
+        ASSERT_FALSE(run(n, false, 0, &result));
+
+        count_image_maps = true;
+        image_maps = 0;
+        ASSERT_TRUE(run(n, true, fill_maps, &result));
+        EXPECT_FALSE(count_image_maps);
+        EXPECT_EQ(result, expected);
+    }
+
+    char heap_buf[1024 * 1024];
+    bool runtime_inited = false;
+    uint8 *buffer = NULL;
+    uint32 buffer_size = 0;
+    wasm_module_t module = NULL;
+    uint8 *filler = NULL;
+    uint64 filler_size = 0;
+    char error_buf[128];
+};
+
+TEST_P(lazy_restore_test, maps_image)
+{
+    /* the written pages stay in the image until they are touched */
+    checkpoint_and_restore(64, 0);
+    EXPECT_GT(image_maps, 0u);
+}
+
+TEST_P(lazy_restore_test, copies_beyond_max_map_count)
+{
+    uint64 max_count = max_map_count();
+
+    /* every written page and every gap is a map of its own, a quarter of
+       the limit of pages needs more than half of it for the memory */
+    if (max_count == 0 || max_count > 256 * 1024)
+        GTEST_SKIP() << "vm.max_map_count is " << max_count;
+
+    /* the maps held make the rest too few, the memory is copied and the
+       image isn't mapped */
+    checkpoint_and_restore((uint32)(max_count / 4 + 8), max_count / 2 + 64);
+    EXPECT_EQ(image_maps, 0u);
+}
+
+INSTANTIATE_TEST_SUITE_P(RunningMode, lazy_restore_test,
+                         testing::Values("pages.wasm"
+#if WASM_ENABLE_AOT != 0
+                                         ,
+                                         "pages.aot"
+#endif
+                                         ));
@@ -0,0 +1,312 @@
+/*
+ * Copyright (C) 2019 Intel Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+ */
+
+#include "test_helper.h"
+#include "gtest/gtest.h"
+
+#include "bh_read_file.h"
+#include "wasm_export.h"
+#include "wasm_image.h"
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+static const char *IMAGE_FILE = "migration_test.img";
+
+/* counter.wasm calls env.tick(i) in each iteration of its loop, the
+   native requests the checkpoint of the instance at checkpoint_tick */
+static const int32 NO_CHECKPOINT = -1;
+static int32 checkpoint_tick = NO_CHECKPOINT;
+static uint32 ticks = 0;
+
+static void
+tick_wrapper(wasm_exec_env_t exec_env, int32 i)
+{
+    ticks++;
+    if (i == checkpoint_tick) {
+        checkpoint_tick = NO_CHECKPOINT;
+        wasm_runtime_request_checkpoint(wasm_runtime_get_module_inst(exec_env),
+                                        IMAGE_FILE);
+    }
+}
+
+static NativeSymbol native_symbols[] = {
+    { "tick", (void *)tick_wrapper, "(i)", NULL },
+};
+
+static uint64
+file_size(const char *path)
+{
+    struct stat st;
+
+    return stat(path, &st) == 0 ? (uint64)st.st_size : 0;
+}
+
+class migration_image_test : public testing::Test
+{
+  protected:
+    void SetUp()
+    {
+        for (uint32 i = 0; i < sizeof(globals); i++)
+            globals[i] = (uint8)(i * 7 + 1);
+        for (uint32 i = 0; i < sizeof(pages); i++)
+            pages[i] = (uint8)(i >> 4);
+
+        /* a small buffered section and a page aligned chunked one, as
+           the dump writes the globals and the linear memory */
+        wasm_image_writer_init(&writer);
+        WASMImageBuffer *buf =
+            wasm_image_writer_add_section(&writer, IMAGE_SECTION_GLOBAL, 0);
+        ASSERT_TRUE(buf != NULL);
+        ASSERT_TRUE(wasm_image_buf_write(buf, globals, sizeof(globals)));
+
+        WASMImageSection *section = wasm_image_writer_add_chunked_section(
+            &writer, IMAGE_SECTION_MEMORY_PAGES,
+            IMAGE_SECTION_FLAG_PAGE_ALIGNED);
+        ASSERT_TRUE(section != NULL);
+        ASSERT_TRUE(wasm_image_section_add_chunk(section, pages,
+                                                 WASM_IMAGE_PAGE_SIZE));
+        ASSERT_TRUE(wasm_image_section_add_chunk(
+            section, pages + WASM_IMAGE_PAGE_SIZE, WASM_IMAGE_PAGE_SIZE));
+
+        ASSERT_TRUE(wasm_image_writer_write_file(&writer, IMAGE_FILE));
+    }
+
+    void TearDown()
+    {
+        wasm_image_writer_destroy(&writer);
+        unlink(IMAGE_FILE);
+    }
+
+    /* Flip one byte of the image file at offset */
+    void corrupt(uint64 offset)
+    {
+        FILE *file = fopen(IMAGE_FILE, "r+b");
+        int c;
+
+        ASSERT_TRUE(file != NULL);
+        ASSERT_EQ(fseek(file, (long)offset, SEEK_SET), 0);
+        c = fgetc(file);
+        ASSERT_NE(c, EOF);
+        ASSERT_EQ(fseek(file, (long)offset, SEEK_SET), 0);
+        fputc(c ^ 0xff, file);
+        fclose(file);
+    }
+
+    WASMImageWriter writer;
+    uint8 globals[40];
+    uint8 pages[WASM_IMAGE_PAGE_SIZE * 2];
+};
+
+TEST_F(migration_image_test, write_read_round_trip)
+{
+    WASMImageReader reader;
+    WASMImageCursor cursor;
+    const WASMImageSectionEntry *entry;
+    const uint8 *data;
+    uint8 read_globals[sizeof(globals)];
+    uint64 size;
+
+    EXPECT_EQ(file_size(IMAGE_FILE), wasm_image_writer_size(&writer));
+    ASSERT_TRUE(wasm_image_reader_open(&reader, IMAGE_FILE));
+    EXPECT_EQ(reader.header->section_count, 2u);
+
+    ASSERT_TRUE(wasm_image_reader_cursor(&reader, IMAGE_SECTION_GLOBAL,
+                                         &cursor));
+    ASSERT_TRUE(
+        wasm_image_cursor_read(&cursor, read_globals, sizeof(read_globals)));
+    EXPECT_EQ(memcmp(read_globals, globals, sizeof(globals)), 0);
+    EXPECT_EQ(cursor.p, cursor.end);
+
+    entry = wasm_image_reader_find(&reader, IMAGE_SECTION_MEMORY_PAGES);
+    ASSERT_TRUE(entry != NULL);
+    EXPECT_EQ(entry->offset % WASM_IMAGE_PAGE_SIZE, 0u);
+    data = wasm_image_reader_get(&reader, IMAGE_SECTION_MEMORY_PAGES, &size);
+    ASSERT_TRUE(data != NULL);
+    ASSERT_EQ(size, sizeof(pages));
+    EXPECT_EQ(memcmp(data, pages, sizeof(pages)), 0);
+
+    EXPECT_TRUE(wasm_image_reader_find(&reader, IMAGE_SECTION_STACK) == NULL);
+    wasm_image_reader_close(&reader);
+}
+
+TEST_F(migration_image_test, section_crc_mismatch)
+{
+    WASMImageReader reader;
+    const WASMImageSectionEntry *entry;
+    uint64 offset;
+
+    ASSERT_TRUE(wasm_image_reader_open(&reader, IMAGE_FILE));
+    entry = wasm_image_reader_find(&reader, IMAGE_SECTION_MEMORY_PAGES);
+    ASSERT_TRUE(entry != NULL);
+    offset = entry->offset + WASM_IMAGE_PAGE_SIZE + 5;
+    wasm_image_reader_close(&reader);
+
+    corrupt(offset);
+
+    /* the header is intact, only the corrupted section is rejected */
+    ASSERT_TRUE(wasm_image_reader_open(&reader, IMAGE_FILE));
+    EXPECT_TRUE(wasm_image_reader_get(&reader, IMAGE_SECTION_MEMORY_PAGES,
+                                      NULL)
+                == NULL);
+    EXPECT_TRUE(wasm_image_reader_get(&reader, IMAGE_SECTION_GLOBAL, NULL)
+                != NULL);
+    wasm_image_reader_close(&reader);
+}
+
+TEST_F(migration_image_test, header_crc_mismatch)
+{
+    WASMImageReader reader;
+
+    /* the type of the first entry of the section table */
+    corrupt(sizeof(WASMImageHeader));
+    EXPECT_FALSE(wasm_image_reader_open(&reader, IMAGE_FILE));
+}
+
+/* A stream is mapped with the size in its header before the rest of it
+   arrives, the size can't be taken on trust */
+TEST_F(migration_image_test, stream_header_size)
+{
+    WASMImageReader reader;
+    WASMImageHeader header;
+    int fds[2];
+
+    memset(&header, 0, sizeof(header));
+    header.magic = WASM_IMAGE_MAGIC;
+    header.version = WASM_IMAGE_VERSION;
+    header.section_count = 2;
+
+    /* larger than any image */
+    header.file_size = WASM_IMAGE_MAX_SIZE + 1;
+    ASSERT_EQ(pipe(fds), 0);
+    ASSERT_EQ(write(fds[1], &header, sizeof(header)),
+              (ssize_t)sizeof(header));
+    close(fds[1]);
+    EXPECT_FALSE(wasm_image_reader_open_stream(&reader, fds[0], "pipe"));
+
+    /* smaller than its own section table */
+    header.file_size = sizeof(header) + sizeof(WASMImageSectionEntry);
+    ASSERT_EQ(pipe(fds), 0);
+    ASSERT_EQ(write(fds[1], &header, sizeof(header)),
+              (ssize_t)sizeof(header));
+    close(fds[1]);
+    EXPECT_FALSE(wasm_image_reader_open_stream(&reader, fds[0], "pipe"));
+}
+
+TEST_F(migration_image_test, truncated_image)
+{
+    WASMImageReader reader;
+    uint64 size = file_size(IMAGE_FILE);
+
+    ASSERT_EQ(truncate(IMAGE_FILE, (off_t)(size - 1)), 0);
+    EXPECT_FALSE(wasm_image_reader_open(&reader, IMAGE_FILE));
+
+    ASSERT_EQ(truncate(IMAGE_FILE, sizeof(WASMImageHeader) - 1), 0);
+    EXPECT_FALSE(wasm_image_reader_open(&reader, IMAGE_FILE));
+}
+
+class migration_restore_test : public testing::TestWithParam<const char *>
+{
+  protected:
+    void SetUp()
+    {
+        ASSERT_TRUE(wasm_runtime_register_natives(
+            "env", native_symbols,
+            sizeof(native_symbols) / sizeof(NativeSymbol)));
+
+        buffer = (uint8 *)bh_read_file_to_buffer(GetParam(), &buffer_size);
+        ASSERT_TRUE(buffer != NULL);
+        module = wasm_runtime_load(buffer, buffer_size, error_buf,
+                                   sizeof(error_buf));
+        ASSERT_TRUE(module != NULL) << error_buf;
+    }
+
+    void TearDown()
+    {
+        if (module)
+            wasm_runtime_unload(module);
+        if (buffer)
+            BH_FREE(buffer);
+        wasm_runtime_unregister_natives("env", native_symbols);
+        unlink(IMAGE_FILE);
+    }
+
+    /* Call run(n) in a new instance, restored from IMAGE_FILE first if
+       restore is set */
+    bool run(uint32 n, bool restore, uint64 *result)
+    {
+        wasm_module_inst_t module_inst;
+        wasm_exec_env_t exec_env = NULL;
+        wasm_function_inst_t func;
+        uint32 argv[2] = { n, 0 };
+        bool ret = false;
+
+        module_inst = wasm_runtime_instantiate(module, 16 * 1024, 0, error_buf,
+                                               sizeof(error_buf));
+        if (!module_inst)
+            return false;
+        if (!(exec_env = wasm_runtime_create_exec_env(module_inst, 16 * 1024))
+            || !(func = wasm_runtime_lookup_function(module_inst, "run"))
+            || (restore
+                && !wasm_runtime_restore_instance(module_inst, IMAGE_FILE)))
+            goto fail;
+
+        if (wasm_runtime_call_wasm(exec_env, func, 1, argv)) {
+            memcpy(result, argv, sizeof(uint64));
+            ret = true;
+        }
+        else {
+            snprintf(exception, sizeof(exception), "%s",
+                     wasm_runtime_get_exception(module_inst));
+        }
+
+    fail:
+        if (exec_env)
+            wasm_runtime_destroy_exec_env(exec_env);
+        wasm_runtime_deinstantiate(module_inst);
+        return ret;
+    }
+
+    WAMRRuntimeRAII<1024 * 1024> runtime;
+    uint8 *buffer = NULL;
+    uint32 buffer_size = 0;
+    wasm_module_t module = NULL;
+    char error_buf[128];
+    char exception[128];
+};
+
+TEST_P(migration_restore_test, checkpoint_and_restore)
+{
+    const uint32 n = 10000;
+    uint64 expected, result;
+
+    checkpoint_tick = NO_CHECKPOINT;
+    ticks = 0;
+    ASSERT_TRUE(run(n, false, &expected));
+    ASSERT_EQ(ticks, n);
+
+    /* the instance stops at the safepoint after the request and the call
+       fails without terminating the process */
+    checkpoint_tick = n / 2;
+    ticks = 0;
+    ASSERT_FALSE(run(n, false, &result));
+    EXPECT_TRUE(strstr(exception, "checkpointed") != NULL) << exception;
+    EXPECT_LT(ticks, n);
+    ASSERT_GT(file_size(IMAGE_FILE), 0u);
+
+    /* a fresh instance resumes where the other one stopped, the loop
+       doesn't start over and the linear memory and globals are kept */
+    ASSERT_TRUE(run(n, true, &result));
+    EXPECT_EQ(result, expected);
+    EXPECT_EQ(ticks, n);
+}
+
+INSTANTIATE_TEST_SUITE_P(RunningMode, migration_restore_test,
+                         testing::Values("counter.wasm"
+#if WASM_ENABLE_AOT != 0
+                                         ,
+                                         "counter.aot"
+#endif
+                                         ));
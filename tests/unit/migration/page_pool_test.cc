@@ -0,0 +1,120 @@
+/*
+ * Copyright (C) 2019 Intel Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+ */
+
+#include "gtest/gtest.h"
+
+#include "wasm_page_pool.h"
+
+#include <string>
+#include <unistd.h>
+
+static const char *POOL_FILE = "page_pool_test.pool";
+
+class page_pool_test : public testing::Test
+{
+  protected:
+    void SetUp()
+    {
+        /* A and B differ in one byte only */
+        memset(pages, 0x11, sizeof(pages));
+        memset(pages + WASM_PAGE_POOL_PAGE_SIZE, 0x11,
+               WASM_PAGE_POOL_PAGE_SIZE);
+        pages[WASM_PAGE_POOL_PAGE_SIZE + 100] = 0x22;
+        memcpy(pages + 2 * WASM_PAGE_POOL_PAGE_SIZE, pages,
+               WASM_PAGE_POOL_PAGE_SIZE);
+        for (uint32 i = 0; i < 3; i++)
+            hashes[i] = wasm_page_pool_hash(page(i));
+
+        pool = wasm_page_pool_open(POOL_FILE, true);
+        ASSERT_TRUE(pool != NULL);
+    }
+
+    void TearDown()
+    {
+        if (pool)
+            wasm_page_pool_close(pool);
+        unlink(POOL_FILE);
+        unlink((std::string(POOL_FILE) + ".idx").c_str());
+    }
+
+    const uint8 *page(uint32 i) { return pages + i * WASM_PAGE_POOL_PAGE_SIZE; }
+
+    /* Whether the page id of the pool holds the content of page(i) */
+    bool holds(WASMPagePool *pool, uint64 id, uint32 i)
+    {
+        uint8 buf[WASM_PAGE_POOL_PAGE_SIZE];
+
+        return wasm_page_pool_read(pool, id, 1, buf)
+               && memcmp(buf, page(i), sizeof(buf)) == 0;
+    }
+
+    WASMPagePool *pool = NULL;
+    /* A, B, A */
+    uint8 pages[3 * WASM_PAGE_POOL_PAGE_SIZE];
+    uint64 hashes[3];
+};
+
+TEST_F(page_pool_test, dedup)
+{
+    WASMPagePool *other;
+    uint64 ids[3], other_ids[3], new_pages;
+
+    EXPECT_NE(hashes[0], hashes[1]);
+    EXPECT_EQ(hashes[0], hashes[2]);
+
+    /* the same page twice in one store */
+    ASSERT_TRUE(wasm_page_pool_store(pool, pages, hashes, 3, ids, &new_pages));
+    EXPECT_EQ(new_pages, 2u);
+    EXPECT_NE(ids[0], ids[1]);
+    EXPECT_EQ(ids[0], ids[2]);
+    EXPECT_TRUE(wasm_page_pool_contains(pool, 0, 2));
+    EXPECT_FALSE(wasm_page_pool_contains(pool, 0, 3));
+    EXPECT_TRUE(holds(pool, ids[0], 0));
+    EXPECT_TRUE(holds(pool, ids[1], 1));
+
+    /* and again in a later store through another opening of the pool, as
+       the next checkpoint of another process */
+    other = wasm_page_pool_open(POOL_FILE, true);
+    ASSERT_TRUE(other != NULL);
+    ASSERT_TRUE(
+        wasm_page_pool_store(other, pages, hashes, 3, other_ids, &new_pages));
+    EXPECT_EQ(new_pages, 0u);
+    EXPECT_EQ(memcmp(other_ids, ids, sizeof(ids)), 0);
+    wasm_page_pool_close(other);
+}
+
+/* Pages with the same hash are told apart by their content */
+TEST_F(page_pool_test, hash_collision)
+{
+    uint64 same[3] = { hashes[0], hashes[0], hashes[0] };
+    uint64 ids[3], new_pages;
+
+    ASSERT_TRUE(wasm_page_pool_store(pool, pages, same, 3, ids, &new_pages));
+    EXPECT_EQ(new_pages, 2u);
+    EXPECT_NE(ids[0], ids[1]);
+    EXPECT_EQ(ids[0], ids[2]);
+    EXPECT_TRUE(holds(pool, ids[0], 0));
+    EXPECT_TRUE(holds(pool, ids[1], 1));
+
+    /* B is found under the hash of A, after A */
+    ASSERT_TRUE(
+        wasm_page_pool_store(pool, page(1), same, 1, ids + 2, &new_pages));
+    EXPECT_EQ(new_pages, 0u);
+    EXPECT_EQ(ids[2], ids[1]);
+}
+
+TEST_F(page_pool_test, read_only)
+{
+    WASMPagePool *reader;
+    uint64 ids[3], new_pages;
+
+    ASSERT_TRUE(wasm_page_pool_store(pool, pages, hashes, 3, ids, &new_pages));
+    reader = wasm_page_pool_open(POOL_FILE, false);
+    ASSERT_TRUE(reader != NULL);
+    EXPECT_FALSE(
+        wasm_page_pool_store(reader, pages, hashes, 3, ids, &new_pages));
+    EXPECT_TRUE(holds(reader, ids[1], 1));
+    wasm_page_pool_close(reader);
+}
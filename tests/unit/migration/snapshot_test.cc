@@ -0,0 +1,146 @@
+/*
+ * Copyright (C) 2019 Intel Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+ */
+
+#include "test_helper.h"
+#include "gtest/gtest.h"
+
+#include "bh_read_file.h"
+#include "wasm_export.h"
+
+#include <unistd.h>
+
+static const char *SNAPSHOT_FILE = "snapshot_test.img";
+
+class snapshot_test : public testing::TestWithParam<const char *>
+{
+  protected:
+    void SetUp()
+    {
+        buffer = (uint8 *)bh_read_file_to_buffer(GetParam(), &buffer_size);
+        ASSERT_TRUE(buffer != NULL);
+        module = wasm_runtime_load(buffer, buffer_size, error_buf,
+                                   sizeof(error_buf));
+        ASSERT_TRUE(module != NULL) << error_buf;
+    }
+
+    void TearDown()
+    {
+        if (snapshot)
+            wasm_runtime_unload_snapshot(snapshot);
+        if (module)
+            wasm_runtime_unload(module);
+        if (buffer)
+            BH_FREE(buffer);
+        unlink(SNAPSHOT_FILE);
+    }
+
+    /* Instantiate snapshot.wasm, run its start function and init, and
+       write the snapshot */
+    void create_snapshot()
+    {
+        wasm_module_inst_t module_inst = wasm_runtime_instantiate(
+            module, 16 * 1024, 0, error_buf, sizeof(error_buf));
+
+        ASSERT_TRUE(module_inst != NULL) << error_buf;
+        EXPECT_TRUE(
+            wasm_runtime_create_snapshot(module_inst, "init", SNAPSHOT_FILE));
+        wasm_runtime_deinstantiate(module_inst);
+    }
+
+    /* Call the export name of module_inst with up to two arguments, the
+       result is 0 if it has none */
+    uint32 call(wasm_module_inst_t module_inst, const char *name,
+                uint32 argc = 0, uint32 arg0 = 0, uint32 arg1 = 0)
+    {
+        wasm_exec_env_t exec_env =
+            wasm_runtime_create_exec_env(module_inst, 16 * 1024);
+        wasm_function_inst_t func =
+            wasm_runtime_lookup_function(module_inst, name);
+        uint32 argv[2] = { arg0, arg1 };
+
+        EXPECT_TRUE(exec_env != NULL);
+        EXPECT_TRUE(func != NULL) << name;
+        if (!exec_env || !func)
+            return 0;
+        EXPECT_TRUE(wasm_runtime_call_wasm(exec_env, func, argc, argv))
+            << wasm_runtime_get_exception(module_inst);
+        wasm_runtime_destroy_exec_env(exec_env);
+        return argv[0];
+    }
+
+    WAMRRuntimeRAII<1024 * 1024> runtime;
+    uint8 *buffer = NULL;
+    uint32 buffer_size = 0;
+    wasm_module_t module = NULL;
+    wasm_snapshot_t snapshot = NULL;
+    char error_buf[128];
+};
+
+TEST_P(snapshot_test, instantiate_from_snapshot)
+{
+    wasm_module_inst_t first, second;
+
+    create_snapshot();
+    snapshot = wasm_runtime_load_snapshot(SNAPSHOT_FILE, error_buf,
+                                          sizeof(error_buf));
+    ASSERT_TRUE(snapshot != NULL) << error_buf;
+
+    first = wasm_runtime_instantiate_from_snapshot(
+        module, snapshot, 16 * 1024, 0, error_buf, sizeof(error_buf));
+    ASSERT_TRUE(first != NULL) << error_buf;
+    second = wasm_runtime_instantiate_from_snapshot(
+        module, snapshot, 16 * 1024, 0, error_buf, sizeof(error_buf));
+    ASSERT_TRUE(second != NULL) << error_buf;
+
+    /* the instances start where init left the other one, the data segment,
+       the global initializer and the start function don't run again */
+    for (wasm_module_inst_t module_inst : { first, second }) {
+        EXPECT_EQ(call(module_inst, "peek", 1, 0), 11u);
+        EXPECT_EQ(call(module_inst, "peek", 1, 8), 1u);
+        EXPECT_EQ(call(module_inst, "global"), 100u);
+        EXPECT_EQ(call(module_inst, "peek", 1, 65536), 9u);
+    }
+
+    /* the pages shared with the snapshot are copied on write */
+    call(first, "poke", 2, 65536, 5);
+    EXPECT_EQ(call(first, "peek", 1, 65536), 5u);
+    EXPECT_EQ(call(second, "peek", 1, 65536), 9u);
+
+    /* the instances outlive the snapshot */
+    wasm_runtime_unload_snapshot(snapshot);
+    snapshot = NULL;
+    EXPECT_EQ(call(second, "peek", 1, 0), 11u);
+
+    wasm_runtime_deinstantiate(first);
+    wasm_runtime_deinstantiate(second);
+}
+
+TEST_P(snapshot_test, missing_init_func)
+{
+    wasm_module_inst_t module_inst = wasm_runtime_instantiate(
+        module, 16 * 1024, 0, error_buf, sizeof(error_buf));
+
+    ASSERT_TRUE(module_inst != NULL) << error_buf;
+    EXPECT_FALSE(
+        wasm_runtime_create_snapshot(module_inst, "missing", SNAPSHOT_FILE));
+    wasm_runtime_deinstantiate(module_inst);
+}
+
+TEST_P(snapshot_test, truncated_snapshot)
+{
+    create_snapshot();
+    ASSERT_EQ(truncate(SNAPSHOT_FILE, 100), 0);
+    snapshot = wasm_runtime_load_snapshot(SNAPSHOT_FILE, error_buf,
+                                          sizeof(error_buf));
+    EXPECT_TRUE(snapshot == NULL);
+}
+
+INSTANTIATE_TEST_SUITE_P(RunningMode, snapshot_test,
+                         testing::Values("snapshot.wasm"
+#if WASM_ENABLE_AOT != 0
+                                         ,
+                                         "snapshot.aot"
+#endif
+                                         ));
@@ -0,0 +1,186 @@
+/*
+ * Copyright (C) 2019 Intel Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+ */
+
+#include "test_helper.h"
+#include "gtest/gtest.h"
+
+#include "bh_read_file.h"
+#include "wasm_export.h"
+
+#include <unistd.h>
+
+static const char *IMAGE_FILE = "superinstruction_test.img";
+
+/* fuse.wasm calls env.tick(i) in each iteration of loop_head, the native
+   requests the checkpoint of the instance at checkpoint_tick */
+static const int32 NO_CHECKPOINT = -1;
+static int32 checkpoint_tick = NO_CHECKPOINT;
+
+static void
+tick_wrapper(wasm_exec_env_t exec_env, int32 i)
+{
+    if (i == checkpoint_tick) {
+        checkpoint_tick = NO_CHECKPOINT;
+        wasm_runtime_request_checkpoint(wasm_runtime_get_module_inst(exec_env),
+                                        IMAGE_FILE);
+    }
+}
+
+static NativeSymbol native_symbols[] = {
+    { "tick", (void *)tick_wrapper, "(i)", NULL },
+};
+
+/* The fast interpreter fuses the pairs of fuse.wasm, the other running
+   modes give the reference results */
+class superinstruction_test : public testing::TestWithParam<const char *>
+{
+  protected:
+    void SetUp()
+    {
+        ASSERT_TRUE(wasm_runtime_register_natives(
+            "env", native_symbols,
+            sizeof(native_symbols) / sizeof(NativeSymbol)));
+
+        buffer = (uint8 *)bh_read_file_to_buffer(GetParam(), &buffer_size);
+        ASSERT_TRUE(buffer != NULL);
+        module = wasm_runtime_load(buffer, buffer_size, error_buf,
+                                   sizeof(error_buf));
+        ASSERT_TRUE(module != NULL) << error_buf;
+        module_inst = wasm_runtime_instantiate(module, 16 * 1024, 0, error_buf,
+                                               sizeof(error_buf));
+        ASSERT_TRUE(module_inst != NULL) << error_buf;
+    }
+
+    void TearDown()
+    {
+        if (module_inst)
+            wasm_runtime_deinstantiate(module_inst);
+        if (module)
+            wasm_runtime_unload(module);
+        if (buffer)
+            BH_FREE(buffer);
+        wasm_runtime_unregister_natives("env", native_symbols);
+        unlink(IMAGE_FILE);
+    }
+
+    /* Call the export name of inst, restored from IMAGE_FILE first if
+       restore is set. Returns false if the call fails. */
+    bool call(wasm_module_inst_t inst, const char *name, uint32 argc,
+              uint32 *argv, bool restore = false)
+    {
+        wasm_exec_env_t exec_env;
+        wasm_function_inst_t func;
+        bool ret = false;
+
+        if (!(exec_env = wasm_runtime_create_exec_env(inst, 16 * 1024)))
+            return false;
+        if ((func = wasm_runtime_lookup_function(inst, name))
+            && (!restore || wasm_runtime_restore_instance(inst, IMAGE_FILE)))
+            ret = wasm_runtime_call_wasm(exec_env, func, argc, argv);
+        wasm_runtime_destroy_exec_env(exec_env);
+        return ret;
+    }
+
+    uint32 call2(const char *name, uint32 a, uint32 b)
+    {
+        uint32 argv[2] = { a, b };
+
+        EXPECT_TRUE(call(module_inst, name, 2, argv))
+            << wasm_runtime_get_exception(module_inst);
+        return argv[0];
+    }
+
+    WAMRRuntimeRAII<1024 * 1024> runtime;
+    uint8 *buffer = NULL;
+    uint32 buffer_size = 0;
+    wasm_module_t module = NULL;
+    wasm_module_inst_t module_inst = NULL;
+    char error_buf[128];
+};
+
+/* The bit of each compare of fuse.wasm that doesn't take its br_if */
+static uint32
+compares(int32 a, int32 b)
+{
+    bool taken[] = { a == 0,
+                     a == b,
+                     a != b,
+                     a < b,
+                     (uint32)a < (uint32)b,
+                     a > b,
+                     (uint32)a > (uint32)b,
+                     a <= b,
+                     (uint32)a <= (uint32)b,
+                     a >= b,
+                     (uint32)a >= (uint32)b };
+    uint32 mask = 0;
+
+    for (uint32 k = 0; k < sizeof(taken) / sizeof(taken[0]); k++) {
+        if (!taken[k])
+            mask |= 1u << k;
+    }
+    return mask;
+}
+
+TEST_P(superinstruction_test, compare_br_if)
+{
+    const int32 values[] = { 0, 1, -1, 5, 7, INT32_MIN, INT32_MAX };
+
+    for (int32 a : values) {
+        for (int32 b : values)
+            EXPECT_EQ(call2("compares", (uint32)a, (uint32)b), compares(a, b))
+                << a << ", " << b;
+    }
+
+    /* the value carried by a taken br_if */
+    EXPECT_EQ(call2("br_if_value", 3, 5), 5u);
+    EXPECT_EQ(call2("br_if_value", 5, 3), 7u);
+    EXPECT_EQ(call2("br_if_value", (uint32)-1, 3), 7u);
+}
+
+TEST_P(superinstruction_test, add_sub_tee)
+{
+    EXPECT_EQ(call2("sub_tee", 3, 10), 49u);
+    EXPECT_EQ(call2("sub_tee", 10, 3), 49u);
+    EXPECT_EQ(call2("sub_tee", 0, 0x10000), 0u);
+}
+
+/* The back-edge of loop_head lands on a fused pair, the second of the pair
+   is never a safepoint, the checkpoint and the restore go through the
+   loop head as they would without fusion */
+TEST_P(superinstruction_test, back_edge_into_fused_pair)
+{
+    const uint32 n = 1000;
+    uint32 argv[1] = { n };
+    wasm_module_inst_t restored;
+
+    checkpoint_tick = NO_CHECKPOINT;
+    ASSERT_TRUE(call(module_inst, "loop_head", 1, argv));
+    EXPECT_EQ(argv[0], n * (n + 1) / 2);
+
+    checkpoint_tick = n / 2;
+    argv[0] = n;
+    ASSERT_FALSE(call(module_inst, "loop_head", 1, argv));
+    ASSERT_TRUE(strstr(wasm_runtime_get_exception(module_inst),
+                       "checkpointed")
+                != NULL);
+
+    restored = wasm_runtime_instantiate(module, 16 * 1024, 0, error_buf,
+                                        sizeof(error_buf));
+    ASSERT_TRUE(restored != NULL) << error_buf;
+    argv[0] = n;
+    EXPECT_TRUE(call(restored, "loop_head", 1, argv, true))
+        << wasm_runtime_get_exception(restored);
+    EXPECT_EQ(argv[0], n * (n + 1) / 2);
+    wasm_runtime_deinstantiate(restored);
+}
+
+INSTANTIATE_TEST_SUITE_P(RunningMode, superinstruction_test,
+                         testing::Values("fuse.wasm"
+#if WASM_ENABLE_AOT != 0
+                                         ,
+                                         "fuse.aot"
+#endif
+                                         ));
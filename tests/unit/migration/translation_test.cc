@@ -0,0 +1,266 @@
+/*
+ * Copyright (C) 2019 Intel Corporation. All rights reserved.
+ * SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+ */
+
+#include "test_helper.h"
+#include "gtest/gtest.h"
+
+#include "bh_platform.h"
+#include "wasm_export.h"
+
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+
+/* Function bodies of the generated modules */
+enum FuncBody {
+    BODY_VALID,
+    /* an i64 operand of i32.add */
+    BODY_TYPE_MISMATCH,
+    /* a local the function doesn't have */
+    BODY_UNKNOWN_LOCAL,
+    /* the last opcode isn't end */
+    BODY_NO_END,
+};
+
+static const uint32 FUNC_COUNT = 64;
+
+static void
+write_leb(std::vector<uint8> &out, uint32 v)
+{
+    do {
+        uint8 b = v & 0x7f;
+        v >>= 7;
+        out.push_back(v ? b | 0x80 : b);
+    } while (v);
+}
+
+static void
+write_section(std::vector<uint8> &out, uint8 id,
+              const std::vector<uint8> &body)
+{
+    out.push_back(id);
+    write_leb(out, (uint32)body.size());
+    out.insert(out.end(), body.begin(), body.end());
+}
+
+/* A module of FUNC_COUNT functions () -> i32, function k returns 3k + 1
+   unless bodies says otherwise, and of an export sum that calls them all
+   and adds their results. Function k is exported as fk. */
+static std::vector<uint8>
+build_module(const std::map<uint32, FuncBody> &bodies)
+{
+    std::vector<uint8> module = { 0, 'a', 's', 'm', 1, 0, 0, 0 };
+    std::vector<uint8> types = { 1, 0x60, 0, 1, 0x7f }, funcs, exports, code;
+
+    write_leb(funcs, FUNC_COUNT + 1);
+    funcs.insert(funcs.end(), FUNC_COUNT + 1, 0);
+
+    write_leb(exports, FUNC_COUNT + 1);
+    for (uint32 k = 0; k <= FUNC_COUNT; k++) {
+        std::string name = k < FUNC_COUNT ? "f" + std::to_string(k) : "sum";
+        write_leb(exports, (uint32)name.size());
+        exports.insert(exports.end(), name.begin(), name.end());
+        exports.push_back(0);
+        write_leb(exports, k);
+    }
+
+    write_leb(code, FUNC_COUNT + 1);
+    for (uint32 k = 0; k <= FUNC_COUNT; k++) {
+        std::map<uint32, FuncBody>::const_iterator it = bodies.find(k);
+        FuncBody kind = it == bodies.end() ? BODY_VALID : it->second;
+        /* no locals, then i32.const k, k < 64 fits one byte */
+        std::vector<uint8> body = { 0, 0x41, (uint8)k };
+
+        if (k == FUNC_COUNT) {
+            body = { 0, 0x41, 0 };
+            for (uint32 i = 0; i < FUNC_COUNT; i++) {
+                body.push_back(0x10);
+                write_leb(body, i);
+                body.push_back(0x6a);
+            }
+            body.push_back(0x0b);
+        }
+        else if (kind == BODY_VALID)
+            body.insert(body.end(), { 0x41, 3, 0x6c, 0x41, 1, 0x6a, 0x0b });
+        else if (kind == BODY_TYPE_MISMATCH)
+            body.insert(body.end(), { 0x42, 1, 0x6a, 0x0b });
+        else if (kind == BODY_UNKNOWN_LOCAL)
+            body = { 0, 0x20, 5, 0x0b };
+        else
+            body.push_back(0x1a);
+        write_leb(code, (uint32)body.size());
+        code.insert(code.end(), body.begin(), body.end());
+    }
+
+    write_section(module, 1, types);
+    write_section(module, 3, funcs);
+    write_section(module, 7, exports);
+    write_section(module, 10, code);
+    return module;
+}
+
+class translation_test : public testing::Test
+{
+  protected:
+    void TearDown()
+    {
+        for (wasm_module_t module : modules)
+            wasm_runtime_unload(module);
+    }
+
+    /* Load a copy of wasm with the given loader threads and laziness,
+       error_buf holds the error if it fails. The loader writes into the
+       buffer and a lazy module translates from it, so each module gets
+       its own that outlives it. */
+    wasm_module_t load(const std::vector<uint8> &wasm, uint32 loader_threads,
+                       bool lazy)
+    {
+        std::vector<uint8> &buf = (buffers.push_back(wasm), buffers.back());
+        LoadArgs args;
+        wasm_module_t module;
+
+        memset(&args, 0, sizeof(args));
+        args.name = (char *)"";
+        args.loader_threads = loader_threads;
+        args.lazy_translation = lazy;
+        error_buf[0] = '\0';
+        module = wasm_runtime_load_ex(buf.data(), (uint32)buf.size(), &args,
+                                      error_buf, sizeof(error_buf));
+        if (module)
+            modules.push_back(module);
+        return module;
+    }
+
+    /* Call the export name of a new instance of module, the result is
+       stored in result, or the exception in exception */
+    bool call(wasm_module_t module, const char *name, uint32 *result)
+    {
+        wasm_module_inst_t module_inst;
+        wasm_exec_env_t exec_env = NULL;
+        wasm_function_inst_t func;
+        uint32 argv[1] = { 0 };
+        bool ret = false;
+
+        exception = "";
+        if (!(module_inst = wasm_runtime_instantiate(module, 16 * 1024, 0,
+                                                     error_buf,
+                                                     sizeof(error_buf))))
+            return false;
+        if ((exec_env = wasm_runtime_create_exec_env(module_inst, 16 * 1024))
+            && (func = wasm_runtime_lookup_function(module_inst, name))) {
+            if ((ret = wasm_runtime_call_wasm(exec_env, func, 0, argv)))
+                *result = argv[0];
+            else
+                exception = wasm_runtime_get_exception(module_inst);
+        }
+        if (exec_env)
+            wasm_runtime_destroy_exec_env(exec_env);
+        wasm_runtime_deinstantiate(module_inst);
+        return ret;
+    }
+
+    static uint32 expected_sum()
+    {
+        uint32 sum = 0;
+
+        for (uint32 k = 0; k < FUNC_COUNT; k++)
+            sum += 3 * k + 1;
+        return sum;
+    }
+
+    WAMRRuntimeRAII<4 * 1024 * 1024> runtime;
+    std::list<std::vector<uint8>> buffers;
+    std::vector<wasm_module_t> modules;
+    std::string exception;
+    char error_buf[128];
+};
+
+TEST_F(translation_test, loader_threads)
+{
+    std::vector<uint8> wasm = build_module({});
+    uint32 result;
+
+    for (uint32 threads : { 0, 1, 2, 4, 8 }) {
+        wasm_module_t module = load(wasm, threads, false);
+        ASSERT_TRUE(module != NULL) << threads << ": " << error_buf;
+        ASSERT_TRUE(call(module, "sum", &result)) << exception;
+        EXPECT_EQ(result, expected_sum()) << threads;
+    }
+}
+
+/* The error of the function with the smallest index is reported,
+   whichever thread finds its own error first */
+TEST_F(translation_test, loader_threads_error)
+{
+    std::vector<uint8> wasm = build_module(
+        { { 10, BODY_TYPE_MISMATCH }, { 40, BODY_UNKNOWN_LOCAL } });
+    std::string serial;
+
+    ASSERT_TRUE(load(wasm, 1, false) == NULL);
+    serial = error_buf;
+    EXPECT_FALSE(serial.empty());
+
+    for (uint32 round = 0; round < 20; round++) {
+        for (uint32 threads : { 2, 4, 8 }) {
+            EXPECT_TRUE(load(wasm, threads, false) == NULL);
+            EXPECT_EQ(serial, error_buf) << threads;
+        }
+    }
+}
+
+#if WASM_ENABLE_FAST_INTERP != 0
+TEST_F(translation_test, lazy_translation)
+{
+    std::vector<uint8> wasm = build_module({});
+    wasm_module_t module = load(wasm, 0, true);
+    uint32 result;
+
+    ASSERT_TRUE(module != NULL) << error_buf;
+    ASSERT_TRUE(call(module, "f7", &result)) << exception;
+    EXPECT_EQ(result, 22u);
+    /* f7 is translated already, the others on this call */
+    ASSERT_TRUE(call(module, "sum", &result)) << exception;
+    EXPECT_EQ(result, expected_sum());
+}
+
+/* A function that fails to translate traps with the error the load would
+   have failed with, on every call, and the others still run */
+TEST_F(translation_test, lazy_translation_error)
+{
+    std::vector<uint8> wasm = build_module({ { 40, BODY_UNKNOWN_LOCAL } });
+    wasm_module_t module;
+    std::string eager;
+    uint32 result;
+
+    ASSERT_TRUE(load(wasm, 0, false) == NULL);
+    eager = error_buf;
+
+    module = load(wasm, 0, true);
+    ASSERT_TRUE(module != NULL) << error_buf;
+    ASSERT_TRUE(call(module, "f39", &result)) << exception;
+    EXPECT_EQ(result, 118u);
+
+    for (uint32 i = 0; i < 2; i++) {
+        EXPECT_FALSE(call(module, "sum", &result));
+        EXPECT_EQ(exception, "Exception: " + eager);
+    }
+    EXPECT_FALSE(call(module, "f40", &result));
+    EXPECT_EQ(exception, "Exception: " + eager);
+}
+
+/* The structure of the code section is still checked at load time */
+TEST_F(translation_test, lazy_translation_no_end)
+{
+    std::vector<uint8> wasm = build_module({ { 20, BODY_NO_END } });
+    std::string eager;
+
+    ASSERT_TRUE(load(wasm, 0, false) == NULL);
+    eager = error_buf;
+    EXPECT_TRUE(load(wasm, 0, true) == NULL);
+    EXPECT_EQ(eager, error_buf);
+}
+
+#endif /* end of WASM_ENABLE_FAST_INTERP != 0 */
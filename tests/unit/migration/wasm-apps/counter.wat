@@ -0,0 +1,35 @@
+;; Copyright (C) 2019 Intel Corporation.  All rights reserved.
+;; SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+
+;; The loop of $work calls env.tick with its counter, so that the test can
+;; request a checkpoint in the middle of the loop. The state spread over
+;; the locals, the operand stack of run, a global and the linear memory all
+;; goes into the result.
+(module
+  (import "env" "tick" (func $tick (param i32)))
+  (memory 1)
+  (global $sum (mut i64) (i64.const 0))
+
+  (func $work (param $n i32) (result i64)
+    (local $i i32) (local $acc i64) (local $addr i32)
+    (loop $l
+      (call $tick (local.get $i))
+      (local.set $acc
+        (i64.add (i64.mul (local.get $acc) (i64.const 31))
+                 (i64.extend_i32_u (local.get $i))))
+      (local.set $addr
+        (i32.shl (i32.and (local.get $i) (i32.const 1023)) (i32.const 2)))
+      (i32.store (local.get $addr)
+        (i32.add (i32.load (local.get $addr)) (local.get $i)))
+      (global.set $sum
+        (i64.add (global.get $sum) (i64.extend_i32_u (local.get $i))))
+      (br_if $l
+        (i32.lt_u (local.tee $i (i32.add (local.get $i) (i32.const 1)))
+                  (local.get $n))))
+    (i64.add (local.get $acc)
+             (i64.extend_i32_u (i32.load (i32.const 400)))))
+
+  (func (export "run") (param $n i32) (result i64)
+    (i64.add (i64.const 7)
+             (i64.add (call $work (local.get $n)) (global.get $sum))))
+)
@@ -0,0 +1,69 @@
+;; Copyright (C) 2019 Intel Corporation.  All rights reserved.
+;; SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+
+;; The pairs the fast interpreter fuses into superinstructions: every i32
+;; compare followed by br_if, and i32.add or i32.sub followed by
+;; local.tee. The other running modes run them one by one with the same
+;; results.
+(module
+  (import "env" "tick" (func $tick (param i32)))
+  ;; unused, the checkpoint of an instance needs a linear memory
+  (memory 1)
+
+  ;; The loop starts with a fused ge_u + br_if, so that its back-edge lands
+  ;; on the pair, and env.tick lets the test checkpoint it half way.
+  ;; Returns the sum of 1..n.
+  (func (export "loop_head") (param $n i32) (result i32)
+    (local $i i32) (local $s i32)
+    (block $done
+      (loop $l
+        (br_if $done (i32.ge_u (local.get $i) (local.get $n)))
+        (call $tick (local.get $i))
+        (local.set $s
+          (i32.add (local.get $s)
+                   (local.tee $i (i32.add (local.get $i) (i32.const 1)))))
+        (br $l)))
+    (local.get $s))
+
+  ;; Bit k of the result is set when the kth compare, in the order of the
+  ;; opcodes from i32.eqz to i32.ge_u, doesn't take its br_if
+  (func (export "compares") (param $a i32) (param $b i32) (result i32)
+    (local $m i32)
+    (block (br_if 0 (i32.eqz (local.get $a)))
+           (local.set $m (i32.or (local.get $m) (i32.const 1))))
+    (block (br_if 0 (i32.eq (local.get $a) (local.get $b)))
+           (local.set $m (i32.or (local.get $m) (i32.const 2))))
+    (block (br_if 0 (i32.ne (local.get $a) (local.get $b)))
+           (local.set $m (i32.or (local.get $m) (i32.const 4))))
+    (block (br_if 0 (i32.lt_s (local.get $a) (local.get $b)))
+           (local.set $m (i32.or (local.get $m) (i32.const 8))))
+    (block (br_if 0 (i32.lt_u (local.get $a) (local.get $b)))
+           (local.set $m (i32.or (local.get $m) (i32.const 16))))
+    (block (br_if 0 (i32.gt_s (local.get $a) (local.get $b)))
+           (local.set $m (i32.or (local.get $m) (i32.const 32))))
+    (block (br_if 0 (i32.gt_u (local.get $a) (local.get $b)))
+           (local.set $m (i32.or (local.get $m) (i32.const 64))))
+    (block (br_if 0 (i32.le_s (local.get $a) (local.get $b)))
+           (local.set $m (i32.or (local.get $m) (i32.const 128))))
+    (block (br_if 0 (i32.le_u (local.get $a) (local.get $b)))
+           (local.set $m (i32.or (local.get $m) (i32.const 256))))
+    (block (br_if 0 (i32.ge_s (local.get $a) (local.get $b)))
+           (local.set $m (i32.or (local.get $m) (i32.const 512))))
+    (block (br_if 0 (i32.ge_u (local.get $a) (local.get $b)))
+           (local.set $m (i32.or (local.get $m) (i32.const 1024))))
+    (local.get $m))
+
+  ;; A fused br_if that carries a value out of its block: 5 if a < b
+  ;; unsigned, 7 otherwise
+  (func (export "br_if_value") (param $a i32) (param $b i32) (result i32)
+    (block (result i32)
+      (br_if 0 (i32.const 5) (i32.lt_u (local.get $a) (local.get $b)))
+      (drop)
+      (i32.const 7)))
+
+  ;; The fused tee both sets the local and leaves the value: (a - b)^2
+  (func (export "sub_tee") (param $a i32) (param $b i32) (result i32)
+    (local $t i32)
+    (i32.mul (local.tee $t (i32.sub (local.get $a) (local.get $b)))
+             (local.get $t)))
+)
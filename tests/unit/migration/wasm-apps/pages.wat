@@ -0,0 +1,36 @@
+;; Copyright (C) 2019 Intel Corporation.  All rights reserved.
+;; SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+
+;; run grows the linear memory to $n * 8 KiB and writes every other 4 KiB
+;; page of it, so that its checkpoint is a run of alternating data and
+;; zero extents. The second loop calls env.tick like counter.wasm does and
+;; folds the written pages into the result.
+(module
+  (import "env" "tick" (func $tick (param i32)))
+  (memory 1)
+
+  (func (export "run") (param $n i32) (result i64)
+    (local $i i32) (local $sum i64)
+    (drop
+      (memory.grow
+        (i32.sub (i32.shr_u (i32.add (local.get $n) (i32.const 7))
+                            (i32.const 3))
+                 (memory.size))))
+    (loop $fill
+      (i32.store (i32.shl (local.get $i) (i32.const 13))
+                 (i32.add (local.get $i) (i32.const 1)))
+      (br_if $fill
+        (i32.lt_u (local.tee $i (i32.add (local.get $i) (i32.const 1)))
+                  (local.get $n))))
+    (local.set $i (i32.const 0))
+    (loop $l
+      (call $tick (local.get $i))
+      (local.set $sum
+        (i64.add (i64.mul (local.get $sum) (i64.const 31))
+                 (i64.extend_i32_u
+                   (i32.load (i32.shl (local.get $i) (i32.const 13))))))
+      (br_if $l
+        (i32.lt_u (local.tee $i (i32.add (local.get $i) (i32.const 1)))
+                  (local.get $n))))
+    (local.get $sum))
+)
@@ -0,0 +1,32 @@
+;; Copyright (C) 2019 Intel Corporation.  All rights reserved.
+;; SPDX-License-Identifier: Apache-2.0 WITH LLVM-exception
+
+;; The data segment, the global initializer and the start function each
+;; leave a mark that init builds on, so that an instance created from the
+;; snapshot shows whether any of them ran again.
+(module
+  (memory 1)
+  (global $g (mut i32) (i32.const 1))
+  (data (i32.const 0) "\01\00\00\00")
+
+  ;; counts the runs of the start function at address 8
+  (func $start
+    (i32.store (i32.const 8) (i32.add (i32.load (i32.const 8)) (i32.const 1))))
+
+  (func (export "init")
+    (global.set $g (i32.const 100))
+    (i32.store (i32.const 0) (i32.add (i32.load (i32.const 0)) (i32.const 10)))
+    (drop (memory.grow (i32.const 1)))
+    (i32.store (i32.const 65536) (i32.const 9)))
+
+  (func (export "peek") (param $addr i32) (result i32)
+    (i32.load (local.get $addr)))
+
+  (func (export "poke") (param $addr i32) (param $value i32)
+    (i32.store (local.get $addr) (local.get $value)))
+
+  (func (export "global") (result i32)
+    (global.get $g))
+
+  (start $start)
+)
@@ -163,6 +163,8 @@ print_help()
     printf("  --xip                     A shorthand of --enalbe-indirect-mode --disable-llvm-intrinsics\n");
     printf("  --enable-indirect-mode    Enalbe call function through symbol table but not direct call\n");
     printf("  --enable-gc               Enalbe GC (Garbage Collection) feature\n");
+    printf("  --enable-checkpoint       Emit safepoints at loop headers and call sites to\n");
+    printf("                            take and restore checkpoints, cannot be used with GC\n");
     printf("  --disable-llvm-intrinsics Disable the LLVM built-in intrinsics\n");
     printf("  --enable-builtin-intrinsics=<flags>\n");
     printf("                            Enable the specified built-in intrinsics, it will override the default\n");
@@ -482,6 +484,10 @@ main(int argc, char *argv[])
             option.enable_aux_stack_frame = true;
             option.enable_gc = true;
         }
+        else if (!strcmp(argv[0], "--enable-checkpoint")) {
+            option.enable_aux_stack_frame = true;
+            option.enable_checkpoint = true;
+        }
         else if (!strcmp(argv[0], "--disable-llvm-intrinsics")) {
             option.disable_llvm_intrinsics = true;
         }
@@ -592,6 +598,11 @@ main(int argc, char *argv[])
         option.enable_ref_types = false;
     }
 
+    if (option.enable_checkpoint && option.enable_gc) {
+        printf("Error: checkpoint isn't supported with GC enabled\n");
+        goto fail0;
+    }
+
     if (!use_dummy_wasm) {
         wasm_file_name = argv[0];
 